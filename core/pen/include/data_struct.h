@@ -37,6 +37,9 @@
     stb_sb_free(v);                                                                                                          \
     v = nullptr
 
+// sets count to 0 and keeps the allocation for reuse
+#define sb_reset(a) ((a) ? stb__sbn(a) = 0 : 0)
+
 static void* stb__sbgrowf(void* arr, int increment, int itemsize)
 {
     int start = stb_sb_count(arr);
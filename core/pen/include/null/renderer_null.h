@@ -0,0 +1,75 @@
+// renderer_null.h
+// Copyright 2014 - 2023 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Null renderer backend, implements pen::direct without a gpu so engine side cpu cost can be profiled headless.
+// resources are tracked by handle, commands and the bytes they carry are counted by type and state is validated.
+
+#pragma once
+
+#include "types.h"
+
+namespace pen
+{
+    namespace e_null_cmd
+    {
+        enum null_cmd_t
+        {
+            create_clear_state,
+            clear,
+            clear_texture,
+            present,
+            load_shader,
+            set_shader,
+            link_shader,
+            create_input_layout,
+            set_input_layout,
+            create_buffer,
+            set_vertex_buffer,
+            set_index_buffer,
+            set_constant_buffer,
+            set_structured_buffer,
+            update_buffer,
+            create_texture,
+            create_sampler,
+            set_texture,
+            create_raster_state,
+            set_raster_state,
+            set_viewport,
+            set_scissor_rect,
+            create_blend_state,
+            set_blend_state,
+            create_depth_stencil_state,
+            set_depth_stencil_state,
+            set_stencil_ref,
+            draw,
+            draw_indexed,
+            draw_indexed_instanced,
+            draw_auto,
+            dispatch_compute,
+            create_render_target,
+            set_targets,
+            set_stream_out_target,
+            resolve_target,
+            read_back_resource,
+            push_perf_marker,
+            pop_perf_marker,
+            replace_resource,
+            release_resource,
+            COUNT
+        };
+    }
+    typedef u32 null_cmd;
+
+    struct null_renderer_stats
+    {
+        u64 frame;
+        u32 cmd_count[e_null_cmd::COUNT]; // number of calls by type
+        u64 cmd_bytes[e_null_cmd::COUNT]; // bytes of data carried, buffer updates, texture and shader data
+        u32 live_resources;
+        u32 validation_errors; // total since init
+    };
+
+    void      null_renderer_get_frame_stats(null_renderer_stats& stats); // last presented frame, thread safe
+    const c8* null_renderer_cmd_name(null_cmd cmd);
+} // namespace pen
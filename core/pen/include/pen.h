@@ -51,7 +51,7 @@ namespace pen
         u32              window_sample_count = 1;
         const c8*        window_title = "pen_app";
         pen_create_flags flags = e_pen_create_flags::renderer;
-        u32              max_renderer_commands = 1 << 16; // space for max commands in cmd buffer
+        u32              max_renderer_commands = 1 << 16; // space for max commands in cmd buffer (of average packed size)
         void* (*user_thread_function)(void*) = nullptr;
         void* user_data = nullptr;
     };
@@ -26,6 +26,7 @@
 #define PEN_CAPS_TEXTURE_CUBE_ARRAY (1 << 4)
 #define PEN_CAPS_BACKBUFFER_BGRA (1 << 5)
 #define PEN_CAPS_VUP (1 << 6) // opengl viewport y-up
+#define PEN_CAPS_STRUCTURED_BUFFER (1 << 7) // structured buffers can be bound to vertex and pixel shaders
 
 // Texture format caps
 #define PEN_CAPS_TEX_FORMAT_BC1 (1 << 31)
@@ -41,6 +42,7 @@
 namespace pen
 {
     typedef void* render_ctx;
+    typedef void* cmd_list;
 
     struct renderer_info
     {
@@ -368,6 +370,22 @@ namespace pen
         float padding_0, padding_1;
     };
 
+    struct renderer_cmd_stats
+    {
+        u32 num_cmds;     // commands submitted last frame
+        u32 packed_bytes; // bytes written to the packed command stream last frame
+        u32 fixed_bytes;  // bytes the same commands would use as fixed size entries
+        f32 consume_ms;   // render thread time spent consuming and executing last frame
+        u32 dropped_cmds; // redundant binds filtered out before entering the stream last frame
+    };
+
+    struct renderer_cmd_timing
+    {
+        const c8* name;
+        u32       count;
+        f64       total_ms;
+    };
+
     // general accessors
     const c8*            renderer_get_shader_platform();
     bool                 renderer_viewport_vup();
@@ -384,6 +402,18 @@ namespace pen
     void       renderer_new_frame();
     void       renderer_set_current_ctx(render_ctx ctx);
     render_ctx renderer_get_main_context();
+
+    // command lists can be recorded on any thread and are stitched into the main context in submit order.
+    // between begin and end, state and draw calls on the calling thread are recorded into the list.
+    // resources created or released while recording go straight to the main context, ahead of every list submitted
+    // after them, the main thread must only record into lists until the lists are submitted.
+    cmd_list   renderer_create_cmd_list();
+    void       renderer_release_cmd_list(cmd_list list);
+    void       renderer_begin_cmd_list(cmd_list list);
+    void       renderer_end_cmd_list();
+    void       renderer_submit_cmd_lists(const cmd_list* lists, u32 num_lists);
+    bool       renderer_recording_cmd_list(); // true between begin and end on the calling thread
+
     u32        renderer_create_clear_state(const clear_state& cs);
     void       renderer_clear(u32 clear_state_index, u32 array_index = 0);
     void       renderer_clear_texture(u32 clear_state_index, u32 texture);
@@ -400,6 +430,8 @@ namespace pen
     void       renderer_set_constant_buffer(u32 buffer_index, u32 unit, u32 flags);
     void       renderer_set_structured_buffer(u32 buffer_index, u32 unit, u32 flags);
     void       renderer_update_buffer(u32 buffer_index, const void* data, u32 data_size, u32 offset = 0);
+    void*      renderer_reserve_buffer_update(u32 data_size); // thread safe, write in place and submit this frame
+    void       renderer_submit_buffer_update(u32 buffer_index, void* data, u32 data_size, u32 offset = 0);
     u32        renderer_create_texture(const texture_creation_params& tcp);
     u32        renderer_create_sampler(const sampler_creation_params& scp);
     void       renderer_set_texture(u32 texture_index, u32 sampler_index, u32 unit, u32 bind_flags);
@@ -444,6 +476,18 @@ namespace pen
     void       renderer_consume_cmd_buffer_non_blocking();
     void       renderer_update_queries();
     void       renderer_get_present_time(f32& cpu_ms, f32& gpu_ms);
+    void       renderer_get_cmd_stats(renderer_cmd_stats& stats);
+
+    // capture writes the command stream, including buffer and creation data, for num_frames presents.
+    // call before renderer_init so the capture contains every resource it uses, it can then be replayed in isolation.
+    bool renderer_capture_begin(const c8* filename, u32 num_frames);
+    u32  renderer_replay_load(const c8* filename); // returns number of frames, call after init
+    bool renderer_replay_frame();                  // submits the next frame up to and including present
+    void renderer_replay_unload();                 // call once the render thread has consumed replayed frames
+
+    // times exec of each command type on the render thread, read when the render thread is idle.
+    void renderer_enable_cmd_timings(bool enable);
+    u32  renderer_get_cmd_timings(renderer_cmd_timing* timings, u32 max_timings); // returns number written
 
     namespace direct
     {
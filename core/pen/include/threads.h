@@ -4,6 +4,8 @@
 
 // Minimalist cross platform thread wrapper api.
 // Includes functions to create jobs, threads, mutex and semaphore.
+// Tasks run on a fixed pool of worker threads (one per core) with per-worker work-stealing deques,
+// use tasks for short lived work and keep jobs for long running threads (render, audio, physics).
 
 #pragma once
 
@@ -40,6 +42,19 @@ namespace pen
         void* user_data;
     };
 
+    // A Task is a function pointer and user data executed on the worker pool.
+    // Counters are incremented on submit and decremented on completion, wait on them to sync,
+    // or pass one as a dependency so a task is only scheduled once the counter reaches zero.
+
+    typedef void (*task_func)(void* user_data);
+
+    struct task_counter
+    {
+        a_u32 value = {0};
+        a_u32 lock = {0};
+        void* pending = nullptr; // tasks waiting for this counter to reach zero
+    };
+
     namespace e_thread_start_flags
     {
         enum thread_start_flags_t
@@ -71,6 +86,30 @@ namespace pen
     void jobs_create_single_thread_update(single_thread_update_func func);
     void jobs_run_single_threaded();
 
+    // Tasks
+    void tasks_init(u32 num_workers = 0); // 0 = one worker per hardware thread
+    void tasks_shutdown();
+    u32  tasks_num_workers();
+    u32  tasks_thread_index(); // 0 - (num_workers-1) for workers, num_workers + n for other submitting threads
+    u32  tasks_max_threads();  // upper bound of tasks_thread_index for sizing per thread scratch data
+    void tasks_submit(task_func func, void* user_data, task_counter* counter = nullptr,
+                      task_counter* dependency = nullptr);
+    bool tasks_complete(task_counter* counter);
+    void tasks_wait(task_counter* counter); // executes pending tasks while waiting
+
+    // Parallel loops
+    // [begin, end) is split into chunks of grain size, chunks are handed out dynamically to the worker pool
+    // and the calling thread, which participates and returns when all chunks are complete.
+
+    // fn(u32 chunk_begin, u32 chunk_end)
+    template <typename F>
+    void parallel_for(u32 begin, u32 end, u32 grain, const F& fn);
+
+    // fn(u32 chunk_begin, u32 chunk_end, T& chunk_result) accumulates into a result initialised with identity,
+    // chunk results are combined with reduce(T& result, const T& chunk_result) in chunk order so the result is deterministic.
+    template <typename T, typename F, typename R>
+    T parallel_reduce(u32 begin, u32 end, u32 grain, const T& identity, const F& fn, const R& reduce);
+
     // Mutex
     mutex* mutex_create();
     void   mutex_destroy(mutex* p_mutex);
@@ -85,4 +124,92 @@ namespace pen
     bool       semaphore_wait(semaphore* p_semaphore);
     void       semaphore_post(semaphore* p_semaphore, u32 count);
 
+
+    // Implementation
+
+    template <typename F>
+    struct parallel_for_ctx
+    {
+        const F* fn;
+        u32      begin;
+        u32      end;
+        u32      grain;
+        a_u32    next_chunk;
+    };
+
+    template <typename F>
+    void parallel_for_task(void* user_data)
+    {
+        parallel_for_ctx<F>* ctx = (parallel_for_ctx<F>*)user_data;
+        for (;;)
+        {
+            u64 chunk_begin = (u64)ctx->begin + (u64)(ctx->next_chunk++) * ctx->grain;
+            if (chunk_begin >= ctx->end)
+                break;
+
+            u32 chunk_end = (u32)min<u64>(chunk_begin + ctx->grain, ctx->end);
+            (*ctx->fn)((u32)chunk_begin, chunk_end);
+        }
+    }
+
+    template <typename F>
+    void parallel_for(u32 begin, u32 end, u32 grain, const F& fn)
+    {
+        if (end <= begin)
+            return;
+
+        grain = max<u32>(grain, 1);
+        u32 num_chunks = (end - begin + grain - 1) / grain;
+        if (num_chunks == 1)
+        {
+            fn(begin, end);
+            return;
+        }
+
+        parallel_for_ctx<F> ctx;
+        ctx.fn = &fn;
+        ctx.begin = begin;
+        ctx.end = end;
+        ctx.grain = grain;
+        ctx.next_chunk = 0;
+
+        // one task per worker at most, each pulls chunks until there are none left
+        u32          num_tasks = min<u32>(num_chunks - 1, tasks_num_workers());
+        task_counter counter;
+        for (u32 i = 0; i < num_tasks; ++i)
+            tasks_submit(parallel_for_task<F>, &ctx, &counter);
+
+        parallel_for_task<F>(&ctx);
+        tasks_wait(&counter);
+    }
+
+    template <typename T, typename F, typename R>
+    T parallel_reduce(u32 begin, u32 end, u32 grain, const T& identity, const F& fn, const R& reduce)
+    {
+        T result = identity;
+        if (end <= begin)
+            return result;
+
+        grain = max<u32>(grain, 1);
+        u32 num_chunks = (end - begin + grain - 1) / grain;
+        if (num_chunks == 1)
+        {
+            fn(begin, end, result);
+            return result;
+        }
+
+        T* chunk_results = new T[num_chunks];
+        for (u32 i = 0; i < num_chunks; ++i)
+            chunk_results[i] = identity;
+
+        parallel_for(begin, end, grain, [&](u32 chunk_begin, u32 chunk_end) {
+            fn(chunk_begin, chunk_end, chunk_results[(chunk_begin - begin) / grain]);
+        });
+
+        for (u32 i = 0; i < num_chunks; ++i)
+            reduce(result, chunk_results[i]);
+
+        delete[] chunk_results;
+        return result;
+    }
 } // namespace pen
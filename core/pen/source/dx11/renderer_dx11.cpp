@@ -1106,6 +1106,8 @@ namespace pen
         _res_pool.grow(resource_slot);
 
         u32 resource_index = resource_slot;
+        _res_pool[resource_index].generic_buffer.srv = nullptr;
+        _res_pool[resource_index].generic_buffer.uav = nullptr;
 
         D3D11_BUFFER_DESC bd;
         ZeroMemory(&bd, sizeof(bd));
@@ -1115,7 +1117,11 @@ namespace pen
         bd.CPUAccessFlags = to_d3d11_cpu_access_flags(params.cpu_access_flags);
         bd.ByteWidth = params.buffer_size;
 
-        if (bd.BindFlags & PEN_BIND_SHADER_WRITE)
+        // structured buffers are read by shaders through an srv, and written by compute through a uav. only buffers
+        // with a stride are structured, other shader resource buffers keep their plain layout
+        u32  view_flags = PEN_BIND_SHADER_RESOURCE | PEN_BIND_SHADER_WRITE;
+        bool structured = params.stride != 0 && (params.bind_flags & view_flags);
+        if (structured)
         {
             bd.MiscFlags |= D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
             bd.StructureByteStride = params.stride;
@@ -1135,7 +1141,7 @@ namespace pen
             CHECK_CALL(s_device->CreateBuffer(&bd, nullptr, &_res_pool[resource_index].generic_buffer.buf));
         }
 
-        if (bd.BindFlags & PEN_BIND_SHADER_WRITE)
+        if (structured && (params.bind_flags & PEN_BIND_SHADER_WRITE))
         {
             // uav if we need it
             D3D11_UNORDERED_ACCESS_VIEW_DESC uav_desc = {};
@@ -1146,7 +1152,10 @@ namespace pen
 
             CHECK_CALL(s_device->CreateUnorderedAccessView(_res_pool[resource_index].generic_buffer.buf, &uav_desc,
                                                            &_res_pool[resource_index].generic_buffer.uav));
+        }
 
+        if (structured)
+        {
             // srv if we need it
             D3D11_SHADER_RESOURCE_VIEW_DESC srv_desc = {};
             srv_desc.ViewDimension = D3D11_SRV_DIMENSION_BUFFEREX;
@@ -1979,7 +1988,17 @@ namespace pen
 
     void direct::renderer_release_buffer(u32 buffer_index)
     {
-        _res_pool[buffer_index].generic_buffer.buf->Release();
+        ua_buffer& gb = _res_pool[buffer_index].generic_buffer;
+        gb.buf->Release();
+
+        if (gb.srv)
+            gb.srv->Release();
+
+        if (gb.uav)
+            gb.uav->Release();
+
+        gb.srv = nullptr;
+        gb.uav = nullptr;
     }
 
     void direct::renderer_release_texture(u32 texture_index)
@@ -2504,6 +2523,7 @@ namespace pen
         s_renderer_info.caps |= PEN_CAPS_DEPTH_CLAMP;
         s_renderer_info.caps |= PEN_CAPS_COMPUTE;
         s_renderer_info.caps |= PEN_CAPS_TEXTURE_CUBE_ARRAY;
+        s_renderer_info.caps |= PEN_CAPS_STRUCTURED_BUFFER;
     }
 
     const renderer_info& renderer_get_info()
@@ -7,7 +7,12 @@
 #include "renderer.h"
 #include "threads.h"
 
+#include <thread>
+
 #define MAX_THREADS 32 // lazy fixed sized array to avoid any thread saftey issues
+#define MAX_TASK_THREADS 64
+#define MAX_EXTERNAL_TASK_THREADS 16 // non worker threads which submit tasks (user, render, physics..)
+#define TASK_DEQUE_SIZE 4096         // must be po2
 
 using namespace pen;
 
@@ -18,6 +23,288 @@ namespace
     single_thread_update_func* s_single_thread_funcs = nullptr;
 } // namespace
 
+#if !PEN_SINGLE_THREADED
+namespace
+{
+    struct task
+    {
+        task_func     func;
+        void*         user_data;
+        task_counter* counter;
+    };
+
+    struct pending_task
+    {
+        task          t;
+        pending_task* next;
+    };
+
+    // chase-lev work stealing deque, the owner pushes and pops from the bottom, thieves steal from the top
+    struct task_deque
+    {
+        std::atomic<s64> top;
+        std::atomic<s64> bottom;
+        task             tasks[TASK_DEQUE_SIZE];
+    };
+
+    namespace e_tasks_state
+    {
+        enum tasks_state_t
+        {
+            uninitialised,
+            initialising,
+            ready
+        };
+    }
+
+    a_u32       s_tasks_state = {e_tasks_state::uninitialised};
+    a_u32       s_tasks_exit = {0};
+    a_u32       s_sleeping_workers = {0};
+    a_u32       s_alive_workers = {0};
+    a_u32       s_num_external = {0};
+    u32         s_num_workers = 0;
+    semaphore*  s_wake_sem = nullptr;
+    task_deque* s_deques[MAX_TASK_THREADS + MAX_EXTERNAL_TASK_THREADS] = {0};
+
+    thread_local u32 t_thread_index = PEN_INVALID_HANDLE;
+
+    task_deque* create_deque()
+    {
+        task_deque* d = (task_deque*)memory_alloc_align(sizeof(task_deque), 64);
+        new (&d->top) std::atomic<s64>(0);
+        new (&d->bottom) std::atomic<s64>(0);
+        return d;
+    }
+
+    bool deque_push(task_deque* d, const task& t)
+    {
+        s64 b = d->bottom.load(std::memory_order_relaxed);
+        s64 tp = d->top.load(std::memory_order_acquire);
+        if (b - tp >= TASK_DEQUE_SIZE)
+            return false;
+
+        d->tasks[b & (TASK_DEQUE_SIZE - 1)] = t;
+        std::atomic_thread_fence(std::memory_order_release);
+        d->bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool deque_pop(task_deque* d, task& out)
+    {
+        s64 b = d->bottom.load(std::memory_order_relaxed) - 1;
+        d->bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        s64 t = d->top.load(std::memory_order_relaxed);
+
+        if (t > b)
+        {
+            // empty
+            d->bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        out = d->tasks[b & (TASK_DEQUE_SIZE - 1)];
+
+        if (t == b)
+        {
+            // last item, race against thieves
+            bool won = d->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            d->bottom.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+
+        return true;
+    }
+
+    bool deque_steal(task_deque* d, task& out)
+    {
+        s64 t = d->top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        s64 b = d->bottom.load(std::memory_order_acquire);
+
+        if (t >= b)
+            return false;
+
+        out = d->tasks[t & (TASK_DEQUE_SIZE - 1)];
+        return d->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+    void counter_lock(task_counter* counter)
+    {
+        u32 expected = 0;
+        while (!counter->lock.compare_exchange_weak(expected, 1, std::memory_order_acquire))
+        {
+            expected = 0;
+            std::this_thread::yield();
+        }
+    }
+
+    void counter_unlock(task_counter* counter)
+    {
+        counter->lock.store(0, std::memory_order_release);
+    }
+
+    u32 get_thread_index()
+    {
+        if (t_thread_index == PEN_INVALID_HANDLE)
+        {
+            // first submit from a non worker thread, give it its own deque
+            u32 ext = s_num_external++;
+            if (ext >= MAX_EXTERNAL_TASK_THREADS)
+            {
+                PEN_LOG("[error] tasks: exceeded %i external task threads", MAX_EXTERNAL_TASK_THREADS);
+                PEN_ASSERT(0);
+                return PEN_INVALID_HANDLE;
+            }
+
+            s_deques[MAX_TASK_THREADS + ext] = create_deque();
+            t_thread_index = MAX_TASK_THREADS + ext;
+        }
+        else if (!s_deques[t_thread_index])
+        {
+            // deques are freed on shutdown, external threads keep their index and get a new one after re-init
+            s_deques[t_thread_index] = create_deque();
+        }
+
+        return t_thread_index;
+    }
+
+    u32 num_deques()
+    {
+        return MAX_TASK_THREADS + min<u32>(s_num_external, MAX_EXTERNAL_TASK_THREADS);
+    }
+
+    bool find_task(u32 thread_index, task& out)
+    {
+        if (deque_pop(s_deques[thread_index], out))
+            return true;
+
+        // steal, starting from the next neighbour to spread contention
+        u32 nd = num_deques();
+        for (u32 i = 1; i < nd; ++i)
+        {
+            u32 victim = (thread_index + i) % nd;
+            if (!s_deques[victim])
+                continue;
+
+            if (deque_steal(s_deques[victim], out))
+                return true;
+        }
+
+        return false;
+    }
+
+    bool has_work()
+    {
+        u32 nd = num_deques();
+        for (u32 i = 0; i < nd; ++i)
+        {
+            task_deque* d = s_deques[i];
+            if (!d)
+                continue;
+
+            if (d->top.load() < d->bottom.load())
+                return true;
+        }
+
+        return false;
+    }
+
+    void wake_workers()
+    {
+        // the push must be visible before we look for sleepers, workers fence between declaring sleep and
+        // checking for work so one side always sees the other
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (s_sleeping_workers.load() > 0)
+            semaphore_post(s_wake_sem, 1);
+    }
+
+    void execute(const task& t);
+
+    void push_or_execute(const task& t)
+    {
+        u32 ti = get_thread_index();
+        if (ti == PEN_INVALID_HANDLE || !deque_push(s_deques[ti], t))
+        {
+            execute(t);
+            return;
+        }
+
+        wake_workers();
+    }
+
+    void execute(const task& t)
+    {
+        t.func(t.user_data);
+
+        task_counter* counter = t.counter;
+        if (!counter)
+            return;
+
+        // fast path while other tasks are still outstanding
+        u32 v = counter->value.load();
+        while (v > 1)
+        {
+            if (counter->value.compare_exchange_weak(v, v - 1))
+                return;
+        }
+
+        // we may be the last task, the final decrement happens under the lock so pending tasks are detached
+        // atomically with completion. waiters also wait for the lock so the unlock is the last write to the counter,
+        // which may live on the waiting threads stack and be gone as soon as it is released.
+        counter_lock(counter);
+        pending_task* pt = nullptr;
+        if (--counter->value == 0)
+        {
+            pt = (pending_task*)counter->pending;
+            counter->pending = nullptr;
+        }
+        counter_unlock(counter);
+
+        while (pt)
+        {
+            pending_task* next = pt->next;
+            push_or_execute(pt->t);
+            memory_free(pt);
+            pt = next;
+        }
+    }
+
+    void* worker_thread(void* params)
+    {
+        t_thread_index = (u32)(intptr_t)params;
+
+        for (;;)
+        {
+            task t;
+            if (find_task(t_thread_index, t))
+            {
+                execute(t);
+                continue;
+            }
+
+            if (s_tasks_exit.load())
+                break;
+
+            // declare we are going to sleep then check again to avoid a lost wake up
+            s_sleeping_workers++;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (has_work() || s_tasks_exit.load())
+            {
+                s_sleeping_workers--;
+                continue;
+            }
+
+            semaphore_wait(s_wake_sem);
+            s_sleeping_workers--;
+        }
+
+        s_alive_workers--;
+        return PEN_THREAD_OK;
+    }
+} // namespace
+#endif
+
 namespace pen
 {
     pen::job* jobs_create_job(dispatch_thread thread_func, u32 stack_size, void* user_data, thread_start_flags flags,
@@ -63,6 +350,7 @@ namespace pen
             }
         }
 
+        tasks_shutdown();
         return true;
     }
 
@@ -79,4 +367,176 @@ namespace pen
             ((single_thread_update_func)s_single_thread_funcs[i])();
         }
     }
+
+#if !PEN_SINGLE_THREADED
+    void tasks_init(u32 num_workers)
+    {
+        u32 expected = e_tasks_state::uninitialised;
+        if (!s_tasks_state.compare_exchange_strong(expected, e_tasks_state::initialising))
+        {
+            // another thread is initialising, wait for it
+            while (s_tasks_state.load() != e_tasks_state::ready)
+                std::this_thread::yield();
+            return;
+        }
+
+        if (num_workers == 0)
+            num_workers = std::thread::hardware_concurrency();
+
+        s_num_workers = max<u32>(min<u32>(num_workers, MAX_TASK_THREADS), 1);
+        s_wake_sem = semaphore_create(0, s_num_workers);
+        s_tasks_exit = 0;
+
+        for (u32 i = 0; i < s_num_workers; ++i)
+            s_deques[i] = create_deque();
+
+        for (u32 i = 0; i < s_num_workers; ++i)
+        {
+            s_alive_workers++;
+            thread_create(worker_thread, 1024 * 1024, (void*)(intptr_t)i, e_thread_start_flags::detached);
+        }
+
+        s_tasks_state = e_tasks_state::ready;
+    }
+
+    void tasks_shutdown()
+    {
+        if (s_tasks_state.load() != e_tasks_state::ready)
+            return;
+
+        s_tasks_exit = 1;
+        for (u32 i = 0; i < s_num_workers; ++i)
+            semaphore_post(s_wake_sem, 1);
+
+        // workers drain their queues before exiting
+        while (s_alive_workers.load() > 0)
+        {
+            semaphore_post(s_wake_sem, 1);
+            thread_sleep_ms(1);
+        }
+
+        for (u32 i = 0; i < MAX_TASK_THREADS + MAX_EXTERNAL_TASK_THREADS; ++i)
+        {
+            memory_free_align(s_deques[i]);
+            s_deques[i] = nullptr;
+        }
+
+        semaphore_destroy(s_wake_sem);
+        s_wake_sem = nullptr;
+
+        s_tasks_state = e_tasks_state::uninitialised;
+    }
+
+    u32 tasks_num_workers()
+    {
+        if (s_tasks_state.load() != e_tasks_state::ready)
+            tasks_init();
+
+        return s_num_workers;
+    }
+
+    u32 tasks_thread_index()
+    {
+        u32 ti = get_thread_index();
+        if (ti < MAX_TASK_THREADS)
+            return ti;
+
+        // external threads are packed after the workers
+        return tasks_num_workers() + (ti - MAX_TASK_THREADS);
+    }
+
+    u32 tasks_max_threads()
+    {
+        return tasks_num_workers() + MAX_EXTERNAL_TASK_THREADS;
+    }
+
+    void tasks_submit(task_func func, void* user_data, task_counter* counter, task_counter* dependency)
+    {
+        if (s_tasks_state.load() != e_tasks_state::ready)
+            tasks_init();
+
+        if (counter)
+            counter->value++;
+
+        task t = {func, user_data, counter};
+
+        if (dependency)
+        {
+            counter_lock(dependency);
+            if (dependency->value.load() > 0)
+            {
+                // defer until the dependency completes
+                pending_task* pt = (pending_task*)memory_alloc(sizeof(pending_task));
+                pt->t = t;
+                pt->next = (pending_task*)dependency->pending;
+                dependency->pending = pt;
+                counter_unlock(dependency);
+                return;
+            }
+            counter_unlock(dependency);
+        }
+
+        push_or_execute(t);
+    }
+
+    bool tasks_complete(task_counter* counter)
+    {
+        return counter->value.load() == 0 && counter->lock.load() == 0;
+    }
+
+    void tasks_wait(task_counter* counter)
+    {
+        u32 ti = get_thread_index();
+        while (!tasks_complete(counter))
+        {
+            // help out instead of blocking
+            task t;
+            if (ti != PEN_INVALID_HANDLE && find_task(ti, t))
+            {
+                execute(t);
+                continue;
+            }
+
+            std::this_thread::yield();
+        }
+    }
+#else
+    // single threaded platforms execute tasks immediately, so dependencies are always complete
+    void tasks_init(u32 num_workers)
+    {
+    }
+
+    void tasks_shutdown()
+    {
+    }
+
+    u32 tasks_num_workers()
+    {
+        return 1;
+    }
+
+    u32 tasks_thread_index()
+    {
+        return 0;
+    }
+
+    u32 tasks_max_threads()
+    {
+        return 1;
+    }
+
+    void tasks_submit(task_func func, void* user_data, task_counter* counter, task_counter* dependency)
+    {
+        func(user_data);
+    }
+
+    bool tasks_complete(task_counter* counter)
+    {
+        return true;
+    }
+
+    void tasks_wait(task_counter* counter)
+    {
+    }
+#endif
 } // namespace pen
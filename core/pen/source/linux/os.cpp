@@ -1,7 +1,9 @@
 // os.cpp
 // Copyright 2014 - 2023 Alex Dixon.
 // License: https://github.com/polymonster/pmtech/blob/master/license.md
+#ifndef PEN_RENDERER_NULL
 #include "GL/glew.h"
+#endif
 
 #include "console.h"
 #include "hash.h"
@@ -21,9 +23,12 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#ifndef PEN_RENDERER_NULL
 #include <GL/glx.h>
 #include <GL/glxext.h>
+#endif
 #include <X11/Xlib.h>
+#include <X11/Xutil.h>
 
 using namespace pen;
 
@@ -31,6 +36,10 @@ using namespace pen;
 window_creation_params pen_window;
 pen::user_info         pen_user_info;
 
+Display* _display;
+Window   _window;
+
+#ifndef PEN_RENDERER_NULL
 // glx / gl stuff
 #define GLX_CONTEXT_MAJOR_VERSION_ARB 0x2091
 #define GLX_CONTEXT_MINOR_VERSION_ARB 0x2092
@@ -48,8 +57,6 @@ static int visual_attribs[] = {GLX_X_RENDERABLE, True, GLX_DRAWABLE_TYPE, GLX_WI
                                None};
 
 GLXContext _gl_context = 0;
-Display*   _display;
-Window     _window;
 
 // externs for the gl implementation
 void pen_make_gl_context_current()
@@ -61,6 +68,7 @@ void pen_gl_swap_buffers()
 {
     glXSwapBuffers(_display, _window);
 }
+#endif
 
 namespace
 {
@@ -82,6 +90,7 @@ namespace
         pen_user_info.user_name = &homedir[6];
     }
 
+#ifndef PEN_RENDERER_NULL
     int ctx_error_handler(Display* dpy, XErrorEvent* ev)
     {
         PEN_LOG("CONTEXT ERROR %i", ev->error_code);
@@ -219,12 +228,16 @@ namespace
 
         s_windowed = true;
 
-        if(argc > 1)
+        if (argc > 1)
         {
-            if(strcmp(argv[1],"-test") == 0)
+            if (strcmp(argv[1], "-test") == 0)
             {
                 pen::renderer_test_enable();
             }
+            else if (strcmp(argv[1], "-capture") == 0 && argc > 3)
+            {
+                pen::renderer_capture_begin(argv[2], atoi(argv[3]));
+            }
         }
 
         // inits renderer and loops in wait for jobs, calling os update
@@ -238,6 +251,31 @@ namespace
 
         return s_error_code;
     }
+#else
+    int pen_run_windowed(int argc, char** argv)
+    {
+        // null renderer runs headless, no display or gl context is required
+        if (argc > 1)
+        {
+            if (strcmp(argv[1], "-test") == 0)
+            {
+                pen::renderer_test_enable();
+            }
+            else if (strcmp(argv[1], "-capture") == 0 && argc > 3)
+            {
+                pen::renderer_capture_begin(argv[2], atoi(argv[3]));
+            }
+        }
+
+        // inits renderer and loops in wait for jobs, calling os update
+        renderer_init(nullptr, true, s_creation_params.max_renderer_commands);
+
+        // exit, kill other threads and wait
+        pen::jobs_terminate_all();
+
+        return s_error_code;
+    }
+#endif
 
     int pen_run_console_app()
     {
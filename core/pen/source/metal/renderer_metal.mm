@@ -202,17 +202,13 @@ namespace // internal structs and static vars
     a_u64              _resize_sync;
 
     // dynamic buffer impl
+    // only for buffers updated at most once a frame, buffers updated more often live at an offset in the stretchy buffer
     id<MTLBuffer> dynamic_buffer::read()
     {
-        if (_static)
-            return static_buffer;
-
-        if (_frame_writes > 1)
-        {
-            _res_pool.get(stretchy_buffer->_gpu_buffer).buffer.dynamic_buffers.backbuffer();
-        }
-
-        return dynamic_buffers.backbuffer();
+        size_t offset = 0;
+        id<MTLBuffer> buf = read(offset);
+        PEN_ASSERT(offset == 0);
+        return buf;
     }
 
     id<MTLBuffer> dynamic_buffer::read(size_t& offset)
@@ -1108,6 +1104,7 @@ namespace pen
                 info.caps |= PEN_CAPS_TEX_FORMAT_BC4;
                 info.caps |= PEN_CAPS_TEX_FORMAT_BC5;
                 info.caps |= PEN_CAPS_COMPUTE;
+                info.caps |= PEN_CAPS_STRUCTURED_BUFFER;
                 info.caps |= PEN_CAPS_TEXTURE_CUBE_ARRAY;
                 info.caps |= PEN_CAPS_BACKBUFFER_BGRA;
             }
@@ -1495,9 +1492,11 @@ namespace pen
                 u32 ri = buffer_indices[i];
                 u32 stride = strides[i];
 
-                auto& bb = _res_pool.get(ri).buffer;
+                // buffers updated more than once this frame are read from the offset of their latest update
+                size_t        read_offset = 0;
+                id<MTLBuffer> buf = _res_pool.get(ri).buffer.read(read_offset);
 
-                [_state.render_encoder setVertexBuffer:bb.read() offset:offsets[i] atIndex:start_slot + i];
+                [_state.render_encoder setVertexBuffer:buf offset:read_offset + offsets[i] atIndex:start_slot + i];
 
                 MTLVertexBufferLayoutDescriptor* layout = [[MTLVertexBufferLayoutDescriptor alloc] init];
 
@@ -1520,10 +1519,11 @@ namespace pen
 
         void renderer_set_index_buffer(u32 buffer_index, u32 format, u32 offset)
         {
+            size_t            read_offset = 0;
             index_buffer_cmd& ib = _state.index_buffer;
-            ib.buffer = _res_pool.get(buffer_index).buffer.read();
+            ib.buffer = _res_pool.get(buffer_index).buffer.read(read_offset);
             ib.type = to_metal_index_format(format);
-            ib.offset = offset;
+            ib.offset = (u32)read_offset + offset;
             ib.size_bytes = index_size_bytes(format);
         }
 
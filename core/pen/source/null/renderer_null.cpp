@@ -0,0 +1,627 @@
+// renderer_null.cpp
+// Copyright 2014 - 2023 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+#include "renderer_null.h"
+#include "console.h"
+#include "data_struct.h"
+#include "memory.h"
+#include "renderer.h"
+#include "renderer_shared.h"
+
+using namespace pen;
+
+namespace
+{
+    namespace e_null_res
+    {
+        enum null_res_t
+        {
+            none,
+            clear_state,
+            shader,
+            program,
+            input_layout,
+            buffer,
+            texture,
+            sampler,
+            raster_state,
+            blend_state,
+            depth_stencil_state,
+            render_target
+        };
+    }
+
+    struct null_resource
+    {
+        u32 type;
+        u32 size;
+        u32 bind_flags;
+    };
+
+    struct null_state
+    {
+        u32 shader[PEN_SHADER_TYPE_CS + 1];
+        u32 input_layout;
+        u32 vertex_buffer;
+        u32 index_buffer;
+        u32 num_colour_targets;
+        u32 depth_target;
+    };
+
+    const c8* k_cmd_names[] = {"create_clear_state",
+                               "clear",
+                               "clear_texture",
+                               "present",
+                               "load_shader",
+                               "set_shader",
+                               "link_shader",
+                               "create_input_layout",
+                               "set_input_layout",
+                               "create_buffer",
+                               "set_vertex_buffer",
+                               "set_index_buffer",
+                               "set_constant_buffer",
+                               "set_structured_buffer",
+                               "update_buffer",
+                               "create_texture",
+                               "create_sampler",
+                               "set_texture",
+                               "create_raster_state",
+                               "set_raster_state",
+                               "set_viewport",
+                               "set_scissor_rect",
+                               "create_blend_state",
+                               "set_blend_state",
+                               "create_depth_stencil_state",
+                               "set_depth_stencil_state",
+                               "set_stencil_ref",
+                               "draw",
+                               "draw_indexed",
+                               "draw_indexed_instanced",
+                               "draw_auto",
+                               "dispatch_compute",
+                               "create_render_target",
+                               "set_targets",
+                               "set_stream_out_target",
+                               "resolve_target",
+                               "read_back_resource",
+                               "push_perf_marker",
+                               "pop_perf_marker",
+                               "replace_resource",
+                               "release_resource"};
+    static_assert(PEN_ARRAY_SIZE(k_cmd_names) == e_null_cmd::COUNT, "mismatched null renderer cmd names");
+
+    // only log the first few errors, the count keeps going
+    const u32 k_max_logged_errors = 64;
+
+    res_pool<null_resource>              _res_pool;
+    null_state                           s_state;
+    null_renderer_stats                  s_frame_stats;
+    multi_buffer<null_renderer_stats, 2> s_stats;
+    renderer_info                        s_renderer_info;
+
+    void count_cmd(null_cmd cmd, u64 bytes = 0)
+    {
+        s_frame_stats.cmd_count[cmd]++;
+        s_frame_stats.cmd_bytes[cmd] += bytes;
+    }
+
+    void validate(bool condition, const c8* msg, u32 handle)
+    {
+        if (condition)
+            return;
+
+        if (s_frame_stats.validation_errors < k_max_logged_errors)
+            PEN_LOG("null renderer validation: %s (handle %i)", msg, handle);
+
+        s_frame_stats.validation_errors++;
+    }
+
+    bool is_type(u32 handle, u32 type)
+    {
+        if (handle >= _res_pool._capacity)
+            return false;
+
+        return _res_pool[handle].type == type;
+    }
+
+    void create_resource(u32 resource_slot, u32 type, u32 size = 0, u32 bind_flags = 0)
+    {
+        _res_pool.grow(resource_slot);
+        validate(_res_pool[resource_slot].type == e_null_res::none, "create over a live resource", resource_slot);
+
+        _res_pool[resource_slot].type = type;
+        _res_pool[resource_slot].size = size;
+        _res_pool[resource_slot].bind_flags = bind_flags;
+
+        s_frame_stats.live_resources++;
+    }
+
+    void release_resource(u32 handle, u32 type)
+    {
+        count_cmd(e_null_cmd::release_resource);
+        validate(is_type(handle, type), "release of a resource which is not live or of the wrong type", handle);
+
+        if (handle < _res_pool._capacity && _res_pool[handle].type != e_null_res::none)
+        {
+            _res_pool[handle].type = e_null_res::none;
+            s_frame_stats.live_resources--;
+        }
+    }
+
+    // 0 unbinds
+    void validate_bind(u32 handle, u32 type, const c8* msg)
+    {
+        if (handle == 0)
+            return;
+
+        validate(is_type(handle, type), msg, handle);
+    }
+
+    void validate_draw()
+    {
+        validate(s_state.shader[PEN_SHADER_TYPE_VS] != 0, "draw without a vertex shader", 0);
+        validate(s_state.num_colour_targets > 0 || s_state.depth_target != PEN_INVALID_HANDLE, "draw without targets",
+                 0);
+        validate(s_state.input_layout != 0 || s_state.vertex_buffer == 0, "draw vertex buffer without input layout",
+                 0);
+    }
+} // namespace
+
+namespace pen
+{
+    a_u64 g_gpu_total;
+
+    void null_renderer_get_frame_stats(null_renderer_stats& stats)
+    {
+        stats = s_stats.frontbuffer();
+    }
+
+    const c8* null_renderer_cmd_name(null_cmd cmd)
+    {
+        if (cmd >= e_null_cmd::COUNT)
+            return "";
+
+        return k_cmd_names[cmd];
+    }
+
+    void direct::renderer_push_perf_marker(const c8* name)
+    {
+        count_cmd(e_null_cmd::push_perf_marker);
+    }
+
+    void direct::renderer_pop_perf_marker()
+    {
+        count_cmd(e_null_cmd::pop_perf_marker);
+    }
+
+    u32 direct::renderer_initialise(void*, u32 bb_res, u32 bb_depth_res)
+    {
+        _res_pool.init(2048);
+
+        create_resource(bb_res, e_null_res::render_target);
+        create_resource(bb_depth_res, e_null_res::render_target);
+
+        s_renderer_info.shader_version = "";
+        s_renderer_info.api_version = "null";
+        s_renderer_info.renderer = "null";
+        s_renderer_info.vendor = "pmtech";
+        s_renderer_info.renderer_cmd = "-renderer null";
+
+        // match the opengl caps so shared glsl data and the same code paths are exercised
+        s_renderer_info.caps |= PEN_CAPS_VUP;
+        s_renderer_info.caps |= PEN_CAPS_TEX_FORMAT_BC1;
+        s_renderer_info.caps |= PEN_CAPS_TEX_FORMAT_BC2;
+        s_renderer_info.caps |= PEN_CAPS_TEX_FORMAT_BC3;
+        s_renderer_info.caps |= PEN_CAPS_DEPTH_CLAMP;
+        s_renderer_info.caps |= PEN_CAPS_TEXTURE_CUBE_ARRAY;
+        s_renderer_info.caps |= PEN_CAPS_COMPUTE;
+
+        return PEN_ERR_OK;
+    }
+
+    void direct::renderer_shutdown()
+    {
+        if (s_frame_stats.live_resources > 0)
+            PEN_LOG("null renderer: %i resources still live at shutdown", s_frame_stats.live_resources);
+    }
+
+    const renderer_info& renderer_get_info()
+    {
+        return s_renderer_info;
+    }
+
+    const c8* renderer_get_shader_platform()
+    {
+        return "glsl";
+    }
+
+    bool renderer_viewport_vup()
+    {
+        return true;
+    }
+
+    bool renderer_depth_0_to_1()
+    {
+        return false;
+    }
+
+    void direct::renderer_sync()
+    {
+    }
+
+    void direct::renderer_retain()
+    {
+    }
+
+    void direct::renderer_new_frame()
+    {
+        _renderer_new_frame();
+    }
+
+    void direct::renderer_end_frame()
+    {
+    }
+
+    void direct::renderer_present()
+    {
+        count_cmd(e_null_cmd::present);
+        _renderer_end_frame();
+
+        // publish and reset the per frame counters, resource and error counts carry over
+        null_renderer_stats& bb = s_stats.backbuffer();
+        bb = s_frame_stats;
+        bb.frame = _renderer_frame_index();
+        s_stats.swap_buffers();
+
+        memset(s_frame_stats.cmd_count, 0x0, sizeof(s_frame_stats.cmd_count));
+        memset(s_frame_stats.cmd_bytes, 0x0, sizeof(s_frame_stats.cmd_bytes));
+
+        s_state = {};
+    }
+
+    void direct::renderer_create_clear_state(const clear_state& cs, u32 resource_slot)
+    {
+        count_cmd(e_null_cmd::create_clear_state);
+        create_resource(resource_slot, e_null_res::clear_state);
+    }
+
+    void direct::renderer_clear(u32 clear_state_index, u32 colour_slice, u32 depth_slice)
+    {
+        count_cmd(e_null_cmd::clear);
+        validate(is_type(clear_state_index, e_null_res::clear_state), "clear with invalid clear state",
+                 clear_state_index);
+    }
+
+    void direct::renderer_clear_texture(u32 clear_state_index, u32 texture)
+    {
+        count_cmd(e_null_cmd::clear_texture);
+        validate(is_type(clear_state_index, e_null_res::clear_state), "clear texture with invalid clear state",
+                 clear_state_index);
+    }
+
+    void direct::renderer_load_shader(const shader_load_params& params, u32 resource_slot)
+    {
+        count_cmd(e_null_cmd::load_shader, params.byte_code_size);
+        create_resource(resource_slot, e_null_res::shader, params.byte_code_size);
+    }
+
+    void direct::renderer_set_shader(u32 shader_index, u32 shader_type)
+    {
+        count_cmd(e_null_cmd::set_shader);
+        validate_bind(shader_index, e_null_res::shader, "set shader which is not a shader");
+
+        if (shader_type <= PEN_SHADER_TYPE_CS)
+            s_state.shader[shader_type] = shader_index;
+    }
+
+    void direct::renderer_link_shader_program(const shader_link_params& params, u32 resource_slot)
+    {
+        count_cmd(e_null_cmd::link_shader);
+        validate_bind(params.vertex_shader, e_null_res::shader, "link with invalid vertex shader");
+        validate_bind(params.pixel_shader, e_null_res::shader, "link with invalid pixel shader");
+        create_resource(resource_slot, e_null_res::program);
+    }
+
+    void direct::renderer_create_input_layout(const input_layout_creation_params& params, u32 resource_slot)
+    {
+        count_cmd(e_null_cmd::create_input_layout);
+        create_resource(resource_slot, e_null_res::input_layout);
+    }
+
+    void direct::renderer_set_input_layout(u32 layout_index)
+    {
+        count_cmd(e_null_cmd::set_input_layout);
+        validate_bind(layout_index, e_null_res::input_layout, "set input layout which is not an input layout");
+        s_state.input_layout = layout_index;
+    }
+
+    void direct::renderer_create_buffer(const buffer_creation_params& params, u32 resource_slot)
+    {
+        count_cmd(e_null_cmd::create_buffer, params.data ? params.buffer_size : 0);
+        create_resource(resource_slot, e_null_res::buffer, params.buffer_size, params.bind_flags);
+    }
+
+    void direct::renderer_set_vertex_buffers(u32* buffer_indices, u32 num_buffers, u32 start_slot, const u32* strides,
+                                             const u32* offsets)
+    {
+        count_cmd(e_null_cmd::set_vertex_buffer);
+        for (u32 i = 0; i < num_buffers; ++i)
+            validate_bind(buffer_indices[i], e_null_res::buffer, "set vertex buffer which is not a buffer");
+
+        if (num_buffers > 0)
+            s_state.vertex_buffer = buffer_indices[0];
+    }
+
+    void direct::renderer_set_index_buffer(u32 buffer_index, u32 format, u32 offset)
+    {
+        count_cmd(e_null_cmd::set_index_buffer);
+        validate_bind(buffer_index, e_null_res::buffer, "set index buffer which is not a buffer");
+        s_state.index_buffer = buffer_index;
+    }
+
+    void direct::renderer_set_constant_buffer(u32 buffer_index, u32 unit, u32 flags)
+    {
+        count_cmd(e_null_cmd::set_constant_buffer);
+        validate_bind(buffer_index, e_null_res::buffer, "set constant buffer which is not a buffer");
+    }
+
+    void direct::renderer_set_structured_buffer(u32 buffer_index, u32 unit, u32 flags)
+    {
+        count_cmd(e_null_cmd::set_structured_buffer);
+        validate_bind(buffer_index, e_null_res::buffer, "set structured buffer which is not a buffer");
+    }
+
+    void direct::renderer_update_buffer(u32 buffer_index, const void* data, u32 data_size, u32 offset)
+    {
+        count_cmd(e_null_cmd::update_buffer, data_size);
+
+        if (!is_type(buffer_index, e_null_res::buffer))
+        {
+            validate(false, "update buffer which is not a buffer", buffer_index);
+            return;
+        }
+
+        validate(offset + data_size <= _res_pool[buffer_index].size, "update buffer out of bounds", buffer_index);
+    }
+
+    void direct::renderer_create_texture(const texture_creation_params& tcp, u32 resource_slot)
+    {
+        count_cmd(e_null_cmd::create_texture, tcp.data ? tcp.data_size : 0);
+        create_resource(resource_slot, e_null_res::texture, tcp.data_size, tcp.bind_flags);
+    }
+
+    void direct::renderer_create_sampler(const sampler_creation_params& scp, u32 resource_slot)
+    {
+        count_cmd(e_null_cmd::create_sampler);
+        create_resource(resource_slot, e_null_res::sampler);
+    }
+
+    void direct::renderer_set_texture(u32 texture_index, u32 sampler_index, u32 unit, u32 bind_flags)
+    {
+        count_cmd(e_null_cmd::set_texture);
+
+        if (texture_index != 0)
+            validate(is_type(texture_index, e_null_res::texture) || is_type(texture_index, e_null_res::render_target),
+                     "set texture which is not a texture or render target", texture_index);
+
+        validate_bind(sampler_index, e_null_res::sampler, "set sampler which is not a sampler");
+    }
+
+    void direct::renderer_create_raster_state(const raster_state_creation_params& rscp, u32 resource_slot)
+    {
+        count_cmd(e_null_cmd::create_raster_state);
+        create_resource(resource_slot, e_null_res::raster_state);
+    }
+
+    void direct::renderer_set_raster_state(u32 raster_state_index)
+    {
+        count_cmd(e_null_cmd::set_raster_state);
+        validate_bind(raster_state_index, e_null_res::raster_state, "set raster state which is not a raster state");
+    }
+
+    void direct::renderer_set_viewport(const viewport& vp)
+    {
+        count_cmd(e_null_cmd::set_viewport);
+    }
+
+    void direct::renderer_set_scissor_rect(const rect& r)
+    {
+        count_cmd(e_null_cmd::set_scissor_rect);
+    }
+
+    void direct::renderer_create_blend_state(const blend_creation_params& bcp, u32 resource_slot)
+    {
+        count_cmd(e_null_cmd::create_blend_state);
+        create_resource(resource_slot, e_null_res::blend_state);
+    }
+
+    void direct::renderer_set_blend_state(u32 blend_state_index)
+    {
+        count_cmd(e_null_cmd::set_blend_state);
+        validate_bind(blend_state_index, e_null_res::blend_state, "set blend state which is not a blend state");
+    }
+
+    void direct::renderer_create_depth_stencil_state(const depth_stencil_creation_params& dscp, u32 resource_slot)
+    {
+        count_cmd(e_null_cmd::create_depth_stencil_state);
+        create_resource(resource_slot, e_null_res::depth_stencil_state);
+    }
+
+    void direct::renderer_set_depth_stencil_state(u32 depth_stencil_state)
+    {
+        count_cmd(e_null_cmd::set_depth_stencil_state);
+        validate_bind(depth_stencil_state, e_null_res::depth_stencil_state,
+                      "set depth stencil state which is not a depth stencil state");
+    }
+
+    void direct::renderer_set_stencil_ref(u8 ref)
+    {
+        count_cmd(e_null_cmd::set_stencil_ref);
+    }
+
+    void direct::renderer_draw(u32 vertex_count, u32 start_vertex, u32 primitive_topology)
+    {
+        count_cmd(e_null_cmd::draw);
+        validate_draw();
+    }
+
+    void direct::renderer_draw_indexed(u32 index_count, u32 start_index, u32 base_vertex, u32 primitive_topology)
+    {
+        count_cmd(e_null_cmd::draw_indexed);
+        validate_draw();
+        validate(s_state.index_buffer != 0, "draw indexed without an index buffer", 0);
+    }
+
+    void direct::renderer_draw_indexed_instanced(u32 instance_count, u32 start_instance, u32 index_count,
+                                                 u32 start_index, u32 base_vertex, u32 primitive_topology)
+    {
+        count_cmd(e_null_cmd::draw_indexed_instanced);
+        validate_draw();
+        validate(s_state.index_buffer != 0, "draw indexed instanced without an index buffer", 0);
+    }
+
+    void direct::renderer_draw_auto()
+    {
+        count_cmd(e_null_cmd::draw_auto);
+    }
+
+    void direct::renderer_dispatch_compute(uint3 grid, uint3 num_threads)
+    {
+        count_cmd(e_null_cmd::dispatch_compute);
+        validate(s_state.shader[PEN_SHADER_TYPE_CS] != 0, "dispatch without a compute shader", 0);
+    }
+
+    void direct::renderer_create_render_target(const texture_creation_params& tcp, u32 resource_slot, bool track)
+    {
+        count_cmd(e_null_cmd::create_render_target);
+        create_resource(resource_slot, e_null_res::render_target, 0, tcp.bind_flags);
+
+        if (track)
+            _renderer_track_managed_render_target(tcp, resource_slot);
+    }
+
+    void direct::renderer_set_targets(const u32* const colour_targets, u32 num_colour_targets, u32 depth_target,
+                                      u32 colour_slice, u32 depth_slice)
+    {
+        count_cmd(e_null_cmd::set_targets);
+
+        for (u32 i = 0; i < num_colour_targets; ++i)
+            validate(is_type(colour_targets[i], e_null_res::render_target), "set colour target which is not a target",
+                     colour_targets[i]);
+
+        if (depth_target != PEN_INVALID_HANDLE)
+            validate(is_type(depth_target, e_null_res::render_target), "set depth target which is not a target",
+                     depth_target);
+
+        s_state.num_colour_targets = num_colour_targets;
+        s_state.depth_target = depth_target;
+    }
+
+    void direct::renderer_set_resolve_targets(u32 colour_target, u32 depth_target)
+    {
+    }
+
+    void direct::renderer_set_stream_out_target(u32 buffer_index)
+    {
+        count_cmd(e_null_cmd::set_stream_out_target);
+        validate_bind(buffer_index, e_null_res::buffer, "set stream out target which is not a buffer");
+    }
+
+    void direct::renderer_resolve_target(u32 target, e_msaa_resolve_type type, resolve_resources res)
+    {
+        count_cmd(e_null_cmd::resolve_target);
+        validate(is_type(target, e_null_res::render_target), "resolve target which is not a target", target);
+    }
+
+    void direct::renderer_read_back_resource(const resource_read_back_params& rrbp)
+    {
+        count_cmd(e_null_cmd::read_back_resource, rrbp.data_size);
+
+        // there is no gpu data, return zeros so callers waiting on the callback still complete
+        void* data = memory_alloc(rrbp.data_size);
+        memset(data, 0x0, rrbp.data_size);
+        rrbp.call_back_function(data, rrbp.row_pitch, rrbp.depth_pitch, rrbp.block_size);
+        memory_free(data);
+    }
+
+    void direct::renderer_replace_resource(u32 dest, u32 src, e_renderer_resource type)
+    {
+        count_cmd(e_null_cmd::replace_resource);
+
+        switch (type)
+        {
+            case RESOURCE_TEXTURE:
+                release_resource(dest, e_null_res::texture);
+                break;
+            case RESOURCE_BUFFER:
+                release_resource(dest, e_null_res::buffer);
+                break;
+            case RESOURCE_VERTEX_SHADER:
+            case RESOURCE_PIXEL_SHADER:
+                release_resource(dest, e_null_res::shader);
+                break;
+            case RESOURCE_RENDER_TARGET:
+                release_resource(dest, e_null_res::render_target);
+                break;
+            default:
+                break;
+        }
+
+        // src is moved into dest
+        _res_pool[dest] = _res_pool[src];
+        _res_pool[src].type = e_null_res::none;
+    }
+
+    void direct::renderer_release_shader(u32 shader_index, u32 shader_type)
+    {
+        release_resource(shader_index, e_null_res::shader);
+    }
+
+    void direct::renderer_release_clear_state(u32 clear_state)
+    {
+        release_resource(clear_state, e_null_res::clear_state);
+    }
+
+    void direct::renderer_release_buffer(u32 buffer_index)
+    {
+        release_resource(buffer_index, e_null_res::buffer);
+    }
+
+    void direct::renderer_release_texture(u32 texture_index)
+    {
+        release_resource(texture_index, e_null_res::texture);
+    }
+
+    void direct::renderer_release_sampler(u32 sampler)
+    {
+        release_resource(sampler, e_null_res::sampler);
+    }
+
+    void direct::renderer_release_raster_state(u32 raster_state_index)
+    {
+        release_resource(raster_state_index, e_null_res::raster_state);
+    }
+
+    void direct::renderer_release_blend_state(u32 blend_state)
+    {
+        release_resource(blend_state, e_null_res::blend_state);
+    }
+
+    void direct::renderer_release_render_target(u32 render_target)
+    {
+        _renderer_untrack_managed_render_target(render_target);
+        release_resource(render_target, e_null_res::render_target);
+    }
+
+    void direct::renderer_release_input_layout(u32 input_layout)
+    {
+        release_resource(input_layout, e_null_res::input_layout);
+    }
+
+    void direct::renderer_release_depth_stencil_state(u32 depth_stencil_state)
+    {
+        release_resource(depth_stencil_state, e_null_res::depth_stencil_state);
+    }
+} // namespace pen
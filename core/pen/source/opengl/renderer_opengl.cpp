@@ -1531,6 +1531,7 @@ namespace pen
             {
                 s_state.vertex_buffer[v] = s_live_state.vertex_buffer[v];
                 s_state.vertex_buffer_stride[v] = s_live_state.vertex_buffer_stride[v];
+                s_state.vertex_buffer_offset[v] = s_live_state.vertex_buffer_offset[v];
 
                 auto& res = _res_pool[s_state.vertex_buffer[v]].handle;
                 CHECK_CALL(glBindBuffer(GL_ARRAY_BUFFER, res));
@@ -1547,6 +1548,7 @@ namespace pen
                     CHECK_CALL(glEnableVertexAttribArray(attribute.location));
 
                     u32 base_vertex_offset = s_state.vertex_buffer_stride[v] * s_state.base_vertex;
+                    base_vertex_offset += s_state.vertex_buffer_offset[v];
 
                     CHECK_CALL(glVertexAttribPointer(attribute.location, attribute.num_elements, attribute.type,
                                                      attribute.type == GL_UNSIGNED_BYTE ? true : false,
@@ -2484,13 +2486,13 @@ namespace pen
         CHECK_CALL(glBindBuffer(res.type, res.handle));
 
 #ifndef PEN_GLES3
-        void* mapped_data = CHECK_CALL(glMapBuffer(res.type, GL_WRITE_ONLY));
+        // map only the range being written and invalidate it, the driver can give the range new storage instead of
+        // preserving its contents. without GL_MAP_UNSYNCHRONIZED_BIT it may still wait for draws reading the buffer
+        void* mapped_data =
+            CHECK_CALL(glMapBufferRange(res.type, offset, data_size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT));
 
         if (mapped_data)
-        {
-            c8* mapped_offset = ((c8*)mapped_data) + offset;
-            memcpy(mapped_offset, data, data_size);
-        }
+            memcpy(mapped_data, data, data_size);
 
         CHECK_CALL(glUnmapBuffer(res.type));
 #else
@@ -26,11 +26,7 @@ pen::resolve_resources             g_resolve_resources;
 
 using namespace pen;
 
-#if PEN_SINGLE_THREADED
-#define add_cmd(cmd) exec_cmd(cmd)
-#else
-#define add_cmd(cmd) _ctx->cmd_buffer.put(cmd)
-#endif
+#define add_cmd(cmd) record_cmd(cmd)
 
 namespace
 {
@@ -92,9 +88,69 @@ namespace
         CMD_PUSH_PERF_MARKER,
         CMD_POP_PERF_MARKER,
         CMD_DISPATCH_COMPUTE,
-        CMD_SET_STENCIL_REF
+        CMD_SET_STENCIL_REF,
+        CMD_COUNT
     };
 
+    const c8* k_cmd_names[] = {"NONE",
+                               "NEW_FRAME",
+                               "CLEAR",
+                               "CLEAR_TEXTURE",
+                               "PRESENT",
+                               "LOAD_SHADER",
+                               "SET_SHADER",
+                               "LINK_SHADER",
+                               "CREATE_INPUT_LAYOUT",
+                               "SET_INPUT_LAYOUT",
+                               "CREATE_BUFFER",
+                               "SET_VERTEX_BUFFER",
+                               "SET_INDEX_BUFFER",
+                               "DRAW",
+                               "DRAW_INDEXED",
+                               "DRAW_INDEXED_INSTANCED",
+                               "CREATE_TEXTURE",
+                               "RELEASE_SHADER",
+                               "RELEASE_BUFFER",
+                               "RELEASE_TEXTURE_2D",
+                               "CREATE_SAMPLER",
+                               "SET_TEXTURE",
+                               "CREATE_RASTER_STATE",
+                               "SET_RASTER_STATE",
+                               "SET_VIEWPORT",
+                               "SET_SCISSOR_RECT",
+                               "SET_VIEWPORT_RATIO",
+                               "SET_SCISSOR_RECT_RATIO",
+                               "RELEASE_RASTER_STATE",
+                               "CREATE_BLEND_STATE",
+                               "SET_BLEND_STATE",
+                               "SET_CONSTANT_BUFFER",
+                               "SET_STRUCTURED_BUFFER",
+                               "UPDATE_BUFFER",
+                               "CREATE_DEPTH_STENCIL_STATE",
+                               "SET_DEPTH_STENCIL_STATE",
+                               "UPDATE_QUERIES",
+                               "CREATE_RENDER_TARGET",
+                               "SET_TARGETS",
+                               "RELEASE_BLEND_STATE",
+                               "RELEASE_RENDER_TARGET",
+                               "RELEASE_INPUT_LAYOUT",
+                               "RELEASE_SAMPLER",
+                               "RELEASE_PROGRAM",
+                               "RELEASE_CLEAR_STATE",
+                               "RELEASE_DEPTH_STENCIL_STATE",
+                               "CREATE_SO_SHADER",
+                               "SET_SO_TARGET",
+                               "RESOLVE_TARGET",
+                               "DRAW_AUTO",
+                               "MAP_RESOURCE",
+                               "REPLACE_RESOURCE",
+                               "CREATE_CLEAR_STATE",
+                               "PUSH_PERF_MARKER",
+                               "POP_PERF_MARKER",
+                               "DISPATCH_COMPUTE",
+                               "SET_STENCIL_REF"};
+    static_assert(PEN_ARRAY_SIZE(k_cmd_names) == CMD_COUNT, "mismatched renderer cmd names");
+
     struct set_shader_cmd
     {
         u32 shader_index;
@@ -239,27 +295,870 @@ namespace
             c8*                              name;
             compute_dispatch_params          cs_dispatch;
             u8                               stencil_ref;
+            u64                              upload_retire_pos;
         };
 
-        renderer_cmd(){};
-    };
+        renderer_cmd(){};
+    };
+
+    // lock-free linear ring for per frame upload data (buffer updates and vertex buffer arrays)
+    // any thread can reserve, memory is recycled when the render thread executes the present of the frame which used it
+    struct upload_arena
+    {
+        u8*    data = nullptr;
+        size_t capacity = 0;
+        a_u64  reserve_pos = {0};
+        a_u64  retire_pos = {0};
+    };
+
+    static const size_t k_upload_arena_size = 32 * 1024 * 1024;
+    static const size_t k_upload_arena_align = 16;
+
+    // lockless single producer single consumer stream of variable length commands.
+    // each command is a small header followed by only the bytes of the renderer_cmd union member it uses,
+    // commands are decoded back into a renderer_cmd on the consumer side.
+    struct cmd_header
+    {
+        u16 command_index;
+        u16 payload_size;
+    };
+
+    struct cmd_stream
+    {
+        u8*   data = nullptr;
+        u32   capacity = 0;
+        a_u32 get_pos = {0};
+        a_u32 put_pos = {0};
+
+        // producer frame stats
+        u32   frame_cmds = 0;
+        u32   frame_bytes = 0;
+        a_u32 last_frame_cmds = {0};
+        a_u32 last_frame_bytes = {0};
+        a_u32 last_frame_dropped = {0};
+    };
+
+    // shadow of the bindings recorded into a stream, so duplicate binds can be dropped before they are written.
+    // commands which may change bindings behind the front end invalidate the whole cache.
+    static const u32 k_bind_cache_units = 32;
+    struct bind_cache
+    {
+        u32             texture_mask = 0;
+        u32             cbuffer_mask = 0;
+        set_texture_cmd texture[k_bind_cache_units];
+        set_buffer_cmd  cbuffer[k_bind_cache_units];
+        u32             dropped = 0;
+    };
+
+    // max_renderer_commands is sized for the average command not the largest
+    static const u32 k_cmd_stream_avg_cmd_size = 32;
+
+    // front end render_ctx
+    struct fe_render_ctx
+    {
+        pen::timer*               present_timer = nullptr;
+        f64                       present_time = 0.0f;
+        pen::resolve_resources    resolve_resources;
+        pen::semaphore*           consume_semaphore = nullptr;
+        pen::semaphore*           continue_semaphore = nullptr;
+        pen::slot_resources       renderer_slot_resources;
+        cmd_stream                cmd_buffer;
+        ring_buffer<renderer_cmd> release_cmd_buffer;
+        pen::timer*               consume_timer = nullptr;
+        f64                       consume_time = 0.0;
+        f64                       consume_time_accum = 0.0;
+        u32*                      free_slots = nullptr;
+        a_s32                     wait;
+        upload_arena              upload;
+        bind_cache                binds;
+        pen::mutex*               resource_mutex = nullptr; // held by threads recording lists to create resources
+    };
+    static fe_render_ctx* _ctx;
+    static render_ctx     _main_ctx;
+
+    bool cmd_has_resource_slot(u32 command_index)
+    {
+        switch (command_index)
+        {
+            case CMD_LOAD_SHADER:
+            case CMD_LINK_SHADER:
+            case CMD_CREATE_INPUT_LAYOUT:
+            case CMD_CREATE_BUFFER:
+            case CMD_CREATE_TEXTURE:
+            case CMD_CREATE_SAMPLER:
+            case CMD_CREATE_RASTER_STATE:
+            case CMD_CREATE_BLEND_STATE:
+            case CMD_CREATE_DEPTH_STENCIL_STATE:
+            case CMD_CREATE_RENDER_TARGET:
+            case CMD_CREATE_CLEAR_STATE:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    void bind_cache_invalidate(bind_cache& bc)
+    {
+        bc.texture_mask = 0;
+        bc.cbuffer_mask = 0;
+    }
+
+    // returns true if the command is redundant and can be dropped
+    bool bind_cache_filter(bind_cache& bc, const renderer_cmd& cmd)
+    {
+        switch (cmd.command_index)
+        {
+            case CMD_SET_TEXTURE:
+            {
+                const set_texture_cmd& st = cmd.set_texture;
+                if (st.unit >= k_bind_cache_units)
+                    return false;
+
+                u32                    bit = 1u << st.unit;
+                const set_texture_cmd& cur = bc.texture[st.unit];
+                if ((bc.texture_mask & bit) && cur.texture_index == st.texture_index &&
+                    cur.sampler_index == st.sampler_index && cur.bind_flags == st.bind_flags)
+                {
+                    bc.dropped++;
+                    return true;
+                }
+
+                bc.texture[st.unit] = st;
+                bc.texture_mask |= bit;
+                return false;
+            }
+
+            case CMD_SET_CONSTANT_BUFFER:
+            {
+                const set_buffer_cmd& sb = cmd.set_buffer;
+                if (sb.unit >= k_bind_cache_units)
+                    return false;
+
+                u32                   bit = 1u << sb.unit;
+                const set_buffer_cmd& cur = bc.cbuffer[sb.unit];
+                if ((bc.cbuffer_mask & bit) && cur.buffer_index == sb.buffer_index && cur.flags == sb.flags)
+                {
+                    bc.dropped++;
+                    return true;
+                }
+
+                bc.cbuffer[sb.unit] = sb;
+                bc.cbuffer_mask |= bit;
+                return false;
+            }
+
+            case CMD_SET_STRUCTURED_BUFFER:
+                // shares units with textures on d3d and with constant buffers on metal
+                if (cmd.set_buffer.unit < k_bind_cache_units)
+                {
+                    bc.texture_mask &= ~(1u << cmd.set_buffer.unit);
+                    bc.cbuffer_mask &= ~(1u << cmd.set_buffer.unit);
+                }
+                return false;
+
+            case CMD_UPDATE_BUFFER:
+                // dynamic buffers can move on update, so they need binding again
+                for (u32 i = 0; i < k_bind_cache_units; ++i)
+                    if ((bc.cbuffer_mask & (1u << i)) && bc.cbuffer[i].buffer_index == cmd.update_buffer.buffer_index)
+                        bc.cbuffer_mask &= ~(1u << i);
+                return false;
+
+            case CMD_NEW_FRAME:
+            case CMD_PRESENT:
+            case CMD_SET_TARGETS:
+            case CMD_CLEAR:
+            case CMD_CLEAR_TEXTURE:
+            case CMD_DISPATCH_COMPUTE:
+            case CMD_RESOLVE_TARGET:
+            case CMD_SET_SO_TARGET:
+            case CMD_MAP_RESOURCE:
+            case CMD_REPLACE_RESOURCE:
+                // backends may start a new pass or bind internally
+                bind_cache_invalidate(bc);
+                return false;
+
+            default:
+                // creation may bind the new resource on some api's
+                if (cmd_has_resource_slot(cmd.command_index))
+                    bind_cache_invalidate(bc);
+                return false;
+        }
+    }
+
+    u32 cmd_payload_size(u32 command_index)
+    {
+        switch (command_index)
+        {
+            case CMD_CLEAR:
+            case CMD_CLEAR_TEXTURE:
+                return sizeof(clear_cmd);
+            case CMD_PRESENT:
+                return sizeof(u64);
+            case CMD_LOAD_SHADER:
+                return sizeof(shader_load_params);
+            case CMD_SET_SHADER:
+                return sizeof(set_shader_cmd);
+            case CMD_LINK_SHADER:
+                return sizeof(shader_link_params);
+            case CMD_CREATE_INPUT_LAYOUT:
+                return sizeof(input_layout_creation_params);
+            case CMD_CREATE_BUFFER:
+                return sizeof(buffer_creation_params);
+            case CMD_SET_VERTEX_BUFFER:
+                return sizeof(set_vertex_buffer_cmd);
+            case CMD_SET_INDEX_BUFFER:
+                return sizeof(set_index_buffer_cmd);
+            case CMD_DRAW:
+                return sizeof(draw_cmd);
+            case CMD_DRAW_INDEXED:
+                return sizeof(draw_indexed_cmd);
+            case CMD_DRAW_INDEXED_INSTANCED:
+                return sizeof(draw_indexed_instanced_cmd);
+            case CMD_CREATE_TEXTURE:
+            case CMD_CREATE_RENDER_TARGET:
+                return sizeof(texture_creation_params);
+            case CMD_CREATE_SAMPLER:
+                return sizeof(sampler_creation_params);
+            case CMD_SET_TEXTURE:
+                return sizeof(set_texture_cmd);
+            case CMD_CREATE_RASTER_STATE:
+                return sizeof(raster_state_creation_params);
+            case CMD_SET_VIEWPORT:
+            case CMD_SET_VIEWPORT_RATIO:
+                return sizeof(viewport);
+            case CMD_SET_SCISSOR_RECT:
+            case CMD_SET_SCISSOR_RECT_RATIO:
+                return sizeof(rect);
+            case CMD_CREATE_BLEND_STATE:
+                return sizeof(blend_creation_params);
+            case CMD_SET_CONSTANT_BUFFER:
+            case CMD_SET_STRUCTURED_BUFFER:
+                return sizeof(set_buffer_cmd);
+            case CMD_UPDATE_BUFFER:
+                return sizeof(update_buffer_cmd);
+            case CMD_CREATE_DEPTH_STENCIL_STATE:
+                return sizeof(depth_stencil_creation_params*);
+            case CMD_SET_TARGETS:
+                return sizeof(set_target_cmd);
+            case CMD_RESOLVE_TARGET:
+                return sizeof(msaa_resolve_params);
+            case CMD_MAP_RESOURCE:
+                return sizeof(resource_read_back_params);
+            case CMD_REPLACE_RESOURCE:
+                return sizeof(replace_resource);
+            case CMD_CREATE_CLEAR_STATE:
+                return sizeof(clear_state);
+            case CMD_PUSH_PERF_MARKER:
+                return sizeof(c8*);
+            case CMD_DISPATCH_COMPUTE:
+                return sizeof(compute_dispatch_params);
+            case CMD_SET_STENCIL_REF:
+                return sizeof(u8);
+            case CMD_RELEASE_SHADER:
+                return sizeof(set_shader_cmd);
+            case CMD_RELEASE_BUFFER:
+            case CMD_RELEASE_TEXTURE_2D:
+            case CMD_RELEASE_RASTER_STATE:
+            case CMD_RELEASE_BLEND_STATE:
+            case CMD_RELEASE_CLEAR_STATE:
+            case CMD_RELEASE_RENDER_TARGET:
+            case CMD_RELEASE_INPUT_LAYOUT:
+            case CMD_RELEASE_SAMPLER:
+            case CMD_RELEASE_DEPTH_STENCIL_STATE:
+            case CMD_SET_INPUT_LAYOUT:
+            case CMD_SET_RASTER_STATE:
+            case CMD_SET_BLEND_STATE:
+            case CMD_SET_DEPTH_STENCIL_STATE:
+            case CMD_SET_SO_TARGET:
+                return sizeof(u32);
+            default:
+                // CMD_NEW_FRAME, CMD_UPDATE_QUERIES, CMD_DRAW_AUTO, CMD_POP_PERF_MARKER
+                return 0;
+        }
+    }
+
+    void cmd_stream_create(cmd_stream& stream, u32 capacity)
+    {
+        stream.data = (u8*)memory_alloc(capacity);
+        stream.capacity = capacity;
+        stream.get_pos = 0;
+        stream.put_pos = 0;
+    }
+
+    u32 cmd_encoded_size(const renderer_cmd& cmd)
+    {
+        u32 size = sizeof(cmd_header) + cmd_payload_size(cmd.command_index);
+        if (cmd_has_resource_slot(cmd.command_index))
+            size += sizeof(u32);
+        return size;
+    }
+
+    void cmd_encode(u8* p, const renderer_cmd& cmd)
+    {
+        cmd_header header = {(u16)cmd.command_index, (u16)cmd_payload_size(cmd.command_index)};
+        memcpy(p, &header, sizeof(cmd_header));
+        p += sizeof(cmd_header);
+
+        if (cmd_has_resource_slot(cmd.command_index))
+        {
+            memcpy(p, &cmd.resource_slot, sizeof(u32));
+            p += sizeof(u32);
+        }
+
+        memcpy(p, &cmd.command_data_index, header.payload_size);
+    }
+
+    // returns the encoded size of the command decoded from p
+    u32 cmd_decode(const u8* p, renderer_cmd& cmd)
+    {
+        cmd_header header;
+        memcpy(&header, p, sizeof(cmd_header));
+        p += sizeof(cmd_header);
+
+        cmd.command_index = header.command_index;
+
+        u32 size = sizeof(cmd_header) + header.payload_size;
+        if (cmd_has_resource_slot(header.command_index))
+        {
+            memcpy(&cmd.resource_slot, p, sizeof(u32));
+            p += sizeof(u32);
+            size += sizeof(u32);
+        }
+
+        memcpy(&cmd.command_data_index, p, header.payload_size);
+        return size;
+    }
+
+    u32 cmd_record_size(const u8* p)
+    {
+        cmd_header header;
+        memcpy(&header, p, sizeof(cmd_header));
+
+        u32 size = sizeof(cmd_header) + header.payload_size;
+        if (cmd_has_resource_slot(header.command_index))
+            size += sizeof(u32);
+        return size;
+    }
+
+    // returns the position to write size bytes contiguously, wrapping to the start when needed
+    u32 cmd_stream_reserve(cmd_stream& stream, u32 size)
+    {
+        u32 pp = stream.put_pos;
+        if (pp + size > stream.capacity)
+        {
+            // not enough room at the end, CMD_NONE marks the consumer to wrap
+            if (pp + sizeof(cmd_header) <= stream.capacity)
+            {
+                cmd_header wrap = {CMD_NONE, 0};
+                memcpy(stream.data + pp, &wrap, sizeof(cmd_header));
+            }
+            pp = 0;
+        }
+        return pp;
+    }
+
+    void cmd_stream_put(cmd_stream& stream, const renderer_cmd& cmd)
+    {
+        u32 size = cmd_encoded_size(cmd);
+        u32 pp = cmd_stream_reserve(stream, size);
+
+        cmd_encode(stream.data + pp, cmd);
+
+        stream.frame_cmds++;
+        stream.frame_bytes += size;
+
+        stream.put_pos = pp + size;
+    }
+
+    // copies already encoded commands, in as few contiguous runs as the wrap allows
+    void cmd_stream_put_encoded(cmd_stream& stream, const u8* data, u32 size, u32 num_cmds)
+    {
+        u32 pos = 0;
+        while (pos < size)
+        {
+            u32 pp = stream.put_pos;
+            u32 run = 0;
+            while (pos + run < size)
+            {
+                u32 rs = cmd_record_size(data + pos + run);
+                if (pp + run + rs > stream.capacity)
+                    break;
+                run += rs;
+            }
+
+            if (run == 0)
+            {
+                // wrap for the next record
+                stream.put_pos = cmd_stream_reserve(stream, cmd_record_size(data + pos));
+                continue;
+            }
+
+            memcpy(stream.data + pp, data + pos, run);
+            stream.put_pos = pp + run;
+            pos += run;
+        }
+
+        stream.frame_cmds += num_cmds;
+        stream.frame_bytes += size;
+    }
+
+    bool cmd_stream_get(cmd_stream& stream, renderer_cmd& cmd)
+    {
+        for (;;)
+        {
+            u32 gp = stream.get_pos;
+            if (gp == stream.put_pos)
+                return false;
+
+            // no room for a header at the end means the producer wrapped
+            if (gp + sizeof(cmd_header) > stream.capacity)
+            {
+                stream.get_pos = 0;
+                continue;
+            }
+
+            cmd_header header;
+            memcpy(&header, stream.data + gp, sizeof(cmd_header));
+            if (header.command_index == CMD_NONE)
+            {
+                stream.get_pos = 0;
+                continue;
+            }
+
+            stream.get_pos = gp + cmd_decode(stream.data + gp, cmd);
+            return true;
+        }
+    }
+
+    // commands recorded on any thread and stitched into the main stream by renderer_submit_cmd_lists
+    struct cmd_list_buffer
+    {
+        u8* data = nullptr;
+        u32 size = 0;
+        u32 capacity = 0;
+        u32 num_cmds = 0;
+
+        bind_cache binds;
+    };
+
+    thread_local cmd_list_buffer* t_cmd_list = nullptr;
+
+    void cmd_list_put(cmd_list_buffer& list, const renderer_cmd& cmd)
+    {
+        u32 size = cmd_encoded_size(cmd);
+        if (list.size + size > list.capacity)
+        {
+            list.capacity = list.capacity * 2 > list.size + size ? list.capacity * 2 : list.size + size;
+            list.data = (u8*)memory_realloc(list.data, list.capacity);
+        }
+
+        cmd_encode(list.data + list.size, cmd);
+        list.size += size;
+        list.num_cmds++;
+    }
+
+    void* upload_arena_reserve(upload_arena& arena, size_t size)
+    {
+        size_t aligned = PEN_ALIGN(size, k_upload_arena_align);
+        if (aligned > arena.capacity)
+            return nullptr;
+
+        for (;;)
+        {
+            u64 end = (arena.reserve_pos += aligned);
+            u64 pos = end - aligned;
+
+            // full, the skipped space is reclaimed when the frame retires
+            if (end - arena.retire_pos > arena.capacity)
+                return nullptr;
+
+            // allocations must be contiguous, skip to the start if we straddle the end
+            size_t offset = pos % arena.capacity;
+            if (offset + size > arena.capacity)
+                continue;
+
+            return arena.data + offset;
+        }
+    }
+
+    bool upload_arena_owns(const upload_arena& arena, const void* mem)
+    {
+        const u8* p = (const u8*)mem;
+        return p >= arena.data && p < arena.data + arena.capacity;
+    }
+
+    // falls back to the heap when the arena is full so callers never fail
+    void* upload_alloc(size_t size)
+    {
+        void* mem = upload_arena_reserve(_ctx->upload, size);
+        if (!mem)
+            mem = memory_alloc(size);
+
+        return mem;
+    }
+
+    void upload_free(void* mem)
+    {
+        if (!upload_arena_owns(_ctx->upload, mem))
+            memory_free(mem);
+    }
+
+    // command stream capture, each record is the packed command followed by the data its pointers reference
+    static const u32 k_capture_magic = 0x43524d50; // PMRC
+    static const u32 k_capture_version = 1;
+
+    namespace e_capture_record
+    {
+        enum capture_record_t
+        {
+            cmd,
+            release
+        };
+    }
+
+    struct capture_blob
+    {
+        u8* data = nullptr;
+        u32 size = 0;
+        u32 capacity = 0;
+    };
+
+    struct capture_header
+    {
+        u32 magic;
+        u32 version;
+        u32 num_frames;
+        u32 max_resource_slot;
+    };
+
+    struct cmd_capture
+    {
+        std::ofstream  file;
+        capture_header header;
+        capture_blob   record;
+        u32            frames_remaining = 0;
+        bool           pending = false;
+        bool           active = false;
+    };
+    cmd_capture s_capture;
+
+    struct capture_reader
+    {
+        u8* data = nullptr;
+        u32 size = 0;
+        u32 pos = 0;
+    };
+
+    struct cmd_replay
+    {
+        capture_reader reader;
+        capture_header header;
+    };
+    cmd_replay s_replay;
+
+    // per command type exec timings, accumulated on the render thread
+    struct cmd_timings
+    {
+        a_u32       enabled = {0};
+        pen::timer* timer = nullptr;
+        f64         ms[CMD_COUNT] = {0};
+        u32         count[CMD_COUNT] = {0};
+    };
+    cmd_timings s_cmd_timings;
+
+    void* blob_reserve(capture_blob& blob, u32 size)
+    {
+        if (blob.size + size > blob.capacity)
+        {
+            blob.capacity = blob.capacity * 2 > blob.size + size ? blob.capacity * 2 : blob.size + size;
+            blob.data = (u8*)memory_realloc(blob.data, blob.capacity);
+        }
+
+        void* p = blob.data + blob.size;
+        blob.size += size;
+        return p;
+    }
+
+    void blob_write(capture_blob& blob, const void* data, u32 size)
+    {
+        memcpy(blob_reserve(blob, size), data, size);
+    }
+
+    void blob_write_u32(capture_blob& blob, u32 value)
+    {
+        blob_write(blob, &value, sizeof(u32));
+    }
+
+    // optional data is prefixed with a present flag
+    void blob_write_optional(capture_blob& blob, const void* data, u32 size)
+    {
+        blob_write_u32(blob, data ? 1 : 0);
+        if (data)
+            blob_write(blob, data, size);
+    }
+
+    // strings are written null terminated so replay can point straight into the loaded file
+    void blob_write_string(capture_blob& blob, const c8* str)
+    {
+        u32 len = str ? (u32)strlen(str) : 0;
+        blob_write_u32(blob, len + 1);
+        blob_write(blob, str, len);
+        blob_write(blob, "", 1);
+    }
+
+    void reader_read(capture_reader& reader, void* dst, u32 size)
+    {
+        PEN_ASSERT(reader.pos + size <= reader.size);
+        memcpy(dst, reader.data + reader.pos, size);
+        reader.pos += size;
+    }
+
+    u32 reader_read_u32(capture_reader& reader)
+    {
+        u32 value;
+        reader_read(reader, &value, sizeof(u32));
+        return value;
+    }
+
+    void* reader_read_alloc(capture_reader& reader, u32 size)
+    {
+        void* mem = memory_alloc(size);
+        reader_read(reader, mem, size);
+        return mem;
+    }
+
+    void* reader_read_optional(capture_reader& reader, u32 size)
+    {
+        if (!reader_read_u32(reader))
+            return nullptr;
+
+        return reader_read_alloc(reader, size);
+    }
+
+    c8* reader_read_string(capture_reader& reader)
+    {
+        u32 size = reader_read_u32(reader);
+        PEN_ASSERT(reader.pos + size <= reader.size);
+        c8* str = (c8*)reader.data + reader.pos;
+        reader.pos += size;
+        return str;
+    }
+
+    // for strings the render thread frees after use
+    c8* reader_alloc_string(capture_reader& reader)
+    {
+        u32 size = reader_read_u32(reader);
+        return (c8*)reader_read_alloc(reader, size);
+    }
+
+    // writes everything the commands pointers reference, the replay mirrors this in capture_read_cmd_data
+    void capture_write_cmd_data(capture_blob& blob, const renderer_cmd& cmd)
+    {
+        switch (cmd.command_index)
+        {
+            case CMD_LOAD_SHADER:
+            {
+                const shader_load_params& slp = cmd.shader_load;
+                blob_write_optional(blob, slp.byte_code, slp.byte_code_size);
+
+                u32 num_so = slp.so_decl_entries ? slp.so_num_entries : 0;
+                blob_write_u32(blob, num_so);
+                blob_write(blob, slp.so_decl_entries, sizeof(stream_out_decl_entry) * num_so);
+                for (u32 i = 0; i < num_so; ++i)
+                    blob_write_string(blob, slp.so_decl_entries[i].semantic_name);
+            }
+            break;
+
+            case CMD_LINK_SHADER:
+            {
+                const shader_link_params& slp = cmd.link_params;
+                blob_write(blob, slp.constants, sizeof(constant_layout_desc) * slp.num_constants);
+                for (u32 i = 0; i < slp.num_constants; ++i)
+                    blob_write_string(blob, slp.constants[i].name);
+
+                u32 num_so = slp.stream_out_names ? slp.num_stream_out_names : 0;
+                blob_write_u32(blob, num_so);
+                for (u32 i = 0; i < num_so; ++i)
+                    blob_write_string(blob, slp.stream_out_names[i]);
+            }
+            break;
+
+            case CMD_CREATE_INPUT_LAYOUT:
+            {
+                const input_layout_creation_params& ilp = cmd.create_input_layout;
+                blob_write(blob, ilp.vs_byte_code, ilp.vs_byte_code_size);
+                blob_write(blob, ilp.input_layout, sizeof(input_layout_desc) * ilp.num_elements);
+                for (u32 i = 0; i < ilp.num_elements; ++i)
+                    blob_write_string(blob, ilp.input_layout[i].semantic_name);
+            }
+            break;
+
+            case CMD_CREATE_BUFFER:
+                blob_write_optional(blob, cmd.create_buffer.data, cmd.create_buffer.buffer_size);
+                break;
+
+            case CMD_CREATE_TEXTURE:
+                blob_write_optional(blob, cmd.create_texture.data, cmd.create_texture.data_size);
+                break;
+
+            case CMD_CREATE_BLEND_STATE:
+                blob_write(blob, cmd.create_blend_state.render_targets,
+                           sizeof(render_target_blend) * cmd.create_blend_state.num_render_targets);
+                break;
+
+            case CMD_CREATE_DEPTH_STENCIL_STATE:
+                blob_write(blob, cmd.p_create_depth_stencil_state, sizeof(depth_stencil_creation_params));
+                break;
+
+            case CMD_SET_VERTEX_BUFFER:
+            {
+                const set_vertex_buffer_cmd& svb = cmd.set_vertex_buffer;
+                blob_write(blob, svb.buffer_indices, sizeof(u32) * svb.num_buffers);
+                blob_write(blob, svb.strides, sizeof(u32) * svb.num_buffers);
+                blob_write(blob, svb.offsets, sizeof(u32) * svb.num_buffers);
+            }
+            break;
+
+            case CMD_UPDATE_BUFFER:
+                blob_write(blob, cmd.update_buffer.data, cmd.update_buffer.data_size);
+                break;
+
+            case CMD_PUSH_PERF_MARKER:
+                blob_write_string(blob, cmd.name);
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    // allocates the commands pointer data the same way the public api does, so exec_cmd can free it as normal
+    void capture_read_cmd_data(capture_reader& reader, renderer_cmd& cmd)
+    {
+        switch (cmd.command_index)
+        {
+            case CMD_LOAD_SHADER:
+            {
+                shader_load_params& slp = cmd.shader_load;
+                slp.byte_code = reader_read_optional(reader, slp.byte_code_size);
+
+                u32 num_so = reader_read_u32(reader);
+                slp.so_decl_entries = nullptr;
+                if (num_so)
+                {
+                    slp.so_decl_entries =
+                        (stream_out_decl_entry*)reader_read_alloc(reader, sizeof(stream_out_decl_entry) * num_so);
+                    for (u32 i = 0; i < num_so; ++i)
+                        slp.so_decl_entries[i].semantic_name = reader_read_string(reader);
+                }
+            }
+            break;
+
+            case CMD_LINK_SHADER:
+            {
+                shader_link_params& slp = cmd.link_params;
+                slp.constants =
+                    (constant_layout_desc*)reader_read_alloc(reader, sizeof(constant_layout_desc) * slp.num_constants);
+                for (u32 i = 0; i < slp.num_constants; ++i)
+                    slp.constants[i].name = reader_alloc_string(reader);
+
+                u32 num_so = reader_read_u32(reader);
+                slp.stream_out_names = nullptr;
+                if (num_so)
+                {
+                    slp.stream_out_names = (c8**)memory_alloc(sizeof(c8*) * num_so);
+                    for (u32 i = 0; i < num_so; ++i)
+                        slp.stream_out_names[i] = reader_alloc_string(reader);
+                }
+            }
+            break;
+
+            case CMD_CREATE_INPUT_LAYOUT:
+            {
+                input_layout_creation_params& ilp = cmd.create_input_layout;
+                ilp.vs_byte_code = reader_read_alloc(reader, ilp.vs_byte_code_size);
+                ilp.input_layout =
+                    (input_layout_desc*)reader_read_alloc(reader, sizeof(input_layout_desc) * ilp.num_elements);
+                for (u32 i = 0; i < ilp.num_elements; ++i)
+                    ilp.input_layout[i].semantic_name = reader_read_string(reader);
+            }
+            break;
+
+            case CMD_CREATE_BUFFER:
+                cmd.create_buffer.data = reader_read_optional(reader, cmd.create_buffer.buffer_size);
+                break;
+
+            case CMD_CREATE_TEXTURE:
+                cmd.create_texture.data = reader_read_optional(reader, cmd.create_texture.data_size);
+                break;
+
+            case CMD_CREATE_BLEND_STATE:
+                cmd.create_blend_state.render_targets = (render_target_blend*)reader_read_alloc(
+                    reader, sizeof(render_target_blend) * cmd.create_blend_state.num_render_targets);
+                break;
 
-    // front end render_ctx
-    struct fe_render_ctx
+            case CMD_CREATE_DEPTH_STENCIL_STATE:
+                cmd.p_create_depth_stencil_state =
+                    (depth_stencil_creation_params*)reader_read_alloc(reader, sizeof(depth_stencil_creation_params));
+                break;
+
+            case CMD_SET_VERTEX_BUFFER:
+            {
+                set_vertex_buffer_cmd& svb = cmd.set_vertex_buffer;
+                u32*                   mem = (u32*)upload_alloc(sizeof(u32) * svb.num_buffers * 3);
+                reader_read(reader, mem, sizeof(u32) * svb.num_buffers * 3);
+                svb.buffer_indices = mem;
+                svb.strides = mem + svb.num_buffers;
+                svb.offsets = mem + svb.num_buffers * 2;
+            }
+            break;
+
+            case CMD_UPDATE_BUFFER:
+                cmd.update_buffer.data = upload_alloc(cmd.update_buffer.data_size);
+                reader_read(reader, cmd.update_buffer.data, cmd.update_buffer.data_size);
+                break;
+
+            case CMD_PUSH_PERF_MARKER:
+                cmd.name = reader_read_string(reader);
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    void capture_cmd(const renderer_cmd& cmd, u32 record_type)
     {
-        pen::timer*               present_timer = nullptr;
-        f64                       present_time = 0.0f;
-        pen::resolve_resources    resolve_resources;
-        pen::semaphore*           consume_semaphore = nullptr;
-        pen::semaphore*           continue_semaphore = nullptr;
-        pen::slot_resources       renderer_slot_resources;
-        ring_buffer<renderer_cmd> cmd_buffer;
-        ring_buffer<renderer_cmd> release_cmd_buffer;
-        u32*                      free_slots = nullptr;
-        a_s32                     wait;
-    };
-    static fe_render_ctx* _ctx;
-    static render_ctx     _main_ctx;
+        capture_blob& blob = s_capture.record;
+        blob.size = 0;
+
+        u32 encoded_size = cmd_encoded_size(cmd);
+        blob_write_u32(blob, record_type);
+        blob_write_u32(blob, encoded_size);
+        cmd_encode((u8*)blob_reserve(blob, encoded_size), cmd);
+
+        // release commands carry their handle outside of the packed command
+        if (record_type == e_capture_record::release)
+            blob_write_u32(blob, cmd.resource_slot);
+
+        capture_write_cmd_data(blob, cmd);
+
+        if (cmd_has_resource_slot(cmd.command_index) && cmd.resource_slot > s_capture.header.max_resource_slot)
+            s_capture.header.max_resource_slot = cmd.resource_slot;
+
+        s_capture.file.write((const c8*)blob.data, blob.size);
+    }
+
+    void capture_end()
+    {
+        // patch the header with the final frame count
+        s_capture.file.seekp(0);
+        s_capture.file.write((const c8*)&s_capture.header, sizeof(capture_header));
+        s_capture.file.close();
+        s_capture.active = false;
+
+        PEN_LOG("renderer capture complete: %i frames", s_capture.header.num_frames);
+    }
 
 } // namespace
 
@@ -276,7 +1175,16 @@ namespace pen
         gpu_ms = (f64)g_gpu_total / 1000.0 / 1000.0;
     }
 
-    void exec_cmd(const renderer_cmd& cmd)
+    void renderer_get_cmd_stats(renderer_cmd_stats& stats)
+    {
+        stats.num_cmds = _ctx->cmd_buffer.last_frame_cmds;
+        stats.packed_bytes = _ctx->cmd_buffer.last_frame_bytes;
+        stats.fixed_bytes = stats.num_cmds * sizeof(renderer_cmd);
+        stats.consume_ms = _ctx->consume_time;
+        stats.dropped_cmds = _ctx->cmd_buffer.last_frame_dropped;
+    }
+
+    void exec_cmd_internal(const renderer_cmd& cmd)
     {
         //PEN_LOG("CMD %i", cmd.command_index);
 
@@ -293,6 +1201,9 @@ namespace pen
                 break;
             case CMD_PRESENT:
                 direct::renderer_present();
+                _ctx->upload.retire_pos = cmd.upload_retire_pos;
+                _ctx->consume_time = _ctx->consume_time_accum + timer_elapsed_ms(_ctx->consume_timer);
+                _ctx->consume_time_accum = 0.0;
                 end_frame_internal();
                 _ctx->present_time = timer_elapsed_ms(_ctx->present_timer);
                 timer_start(_ctx->present_timer);
@@ -338,9 +1249,7 @@ namespace pen
                 direct::renderer_set_vertex_buffers(cmd.set_vertex_buffer.buffer_indices, cmd.set_vertex_buffer.num_buffers,
                                                     cmd.set_vertex_buffer.start_slot, cmd.set_vertex_buffer.strides,
                                                     cmd.set_vertex_buffer.offsets);
-                memory_free(cmd.set_vertex_buffer.buffer_indices);
-                memory_free(cmd.set_vertex_buffer.strides);
-                memory_free(cmd.set_vertex_buffer.offsets);
+                upload_free(cmd.set_vertex_buffer.buffer_indices);
                 break;
 
             case CMD_SET_INDEX_BUFFER:
@@ -440,7 +1349,7 @@ namespace pen
             case CMD_UPDATE_BUFFER:
                 direct::renderer_update_buffer(cmd.update_buffer.buffer_index, cmd.update_buffer.data,
                                                cmd.update_buffer.data_size, cmd.update_buffer.offset);
-                memory_free(cmd.update_buffer.data);
+                upload_free(cmd.update_buffer.data);
                 break;
 
             case CMD_CREATE_DEPTH_STENCIL_STATE:
@@ -533,6 +1442,21 @@ namespace pen
         }
     }
 
+    void exec_cmd(const renderer_cmd& cmd)
+    {
+        if (!s_cmd_timings.enabled)
+        {
+            exec_cmd_internal(cmd);
+            return;
+        }
+
+        u32 ci = cmd.command_index;
+        timer_start(s_cmd_timings.timer);
+        exec_cmd_internal(cmd);
+        s_cmd_timings.ms[ci] += timer_elapsed_ms(s_cmd_timings.timer);
+        s_cmd_timings.count[ci]++;
+    }
+
     //
     //
     //
@@ -560,21 +1484,103 @@ namespace pen
 #endif
     }
 
+    // while lists are recorded the slots, the main stream and the release buffer are shared by the recording threads
+    void lock_resources()
+    {
+        if (t_cmd_list)
+            mutex_lock(_ctx->resource_mutex);
+    }
+
+    void unlock_resources()
+    {
+        if (t_cmd_list)
+            mutex_unlock(_ctx->resource_mutex);
+    }
+
+    u32 next_resource_slot()
+    {
+        lock_resources();
+        u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
+        unlock_resources();
+
+        return resource_slot;
+    }
+
+    void put_cmd(const renderer_cmd& cmd)
+    {
+        if (s_capture.active)
+            capture_cmd(cmd, e_capture_record::cmd);
+
+#if PEN_SINGLE_THREADED
+        exec_cmd(cmd);
+#else
+        cmd_stream_put(_ctx->cmd_buffer, cmd);
+#endif
+    }
+
+    void record_cmd(const renderer_cmd& cmd)
+    {
+        if (t_cmd_list)
+        {
+            // resources are created in the main stream ahead of every list, so any list may use them
+            if (cmd_has_resource_slot(cmd.command_index))
+            {
+                lock_resources();
+                put_cmd(cmd);
+                unlock_resources();
+                return;
+            }
+
+            if (!bind_cache_filter(t_cmd_list->binds, cmd))
+                cmd_list_put(*t_cmd_list, cmd);
+            return;
+        }
+
+        if (bind_cache_filter(_ctx->binds, cmd))
+            return;
+
+        put_cmd(cmd);
+    }
+
+    void add_release_cmd(const renderer_cmd& cmd)
+    {
+        lock_resources();
+
+        if (s_capture.active)
+            capture_cmd(cmd, e_capture_record::release);
+
+        _ctx->release_cmd_buffer.put(cmd);
+
+        unlock_resources();
+    }
+
     void renderer_consume_cmd_buffer_non_blocking()
     {
+        renderer_cmd cmd;
+        while (cmd_stream_get(_ctx->cmd_buffer, cmd))
+            exec_cmd(cmd);
+    }
+
+    bool consume_cmd_buffer_until_present()
+    {
+        renderer_cmd cmd;
+        if (!cmd_stream_get(_ctx->cmd_buffer, cmd))
+            return false;
+
+        timer_start(_ctx->consume_timer);
         for (;;)
         {
-            renderer_cmd* cmd = _ctx->cmd_buffer.check();
-            if(cmd) {
-                cmd = _ctx->cmd_buffer.get();
-                if (cmd)
-                    exec_cmd(*cmd);
-            }
-            else
-            {
+            // present publishes the consume time for the frame
+            exec_cmd(cmd);
+            if (cmd.command_index == CMD_PRESENT)
+                return true;
+
+            if (!cmd_stream_get(_ctx->cmd_buffer, cmd))
                 break;
-            }
         }
+
+        _ctx->consume_time_accum += timer_elapsed_ms(_ctx->consume_timer);
+        return true;
     }
 
     void new_frame_internal()
@@ -626,18 +1632,8 @@ namespace pen
 
         for (;;)
         {
-            renderer_cmd* cmd = _ctx->cmd_buffer.get();
-
-            while (cmd)
-            {
-                exec_cmd(*cmd);
-
-                // break at present to re-call os update
-                if (cmd->command_index == CMD_PRESENT)
-                    break;
-
-                cmd = _ctx->cmd_buffer.get();
-            }
+            // breaks at present to re-call os update
+            consume_cmd_buffer_until_present();
 
             if (!pen::os_update())
                 break;
@@ -649,18 +1645,8 @@ namespace pen
         // this function is invoked from mtk draw in view
         //if we start renderin  we need to wait for present to prevent command buffer being released before ending encoding
 
-        renderer_cmd* cmd = _ctx->cmd_buffer.get();
-        bool          started = cmd;
-        while (cmd)
-        {
-            exec_cmd(*cmd);
-
-            // break at present to re-call os update
-            if (cmd->command_index == CMD_PRESENT)
-                break;
-
-            cmd = _ctx->cmd_buffer.get();
-        }
+        // breaks at present to re-call os update
+        bool started = consume_cmd_buffer_until_present();
 
         direct::renderer_retain();
         return started;
@@ -730,14 +1716,18 @@ namespace pen
     render_ctx renderer_create_context(u32 max_commands)
     {
         fe_render_ctx* new_ctx = new fe_render_ctx();
-        new_ctx->cmd_buffer.create(max_commands);
+        cmd_stream_create(new_ctx->cmd_buffer, max_commands * k_cmd_stream_avg_cmd_size);
         new_ctx->release_cmd_buffer.create(1024);
         new_ctx->present_timer = timer_create();
+        new_ctx->consume_timer = timer_create();
         timer_start(new_ctx->present_timer);
         new_ctx->present_time = 0.0f;
         new_ctx->consume_semaphore = semaphore_create(0, 1);
         new_ctx->continue_semaphore = semaphore_create(0, 1);
+        new_ctx->upload.data = (u8*)memory_alloc_align(k_upload_arena_size, k_upload_arena_align);
+        new_ctx->upload.capacity = k_upload_arena_size;
         slot_resources_init(&new_ctx->renderer_slot_resources, 2048);
+        new_ctx->resource_mutex = mutex_create();
 
         return (render_ctx*)new_ctx;
     }
@@ -760,6 +1750,13 @@ namespace pen
 
         init_resolve_resources(_ctx);
 
+        // a capture requested before init starts here so it contains every resource the app creates
+        if (s_capture.pending)
+        {
+            s_capture.pending = false;
+            s_capture.active = true;
+        }
+
         if (wait_for_jobs)
             renderer_wait_for_jobs();
     }
@@ -947,13 +1944,235 @@ namespace pen
         add_cmd(cmd);
     }
 
+    cmd_list renderer_create_cmd_list()
+    {
+        return (cmd_list) new cmd_list_buffer();
+    }
+
+    void renderer_release_cmd_list(cmd_list list)
+    {
+        cmd_list_buffer* clb = (cmd_list_buffer*)list;
+        memory_free(clb->data);
+        delete clb;
+    }
+
+    void renderer_begin_cmd_list(cmd_list list)
+    {
+        PEN_ASSERT(!t_cmd_list);
+        t_cmd_list = (cmd_list_buffer*)list;
+
+        // state at the point the list is stitched in is unknown
+        bind_cache_invalidate(t_cmd_list->binds);
+    }
+
+    void renderer_end_cmd_list()
+    {
+        PEN_ASSERT(t_cmd_list);
+        t_cmd_list = nullptr;
+    }
+
+    bool renderer_recording_cmd_list()
+    {
+        return t_cmd_list != nullptr;
+    }
+
+    void renderer_submit_cmd_lists(const cmd_list* lists, u32 num_lists)
+    {
+        PEN_ASSERT(!t_cmd_list);
+
+        for (u32 i = 0; i < num_lists; ++i)
+        {
+            cmd_list_buffer* clb = (cmd_list_buffer*)lists[i];
+
+#if PEN_SINGLE_THREADED
+            renderer_cmd cmd;
+            for (u32 pos = 0; pos < clb->size;)
+            {
+                pos += cmd_decode(clb->data + pos, cmd);
+                if (s_capture.active)
+                    capture_cmd(cmd, e_capture_record::cmd);
+                exec_cmd(cmd);
+            }
+#else
+            if (s_capture.active)
+            {
+                renderer_cmd cmd;
+                for (u32 pos = 0; pos < clb->size;)
+                {
+                    pos += cmd_decode(clb->data + pos, cmd);
+                    capture_cmd(cmd, e_capture_record::cmd);
+                }
+            }
+
+            cmd_stream_put_encoded(_ctx->cmd_buffer, clb->data, clb->size, clb->num_cmds);
+#endif
+            clb->size = 0;
+            clb->num_cmds = 0;
+
+            _ctx->binds.dropped += clb->binds.dropped;
+            clb->binds.dropped = 0;
+        }
+
+        // lists leave the bindings in whatever state they last set
+        bind_cache_invalidate(_ctx->binds);
+    }
+
     void renderer_present()
     {
+        PEN_ASSERT(!t_cmd_list);
+
         pen::renderer_test_run();
 
         renderer_cmd cmd;
         cmd.command_index = CMD_PRESENT;
+        cmd.upload_retire_pos = _ctx->upload.reserve_pos;
         add_cmd(cmd);
+
+        cmd_stream& stream = _ctx->cmd_buffer;
+        stream.last_frame_cmds = stream.frame_cmds;
+        stream.last_frame_bytes = stream.frame_bytes;
+        stream.last_frame_dropped = _ctx->binds.dropped;
+        stream.frame_cmds = 0;
+        stream.frame_bytes = 0;
+        _ctx->binds.dropped = 0;
+
+        if (s_capture.active)
+        {
+            s_capture.header.num_frames++;
+            if (--s_capture.frames_remaining == 0)
+                capture_end();
+        }
+    }
+
+    bool renderer_capture_begin(const c8* filename, u32 num_frames)
+    {
+        PEN_ASSERT(!s_capture.active && !s_capture.pending);
+
+        s_capture.file.open(filename, std::ios::binary);
+        if (!s_capture.file.is_open())
+        {
+            PEN_LOG("renderer capture failed to open %s", filename);
+            return false;
+        }
+
+        s_capture.header.magic = k_capture_magic;
+        s_capture.header.version = k_capture_version;
+        s_capture.header.num_frames = 0;
+        s_capture.header.max_resource_slot = 0;
+        s_capture.frames_remaining = num_frames;
+        s_capture.file.write((const c8*)&s_capture.header, sizeof(capture_header));
+
+        // before init we wait so the capture contains all resource creation
+        if (_ctx)
+            s_capture.active = true;
+        else
+            s_capture.pending = true;
+
+        return true;
+    }
+
+    u32 renderer_replay_load(const c8* filename)
+    {
+        renderer_replay_unload();
+
+        capture_reader& reader = s_replay.reader;
+        if (filesystem_read_file_to_buffer(filename, (void**)&reader.data, reader.size) != PEN_ERR_OK)
+        {
+            PEN_LOG("renderer replay failed to open %s", filename);
+            return 0;
+        }
+
+        reader_read(reader, &s_replay.header, sizeof(capture_header));
+        if (s_replay.header.magic != k_capture_magic || s_replay.header.version != k_capture_version)
+        {
+            PEN_LOG("renderer replay %s is not a compatible capture", filename);
+            renderer_replay_unload();
+            return 0;
+        }
+
+        // the capture owns the slots it created, take them so nothing else allocates over them
+        while (slot_resources_get_next(&_ctx->renderer_slot_resources) < s_replay.header.max_resource_slot)
+            ;
+
+        return s_replay.header.num_frames;
+    }
+
+    bool renderer_replay_frame()
+    {
+        capture_reader& reader = s_replay.reader;
+        while (reader.pos < reader.size)
+        {
+            u32 record_type = reader_read_u32(reader);
+            u32 encoded_size = reader_read_u32(reader);
+
+            renderer_cmd cmd;
+            cmd_decode(reader.data + reader.pos, cmd);
+            reader.pos += encoded_size;
+
+            if (record_type == e_capture_record::release)
+            {
+                cmd.resource_slot = reader_read_u32(reader);
+                cmd.frame_index = _renderer_frame_index();
+                _ctx->release_cmd_buffer.put(cmd);
+                continue;
+            }
+
+            capture_read_cmd_data(reader, cmd);
+
+            switch (cmd.command_index)
+            {
+                case CMD_PRESENT:
+                    // re-issue so the upload arena retire position is for this run
+                    renderer_present();
+                    return true;
+                case CMD_MAP_RESOURCE:
+                    // call back and user data are pointers into the captured process
+                    break;
+                default:
+                    record_cmd(cmd);
+                    break;
+            }
+        }
+
+        return false;
+    }
+
+    void renderer_replay_unload()
+    {
+        // strings referenced by in flight commands point into the file data
+        memory_free(s_replay.reader.data);
+        s_replay.reader = capture_reader();
+    }
+
+    void renderer_enable_cmd_timings(bool enable)
+    {
+        if (!s_cmd_timings.timer)
+            s_cmd_timings.timer = timer_create();
+
+        if (enable)
+        {
+            memset(s_cmd_timings.ms, 0x0, sizeof(s_cmd_timings.ms));
+            memset(s_cmd_timings.count, 0x0, sizeof(s_cmd_timings.count));
+        }
+
+        s_cmd_timings.enabled = enable ? 1 : 0;
+    }
+
+    u32 renderer_get_cmd_timings(renderer_cmd_timing* timings, u32 max_timings)
+    {
+        u32 n = 0;
+        for (u32 i = 0; i < CMD_COUNT && n < max_timings; ++i)
+        {
+            if (!s_cmd_timings.count[i])
+                continue;
+
+            timings[n].name = k_cmd_names[i];
+            timings[n].count = s_cmd_timings.count[i];
+            timings[n].total_ms = s_cmd_timings.ms[i];
+            ++n;
+        }
+
+        return n;
     }
 
     u32 renderer_load_shader(const shader_load_params& params)
@@ -982,7 +2201,7 @@ namespace pen
             memcpy(cmd.shader_load.so_decl_entries, params.so_decl_entries, entries_size);
         }
 
-        u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
+        u32 resource_slot = next_resource_slot();
         cmd.resource_slot = resource_slot;
 
         add_cmd(cmd);
@@ -1032,7 +2251,7 @@ namespace pen
             }
         }
 
-        u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
+        u32 resource_slot = next_resource_slot();
         cmd.resource_slot = resource_slot;
 
         add_cmd(cmd);
@@ -1072,7 +2291,7 @@ namespace pen
 
         memcpy(cmd.create_input_layout.input_layout, params.input_layout, input_layouts_size);
 
-        u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
+        u32 resource_slot = next_resource_slot();
         cmd.resource_slot = resource_slot;
 
         add_cmd(cmd);
@@ -1104,7 +2323,7 @@ namespace pen
             memcpy(cmd.create_buffer.data, params.data, params.buffer_size);
         }
 
-        u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
+        u32 resource_slot = next_resource_slot();
         cmd.resource_slot = resource_slot;
 
         add_cmd(cmd);
@@ -1127,9 +2346,11 @@ namespace pen
         cmd.set_vertex_buffer.start_slot = start_slot;
         cmd.set_vertex_buffer.num_buffers = num_buffers;
 
-        cmd.set_vertex_buffer.buffer_indices = (u32*)memory_alloc(sizeof(u32) * num_buffers);
-        cmd.set_vertex_buffer.strides = (u32*)memory_alloc(sizeof(u32) * num_buffers);
-        cmd.set_vertex_buffer.offsets = (u32*)memory_alloc(sizeof(u32) * num_buffers);
+        // single allocation for all 3 arrays
+        u32* mem = (u32*)upload_alloc(sizeof(u32) * num_buffers * 3);
+        cmd.set_vertex_buffer.buffer_indices = mem;
+        cmd.set_vertex_buffer.strides = mem + num_buffers;
+        cmd.set_vertex_buffer.offsets = mem + num_buffers * 2;
 
         for (u32 i = 0; i < num_buffers; ++i)
         {
@@ -1208,7 +2429,7 @@ namespace pen
 
         memcpy(&cmd.create_render_target, (void*)&tcp, sizeof(texture_creation_params));
 
-        u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
+        u32 resource_slot = next_resource_slot();
         cmd.resource_slot = resource_slot;
 
         add_cmd(cmd);
@@ -1247,7 +2468,7 @@ namespace pen
             cmd.create_texture.data = nullptr;
         }
 
-        u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
+        u32 resource_slot = next_resource_slot();
         cmd.resource_slot = resource_slot;
 
         add_cmd(cmd);
@@ -1263,7 +2484,7 @@ namespace pen
 
         memcpy(&cmd.create_sampler, (void*)&scp, sizeof(sampler_creation_params));
 
-        u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
+        u32 resource_slot = next_resource_slot();
         cmd.resource_slot = resource_slot;
 
         add_cmd(cmd);
@@ -1293,7 +2514,7 @@ namespace pen
 
         memcpy(&cmd.create_raster_state, (void*)&rscp, sizeof(raster_state_creation_params));
 
-        u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
+        u32 resource_slot = next_resource_slot();
         cmd.resource_slot = resource_slot;
 
         add_cmd(cmd);
@@ -1359,7 +2580,7 @@ namespace pen
 
         memcpy(cmd.create_blend_state.render_targets, (void*)bcp.render_targets, render_target_modes_size);
 
-        u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
+        u32 resource_slot = next_resource_slot();
         cmd.resource_slot = resource_slot;
 
         add_cmd(cmd);
@@ -1416,12 +2637,37 @@ namespace pen
         cmd.update_buffer.buffer_index = buffer_index;
         cmd.update_buffer.data_size = data_size;
         cmd.update_buffer.offset = offset;
-        cmd.update_buffer.data = memory_alloc(data_size);
+        cmd.update_buffer.data = upload_alloc(data_size);
         memcpy(cmd.update_buffer.data, data, data_size);
 
         add_cmd(cmd);
     }
 
+    void* renderer_reserve_buffer_update(u32 data_size)
+    {
+        return upload_alloc(data_size);
+    }
+
+    void renderer_submit_buffer_update(u32 buffer_index, void* data, u32 data_size, u32 offset)
+    {
+        renderer_cmd cmd;
+
+        if (buffer_index == 0)
+        {
+            upload_free(data);
+            return;
+        }
+
+        cmd.command_index = CMD_UPDATE_BUFFER;
+
+        cmd.update_buffer.buffer_index = buffer_index;
+        cmd.update_buffer.data_size = data_size;
+        cmd.update_buffer.offset = offset;
+        cmd.update_buffer.data = data;
+
+        add_cmd(cmd);
+    }
+
     u32 renderer_create_depth_stencil_state(const depth_stencil_creation_params& dscp)
     {
         renderer_cmd cmd;
@@ -1433,7 +2679,7 @@ namespace pen
 
         memcpy(cmd.p_create_depth_stencil_state, &dscp, sizeof(depth_stencil_creation_params));
 
-        u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
+        u32 resource_slot = next_resource_slot();
         cmd.resource_slot = resource_slot;
 
         add_cmd(cmd);
@@ -1488,7 +2734,7 @@ namespace pen
         cmd.set_shader.shader_index = shader_index;
         cmd.set_shader.shader_type = shader_type;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_release_cmd(cmd);
     }
 
     void renderer_release_buffer(u32 buffer_index)
@@ -1500,7 +2746,7 @@ namespace pen
         cmd.resource_slot = buffer_index;
         cmd.command_data_index = buffer_index;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_release_cmd(cmd);
     }
 
     void renderer_release_texture(u32 texture_index)
@@ -1512,7 +2758,7 @@ namespace pen
         cmd.command_data_index = texture_index;
         cmd.frame_index = pen::_renderer_frame_index();
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_release_cmd(cmd);
     }
 
     void renderer_release_blend_state(u32 blend_state)
@@ -1524,7 +2770,7 @@ namespace pen
         cmd.resource_slot = blend_state;
         cmd.command_data_index = blend_state;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_release_cmd(cmd);
     }
 
     void renderer_release_render_target(u32 render_target)
@@ -1536,7 +2782,7 @@ namespace pen
         cmd.resource_slot = render_target;
         cmd.command_data_index = render_target;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_release_cmd(cmd);
     }
 
     void renderer_release_clear_state(u32 clear_state)
@@ -1548,7 +2794,7 @@ namespace pen
         cmd.resource_slot = clear_state;
         cmd.command_data_index = clear_state;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_release_cmd(cmd);
     }
 
     void renderer_release_input_layout(u32 input_layout)
@@ -1560,7 +2806,7 @@ namespace pen
         cmd.resource_slot = input_layout;
         cmd.command_data_index = input_layout;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_release_cmd(cmd);
     }
 
     void renderer_release_sampler(u32 sampler)
@@ -1572,7 +2818,7 @@ namespace pen
         cmd.resource_slot = sampler;
         cmd.command_data_index = sampler;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_release_cmd(cmd);
     }
 
     void renderer_release_depth_stencil_state(u32 depth_stencil_state)
@@ -1584,7 +2830,7 @@ namespace pen
         cmd.resource_slot = depth_stencil_state;
         cmd.command_data_index = depth_stencil_state;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_release_cmd(cmd);
     }
 
     void renderer_release_raster_state(u32 raster_state_index)
@@ -1595,7 +2841,7 @@ namespace pen
         cmd.resource_slot = raster_state_index;
         cmd.command_data_index = raster_state_index;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_release_cmd(cmd);
     }
 
     void renderer_set_stream_out_target(u32 buffer_index)
@@ -1666,7 +2912,7 @@ namespace pen
     {
         renderer_cmd cmd;
 
-        u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
+        u32 resource_slot = next_resource_slot();
 
         cmd.command_index = CMD_CREATE_CLEAR_STATE;
         cmd.clear_state_params = cs;
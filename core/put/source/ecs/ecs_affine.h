@@ -0,0 +1,160 @@
+// ecs_affine.h
+// Copyright 2014 - 2023 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Scene transforms are always affine, so entity matrices are stored as the top 3 rows of a row major mat4 and the bottom
+// row is implicitly 0, 0, 0, 1. They are a quarter smaller than a mat4, a multiply needs 36 multiplies instead of 64 and
+// an inverse only needs the cofactors of the upper 3x3.
+
+#pragma once
+
+#include "maths/maths.h"
+
+namespace put
+{
+    namespace ecs
+    {
+        struct mat3x4
+        {
+            f32 m[12];
+
+            mat3x4() = default;
+
+            // drops the bottom row, mat must be affine
+            explicit mat3x4(const mat4& mat)
+            {
+                for (u32 i = 0; i < 12; ++i)
+                    m[i] = mat.m[i];
+            }
+
+            operator mat4() const
+            {
+                mat4 mat;
+                for (u32 i = 0; i < 12; ++i)
+                    mat.m[i] = m[i];
+
+                mat.m[12] = 0.0f;
+                mat.m[13] = 0.0f;
+                mat.m[14] = 0.0f;
+                mat.m[15] = 1.0f;
+                return mat;
+            }
+
+            static mat3x4 create_identity()
+            {
+                mat3x4 mat;
+                for (u32 i = 0; i < 12; ++i)
+                    mat.m[i] = (i % 5) == 0 ? 1.0f : 0.0f;
+
+                return mat;
+            }
+
+            vec3f get_translation() const
+            {
+                return vec3f(m[3], m[7], m[11]);
+            }
+
+            void set_translation(const vec3f& t)
+            {
+                m[3] = t.x;
+                m[7] = t.y;
+                m[11] = t.z;
+            }
+
+            vec4f get_row(u32 index) const
+            {
+                if (index > 2)
+                    return vec4f(0.0f, 0.0f, 0.0f, 1.0f);
+
+                return vec4f(m[index * 4 + 0], m[index * 4 + 1], m[index * 4 + 2], m[index * 4 + 3]);
+            }
+
+            vec4f get_column(u32 index) const
+            {
+                return vec4f(m[index], m[4 + index], m[8 + index], index == 3 ? 1.0f : 0.0f);
+            }
+
+            // transforms a point, w is always 1
+            vec3f transform_vector(const vec3f& v) const
+            {
+                return vec3f(m[0] * v.x + m[1] * v.y + m[2] * v.z + m[3], m[4] * v.x + m[5] * v.y + m[6] * v.z + m[7],
+                             m[8] * v.x + m[9] * v.y + m[10] * v.z + m[11]);
+            }
+
+            vec4f transform_vector(const vec4f& v) const
+            {
+                return vec4f(m[0] * v.x + m[1] * v.y + m[2] * v.z + m[3] * v.w,
+                             m[4] * v.x + m[5] * v.y + m[6] * v.z + m[7] * v.w,
+                             m[8] * v.x + m[9] * v.y + m[10] * v.z + m[11] * v.w, v.w);
+            }
+
+            mat3x4 operator*(const mat3x4& rhs) const
+            {
+                const f32* b = rhs.m;
+
+                mat3x4 r;
+                for (u32 i = 0; i < 12; i += 4)
+                {
+                    const f32* a = &m[i];
+                    r.m[i + 0] = a[0] * b[0] + a[1] * b[4] + a[2] * b[8];
+                    r.m[i + 1] = a[0] * b[1] + a[1] * b[5] + a[2] * b[9];
+                    r.m[i + 2] = a[0] * b[2] + a[1] * b[6] + a[2] * b[10];
+                    r.m[i + 3] = a[0] * b[3] + a[1] * b[7] + a[2] * b[11] + a[3];
+                }
+
+                return r;
+            }
+        };
+
+        // upper 3x3 of the inverse transpose with zero translation, it transforms normals by mat. the rows of the
+        // cofactor matrix are the cross products of the rows of mat so no general 4x4 inverse is needed
+        inline mat3x4 affine_inverse_transpose(const mat3x4& mat)
+        {
+            const f32* a = mat.m;
+
+            mat3x4 r;
+            f32*   c = r.m;
+            c[0] = a[5] * a[10] - a[6] * a[9];
+            c[1] = a[6] * a[8] - a[4] * a[10];
+            c[2] = a[4] * a[9] - a[5] * a[8];
+
+            c[4] = a[9] * a[2] - a[10] * a[1];
+            c[5] = a[10] * a[0] - a[8] * a[2];
+            c[6] = a[8] * a[1] - a[9] * a[0];
+
+            c[8] = a[1] * a[6] - a[2] * a[5];
+            c[9] = a[2] * a[4] - a[0] * a[6];
+            c[10] = a[0] * a[5] - a[1] * a[4];
+
+            f32 inv_det = 1.0f / (a[0] * c[0] + a[1] * c[1] + a[2] * c[2]);
+            for (u32 i = 0; i < 12; i += 4)
+            {
+                c[i + 0] *= inv_det;
+                c[i + 1] *= inv_det;
+                c[i + 2] *= inv_det;
+                c[i + 3] = 0.0f;
+            }
+
+            return r;
+        }
+
+        // transposed inverse of the upper 3x3, translation is the inverse rotation scale applied to the negated
+        // translation of mat
+        inline mat3x4 affine_inverse(const mat3x4& mat)
+        {
+            mat3x4 it = affine_inverse_transpose(mat);
+
+            mat3x4 r;
+            for (u32 i = 0; i < 3; ++i)
+            {
+                f32* row = &r.m[i * 4];
+                row[0] = it.m[i];
+                row[1] = it.m[4 + i];
+                row[2] = it.m[8 + i];
+                row[3] = -(row[0] * mat.m[3] + row[1] * mat.m[7] + row[2] * mat.m[11]);
+            }
+
+            return r;
+        }
+    } // namespace ecs
+} // namespace put
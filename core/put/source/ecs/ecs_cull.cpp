@@ -1,13 +1,20 @@
 #include "ecs_cull.h"
 
+#include "ecs_resources.h"
 #include "ecs_scene.h"
+#include "ecs_simd.h"
+#include "threads.h"
 #include "timer.h"
 
-#if __SSE2__ || __AVX2__ || __AVX__
+#if PUT_SIMD_SSE2
 #include <immintrin.h>
 #include <xmmintrin.h>
 #endif
 
+#if __ARM_NEON || __ARM_NEON__
+#include <arm_neon.h>
+#endif
+
 using namespace ::pen;
 
 namespace put
@@ -20,6 +27,7 @@ namespace put
 
         void frustum_cull_aabb_scalar(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
         {
+            render_frame   rf = get_render_frame(scene);
             const frustum& frust = cam->camera_frustum;
 
             u32 n = sb_count(entities_in);
@@ -27,19 +35,21 @@ namespace put
             {
                 u32 e = entities_in[i];
 
-                vec3f pos = scene->pos_extent[e].pos.xyz;
-                vec3f extent = scene->pos_extent[e].extent.xyz;
+                vec3f pos = rf.pos_extent[e].pos.xyz;
+                vec3f extent = rf.pos_extent[e].extent.xyz;
 
                 bool inside = true;
                 for (s32 p = 0; p < 6; ++p)
                 {
-                    vec3f sign_flip = sgn(frust.n[p]) * -1.0f;
-                    f32   pd = maths::plane_distance(frust.p[p], frust.n[p]);
-                    f32   d2 = dot(pos + extent * sign_flip, frust.n[p]);
+                    // outside if the centre is further in front of the plane than the extent projected onto its normal
+                    vec3f pn = frust.n[p];
+                    f32   d = pos.x * pn.x + pos.y * pn.y + pos.z * pn.z + maths::plane_distance(frust.p[p], pn);
+                    f32   r = extent.x * fabs(pn.x) + extent.y * fabs(pn.y) + extent.z * fabs(pn.z);
 
-                    if (d2 > -pd)
+                    if (d > r)
                     {
                         inside = false;
+                        break;
                     }
                 }
 
@@ -52,6 +62,7 @@ namespace put
 
         void frustum_cull_sphere_scalar(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
         {
+            render_frame   rf = get_render_frame(scene);
             const frustum& camera_frustum = cam->camera_frustum;
 
             u32 n = sb_count(entities_in);
@@ -59,8 +70,8 @@ namespace put
             {
                 u32 e = entities_in[i];
 
-                vec3f pos = scene->pos_extent[e].pos.xyz;
-                f32   radius = scene->pos_extent[e].extent.w;
+                vec3f pos = rf.pos_extent[e].pos.xyz;
+                f32   radius = rf.pos_extent[e].extent.w;
 
                 bool inside = true;
                 for (s32 p = 0; p < 6; ++p)
@@ -81,465 +92,1183 @@ namespace put
             }
         }
 
-        void filter_entities_scalar(const ecs_scene* scene, u32** entities_out)
+        namespace
         {
-            u32 accept_entities = e_cmp::geometry | e_cmp::material;
-            u32 reject_entities = e_cmp::sub_instance;
-
-            for (u32 i = 0; i < scene->num_entities; ++i)
+            bool renderable_flags(u64 entity_flags, u64 state_flags)
             {
+                u32 accept_entities = e_cmp::geometry | e_cmp::material;
+                u32 reject_entities = e_cmp::sub_instance;
+
                 // entity flags accept
-                if ((scene->entities[i] & accept_entities) != accept_entities)
-                    continue;
-                    
-                if (scene->state_flags[i] & e_state::hidden)
-                    continue;
+                if ((entity_flags & accept_entities) != accept_entities)
+                    return false;
+
+                if (state_flags & e_state::hidden)
+                    return false;
 
                 // entity flags reject
-                if (reject_entities)
-                    if (scene->entities[i] & reject_entities)
-                        continue;
+                return !(entity_flags & reject_entities);
+            }
+        } // namespace
+
+        bool is_renderable(const ecs_scene* scene, u32 entity)
+        {
+            return renderable_flags(scene->entities[entity], scene->state_flags[entity]);
+        }
+
+        bool is_renderable(const render_frame& rf, u32 entity)
+        {
+            return renderable_flags(rf.entities[entity], rf.state_flags[entity]);
+        }
+
+        void filter_entities_scalar(const ecs_scene* scene, u32** entities_out)
+        {
+            render_frame rf = get_render_frame(scene);
+            for (u32 i = 0; i < rf.num_entities; ++i)
+                if (is_renderable(rf, i))
+                    sb_push(*entities_out, i);
+        }
+
+        void update_renderables(ecs_scene* scene)
+        {
+            renderable_set& rs = scene->renderables;
+            u32             num = (u32)scene->num_entities;
 
-                sb_push(*entities_out, i);
+            // scene was resized or cleared
+            if (sb_count(rs.slots) != num)
+            {
+                sb_reset(rs.entities);
+                sb_clear(rs.slots);
+                sb_add(rs.slots, num);
+                for (u32 n = 0; n < num; ++n)
+                    rs.slots[n] = PEN_INVALID_HANDLE;
+            }
+
+            for (u32 n = 0; n < num; ++n)
+            {
+                bool renderable = is_renderable(scene, n);
+                if (renderable == is_valid(rs.slots[n]))
+                    continue;
+
+                if (renderable)
+                {
+                    rs.slots[n] = sb_count(rs.entities);
+                    sb_push(rs.entities, n);
+                }
+                else
+                {
+                    // swap the last entity into the removed slot
+                    u32 slot = rs.slots[n];
+                    u32 last = sb_last(rs.entities);
+                    rs.entities[slot] = last;
+                    rs.slots[last] = slot;
+                    rs.slots[n] = PEN_INVALID_HANDLE;
+                    stb__sbn(rs.entities)--;
+                }
             }
         }
 
         //
-        // sse2 128 implementation
+        // soa inputs
         //
-#if __SSE__ || __AVX__
-        void frustum_cull_aabb_simd128(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
+
+        namespace
         {
-            const frustum& frust = cam->camera_frustum;
+            // pos extent gathered from the entity list into separate aligned streams, padded to the widest simd width
+            // so kernels can use aligned loads without touching the callers entity list
+            struct cull_soa
+            {
+                f32* data = nullptr;
+                u32  capacity = 0;
+                u32  count = 0;
+                f32* px;
+                f32* py;
+                f32* pz;
+                f32* ex;
+                f32* ey;
+                f32* ez;
+                f32* radius;
+            };
+
+            static const u32 k_soa_width = 8;
+            static const u32 k_soa_streams = 7;
+
+            // per thread so views can be culled concurrently
+            thread_local cull_soa t_cull_soa;
+
+            const cull_soa& gather_soa(const ecs_scene* scene, const u32* entities_in, u32 count, bool aabb)
+            {
+                cull_soa& soa = t_cull_soa;
 
-            // pad to 4
-            u32 xn = sb_count(entities_in);
-            u32 yn = PEN_ALIGN(xn, 4);
-            for (u32 i = 0; i < yn - xn; ++i)
-                sb_push(entities_in, entities_in[0]);
+                u32 padded = PEN_ALIGN(count, k_soa_width);
+                if (padded > soa.capacity)
+                {
+                    memory_free_align(soa.data);
+                    soa.capacity = max<u32>(padded, soa.capacity * 2);
+                    soa.data = (f32*)memory_alloc_align(sizeof(f32) * soa.capacity * k_soa_streams, 32);
+                }
 
-            // sphere radius and position
-            __m128 posx;
-            __m128 posy;
-            __m128 posz;
-            __m128 extx;
-            __m128 exty;
-            __m128 extz;
+                soa.count = count;
+                soa.px = soa.data;
+                soa.py = soa.px + soa.capacity;
+                soa.pz = soa.py + soa.capacity;
+                soa.ex = soa.pz + soa.capacity;
+                soa.ey = soa.ex + soa.capacity;
+                soa.ez = soa.ey + soa.capacity;
+                soa.radius = soa.ez + soa.capacity;
+
+                render_frame rf = get_render_frame(scene);
+                for (u32 i = 0; i < count; ++i)
+                {
+                    const cmp_pos_extent& pe = rf.pos_extent[entities_in[i]];
+                    soa.px[i] = pe.pos.x;
+                    soa.py[i] = pe.pos.y;
+                    soa.pz[i] = pe.pos.z;
 
-            // plane normal
-            __m128 pnx[6];
-            __m128 pny[6];
-            __m128 pnz[6];
+                    if (aabb)
+                    {
+                        soa.ex[i] = pe.extent.x;
+                        soa.ey[i] = pe.extent.y;
+                        soa.ez[i] = pe.extent.z;
+                    }
+                    else
+                    {
+                        soa.radius[i] = pe.extent.w;
+                    }
+                }
 
-            // plane distance
-            __m128 pd[6];
-            __m128 pd_neg[6];
+                // padding lanes are tested but never output
+                for (u32 i = count; i < padded; ++i)
+                {
+                    soa.px[i] = soa.py[i] = soa.pz[i] = 0.0f;
+                    soa.ex[i] = soa.ey[i] = soa.ez[i] = soa.radius[i] = 0.0f;
+                }
 
-            // plane sign flip
-            __m128 sfx[6];
-            __m128 sfy[6];
-            __m128 sfz[6];
+                return soa;
+            }
 
-            f32 result[4];
-            u32 e[4];
+            // plane normals, distances and absolute normals for projecting aabb extents
+            struct cull_planes
+            {
+                f32 nx[6];
+                f32 ny[6];
+                f32 nz[6];
+                f32 d[6];
+                f32 ax[6];
+                f32 ay[6];
+                f32 az[6];
+            };
+
+            void get_cull_planes(const camera* cam, cull_planes& planes)
+            {
+                const frustum& frust = cam->camera_frustum;
+                for (s32 p = 0; p < 6; ++p)
+                {
+                    planes.nx[p] = frust.n[p].x;
+                    planes.ny[p] = frust.n[p].y;
+                    planes.nz[p] = frust.n[p].z;
+                    planes.d[p] = maths::plane_distance(frust.p[p], frust.n[p]);
+                    planes.ax[p] = fabs(frust.n[p].x);
+                    planes.ay[p] = fabs(frust.n[p].y);
+                    planes.az[p] = fabs(frust.n[p].z);
+                }
+            }
 
-            // load camera planes
-            for (s32 p = 0; p < 6; ++p)
+            // push entities with a set bit in the visible mask, lanes past count are padding
+            void push_visible(const u32* entities_in, u32 i, u32 count, u32 visible, u32** entities_out)
             {
-                f32 ppd = maths::plane_distance(frust.p[p], frust.n[p]);
-                pnx[p] = _mm_set1_ps(frust.n[p].x);
-                pny[p] = _mm_set1_ps(frust.n[p].y);
-                pnz[p] = _mm_set1_ps(frust.n[p].z);
-                pd[p] = _mm_set1_ps(ppd);
-                pd_neg[p] = _mm_set1_ps(-ppd);
+                while (visible)
+                {
+                    u32 j = 0;
+                    while (!(visible & (1 << j)))
+                        ++j;
 
-                sfx[p] = _mm_set1_ps(sgn(frust.n[p].x) * -1.0f);
-                sfy[p] = _mm_set1_ps(sgn(frust.n[p].y) * -1.0f);
-                sfz[p] = _mm_set1_ps(sgn(frust.n[p].z) * -1.0f);
+                    visible &= ~(1 << j);
+                    if (i + j < count)
+                        sb_push(*entities_out, entities_in[i + j]);
+                }
             }
+        } // namespace
 
-            u32 n = sb_count(entities_in);
-            for (u32 i = 0; i < n; i += 4)
+        //
+        // sse2 128 implementation
+        //
+#if PUT_SIMD_SSE2
+        void frustum_cull_aabb_simd128(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
+        {
+            cull_planes planes;
+            get_cull_planes(cam, planes);
+
+            u32             count = sb_count(entities_in);
+            const cull_soa& soa = gather_soa(scene, entities_in, count, true);
+
+            for (u32 i = 0; i < count; i += 4)
             {
-                // unpack entities
-                for (u32 j = 0; j < 4; ++j)
-                    e[j] = entities_in[i + j];
+                __m128 posx = _mm_load_ps(soa.px + i);
+                __m128 posy = _mm_load_ps(soa.py + i);
+                __m128 posz = _mm_load_ps(soa.pz + i);
+                __m128 extx = _mm_load_ps(soa.ex + i);
+                __m128 exty = _mm_load_ps(soa.ey + i);
+                __m128 extz = _mm_load_ps(soa.ez + i);
+
+                __m128 outside = _mm_setzero_ps();
+
+                for (s32 p = 0; p < 6; ++p)
+                {
+                    // distance of the centre to the plane
+                    __m128 d = _mm_add_ps(_mm_mul_ps(posx, _mm_set1_ps(planes.nx[p])), _mm_set1_ps(planes.d[p]));
+                    d = _mm_add_ps(_mm_mul_ps(posy, _mm_set1_ps(planes.ny[p])), d);
+                    d = _mm_add_ps(_mm_mul_ps(posz, _mm_set1_ps(planes.nz[p])), d);
+
+                    // extent projected onto the plane normal
+                    __m128 r = _mm_mul_ps(extx, _mm_set1_ps(planes.ax[p]));
+                    r = _mm_add_ps(_mm_mul_ps(exty, _mm_set1_ps(planes.ay[p])), r);
+                    r = _mm_add_ps(_mm_mul_ps(extz, _mm_set1_ps(planes.az[p])), r);
 
-                auto& p0 = scene->pos_extent[e[0]].pos;
-                auto& p1 = scene->pos_extent[e[1]].pos;
-                auto& p2 = scene->pos_extent[e[2]].pos;
-                auto& p3 = scene->pos_extent[e[3]].pos;
-                auto& e0 = scene->pos_extent[e[0]].extent;
-                auto& e1 = scene->pos_extent[e[1]].extent;
-                auto& e2 = scene->pos_extent[e[2]].extent;
-                auto& e3 = scene->pos_extent[e[3]].extent;
+                    outside = _mm_or_ps(outside, _mm_cmpgt_ps(d, r));
+                }
+
+                push_visible(entities_in, i, count, ~_mm_movemask_ps(outside) & 0xf, entities_out);
+            }
+        }
+
+        void frustum_cull_sphere_simd128(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
+        {
+            cull_planes planes;
+            get_cull_planes(cam, planes);
 
-                posx = _mm_set_ps(p0.x, p1.x, p2.x, p3.x);
-                posy = _mm_set_ps(p0.y, p1.y, p2.y, p3.y);
-                posz = _mm_set_ps(p0.z, p1.z, p2.z, p3.z);
+            u32             count = sb_count(entities_in);
+            const cull_soa& soa = gather_soa(scene, entities_in, count, false);
 
-                extx = _mm_set_ps(e0.x, e1.x, e2.x, e3.x);
-                exty = _mm_set_ps(e0.y, e1.y, e2.y, e3.y);
-                extz = _mm_set_ps(e0.z, e1.z, e2.z, e3.z);
+            for (u32 i = 0; i < count; i += 4)
+            {
+                __m128 posx = _mm_load_ps(soa.px + i);
+                __m128 posy = _mm_load_ps(soa.py + i);
+                __m128 posz = _mm_load_ps(soa.pz + i);
+                __m128 radius = _mm_load_ps(soa.radius + i);
 
-                __m128 inside = _mm_set1_ps(0.0f);
+                __m128 outside = _mm_setzero_ps();
 
                 for (s32 p = 0; p < 6; ++p)
                 {
-                    // get distance to plane
-                    // dot product with plane normal and also add plane distance
-                    __m128 dd = _mm_fmadd_ps(posx, pnx[p], pd[p]);
-                    dd = _mm_fmadd_ps(posy, pny[p], dd);
-                    dd = _mm_fmadd_ps(posz, pnz[p], dd);
+                    // distance of the centre to the plane
+                    __m128 d = _mm_add_ps(_mm_mul_ps(posx, _mm_set1_ps(planes.nx[p])), _mm_set1_ps(planes.d[p]));
+                    d = _mm_add_ps(_mm_mul_ps(posy, _mm_set1_ps(planes.ny[p])), d);
+                    d = _mm_add_ps(_mm_mul_ps(posz, _mm_set1_ps(planes.nz[p])), d);
+
+                    outside = _mm_or_ps(outside, _mm_cmpgt_ps(d, radius));
+                }
 
-                    // pos + extent * sign_flip
-                    __m128 dpx = _mm_fmadd_ps(extx, sfx[p], posx);
-                    __m128 dpy = _mm_fmadd_ps(exty, sfy[p], posy);
-                    __m128 dpz = _mm_fmadd_ps(extz, sfz[p], posz);
+                push_visible(entities_in, i, count, ~_mm_movemask_ps(outside) & 0xf, entities_out);
+            }
+        }
+#endif
+
+        //
+        // avx 256 implementation
+        //
+#if PUT_SIMD_AVX2
+        PUT_TARGET_AVX2 void frustum_cull_aabb_simd256(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
+        {
+            cull_planes planes;
+            get_cull_planes(cam, planes);
+
+            u32             count = sb_count(entities_in);
+            const cull_soa& soa = gather_soa(scene, entities_in, count, true);
+
+            for (u32 i = 0; i < count; i += 8)
+            {
+                __m256 posx = _mm256_load_ps(soa.px + i);
+                __m256 posy = _mm256_load_ps(soa.py + i);
+                __m256 posz = _mm256_load_ps(soa.pz + i);
+                __m256 extx = _mm256_load_ps(soa.ex + i);
+                __m256 exty = _mm256_load_ps(soa.ey + i);
+                __m256 extz = _mm256_load_ps(soa.ez + i);
 
-                    // dot(pos + extent * sign_flip, frust.n[p]);
-                    __m128 r = _mm_mul_ps(dpx, pnx[p]);
-                    r = _mm_fmadd_ps(dpy, pny[p], r);
-                    r = _mm_fmadd_ps(dpz, pnz[p], r);
+                __m256 outside = _mm256_setzero_ps();
 
-                    // if(r > -pd) inside = false
-                    __m128 ge = _mm_cmpge_ps(r, pd_neg[p]);
-                    inside = _mm_add_ps(ge, inside);
+                for (s32 p = 0; p < 6; ++p)
+                {
+                    // distance of the centre to the plane
+                    __m256 d = _mm256_add_ps(_mm256_mul_ps(posx, _mm256_set1_ps(planes.nx[p])), _mm256_set1_ps(planes.d[p]));
+                    d = _mm256_add_ps(_mm256_mul_ps(posy, _mm256_set1_ps(planes.ny[p])), d);
+                    d = _mm256_add_ps(_mm256_mul_ps(posz, _mm256_set1_ps(planes.nz[p])), d);
+
+                    // extent projected onto the plane normal
+                    __m256 r = _mm256_mul_ps(extx, _mm256_set1_ps(planes.ax[p]));
+                    r = _mm256_add_ps(_mm256_mul_ps(exty, _mm256_set1_ps(planes.ay[p])), r);
+                    r = _mm256_add_ps(_mm256_mul_ps(extz, _mm256_set1_ps(planes.az[p])), r);
+
+                    outside = _mm256_or_ps(outside, _mm256_cmp_ps(d, r, _CMP_GT_OQ));
                 }
 
-                _mm_store_ps(result, inside);
-                for (u32 j = 0; j < 4; ++j)
-                    if (!result[j])
-                        sb_push(*entities_out, e[3 - j]);
+                push_visible(entities_in, i, count, ~_mm256_movemask_ps(outside) & 0xff, entities_out);
             }
         }
 
-        void frustum_cull_sphere_simd128(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
+        PUT_TARGET_AVX2 void frustum_cull_sphere_simd256(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
         {
-            const frustum& frust = cam->camera_frustum;
+            cull_planes planes;
+            get_cull_planes(cam, planes);
 
-            // pad to 4
-            u32 xn = sb_count(entities_in);
-            u32 yn = PEN_ALIGN(xn, 4);
-            for (u32 i = 0; i < yn - xn; ++i)
-                sb_push(entities_in, entities_in[0]);
+            u32             count = sb_count(entities_in);
+            const cull_soa& soa = gather_soa(scene, entities_in, count, false);
 
-            // sphere radius and position
-            __m128 radius;
-            __m128 posx;
-            __m128 posy;
-            __m128 posz;
+            for (u32 i = 0; i < count; i += 8)
+            {
+                __m256 posx = _mm256_load_ps(soa.px + i);
+                __m256 posy = _mm256_load_ps(soa.py + i);
+                __m256 posz = _mm256_load_ps(soa.pz + i);
+                __m256 radius = _mm256_load_ps(soa.radius + i);
 
-            // plane normal
-            __m128 pnx[6];
-            __m128 pny[6];
-            __m128 pnz[6];
+                __m256 outside = _mm256_setzero_ps();
 
-            // plane distance
-            __m128 pd[6];
+                for (s32 p = 0; p < 6; ++p)
+                {
+                    // distance of the centre to the plane
+                    __m256 d = _mm256_add_ps(_mm256_mul_ps(posx, _mm256_set1_ps(planes.nx[p])), _mm256_set1_ps(planes.d[p]));
+                    d = _mm256_add_ps(_mm256_mul_ps(posy, _mm256_set1_ps(planes.ny[p])), d);
+                    d = _mm256_add_ps(_mm256_mul_ps(posz, _mm256_set1_ps(planes.nz[p])), d);
 
-            f32 result[4];
-            u32 e[4];
+                    outside = _mm256_or_ps(outside, _mm256_cmp_ps(d, radius, _CMP_GT_OQ));
+                }
 
-            // load camera planes
-            for (s32 p = 0; p < 6; ++p)
-            {
-                f32 ppd = maths::plane_distance(frust.p[p], frust.n[p]);
-                pnx[p] = _mm_set1_ps(frust.n[p].x);
-                pny[p] = _mm_set1_ps(frust.n[p].y);
-                pnz[p] = _mm_set1_ps(frust.n[p].z);
-                pd[p] = _mm_set1_ps(ppd);
+                push_visible(entities_in, i, count, ~_mm256_movemask_ps(outside) & 0xff, entities_out);
             }
+        }
+#endif
 
-            u32 n = sb_count(entities_in);
-            for (u32 i = 0; i < n; i += 4)
+        //
+        // arm neon simd 128 implementation
+        //
+#if __ARM_NEON || __ARM_NEON__
+        namespace
+        {
+            u32 neon_visible_mask(uint32x4_t outside)
             {
-                // unpack entities
+                u32 lanes[4];
+                vst1q_u32(lanes, outside);
+
+                u32 visible = 0;
                 for (u32 j = 0; j < 4; ++j)
-                    e[j] = entities_in[i + j];
+                    if (!lanes[j])
+                        visible |= 1 << j;
 
-                // load entities values
-                auto& p0 = scene->pos_extent[e[0]].pos;
-                auto& p1 = scene->pos_extent[e[1]].pos;
-                auto& p2 = scene->pos_extent[e[2]].pos;
-                auto& p3 = scene->pos_extent[e[3]].pos;
-                auto& r0 = scene->pos_extent[e[0]].extent;
-                auto& r1 = scene->pos_extent[e[1]].extent;
-                auto& r2 = scene->pos_extent[e[2]].extent;
-                auto& r3 = scene->pos_extent[e[3]].extent;
+                return visible;
+            }
+        } // namespace
 
-                radius = _mm_set_ps(r0.w, r1.w, r2.w, r3.w);
+        void frustum_cull_aabb_neon(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
+        {
+            cull_planes planes;
+            get_cull_planes(cam, planes);
 
-                posx = _mm_set_ps(p0.x, p1.x, p2.x, p3.x);
-                posy = _mm_set_ps(p0.y, p1.y, p2.y, p3.y);
-                posz = _mm_set_ps(p0.z, p1.z, p2.z, p3.z);
+            u32             count = sb_count(entities_in);
+            const cull_soa& soa = gather_soa(scene, entities_in, count, true);
 
-                __m128 inside = _mm_set1_ps(0.0f);
+            for (u32 i = 0; i < count; i += 4)
+            {
+                float32x4_t posx = vld1q_f32(soa.px + i);
+                float32x4_t posy = vld1q_f32(soa.py + i);
+                float32x4_t posz = vld1q_f32(soa.pz + i);
+                float32x4_t extx = vld1q_f32(soa.ex + i);
+                float32x4_t exty = vld1q_f32(soa.ey + i);
+                float32x4_t extz = vld1q_f32(soa.ez + i);
+
+                uint32x4_t outside = vdupq_n_u32(0);
 
                 for (s32 p = 0; p < 6; ++p)
                 {
-                    // get distance to plane
-                    // dot product with plane normal and also add plane distance
-                    __m128 dd = _mm_fmadd_ps(posx, pnx[p], pd[p]);
-                    dd = _mm_fmadd_ps(posy, pny[p], dd);
-                    dd = _mm_fmadd_ps(posz, pnz[p], dd);
+                    // distance of the centre to the plane
+                    float32x4_t d = vaddq_f32(vmulq_n_f32(posx, planes.nx[p]), vdupq_n_f32(planes.d[p]));
+                    d = vaddq_f32(vmulq_n_f32(posy, planes.ny[p]), d);
+                    d = vaddq_f32(vmulq_n_f32(posz, planes.nz[p]), d);
+
+                    // extent projected onto the plane normal
+                    float32x4_t r = vmulq_n_f32(extx, planes.ax[p]);
+                    r = vaddq_f32(vmulq_n_f32(exty, planes.ay[p]), r);
+                    r = vaddq_f32(vmulq_n_f32(extz, planes.az[p]), r);
 
-                    // compare if dd is greater than radius, if so we are outside
-                    __m128 ge = _mm_cmpge_ps(dd, radius);
-                    inside = _mm_add_ps(ge, inside);
+                    outside = vorrq_u32(outside, vcgtq_f32(d, r));
                 }
 
-                _mm_store_ps(result, inside);
-                for (u32 j = 0; j < 4; ++j)
-                    if (!result[j])
-                        sb_push(*entities_out, e[3 - j]);
+                push_visible(entities_in, i, count, neon_visible_mask(outside), entities_out);
+            }
+        }
+
+        void frustum_cull_sphere_neon(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
+        {
+            cull_planes planes;
+            get_cull_planes(cam, planes);
+
+            u32             count = sb_count(entities_in);
+            const cull_soa& soa = gather_soa(scene, entities_in, count, false);
+
+            for (u32 i = 0; i < count; i += 4)
+            {
+                float32x4_t posx = vld1q_f32(soa.px + i);
+                float32x4_t posy = vld1q_f32(soa.py + i);
+                float32x4_t posz = vld1q_f32(soa.pz + i);
+                float32x4_t radius = vld1q_f32(soa.radius + i);
+
+                uint32x4_t outside = vdupq_n_u32(0);
+
+                for (s32 p = 0; p < 6; ++p)
+                {
+                    // distance of the centre to the plane
+                    float32x4_t d = vaddq_f32(vmulq_n_f32(posx, planes.nx[p]), vdupq_n_f32(planes.d[p]));
+                    d = vaddq_f32(vmulq_n_f32(posy, planes.ny[p]), d);
+                    d = vaddq_f32(vmulq_n_f32(posz, planes.nz[p]), d);
+
+                    outside = vorrq_u32(outside, vcgtq_f32(d, radius));
+                }
+
+                push_visible(entities_in, i, count, neon_visible_mask(outside), entities_out);
             }
         }
 #endif
 
         //
-        // avx 256 implementation
+        // dispatch
         //
-#if __AVX2__
-        void frustum_cull_sphere_simd256(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
+
+        namespace
         {
-            const frustum& frust = cam->camera_frustum;
+            typedef void (*cull_func)(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out);
 
-            // pad to 8
-            u32 xn = sb_count(entities_in);
-            u32 yn = PEN_ALIGN(xn, 8);
-            for (u32 i = 0; i < yn - xn; ++i)
-                sb_push(entities_in, entities_in[0]);
+            struct cull_kernels
+            {
+                simd_flags level;
+                cull_func  aabb;
+                cull_func  sphere;
+            };
+
+            // widest first
+            const cull_kernels k_cull_kernels[] = {
+#if PUT_SIMD_AVX2
+                {e_simd::avx2, frustum_cull_aabb_simd256, frustum_cull_sphere_simd256},
+#endif
+#if PUT_SIMD_SSE2
+                {e_simd::sse2, frustum_cull_aabb_simd128, frustum_cull_sphere_simd128},
+#endif
+#if __ARM_NEON || __ARM_NEON__
+                {e_simd::neon, frustum_cull_aabb_neon, frustum_cull_sphere_neon},
+#endif
+                {e_simd::scalar, frustum_cull_aabb_scalar, frustum_cull_sphere_scalar}};
 
-            // splat constants
-            __m256 zero = _mm256_set1_ps(0.0f);
+            // selected from the current simd level each call, so simd_set_level applies to culling as well
+            const cull_kernels& get_cull_kernels()
+            {
+                simd_flags level = simd_get_level();
+                for (u32 i = 0; i < PEN_ARRAY_SIZE(k_cull_kernels); ++i)
+                    if ((k_cull_kernels[i].level & level) == k_cull_kernels[i].level)
+                        return k_cull_kernels[i];
 
-            // sphere radius and position
-            __m256 radius;
-            __m256 posx;
-            __m256 posy;
-            __m256 posz;
+                return k_cull_kernels[PEN_ARRAY_SIZE(k_cull_kernels) - 1];
+            }
+        } // namespace
 
-            // plane normal
-            __m256 pnx[6];
-            __m256 pny[6];
-            __m256 pnz[6];
+        void simd_init()
+        {
+            // first call to simd_get_level detects the cpu and selects kernels
+            simd_flags level = simd_get_level();
+            PEN_LOG("simd: %s (supported 0x%x)", simd_level_name(level), simd_supported());
+        }
 
-            // plane distance
-            __m256 pd[6];
+        void frustum_cull_aabb(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
+        {
+            get_cull_kernels().aabb(scene, cam, entities_in, entities_out);
+        }
+
+        void frustum_cull_sphere(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
+        {
+            get_cull_kernels().sphere(scene, cam, entities_in, entities_out);
+        }
+
+        //
+        // bounding volume hierarchy
+        //
+
+        namespace
+        {
+            static const u32 k_bvh_leaf_size = 8;
+            static const u32 k_bvh_max_depth = 64;
+            static const f32 k_bvh_rebuild_cost = 2.0f; // rebuild when refits have doubled the summed surface area
 
-            f32 result[8];
-            u32 e[8];
+            bool bvh_member(const ecs_scene* scene, u32 n)
+            {
+                u32 accept_entities = e_cmp::geometry | e_cmp::material;
+                u32 reject_entities = e_cmp::sub_instance;
+
+                if ((scene->entities[n] & accept_entities) != accept_entities)
+                    return false;
 
-            // load camera planes
-            for (s32 p = 0; p < 6; ++p)
+                return !(scene->entities[n] & reject_entities);
+            }
+
+            f32 axis_value(const vec3f& v, u32 axis)
             {
-                f32 ppd = maths::plane_distance(frust.p[p], frust.n[p]);
-                pnx[p] = _mm256_set1_ps(frust.n[p].x);
-                pny[p] = _mm256_set1_ps(frust.n[p].y);
-                pnz[p] = _mm256_set1_ps(frust.n[p].z);
-                pd[p] = _mm256_set1_ps(ppd);
+                return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
             }
 
-            u32 n = sb_count(entities_in);
-            for (u32 i = 0; i < n; i += 8)
-            {
-                // unpack entities
-                for (u32 j = 0; j < 8; ++j)
-                    e[j] = entities_in[i + j];
-
-                // load entities values
-                auto& p0 = scene->pos_extent[e[0]].pos;
-                auto& p1 = scene->pos_extent[e[1]].pos;
-                auto& p2 = scene->pos_extent[e[2]].pos;
-                auto& p3 = scene->pos_extent[e[3]].pos;
-                auto& p4 = scene->pos_extent[e[4]].pos;
-                auto& p5 = scene->pos_extent[e[5]].pos;
-                auto& p6 = scene->pos_extent[e[6]].pos;
-                auto& p7 = scene->pos_extent[e[7]].pos;
-                auto& r0 = scene->pos_extent[e[0]].extent;
-                auto& r1 = scene->pos_extent[e[1]].extent;
-                auto& r2 = scene->pos_extent[e[2]].extent;
-                auto& r3 = scene->pos_extent[e[3]].extent;
-                auto& r4 = scene->pos_extent[e[4]].extent;
-                auto& r5 = scene->pos_extent[e[5]].extent;
-                auto& r6 = scene->pos_extent[e[6]].extent;
-                auto& r7 = scene->pos_extent[e[7]].extent;
-
-                radius = _mm256_set_ps(r0.w, r1.w, r2.w, r3.w, r4.w, r5.w, r6.w, r7.w);
-
-                posx = _mm256_set_ps(p0.x, p1.x, p2.x, p3.x, p4.x, p5.x, p6.x, p7.x);
-                posy = _mm256_set_ps(p0.y, p1.y, p2.y, p3.y, p4.y, p5.y, p6.y, p7.y);
-                posz = _mm256_set_ps(p0.z, p1.z, p2.z, p3.z, p4.z, p5.z, p6.z, p7.z);
-
-                __m256 inside = _mm256_set1_ps(0.0f);
+            f32 surface_area(const vec3f& min, const vec3f& max)
+            {
+                vec3f d = max - min;
+                return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+            }
 
-                for (s32 p = 0; p < 6; ++p)
+            void bvh_range_bounds(const ecs_scene* scene, const scene_bvh& bvh, u32 first, u32 count, vec3f& min, vec3f& max)
+            {
+                min = vec3f::flt_max();
+                max = -vec3f::flt_max();
+                for (u32 i = first; i < first + count; ++i)
                 {
-                    // get distance to plane
-                    // dot product with plane normal and also add plane distance
-                    __m256 dd = _mm256_fmadd_ps(posx, pnx[p], pd[p]);
-                    dd = _mm256_fmadd_ps(posy, pny[p], dd);
-                    dd = _mm256_fmadd_ps(posz, pnz[p], dd);
+                    const cmp_pos_extent& pe = scene->pos_extent[bvh.entities[i]];
+                    min = min_union(min, pe.pos.xyz - pe.extent.xyz);
+                    max = max_union(max, pe.pos.xyz + pe.extent.xyz);
+                }
+            }
+
+            // top down, splits the centroid bounds in half on the longest axis, deep nodes split by count so the
+            // traversal stack is bounded. centroids are kept in the same order as bvh.entities so splitting reads them
+            // sequentially, node bounds are built bottom up as the recursion returns
+            void build_bvh_node(const ecs_scene* scene, scene_bvh& bvh, vec3f* centroids, u32 node_index, u32 depth)
+            {
+                bvh_node node = bvh.nodes[node_index];
+                node.child = PEN_INVALID_HANDLE;
+
+                if (node.count <= k_bvh_leaf_size)
+                {
+                    for (u32 i = node.first; i < node.first + node.count; ++i)
+                        bvh.leaves[bvh.entities[i]] = node_index;
+
+                    bvh_range_bounds(scene, bvh, node.first, node.count, node.min, node.max);
+                    if (node.count > 0)
+                        bvh.cost += surface_area(node.min, node.max);
 
-                    __m256 diff = _mm256_sub_ps(dd, radius);
-                    diff = _mm256_max_ps(diff, zero);
-                    inside = _mm256_add_ps(diff, inside);
+                    bvh.nodes[node_index] = node;
+                    return;
                 }
 
-                _mm256_store_ps(result, inside);
-                for (u32 j = 0; j < 8; ++j)
-                    if (!result[j])
-                        sb_push(*entities_out, e[7 - j]);
+                u32*   entities = &bvh.entities[node.first];
+                vec3f* c = &centroids[node.first];
+                u32    num_left = node.count / 2;
+
+                if (depth < k_bvh_max_depth / 2)
+                {
+                    vec3f cmin = vec3f::flt_max();
+                    vec3f cmax = -vec3f::flt_max();
+                    for (u32 i = 0; i < node.count; ++i)
+                    {
+                        cmin = min_union(cmin, c[i]);
+                        cmax = max_union(cmax, c[i]);
+                    }
+
+                    vec3f ext = cmax - cmin;
+                    u32   axis = 0;
+                    if (ext.y > ext.x)
+                        axis = 1;
+                    if (ext.z > axis_value(ext, axis))
+                        axis = 2;
+
+                    f32 mid = axis_value(cmin, axis) + axis_value(ext, axis) * 0.5f;
+
+                    // partition around the mid point
+                    u32 i = 0;
+                    u32 j = node.count;
+                    while (i < j)
+                    {
+                        if (axis_value(c[i], axis) < mid)
+                        {
+                            ++i;
+                        }
+                        else
+                        {
+                            --j;
+                            std::swap(entities[i], entities[j]);
+                            std::swap(c[i], c[j]);
+                        }
+                    }
+
+                    // all centroids on one side, fall back to splitting by count
+                    if (i > 0 && i < node.count)
+                        num_left = i;
+                }
+
+                node.child = sb_count(bvh.nodes);
+                bvh.nodes[node_index] = node;
+
+                bvh_node left;
+                left.first = node.first;
+                left.count = num_left;
+
+                bvh_node right;
+                right.first = node.first + num_left;
+                right.count = node.count - num_left;
+
+                sb_push(bvh.nodes, left);
+                sb_push(bvh.nodes, right);
+                sb_push(bvh.parents, node_index);
+                sb_push(bvh.parents, node_index);
+
+                build_bvh_node(scene, bvh, centroids, node.child, depth + 1);
+                build_bvh_node(scene, bvh, centroids, node.child + 1, depth + 1);
+
+                bvh_node& built = bvh.nodes[node_index];
+                built.min = min_union(bvh.nodes[node.child].min, bvh.nodes[node.child + 1].min);
+                built.max = max_union(bvh.nodes[node.child].max, bvh.nodes[node.child + 1].max);
+                bvh.cost += surface_area(built.min, built.max);
             }
-        }
 
-        void frustum_cull_aabb_simd256(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
-        {
-            const frustum& frust = cam->camera_frustum;
+            void build_bvh(ecs_scene* scene)
+            {
+                scene_bvh& bvh = scene->bvh;
+                u32        num = (u32)scene->num_entities;
 
-            // pad to 8
-            u32 xn = sb_count(entities_in);
-            u32 yn = PEN_ALIGN(xn, 8);
-            for (u32 i = 0; i < yn - xn; ++i)
-                sb_push(entities_in, entities_in[0]);
+                sb_clear(bvh.nodes);
+                sb_clear(bvh.parents);
+                sb_clear(bvh.entities);
+                sb_clear(bvh.leaves);
 
-            // splat constants
-            __m256 zero = _mm256_set1_ps(0.0f);
+                sb_add(bvh.leaves, num);
+                for (u32 n = 0; n < num; ++n)
+                {
+                    bvh.leaves[n] = PEN_INVALID_HANDLE;
+                    if (bvh_member(scene, n))
+                        sb_push(bvh.entities, n);
+                }
 
-            // sphere radius and position
-            __m256 posx;
-            __m256 posy;
-            __m256 posz;
-            __m256 extx;
-            __m256 exty;
-            __m256 extz;
+                bvh_node root;
+                root.first = 0;
+                root.count = sb_count(bvh.entities);
+                sb_push(bvh.nodes, root);
+                sb_push(bvh.parents, 0);
+
+                vec3f* centroids = (vec3f*)memory_alloc(sizeof(vec3f) * max<u32>(root.count, 1));
+                for (u32 i = 0; i < root.count; ++i)
+                    centroids[i] = scene->pos_extent[bvh.entities[i]].pos.xyz;
+
+                bvh.cost = 0.0f;
+                build_bvh_node(scene, bvh, centroids, 0, 0);
+                memory_free(centroids);
+                bvh.build_cost = bvh.cost;
+                bvh.rebuilds++;
+            }
 
-            // plane normal
-            __m256 pnx[6];
-            __m256 pny[6];
-            __m256 pnz[6];
+            // recomputes node bounds from its entities or children, returns false if they did not change
+            bool refit_bvh_node(const ecs_scene* scene, scene_bvh& bvh, u32 node_index)
+            {
+                bvh_node& node = bvh.nodes[node_index];
 
-            // sign flip
-            __m256 sfx[6];
-            __m256 sfy[6];
-            __m256 sfz[6];
+                vec3f min, max;
+                if (is_valid(node.child))
+                {
+                    const bvh_node& l = bvh.nodes[node.child];
+                    const bvh_node& r = bvh.nodes[node.child + 1];
+                    min = min_union(l.min, r.min);
+                    max = max_union(l.max, r.max);
+                }
+                else
+                {
+                    bvh_range_bounds(scene, bvh, node.first, node.count, min, max);
+                }
+
+                if (memcmp(&min, &node.min, sizeof(vec3f)) == 0 && memcmp(&max, &node.max, sizeof(vec3f)) == 0)
+                    return false;
+
+                bvh.cost += surface_area(min, max) - surface_area(node.min, node.max);
+                node.min = min;
+                node.max = max;
+                return true;
+            }
+        } // namespace
 
-            // plane distance
-            __m256 pd[6];
-            __m256 pd_neg[6];
+        void update_bvh(ecs_scene* scene)
+        {
+            scene_bvh& bvh = scene->bvh;
+            u32        num = (u32)scene->num_entities;
 
-            f32 result[8];
-            u32 e[8];
+            // renderables added or removed
+            bool rebuild = !bvh.nodes || sb_count(bvh.leaves) != num;
 
-            // load camera planes
-            for (s32 p = 0; p < 6; ++p)
+            u32*      dirty_leaves = nullptr;
+            const u8* bounds_dirty = scene->hierarchy.bounds_dirty;
+            for (u32 n = 0; n < num && !rebuild; ++n)
             {
-                f32 ppd = maths::plane_distance(frust.p[p], frust.n[p]);
-                pnx[p] = _mm256_set1_ps(frust.n[p].x);
-                pny[p] = _mm256_set1_ps(frust.n[p].y);
-                pnz[p] = _mm256_set1_ps(frust.n[p].z);
-                pd[p] = _mm256_set1_ps(ppd);
-                pd_neg[p] = _mm256_set1_ps(-ppd);
+                bool member = bvh_member(scene, n);
+                if (member != is_valid(bvh.leaves[n]))
+                {
+                    rebuild = true;
+                    break;
+                }
 
-                sfx[p] = _mm256_set1_ps(sgn(frust.n[p].x) * -1.0f);
-                sfy[p] = _mm256_set1_ps(sgn(frust.n[p].y) * -1.0f);
-                sfz[p] = _mm256_set1_ps(sgn(frust.n[p].z) * -1.0f);
+                if (member && bounds_dirty && bounds_dirty[n])
+                    sb_push(dirty_leaves, bvh.leaves[n]);
             }
 
-            // n is number of entities + padding for alignment
-            u32 n = sb_count(entities_in);
-            for (u32 i = 0; i < n; i += 8)
-            {
-                // unpack entities
-                for (u32 j = 0; j < 8; ++j)
-                    e[j] = entities_in[i + j];
-
-                // load entities values
-                auto& p0 = scene->pos_extent[e[0]].pos;
-                auto& p1 = scene->pos_extent[e[1]].pos;
-                auto& p2 = scene->pos_extent[e[2]].pos;
-                auto& p3 = scene->pos_extent[e[3]].pos;
-                auto& p4 = scene->pos_extent[e[4]].pos;
-                auto& p5 = scene->pos_extent[e[5]].pos;
-                auto& p6 = scene->pos_extent[e[6]].pos;
-                auto& p7 = scene->pos_extent[e[7]].pos;
-                auto& e0 = scene->pos_extent[e[0]].extent;
-                auto& e1 = scene->pos_extent[e[1]].extent;
-                auto& e2 = scene->pos_extent[e[2]].extent;
-                auto& e3 = scene->pos_extent[e[3]].extent;
-                auto& e4 = scene->pos_extent[e[4]].extent;
-                auto& e5 = scene->pos_extent[e[5]].extent;
-                auto& e6 = scene->pos_extent[e[6]].extent;
-                auto& e7 = scene->pos_extent[e[7]].extent;
-
-                posx = _mm256_set_ps(p0.x, p1.x, p2.x, p3.x, p4.x, p5.x, p6.x, p7.x);
-                posy = _mm256_set_ps(p0.y, p1.y, p2.y, p3.y, p4.y, p5.y, p6.y, p7.y);
-                posz = _mm256_set_ps(p0.z, p1.z, p2.z, p3.z, p4.z, p5.z, p6.z, p7.z);
-                extx = _mm256_set_ps(e0.x, e1.x, e2.x, e3.x, e4.x, e5.x, e6.x, e7.x);
-                exty = _mm256_set_ps(e0.y, e1.y, e2.y, e3.y, e4.y, e5.y, e6.y, e7.y);
-                extz = _mm256_set_ps(e0.z, e1.z, e2.z, e3.z, e4.z, e5.z, e6.z, e7.z);
-
-                __m256 inside = _mm256_set1_ps(0.0f);
+            if (!rebuild)
+            {
+                // leaves first so each walk up to the root sees its siblings final bounds, a walk stops at the first
+                // node that did not change
+                u32 num_dirty = sb_count(dirty_leaves);
+                for (u32 i = 0; i < num_dirty; ++i)
+                    refit_bvh_node(scene, bvh, dirty_leaves[i]);
 
-                for (s32 p = 0; p < 6; ++p)
+                for (u32 i = 0; i < num_dirty; ++i)
                 {
-                    // get distance to plane
-                    // dot product with plane normal and also add plane distance
-                    __m256 dd = _mm256_fmadd_ps(posx, pnx[p], pd[p]);
-                    dd = _mm256_fmadd_ps(posy, pny[p], dd);
-                    dd = _mm256_fmadd_ps(posz, pnz[p], dd);
+                    u32 node = dirty_leaves[i];
+                    while (node != 0)
+                    {
+                        node = bvh.parents[node];
+                        if (!refit_bvh_node(scene, bvh, node))
+                            break;
+                    }
+                }
 
-                    // pos + extent * sign_flip
-                    __m256 dpx = _mm256_fmadd_ps(extx, sfx[p], posx);
-                    __m256 dpy = _mm256_fmadd_ps(exty, sfy[p], posy);
-                    __m256 dpz = _mm256_fmadd_ps(extz, sfz[p], posz);
+                // moving entities stretch nodes, rebuild once culling has become too loose
+                rebuild = bvh.cost > bvh.build_cost * k_bvh_rebuild_cost;
+            }
+
+            if (rebuild)
+                build_bvh(scene);
+
+            sb_free(dirty_leaves);
+        }
+
+        void frustum_cull_bvh(const ecs_scene* scene, const camera* cam, u32** entities_out)
+        {
+            render_frame     rf = get_render_frame(scene);
+            const scene_bvh& bvh = rf.bvh;
+            if (!bvh.nodes)
+                return;
 
-                    // dot(pos + extent * sign_flip, frust.n[p]);
-                    __m256 r = _mm256_mul_ps(dpx, pnx[p]);
-                    r = _mm256_fmadd_ps(dpy, pny[p], r);
-                    r = _mm256_fmadd_ps(dpz, pnz[p], r);
+            cull_planes planes;
+            get_cull_planes(cam, planes);
+
+            // nodes to visit with the planes they may still intersect, planes a parent is fully inside are skipped
+            struct bvh_visit
+            {
+                u32 node;
+                u32 planes;
+            };
+
+            bvh_visit stack[k_bvh_max_depth + 1];
+            u32       sp = 0;
+            stack[sp++] = {0, 0x3f};
+
+            while (sp > 0)
+            {
+                bvh_visit       v = stack[--sp];
+                const bvh_node& node = bvh.nodes[v.node];
+                if (node.count == 0)
+                    continue;
+
+                vec3f c = (node.min + node.max) * 0.5f;
+                vec3f e = (node.max - node.min) * 0.5f;
+
+                bool outside = false;
+                for (u32 p = 0; p < 6; ++p)
+                {
+                    if (!(v.planes & (1 << p)))
+                        continue;
 
-                    // if(r > -pd) inside = false
-                    __m256 diff = _mm256_sub_ps(r, pd_neg[p]);
-                    diff = _mm256_max_ps(diff, zero);
-                    inside = _mm256_add_ps(diff, inside);
+                    f32 d = c.x * planes.nx[p] + c.y * planes.ny[p] + c.z * planes.nz[p] + planes.d[p];
+                    f32 r = e.x * planes.ax[p] + e.y * planes.ay[p] + e.z * planes.az[p];
+
+                    if (d > r)
+                    {
+                        outside = true;
+                        break;
+                    }
+
+                    if (d < -r)
+                        v.planes &= ~(1 << p);
+                }
+
+                if (outside)
+                    continue;
+
+                // fully inside or a leaf, output entities that pass the remaining planes
+                if (!v.planes || !is_valid(node.child))
+                {
+                    for (u32 i = node.first; i < node.first + node.count; ++i)
+                    {
+                        u32 n = bvh.entities[i];
+                        if (rf.state_flags[n] & e_state::hidden)
+                            continue;
+
+                        const cmp_pos_extent& pe = rf.pos_extent[n];
+
+                        bool inside = true;
+                        for (u32 p = 0; p < 6; ++p)
+                        {
+                            if (!(v.planes & (1 << p)))
+                                continue;
+
+                            f32 d = pe.pos.x * planes.nx[p] + pe.pos.y * planes.ny[p] + pe.pos.z * planes.nz[p] + planes.d[p];
+                            f32 r = pe.extent.x * planes.ax[p] + pe.extent.y * planes.ay[p] + pe.extent.z * planes.az[p];
+
+                            if (d > r)
+                            {
+                                inside = false;
+                                break;
+                            }
+                        }
+
+                        if (inside)
+                            sb_push(*entities_out, n);
+                    }
+                    continue;
                 }
 
-                _mm256_store_ps(result, inside);
-                for (u32 j = 0; j < 8; ++j)
-                    if (!result[j])
-                        sb_push(*entities_out, e[7 - j]);
+                stack[sp++] = {node.child + 1, v.planes};
+                stack[sp++] = {node.child, v.planes};
             }
         }
-#endif
+
         //
-        // Arm neon simd 128 implementation
+        // software occlusion
         //
 
-#ifdef __ARM_NEON__
-        void frustum_cull_aabb_simd128(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
+        namespace
         {
-        }
+            const u32 k_occlusion_width = 256;
+            const u32 k_occlusion_height = 128;
+            const u32 k_occlusion_band_rows = 8;
+            const u32 k_occlusion_tri_floats = 9;
 
-        void frustum_cull_sphere_simd128(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
-        {
-        }
+            // row major matrix * (p, 1)
+            inline vec4f transform_point(const mat4& m, f32 x, f32 y, f32 z)
+            {
+                return vec4f(m.m[0] * x + m.m[1] * y + m.m[2] * z + m.m[3], m.m[4] * x + m.m[5] * y + m.m[6] * z + m.m[7],
+                             m.m[8] * x + m.m[9] * y + m.m[10] * z + m.m[11],
+                             m.m[12] * x + m.m[13] * y + m.m[14] * z + m.m[15]);
+            }
+
+            bool occlusion_enabled_for(const camera* cam)
+            {
+                // 1/w is constant with an orthographic projection so there is no depth to compare
+                return !(cam->flags & e_camera_flags::orthographic);
+            }
+
+            // transforms the triangles of one occluder to screen space, triangles crossing the near plane are written
+            // degenerate and skipped by the rasteriser
+            void transform_occluder(const render_frame& rf, const mat4& vp, occlusion_buffer& ob, u32 i, f32 near_plane)
+            {
+                u32                   n = ob.occluders[i];
+                const pmm_renderable* r = ob.geometry[i];
+                mat4                  wvp = vp * (mat4)rf.world_matrices[n];
+
+                const vec4f* pb = (const vec4f*)r->cpu_vertex_buffer;
+                const u16*   i16 = (const u16*)r->cpu_index_buffer;
+                const u32*   i32 = (const u32*)r->cpu_index_buffer;
+                bool         short_indices = r->index_type == PEN_FORMAT_R16_UINT;
+
+                f32* out = ob.tris + ob.tri_offsets[i] * k_occlusion_tri_floats;
+                f32  hw = (f32)ob.width * 0.5f;
+                f32  hh = (f32)ob.height * 0.5f;
+
+                u32 num_tris = r->num_indices / 3;
+                for (u32 t = 0; t < num_tris; ++t)
+                {
+                    bool clipped = false;
+                    for (u32 v = 0; v < 3; ++v)
+                    {
+                        u32          index = short_indices ? i16[t * 3 + v] : i32[t * 3 + v];
+                        const vec4f& p = pb[index];
+                        vec4f        c = transform_point(wvp, p.x, p.y, p.z);
+
+                        if (c.w < near_plane)
+                        {
+                            clipped = true;
+                            break;
+                        }
+
+                        f32 inv_w = 1.0f / c.w;
+                        out[v * 3 + 0] = (c.x * inv_w + 1.0f) * hw;
+                        out[v * 3 + 1] = (1.0f - c.y * inv_w) * hh;
+                        out[v * 3 + 2] = inv_w;
+                    }
+
+                    if (clipped)
+                        memset(out, 0x0, sizeof(f32) * k_occlusion_tri_floats);
+
+                    out += k_occlusion_tri_floats;
+                }
+            }
+
+            // conservative rasterisation of the triangles overlapping rows [y_begin, y_end). only pixels whose whole area
+            // is inside a triangle are written and depth is pushed back by the gradient across half a pixel so the
+            // buffer never holds an occluder nearer than the real surface
+            void rasterise_band(occlusion_buffer& ob, u32 y_begin, u32 y_end)
+            {
+                u32 num_tris = sb_count(ob.tris) / k_occlusion_tri_floats;
+                for (u32 t = 0; t < num_tris; ++t)
+                {
+                    const f32* tri = ob.tris + t * k_occlusion_tri_floats;
+
+                    f32 x0 = tri[0], y0 = tri[1], z0 = tri[2];
+                    f32 x1 = tri[3], y1 = tri[4], z1 = tri[5];
+                    f32 x2 = tri[6], y2 = tri[7], z2 = tri[8];
+
+                    f32 area = (x1 - x0) * (y2 - y0) - (x2 - x0) * (y1 - y0);
+                    if (fabs(area) < 1e-6f)
+                        continue;
+
+                    // wind consistently so inside is positive for all edges, occluders are drawn double sided
+                    if (area < 0.0f)
+                    {
+                        std::swap(x1, x2);
+                        std::swap(y1, y2);
+                        std::swap(z1, z2);
+                        area = -area;
+                    }
+
+                    f32 min_y = std::min(y0, std::min(y1, y2));
+                    f32 max_y = std::max(y0, std::max(y1, y2));
+                    f32 min_x = std::min(x0, std::min(x1, x2));
+                    f32 max_x = std::max(x0, std::max(x1, x2));
+
+                    if (max_y < (f32)y_begin || min_y >= (f32)y_end || max_x < 0.0f || min_x >= (f32)ob.width)
+                        continue;
+
+                    // edge functions e = a * x + b * y + c, opposite vertex 0, 1 and 2
+                    f32 ea[3] = {y1 - y2, y2 - y0, y0 - y1};
+                    f32 eb[3] = {x2 - x1, x0 - x2, x1 - x0};
+                    f32 ec[3] = {-(ea[0] * x1 + eb[0] * y1), -(ea[1] * x2 + eb[1] * y2), -(ea[2] * x0 + eb[2] * y0)};
+
+                    // a pixel is fully inside an edge when its centre is half a pixel further in than the edge
+                    f32 et[3];
+                    for (u32 e = 0; e < 3; ++e)
+                        et[e] = 0.5f * (fabs(ea[e]) + fabs(eb[e]));
+
+                    // 1/w plane, offset to the furthest point within a pixel
+                    f32 inv_area = 1.0f / area;
+                    f32 za = (ea[0] * z0 + ea[1] * z1 + ea[2] * z2) * inv_area;
+                    f32 zb = (eb[0] * z0 + eb[1] * z1 + eb[2] * z2) * inv_area;
+                    f32 zc = (ec[0] * z0 + ec[1] * z1 + ec[2] * z2) * inv_area - 0.5f * (fabs(za) + fabs(zb));
+                    f32 zmin = std::min(z0, std::min(z1, z2));
+
+                    // clamp before converting, vertices near the w = near plane can be far off screen
+                    s32 px0 = (s32)std::max(min_x, 0.0f) & ~3;
+                    s32 px1 = (s32)std::min(max_x, (f32)ob.width - 1.0f);
+                    s32 py0 = (s32)std::max(min_y, (f32)y_begin);
+                    s32 py1 = (s32)std::min(max_y, (f32)y_end - 1.0f);
+
+                    for (s32 py = py0; py <= py1; ++py)
+                    {
+                        f32  cy = (f32)py + 0.5f;
+                        f32* row = ob.depth + py * ob.width;
+
+#if PUT_SIMD_SSE2
+                        __m128 step = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+                        __m128 e0y = _mm_set1_ps(eb[0] * cy + ec[0]);
+                        __m128 e1y = _mm_set1_ps(eb[1] * cy + ec[1]);
+                        __m128 e2y = _mm_set1_ps(eb[2] * cy + ec[2]);
+                        __m128 zy = _mm_set1_ps(zb * cy + zc);
+
+                        for (s32 px = px0; px <= px1; px += 4)
+                        {
+                            __m128 cx = _mm_add_ps(_mm_set1_ps((f32)px), step);
+
+                            __m128 e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(ea[0]), cx), e0y);
+                            __m128 e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(ea[1]), cx), e1y);
+                            __m128 e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(ea[2]), cx), e2y);
+
+                            __m128 inside = _mm_cmpge_ps(e0, _mm_set1_ps(et[0]));
+                            inside = _mm_and_ps(inside, _mm_cmpge_ps(e1, _mm_set1_ps(et[1])));
+                            inside = _mm_and_ps(inside, _mm_cmpge_ps(e2, _mm_set1_ps(et[2])));
+
+                            if (_mm_movemask_ps(inside) == 0)
+                                continue;
+
+                            __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(za), cx), zy);
+                            z = _mm_max_ps(z, _mm_set1_ps(zmin));
+
+                            __m128 d = _mm_load_ps(row + px);
+                            __m128 nd = _mm_max_ps(d, z);
+                            _mm_store_ps(row + px, _mm_or_ps(_mm_and_ps(inside, nd), _mm_andnot_ps(inside, d)));
+                        }
+#else
+                        for (s32 px = px0; px <= px1; ++px)
+                        {
+                            f32 cx = (f32)px + 0.5f;
+
+                            bool inside = true;
+                            for (u32 e = 0; e < 3; ++e)
+                                inside &= ea[e] * cx + eb[e] * cy + ec[e] >= et[e];
+
+                            if (!inside)
+                                continue;
+
+                            f32 z = std::max(za * cx + zb * cy + zc, zmin);
+                            row[px] = std::max(row[px], z);
+                        }
+#endif
+                    }
+                }
+            }
+
+            // bounds are hidden when every pixel their screen rect touches has an occluder nearer than their nearest point
+            bool aabb_occluded(const occlusion_buffer& ob, const mat4& vp, const cmp_pos_extent& pe, f32 near_plane)
+            {
+                f32 min_x = FLT_MAX, min_y = FLT_MAX;
+                f32 max_x = -FLT_MAX, max_y = -FLT_MAX;
+                f32 max_inv_w = 0.0f;
+
+                for (u32 c = 0; c < 8; ++c)
+                {
+                    f32   x = pe.pos.x + ((c & 1) ? pe.extent.x : -pe.extent.x);
+                    f32   y = pe.pos.y + ((c & 2) ? pe.extent.y : -pe.extent.y);
+                    f32   z = pe.pos.z + ((c & 4) ? pe.extent.z : -pe.extent.z);
+                    vec4f cp = transform_point(vp, x, y, z);
+
+                    // crosses the near plane, the camera may be inside
+                    if (cp.w < near_plane)
+                        return false;
+
+                    f32 inv_w = 1.0f / cp.w;
+                    f32 sx = (cp.x * inv_w + 1.0f) * (f32)ob.width * 0.5f;
+                    f32 sy = (1.0f - cp.y * inv_w) * (f32)ob.height * 0.5f;
+
+                    min_x = std::min(min_x, sx);
+                    max_x = std::max(max_x, sx);
+                    min_y = std::min(min_y, sy);
+                    max_y = std::max(max_y, sy);
+                    max_inv_w = std::max(max_inv_w, inv_w);
+                }
+
+                // off screen is left to the frustum cull
+                if (max_x < 0.0f || max_y < 0.0f || min_x >= (f32)ob.width || min_y >= (f32)ob.height)
+                    return false;
+
+                s32 x0 = (s32)std::max(min_x, 0.0f);
+                s32 x1 = (s32)std::min(max_x, (f32)ob.width - 1.0f);
+                s32 y0 = (s32)std::max(min_y, 0.0f);
+                s32 y1 = (s32)std::min(max_y, (f32)ob.height - 1.0f);
+
+                for (s32 y = y0; y <= y1; ++y)
+                {
+                    const f32* row = ob.depth + y * ob.width;
+                    s32        x = x0;
+
+#if PUT_SIMD_SSE2
+                    __m128 box = _mm_set1_ps(max_inv_w);
+                    for (; x + 3 <= x1; x += 4)
+                        if (_mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(row + x), box)))
+                            return false;
 #endif
-        void frustum_cull_simd_init()
+                    for (; x <= x1; ++x)
+                        if (row[x] <= max_inv_w)
+                            return false;
+                }
+
+                return true;
+            }
+        } // namespace
+
+        void rasterise_occluders(const ecs_scene* scene, const camera* cam, occlusion_buffer& ob)
         {
+            if (!ob.depth)
+            {
+                ob.width = k_occlusion_width;
+                ob.height = k_occlusion_height;
+                ob.depth = (f32*)memory_alloc_align(sizeof(f32) * ob.width * ob.height, 16);
+            }
+
+            memset(ob.depth, 0x0, sizeof(f32) * ob.width * ob.height);
+            sb_reset(ob.occluders);
+            sb_reset(ob.geometry);
+            sb_reset(ob.tri_offsets);
+            sb_reset(ob.tris);
+
+            if (!occlusion_enabled_for(cam))
+                return;
+
+            // occluders and their triangle ranges
+            render_frame rf = get_render_frame(scene);
+            u32          num_tris = 0;
+            u32          nr = sb_count(rf.renderables);
+            for (u32 i = 0; i < nr; ++i)
+            {
+                u32 n = rf.renderables[i];
+                if (!(rf.state_flags[n] & e_state::occluder) || (rf.entities[n] & e_cmp::skinned))
+                    continue;
+
+                geometry_resource* gr = get_geometry_resource(scene->id_geometry[n]);
+                if (!gr)
+                    continue;
+
+                const pmm_renderable& r = gr->renderable[e_pmm_renderable::position_only];
+                if (!r.cpu_vertex_buffer || !r.cpu_index_buffer)
+                    continue;
+
+                sb_push(ob.occluders, n);
+                sb_push(ob.geometry, &r);
+                sb_push(ob.tri_offsets, num_tris);
+                num_tris += r.num_indices / 3;
+            }
+
+            u32 num_occluders = sb_count(ob.occluders);
+            if (num_occluders == 0)
+                return;
+
+            sb_add(ob.tris, num_tris * k_occlusion_tri_floats);
+
+            mat4 vp = cam->proj * cam->view;
+            f32  near_plane = cam->near_plane;
+
+            pen::parallel_for(0, num_occluders, 1, [&](u32 begin, u32 end) {
+                for (u32 i = begin; i < end; ++i)
+                    transform_occluder(rf, vp, ob, i, near_plane);
+            });
+
+            // bands write disjoint rows so need no synchronisation
+            u32 num_bands = (ob.height + k_occlusion_band_rows - 1) / k_occlusion_band_rows;
+            pen::parallel_for(0, num_bands, 1, [&](u32 begin, u32 end) {
+                for (u32 b = begin; b < end; ++b)
+                {
+                    u32 y_begin = b * k_occlusion_band_rows;
+                    rasterise_band(ob, y_begin, std::min(y_begin + k_occlusion_band_rows, ob.height));
+                }
+            });
         }
 
-        void frustum_cull_aabb(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
+        void free_occlusion_buffer(occlusion_buffer& ob)
         {
-            frustum_cull_aabb_scalar(scene, cam, entities_in, entities_out);
-            //frustum_cull_aabb_simd256(scene, cam, entities_in, entities_out);
+            memory_free_align(ob.depth);
+            sb_free(ob.occluders);
+            sb_free(ob.geometry);
+            sb_free(ob.tri_offsets);
+            sb_free(ob.tris);
+            ob = occlusion_buffer();
         }
 
-        void frustum_cull_sphere(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
+        void occlusion_cull(const ecs_scene* scene, const camera* cam, const occlusion_buffer& ob, u32* entities_in,
+                            u32** entities_out)
         {
-            frustum_cull_sphere_scalar(scene, cam, entities_in, entities_out);
-            //frustum_cull_sphere_simd256(scene, cam, entities_in, entities_out);
+            u32 n = sb_count(entities_in);
+
+            if (sb_count(ob.occluders) == 0 || !occlusion_enabled_for(cam))
+            {
+                for (u32 i = 0; i < n; ++i)
+                    sb_push(*entities_out, entities_in[i]);
+                return;
+            }
+
+            render_frame rf = get_render_frame(scene);
+            mat4         vp = cam->proj * cam->view;
+            for (u32 i = 0; i < n; ++i)
+            {
+                u32 e = entities_in[i];
+
+                // occluders are always in front of their own depth so skip the test
+                if (!(rf.state_flags[e] & e_state::occluder))
+                    if (aabb_occluded(ob, vp, rf.pos_extent[e], cam->near_plane))
+                        continue;
+
+                sb_push(*entities_out, e);
+            }
         }
 
         void debug_culling()
@@ -8,17 +8,43 @@ namespace put
     namespace ecs
     {
         struct ecs_scene;
+        struct occlusion_buffer;
+        struct render_frame;
 
         // run time detect of simd extensions and setup function pointers to the fastest implementation
         void simd_init();
 
+        // geometry and material, not hidden or a sub instance
+        bool is_renderable(const ecs_scene* scene, u32 entity);
+        bool is_renderable(const render_frame& rf, u32 entity);
+
+        // adds and removes entities in scene->renderables whose flags changed since the last update
+        void update_renderables(ecs_scene* scene);
+
+        // culling reads the render frame of the scene, see get_render_frame
         // frustum_cull_xxx_scalar versions scalar float cross platform implementations,
         void filter_entities_scalar(const ecs_scene* scene, u32** filtered_entities_out);
         void frustum_cull_aabb_scalar(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out);
         void frustum_cull_sphere_scalar(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out);
 
-        // frustum_cull_xxx functions are replaced by simd where available and fall back to scalar if no simd is available
+        // frustum_cull_xxx functions use the widest simd kernel allowed by simd_get_level and fall back to scalar,
+        // entities_in is not modified and output keeps the order of entities_in
         void frustum_cull_aabb(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out);
         void frustum_cull_sphere(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out);
+
+        // builds or refits scene->bvh, called by update_scene once bounds are up to date
+        void update_bvh(ecs_scene* scene);
+
+        // hierarchical frustum cull of renderable entities, replaces filter_entities + frustum_cull_aabb
+        void frustum_cull_bvh(const ecs_scene* scene, const camera* cam, u32** entities_out);
+
+        // software occlusion, entities flagged e_state::occluder are rasterised from their position only cpu buffers into
+        // a low resolution depth buffer, bands of rows are rasterised in parallel. perspective cameras only
+        void rasterise_occluders(const ecs_scene* scene, const camera* cam, occlusion_buffer& ob);
+        void free_occlusion_buffer(occlusion_buffer& ob);
+
+        // removes entities whose bounds are entirely behind the occluders in ob, output keeps the order of entities_in
+        void occlusion_cull(const ecs_scene* scene, const camera* cam, const occlusion_buffer& ob, u32* entities_in,
+                            u32** entities_out);
     } // namespace ecs
 } // namespace put
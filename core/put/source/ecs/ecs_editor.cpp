@@ -1801,6 +1801,30 @@ namespace put
                     }
                 }
             }
+
+            bool occluder = true;
+            for (u32 i = 0; i < num_selected; ++i)
+            {
+                u32 s = scene->selection_list[i];
+                if (!(scene->state_flags[s] & e_state::occluder))
+                    occluder = false;
+            }
+
+            if (ImGui::Checkbox("Occluder", &occluder))
+            {
+                for (u32 i = 0; i < num_selected; ++i)
+                {
+                    u32 s = scene->selection_list[i];
+                    if (occluder)
+                    {
+                        scene->state_flags[s] |= e_state::occluder;
+                    }
+                    else
+                    {
+                        scene->state_flags[s] &= ~e_state::occluder;
+                    }
+                }
+            }
         }
 
         void scene_components_ui(ecs_scene* scene)
@@ -2339,7 +2363,7 @@ namespace put
                     if (changed)
                     {
                         s32 s = selected_index;
-                        scene->world_matrices[s] = mat4::create_identity();
+                        scene->world_matrices[s] = mat3x4::create_identity();
                     }
                 }
                 else
@@ -2553,6 +2577,8 @@ namespace put
                             tree = scene_tree();
                             build_scene_tree(scene, -1, tree);
 
+                            // the flag may be consumed here before the next update sees it
+                            scene->hierarchy.rebuild = true;
                             scene->flags &= ~e_scene_flags::invalidate_scene_tree;
                         }
 
@@ -2707,6 +2733,9 @@ namespace put
 
         void transform_widget(const scene_view& view)
         {
+            // editor views read and edit the live scene
+            wait_for_update(view.scene);
+
             if (pen::input_key(PK_MENU) || pen::input_key(PK_COMMAND))
                 return;
 
@@ -3102,6 +3131,8 @@ namespace put
 
         void render_light_debug(const scene_view& view)
         {
+            wait_for_update(view.scene);
+
             bool selected_only = !(view.scene->view_flags & e_scene_view_flags::lights);
 
             vec2i vpi = vec2i(view.viewport->width, view.viewport->height);
@@ -3170,7 +3201,7 @@ namespace put
 
                         cmp_draw_call dc;
                         dc.world_matrix = scene->world_matrices[n];
-                        dc.world_matrix_inv_transpose = mat4::create_identity();
+                        dc.world_matrix_inv_transpose = mat3x4::create_identity();
                         dc.v2 = vec4f(scene->lights[n].colour, 1.0f);
 
                         pen::renderer_update_buffer(scene->cbuffer[n], &dc, sizeof(cmp_draw_call));
@@ -3187,6 +3218,7 @@ namespace put
         void render_physics_debug(const scene_view& view)
         {
             ecs_scene* scene = view.scene;
+            wait_for_update(scene);
 
             pen::renderer_set_constant_buffer(view.cb_view, 0, pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS);
 
@@ -3234,14 +3266,14 @@ namespace put
 
                         mat4 translation_mat = mat::create_translation(s_physics_preview.offset.translation);
 
-                        dc.world_matrix = translation_mat * scene->world_matrices[n] * scale;
+                        dc.world_matrix = mat3x4(translation_mat) * scene->world_matrices[n] * mat3x4(scale);
                     }
                     else
                     {
                         // from physics instance
                         mat4 scale = mat::create_scale(scene->physics_data[n].rigid_body.dimensions);
                         mat4 rbmat = physics::get_rb_matrix(scene->physics_handles[n]);
-                        dc.world_matrix = rbmat * scale;
+                        dc.world_matrix = mat3x4(rbmat * scale);
                     }
 
                     dc.v2 = vec4f::white();
@@ -3273,6 +3305,8 @@ namespace put
             if (scene->view_flags & e_scene_view_flags::hide_debug)
                 return;
 
+            wait_for_update(scene);
+
             render_physics_debug(view);
 
             if (scene->view_flags & e_scene_view_flags::matrix)
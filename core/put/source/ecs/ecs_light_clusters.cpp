@@ -0,0 +1,720 @@
+// ecs_light_clusters.cpp
+// Copyright 2014 - 2023 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+#include "ecs_light_clusters.h"
+
+#include "ecs_scene.h"
+#include "ecs_simd.h"
+#include "renderer.h"
+#include "threads.h"
+#include "timer.h"
+
+#if PUT_SIMD_SSE2
+#include <immintrin.h>
+#include <xmmintrin.h>
+#endif
+
+using namespace ::pen;
+
+namespace put
+{
+    namespace ecs
+    {
+        namespace
+        {
+            // point_light_attenuation_cutoff reaches 0 at sqrt(5) * radius
+            static const f32 k_point_light_range = 2.2360679f;
+            static const u32 k_max_cluster_lights = 1 << 24; // light index shares a pair with the cluster
+            static const u32 k_light_grain = 256;
+            static const u32 k_min_buffer_capacity = 1024;
+            static const u32 k_no_slices = 0xffff; // first slice > last slice
+
+            namespace e_cluster_light
+            {
+                enum cluster_light_t
+                {
+                    point,
+                    spot
+                };
+            }
+
+            // streams of light_clusters::bounds, each has one value per cluster
+            namespace e_cluster_bounds
+            {
+                enum cluster_bounds_t
+                {
+                    min_x,
+                    min_y,
+                    min_z,
+                    max_x,
+                    max_y,
+                    max_z,
+                    centre_x,
+                    centre_y,
+                    centre_z,
+                    radius,
+                    count
+                };
+            }
+
+            struct cluster_depth
+            {
+                f32 near_plane;
+                f32 far_plane;
+                f32 scale; // slice = log(depth) * scale + bias
+                f32 bias;
+            };
+
+            inline const f32* bounds_stream(const f32* bounds, u32 stream)
+            {
+                return bounds + stream * e_cluster_grid::clusters;
+            }
+
+            f32 slice_depth(const cluster_depth& cd, u32 slice)
+            {
+                return cd.near_plane * powf(cd.far_plane / cd.near_plane, (f32)slice / (f32)e_cluster_grid::slices);
+            }
+
+            u32 depth_slice(const cluster_depth& cd, f32 depth)
+            {
+                f32 s = floorf(logf(std::max(depth, cd.near_plane)) * cd.scale + cd.bias);
+                return (u32)std::min(std::max(s, 0.0f), (f32)e_cluster_grid::slices - 1.0f);
+            }
+
+            // view space aabb and bounding sphere of each cluster in a slice, the camera looks down -z and tile edges are
+            // unprojected at the slice near and far depth
+            void build_slice_bounds(f32* bounds, const mat4& proj, const cluster_depth& cd, u32 slice)
+            {
+                f32 d[2] = {slice_depth(cd, slice), slice_depth(cd, slice + 1)};
+
+                u32 c = slice * e_cluster_grid::slice_clusters;
+                for (u32 y = 0; y < e_cluster_grid::tiles_y; ++y)
+                {
+                    f32 ndc_y[2] = {-1.0f + 2.0f * y / e_cluster_grid::tiles_y,
+                                    -1.0f + 2.0f * (y + 1) / e_cluster_grid::tiles_y};
+
+                    for (u32 x = 0; x < e_cluster_grid::tiles_x; ++x, ++c)
+                    {
+                        f32 ndc_x[2] = {-1.0f + 2.0f * x / e_cluster_grid::tiles_x,
+                                        -1.0f + 2.0f * (x + 1) / e_cluster_grid::tiles_x};
+
+                        vec3f bmin = vec3f(FLT_MAX, FLT_MAX, -d[1]);
+                        vec3f bmax = vec3f(-FLT_MAX, -FLT_MAX, -d[0]);
+                        for (u32 i = 0; i < 2; ++i)
+                        {
+                            for (u32 j = 0; j < 2; ++j)
+                            {
+                                f32 vx = d[i] * (ndc_x[j] + proj.m[2]) / proj.m[0];
+                                f32 vy = d[i] * (ndc_y[j] + proj.m[6]) / proj.m[5];
+                                bmin.x = std::min(bmin.x, vx);
+                                bmin.y = std::min(bmin.y, vy);
+                                bmax.x = std::max(bmax.x, vx);
+                                bmax.y = std::max(bmax.y, vy);
+                            }
+                        }
+
+                        vec3f centre = (bmin + bmax) * 0.5f;
+                        vec3f half = (bmax - bmin) * 0.5f;
+
+                        bounds[e_cluster_bounds::min_x * e_cluster_grid::clusters + c] = bmin.x;
+                        bounds[e_cluster_bounds::min_y * e_cluster_grid::clusters + c] = bmin.y;
+                        bounds[e_cluster_bounds::min_z * e_cluster_grid::clusters + c] = bmin.z;
+                        bounds[e_cluster_bounds::max_x * e_cluster_grid::clusters + c] = bmax.x;
+                        bounds[e_cluster_bounds::max_y * e_cluster_grid::clusters + c] = bmax.y;
+                        bounds[e_cluster_bounds::max_z * e_cluster_grid::clusters + c] = bmax.z;
+                        bounds[e_cluster_bounds::centre_x * e_cluster_grid::clusters + c] = centre.x;
+                        bounds[e_cluster_bounds::centre_y * e_cluster_grid::clusters + c] = centre.y;
+                        bounds[e_cluster_bounds::centre_z * e_cluster_grid::clusters + c] = centre.z;
+                        bounds[e_cluster_bounds::radius * e_cluster_grid::clusters + c] = mag(half);
+                    }
+                }
+            }
+
+            // view space bounds of one light and the range of slices it can reach. the spot attenuation has no range so
+            // cones extend to the far plane, their depth range is bounded only when the whole cone faces away from or
+            // toward the camera
+            void transform_light(light_clusters& lc, u32 i, const mat4& view, const cluster_depth& cd)
+            {
+                const light_data& l = lc.lights[i];
+                const mat4&       m = view;
+
+                vec3f p = l.pos_radius.xyz;
+                vec3f vp = vec3f(m.m[0] * p.x + m.m[1] * p.y + m.m[2] * p.z + m.m[3],
+                                 m.m[4] * p.x + m.m[5] * p.y + m.m[6] * p.z + m.m[7],
+                                 m.m[8] * p.x + m.m[9] * p.y + m.m[10] * p.z + m.m[11]);
+
+                f32 depth = -vp.z;
+                f32 dmin = -FLT_MAX;
+                f32 dmax = FLT_MAX;
+
+                if (l.data.z == (f32)e_cluster_light::point)
+                {
+                    f32 r = l.pos_radius.w * k_point_light_range;
+                    lc.spheres[i] = vec4f(vp, r);
+                    lc.cones[i] = vec4f(0.0f, 0.0f, 0.0f, 0.0f);
+                    dmin = depth - r;
+                    dmax = depth + r;
+                }
+                else
+                {
+                    vec3f d = l.dir_cutoff.xyz;
+                    vec3f vd = vec3f(m.m[0] * d.x + m.m[1] * d.y + m.m[2] * d.z, m.m[4] * d.x + m.m[5] * d.y + m.m[6] * d.z,
+                                     m.m[8] * d.x + m.m[9] * d.y + m.m[10] * d.z);
+
+                    vd = normalize(vd);
+                    f32 cos_angle = std::min(std::max(1.0f - l.dir_cutoff.w, -1.0f), 1.0f);
+
+                    lc.spheres[i] = vec4f(vp, 0.0f);
+                    lc.cones[i] = vec4f(vd, cos_angle);
+
+                    if (cos_angle > 0.0f)
+                    {
+                        f32 half_angle = acosf(cos_angle);
+                        f32 axis_angle = acosf(std::min(std::max(-vd.z, -1.0f), 1.0f));
+
+                        if (axis_angle + half_angle <= (f32)M_PI_2)
+                            dmin = depth;
+                        else if (axis_angle - half_angle >= (f32)M_PI_2)
+                            dmax = depth;
+                    }
+                }
+
+                if (dmax < cd.near_plane || dmin > cd.far_plane)
+                {
+                    lc.light_slices[i] = k_no_slices;
+                    return;
+                }
+
+                u32 first = depth_slice(cd, dmin);
+                u32 last = depth_slice(cd, std::min(dmax, cd.far_plane));
+                lc.light_slices[i] = first | last << 16;
+            }
+
+            //
+            // binning kernels, test one light against the clusters of a slice and push a pair for each overlap
+            //
+
+            typedef void (*bin_light_fn)(const f32* bounds, u32 slice, const vec4f& sphere, const vec4f& cone, u32 light,
+                                         u32** pairs);
+
+            // y bounds of a cluster depend only on its row and slice, rows the sphere misses are skipped whole
+            bool sphere_misses_row(const f32* min_y, const f32* max_y, const vec4f& sphere, u32 row)
+            {
+                f32 dy = std::max(std::max(min_y[row] - sphere.y, sphere.y - max_y[row]), 0.0f);
+                return dy * dy > sphere.w * sphere.w;
+            }
+
+            void bin_point_light_scalar(const f32* bounds, u32 slice, const vec4f& sphere, const vec4f& cone, u32 light,
+                                        u32** pairs)
+            {
+                u32 first = slice * e_cluster_grid::slice_clusters;
+
+                const f32* min_x = bounds_stream(bounds, e_cluster_bounds::min_x) + first;
+                const f32* min_y = bounds_stream(bounds, e_cluster_bounds::min_y) + first;
+                const f32* min_z = bounds_stream(bounds, e_cluster_bounds::min_z) + first;
+                const f32* max_x = bounds_stream(bounds, e_cluster_bounds::max_x) + first;
+                const f32* max_y = bounds_stream(bounds, e_cluster_bounds::max_y) + first;
+                const f32* max_z = bounds_stream(bounds, e_cluster_bounds::max_z) + first;
+
+                f32 r2 = sphere.w * sphere.w;
+
+                for (u32 row = 0; row < e_cluster_grid::slice_clusters; row += e_cluster_grid::tiles_x)
+                {
+                    if (sphere_misses_row(min_y, max_y, sphere, row))
+                        continue;
+
+                    for (u32 c = row; c < row + e_cluster_grid::tiles_x; ++c)
+                    {
+                        f32 dx = std::max(std::max(min_x[c] - sphere.x, sphere.x - max_x[c]), 0.0f);
+                        f32 dy = std::max(std::max(min_y[c] - sphere.y, sphere.y - max_y[c]), 0.0f);
+                        f32 dz = std::max(std::max(min_z[c] - sphere.z, sphere.z - max_z[c]), 0.0f);
+
+                        if (dx * dx + dy * dy + dz * dz <= r2)
+                            sb_push(*pairs, c << 24 | light);
+                    }
+                }
+            }
+
+            // cone against the cluster bounding sphere, conservative where the nearest point of the cone is its apex
+            void bin_spot_light_scalar(const f32* bounds, u32 slice, const vec4f& sphere, const vec4f& cone, u32 light,
+                                       u32** pairs)
+            {
+                u32 first = slice * e_cluster_grid::slice_clusters;
+                f32 cos_angle = cone.w;
+                f32 sin_angle = sqrtf(1.0f - cos_angle * cos_angle);
+
+                for (u32 c = 0; c < e_cluster_grid::slice_clusters; ++c)
+                {
+                    u32 i = first + c;
+                    f32 vx = bounds_stream(bounds, e_cluster_bounds::centre_x)[i] - sphere.x;
+                    f32 vy = bounds_stream(bounds, e_cluster_bounds::centre_y)[i] - sphere.y;
+                    f32 vz = bounds_stream(bounds, e_cluster_bounds::centre_z)[i] - sphere.z;
+                    f32 r = bounds_stream(bounds, e_cluster_bounds::radius)[i];
+
+                    f32 len2 = vx * vx + vy * vy + vz * vz;
+                    f32 along = vx * cone.x + vy * cone.y + vz * cone.z;
+                    f32 closest = cos_angle * sqrtf(std::max(len2 - along * along, 0.0f)) - along * sin_angle;
+
+                    if (closest <= r && along >= -r)
+                        sb_push(*pairs, c << 24 | light);
+                }
+            }
+
+#if PUT_SIMD_SSE2
+            // 4 clusters at a time, slices and rows start on a multiple of 4 clusters so the streams are aligned
+            void push_pairs(u32 mask, u32 c, u32 light, u32** pairs)
+            {
+                for (u32 j = 0; j < 4; ++j)
+                    if (mask & (1 << j))
+                        sb_push(*pairs, (c + j) << 24 | light);
+            }
+
+            void bin_point_light_simd128(const f32* bounds, u32 slice, const vec4f& sphere, const vec4f& cone, u32 light,
+                                         u32** pairs)
+            {
+                u32 first = slice * e_cluster_grid::slice_clusters;
+
+                const f32* min_x = bounds_stream(bounds, e_cluster_bounds::min_x) + first;
+                const f32* min_y = bounds_stream(bounds, e_cluster_bounds::min_y) + first;
+                const f32* min_z = bounds_stream(bounds, e_cluster_bounds::min_z) + first;
+                const f32* max_x = bounds_stream(bounds, e_cluster_bounds::max_x) + first;
+                const f32* max_y = bounds_stream(bounds, e_cluster_bounds::max_y) + first;
+                const f32* max_z = bounds_stream(bounds, e_cluster_bounds::max_z) + first;
+
+                __m128 sx = _mm_set1_ps(sphere.x);
+                __m128 sy = _mm_set1_ps(sphere.y);
+                __m128 sz = _mm_set1_ps(sphere.z);
+                __m128 r2 = _mm_set1_ps(sphere.w * sphere.w);
+                __m128 zero = _mm_setzero_ps();
+
+                for (u32 row = 0; row < e_cluster_grid::slice_clusters; row += e_cluster_grid::tiles_x)
+                {
+                    if (sphere_misses_row(min_y, max_y, sphere, row))
+                        continue;
+
+                    for (u32 c = row; c < row + e_cluster_grid::tiles_x; c += 4)
+                    {
+                        // distance outside the aabb on each axis, 0 inside
+                        __m128 dx = _mm_sub_ps(_mm_load_ps(min_x + c), sx);
+                        __m128 dy = _mm_sub_ps(_mm_load_ps(min_y + c), sy);
+                        __m128 dz = _mm_sub_ps(_mm_load_ps(min_z + c), sz);
+                        dx = _mm_max_ps(_mm_max_ps(dx, _mm_sub_ps(sx, _mm_load_ps(max_x + c))), zero);
+                        dy = _mm_max_ps(_mm_max_ps(dy, _mm_sub_ps(sy, _mm_load_ps(max_y + c))), zero);
+                        dz = _mm_max_ps(_mm_max_ps(dz, _mm_sub_ps(sz, _mm_load_ps(max_z + c))), zero);
+
+                        __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+                        u32 mask = _mm_movemask_ps(_mm_cmple_ps(d2, r2));
+                        if (mask)
+                            push_pairs(mask, c, light, pairs);
+                    }
+                }
+            }
+
+            void bin_spot_light_simd128(const f32* bounds, u32 slice, const vec4f& sphere, const vec4f& cone, u32 light,
+                                        u32** pairs)
+            {
+                u32 first = slice * e_cluster_grid::slice_clusters;
+
+                const f32* cx = bounds_stream(bounds, e_cluster_bounds::centre_x) + first;
+                const f32* cy = bounds_stream(bounds, e_cluster_bounds::centre_y) + first;
+                const f32* cz = bounds_stream(bounds, e_cluster_bounds::centre_z) + first;
+                const f32* cr = bounds_stream(bounds, e_cluster_bounds::radius) + first;
+
+                __m128 ax = _mm_set1_ps(sphere.x);
+                __m128 ay = _mm_set1_ps(sphere.y);
+                __m128 az = _mm_set1_ps(sphere.z);
+                __m128 dx = _mm_set1_ps(cone.x);
+                __m128 dy = _mm_set1_ps(cone.y);
+                __m128 dz = _mm_set1_ps(cone.z);
+                __m128 cos_angle = _mm_set1_ps(cone.w);
+                __m128 sin_angle = _mm_set1_ps(sqrtf(1.0f - cone.w * cone.w));
+                __m128 zero = _mm_setzero_ps();
+
+                for (u32 c = 0; c < e_cluster_grid::slice_clusters; c += 4)
+                {
+                    __m128 vx = _mm_sub_ps(_mm_load_ps(cx + c), ax);
+                    __m128 vy = _mm_sub_ps(_mm_load_ps(cy + c), ay);
+                    __m128 vz = _mm_sub_ps(_mm_load_ps(cz + c), az);
+                    __m128 r = _mm_load_ps(cr + c);
+
+                    __m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz));
+                    __m128 along = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, dx), _mm_mul_ps(vy, dy)), _mm_mul_ps(vz, dz));
+                    __m128 side = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(len2, _mm_mul_ps(along, along)), zero));
+                    __m128 closest = _mm_sub_ps(_mm_mul_ps(cos_angle, side), _mm_mul_ps(along, sin_angle));
+
+                    __m128 hit = _mm_cmple_ps(closest, r);
+                    hit = _mm_and_ps(hit, _mm_cmpge_ps(along, _mm_sub_ps(zero, r)));
+
+                    u32 mask = _mm_movemask_ps(hit);
+                    if (mask)
+                        push_pairs(mask, c, light, pairs);
+                }
+            }
+#endif
+
+            struct bin_kernels
+            {
+                simd_flags   level;
+                bin_light_fn point;
+                bin_light_fn spot;
+            };
+
+            const bin_kernels k_bin_kernels[] = {
+#if PUT_SIMD_SSE2
+                {e_simd::sse2, bin_point_light_simd128, bin_spot_light_simd128},
+#endif
+                {e_simd::scalar, bin_point_light_scalar, bin_spot_light_scalar}};
+
+            const bin_kernels& get_bin_kernels()
+            {
+                simd_flags level = simd_get_level();
+                for (u32 i = 0; i < PEN_ARRAY_SIZE(k_bin_kernels); ++i)
+                    if ((k_bin_kernels[i].level & level) == k_bin_kernels[i].level)
+                        return k_bin_kernels[i];
+
+                return k_bin_kernels[PEN_ARRAY_SIZE(k_bin_kernels) - 1];
+            }
+
+            // bins the lights which reach a slice, then counting sorts the pairs into per cluster ranges of the slice
+            void bin_slice(light_clusters& lc, const bin_kernels& kernels, const mat4& proj, const cluster_depth& cd,
+                           u32 slice)
+            {
+                build_slice_bounds(lc.bounds, proj, cd, slice);
+
+                u32*& pairs = lc.pairs[slice];
+                sb_reset(pairs);
+
+                const u32* lights = lc.slice_lights[slice];
+                u32        num_lights = sb_count(lights);
+                for (u32 l = 0; l < num_lights; ++l)
+                {
+                    u32 i = lights[l];
+                    if (lc.lights[i].data.z == (f32)e_cluster_light::point)
+                    {
+                        kernels.point(lc.bounds, slice, lc.spheres[i], lc.cones[i], i, &pairs);
+                    }
+                    else if (lc.cones[i].w > 0.0f)
+                    {
+                        kernels.spot(lc.bounds, slice, lc.spheres[i], lc.cones[i], i, &pairs);
+                    }
+                    else
+                    {
+                        // cones of 90 degrees or wider can reach every cluster in their depth range
+                        for (u32 c = 0; c < e_cluster_grid::slice_clusters; ++c)
+                            sb_push(pairs, c << 24 | i);
+                    }
+                }
+
+                u32 offsets[e_cluster_grid::slice_clusters] = {0};
+                u32 num_pairs = sb_count(pairs);
+                for (u32 p = 0; p < num_pairs; ++p)
+                    ++offsets[pairs[p] >> 24];
+
+                u32* grid = lc.grid + slice * e_cluster_grid::slice_clusters * 2;
+                u32  offset = 0;
+                for (u32 c = 0; c < e_cluster_grid::slice_clusters; ++c)
+                {
+                    u32 count = offsets[c];
+                    grid[c * 2 + 0] = offset;
+                    grid[c * 2 + 1] = count;
+                    offsets[c] = offset;
+                    offset += count;
+                }
+
+                u32*& indices = lc.slice_indices[slice];
+                sb_reset(indices);
+                if (num_pairs > 0)
+                    sb_add(indices, num_pairs);
+
+                // pairs are pushed light by light so each cluster keeps its lights in ascending order
+                for (u32 p = 0; p < num_pairs; ++p)
+                    indices[offsets[pairs[p] >> 24]++] = pairs[p] & 0xffffff;
+            }
+
+            u32 create_structured_buffer(u32 stride, u32 count)
+            {
+                pen::buffer_creation_params bcp;
+                bcp.usage_flags = PEN_USAGE_DYNAMIC;
+                bcp.bind_flags = PEN_BIND_SHADER_RESOURCE;
+                bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
+                bcp.buffer_size = stride * count;
+                bcp.stride = stride;
+                bcp.data = nullptr;
+
+                return pen::renderer_create_buffer(bcp);
+            }
+
+            // buffers grow to the next power of 2 so they are only recreated while the number of lights is rising
+            void reserve_structured_buffer(u32& buffer, u32& capacity, u32 stride, u32 count)
+            {
+                if (count <= capacity && is_valid(buffer))
+                    return;
+
+                if (is_valid(buffer))
+                    pen::renderer_release_buffer(buffer);
+
+                capacity = std::max(capacity, k_min_buffer_capacity);
+                while (capacity < count)
+                    capacity *= 2;
+
+                buffer = create_structured_buffer(stride, capacity);
+            }
+
+            void upload_light_clusters(light_clusters& lc)
+            {
+                u32 num_lights = sb_count(lc.lights);
+                u32 num_indices = sb_count(lc.indices);
+
+                if (!is_valid(lc.info_buffer))
+                {
+                    pen::buffer_creation_params bcp;
+                    bcp.usage_flags = PEN_USAGE_DYNAMIC;
+                    bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
+                    bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
+                    bcp.buffer_size = sizeof(light_cluster_info);
+                    bcp.data = nullptr;
+
+                    lc.info_buffer = pen::renderer_create_buffer(bcp);
+                    lc.grid_buffer = create_structured_buffer(sizeof(u32) * 2, e_cluster_grid::clusters);
+                }
+
+                reserve_structured_buffer(lc.light_buffer, lc.light_capacity, sizeof(light_data), num_lights);
+                reserve_structured_buffer(lc.index_buffer, lc.index_capacity, sizeof(u32), num_indices);
+
+                pen::renderer_update_buffer(lc.info_buffer, &lc.info, sizeof(light_cluster_info));
+                pen::renderer_update_buffer(lc.grid_buffer, lc.grid, sizeof(u32) * 2 * e_cluster_grid::clusters);
+
+                if (num_lights > 0)
+                    pen::renderer_update_buffer(lc.light_buffer, lc.lights, sizeof(light_data) * num_lights);
+
+                if (num_indices > 0)
+                    pen::renderer_update_buffer(lc.index_buffer, lc.indices, sizeof(u32) * num_indices);
+            }
+        } // namespace
+
+        void gather_cluster_lights(ecs_scene* scene)
+        {
+            light_clusters& lc = scene->clusters;
+            lc.built = false;
+            sb_reset(lc.lights);
+
+            if (!(scene->flags & e_scene_flags::clustered_lights))
+                return;
+
+            // shadow maps and omni shadow maps are assigned in entity order by render_shadow_views and
+            // render_omni_shadow_views
+            u32 shadow_index = 0;
+            u32 omni_shadow_index = 0;
+            const entity_query& light_query = get_entity_query(scene, e_query::light);
+            for (u32 i = 0; i < sb_count(light_query.entities); ++i)
+            {
+                u32              n = light_query.entities[i];
+                const cmp_light& l = scene->lights[n];
+
+                u32 sm = shadow_index;
+                u32 osm = omni_shadow_index;
+
+                if (l.flags & (e_light_flags::shadow_map | e_light_flags::global_illumination))
+                    ++shadow_index;
+
+                if (l.flags & e_light_flags::omni_shadow_map)
+                    ++omni_shadow_index;
+
+                const cmp_transform& t = scene->transforms[n];
+
+                light_data ld = {};
+                if (l.type == e_light_type::point)
+                {
+                    bool shadow = (l.flags & e_light_flags::omni_shadow_map) && osm < e_scene_limits::max_omni_shadow_maps;
+                    ld.pos_radius = vec4f(t.translation, l.radius);
+                    ld.colour = vec4f(l.colour, shadow ? 1.0f : 0.0f);
+                    ld.data = vec4f(0.0f, (f32)osm, (f32)e_cluster_light::point, 0.0f);
+                }
+                else if (l.type == e_light_type::spot)
+                {
+                    vec3f dir = normalize(-scene->world_matrices[n].get_column(1).xyz);
+
+                    bool shadow = (l.flags & e_light_flags::shadow_map) && sm < e_scene_limits::max_shadow_maps;
+                    ld.pos_radius = vec4f(t.translation, l.radius);
+                    ld.dir_cutoff = vec4f(dir, l.cos_cutoff);
+                    ld.colour = vec4f(l.colour, shadow ? 1.0f : 0.0f);
+                    ld.data = vec4f(l.spot_falloff, (f32)sm, (f32)e_cluster_light::spot, 0.0f);
+                }
+                else
+                {
+                    continue;
+                }
+
+                sb_push(lc.lights, ld);
+            }
+
+            PEN_ASSERT(sb_count(lc.lights) < k_max_cluster_lights);
+        }
+
+        void build_light_clusters(light_clusters& lc, const camera* cam, bool parallel)
+        {
+            f64 start = pen::get_time_ms();
+
+            cluster_depth cd;
+            cd.near_plane = cam->near_plane;
+            cd.far_plane = cam->far_plane;
+            cd.scale = (f32)e_cluster_grid::slices / logf(cd.far_plane / cd.near_plane);
+            cd.bias = -logf(cd.near_plane) * cd.scale;
+
+            u32 num_lights = sb_count(lc.lights);
+
+            lc.view = cam->view;
+            lc.proj = cam->proj;
+            lc.info.dims = vec4f(e_cluster_grid::tiles_x, e_cluster_grid::tiles_y, e_cluster_grid::slices, num_lights);
+            lc.info.slice = vec4f(cd.scale, cd.bias, 0.0f, 0.0f);
+
+            if (!lc.bounds)
+            {
+                lc.bounds = (f32*)memory_alloc_align(sizeof(f32) * e_cluster_bounds::count * e_cluster_grid::clusters, 16);
+                lc.grid = (u32*)memory_alloc(sizeof(u32) * 2 * e_cluster_grid::clusters);
+            }
+
+            sb_reset(lc.spheres);
+            sb_reset(lc.cones);
+            sb_reset(lc.light_slices);
+            if (num_lights > 0)
+            {
+                sb_add(lc.spheres, num_lights);
+                sb_add(lc.cones, num_lights);
+                sb_add(lc.light_slices, num_lights);
+            }
+
+            auto transform_lights = [&](u32 begin, u32 end) {
+                for (u32 i = begin; i < end; ++i)
+                    transform_light(lc, i, cam->view, cd);
+            };
+
+            if (parallel)
+                pen::parallel_for(0, num_lights, k_light_grain, transform_lights);
+            else
+                transform_lights(0, num_lights);
+
+            // lights are listed in each slice they reach so slices only visit their own lights
+            for (u32 s = 0; s < e_cluster_grid::slices; ++s)
+                sb_reset(lc.slice_lights[s]);
+
+            for (u32 i = 0; i < num_lights; ++i)
+            {
+                u32 first = lc.light_slices[i] & 0xffff;
+                u32 last = lc.light_slices[i] >> 16;
+                for (u32 s = first; s <= last; ++s)
+                    sb_push(lc.slice_lights[s], i);
+            }
+
+            // slices write disjoint ranges of the grid and their own scratch so need no synchronisation
+            const bin_kernels& kernels = get_bin_kernels();
+            auto bin_slices = [&](u32 begin, u32 end) {
+                for (u32 s = begin; s < end; ++s)
+                    bin_slice(lc, kernels, cam->proj, cd, s);
+            };
+
+            if (parallel)
+                pen::parallel_for(0, e_cluster_grid::slices, 1, bin_slices);
+            else
+                bin_slices(0, e_cluster_grid::slices);
+
+            // concatenate slices, offsets in the grid become global
+            sb_reset(lc.indices);
+            u32 offset = 0;
+            for (u32 s = 0; s < e_cluster_grid::slices; ++s)
+            {
+                u32* grid = lc.grid + s * e_cluster_grid::slice_clusters * 2;
+                for (u32 c = 0; c < e_cluster_grid::slice_clusters; ++c)
+                    grid[c * 2] += offset;
+
+                u32 count = sb_count(lc.slice_indices[s]);
+                if (count > 0)
+                    memcpy(sb_add(lc.indices, count), lc.slice_indices[s], sizeof(u32) * count);
+
+                offset += count;
+            }
+
+            lc.built = true;
+            lc.build_ms = pen::get_time_ms() - start;
+        }
+
+        bool light_clusters_enabled(const ecs_scene* scene, const camera* cam)
+        {
+            if (!(scene->flags & e_scene_flags::clustered_lights))
+                return false;
+
+            // tiles are built from a perspective projection
+            if (cam->flags & e_camera_flags::orthographic)
+                return false;
+
+            return pen::renderer_get_info().caps & PEN_CAPS_STRUCTURED_BUFFER;
+        }
+
+        void bind_light_clusters(ecs_scene* scene, const camera* cam)
+        {
+            light_clusters& lc = scene->clusters;
+
+            // views recorded into command lists share the clusters, each uploads its own so the buffers hold the right
+            // camera whichever order the lists were recorded in. jobs run while waiting on parallel_for could take
+            // the lock again so the build is serial
+            bool recording = pen::renderer_recording_cmd_list();
+            static pen::mutex* s_record_mutex = pen::mutex_create();
+            if (recording)
+                pen::mutex_lock(s_record_mutex);
+
+            bool same_camera = memcmp(&lc.view, &cam->view, sizeof(mat4)) == 0;
+            same_camera &= memcmp(&lc.proj, &cam->proj, sizeof(mat4)) == 0;
+
+            bool rebuild = !lc.built || !same_camera;
+            if (rebuild)
+                build_light_clusters(lc, cam, !recording);
+
+            if (rebuild || recording || !lc.uploaded)
+                upload_light_clusters(lc);
+
+            lc.uploaded = !recording;
+
+            u32 flags = pen::SBUFFER_BIND_PS | pen::SBUFFER_BIND_READ;
+            pen::renderer_set_structured_buffer(lc.light_buffer, e_global_textures::cluster_lights, flags);
+            pen::renderer_set_structured_buffer(lc.grid_buffer, e_global_textures::cluster_grid, flags);
+            pen::renderer_set_structured_buffer(lc.index_buffer, e_global_textures::cluster_indices, flags);
+            pen::renderer_set_constant_buffer(lc.info_buffer, 12, pen::CBUFFER_BIND_PS);
+
+            if (recording)
+                pen::mutex_unlock(s_record_mutex);
+        }
+
+        void free_light_clusters(light_clusters& lc)
+        {
+            sb_free(lc.lights);
+            sb_free(lc.spheres);
+            sb_free(lc.cones);
+            sb_free(lc.light_slices);
+            sb_free(lc.indices);
+
+            for (u32 s = 0; s < e_cluster_grid::slices; ++s)
+            {
+                sb_free(lc.slice_lights[s]);
+                sb_free(lc.pairs[s]);
+                sb_free(lc.slice_indices[s]);
+                lc.slice_lights[s] = nullptr;
+                lc.pairs[s] = nullptr;
+                lc.slice_indices[s] = nullptr;
+            }
+
+            memory_free_align(lc.bounds);
+            memory_free(lc.grid);
+
+            lc.lights = nullptr;
+            lc.spheres = nullptr;
+            lc.cones = nullptr;
+            lc.light_slices = nullptr;
+            lc.indices = nullptr;
+            lc.bounds = nullptr;
+            lc.grid = nullptr;
+            lc.built = false;
+        }
+    } // namespace ecs
+} // namespace put
@@ -0,0 +1,38 @@
+// ecs_light_clusters.h
+// Copyright 2014 - 2023 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Clustered forward lighting. Point and spot lights are binned on the cpu into a froxel grid built from a view camera,
+// point lights by sphere vs cluster aabb and spot lights by cone vs cluster bounding sphere, 4 clusters at a time.
+// The lights, per cluster ranges and index lists are uploaded as structured buffers, pixels find their cluster from
+// screen position and view depth and only loop over its lights, so the number of lights is no longer limited by the
+// forward light cbuffer. Directional lights stay in the forward light cbuffer.
+
+#pragma once
+
+#include "camera.h"
+#include "types.h"
+
+namespace put
+{
+    namespace ecs
+    {
+        struct ecs_scene;
+        struct light_clusters;
+
+        // gathers every point and spot light of the scene into scene->clusters, called by update_scene
+        void gather_cluster_lights(ecs_scene* scene);
+
+        // bins lc.lights into the clusters of a perspective camera, spreading the work over jobs when parallel is set
+        void build_light_clusters(light_clusters& lc, const camera* cam, bool parallel = true);
+
+        // true if forward lit views of the scene rendered with cam should use clustered lighting
+        bool light_clusters_enabled(const ecs_scene* scene, const camera* cam);
+
+        // builds the clusters for cam if they are not already, uploads and binds them for the pixel shader
+        void bind_light_clusters(ecs_scene* scene, const camera* cam);
+
+        // frees cpu memory, gpu buffers are kept for the lifetime of the scene
+        void free_light_clusters(light_clusters& lc);
+    } // namespace ecs
+} // namespace put
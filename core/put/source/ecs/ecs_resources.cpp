@@ -461,8 +461,8 @@ namespace
         scene->transforms[root].scale = vec3f::one();
         scene->transforms[root].translation = vec3f::zero();
         scene->transforms[root].rotation = quat();
-        scene->local_matrices[root] = mat4::create_identity();
-        scene->world_matrices[root] = mat4::create_identity();
+        scene->local_matrices[root] = mat3x4::create_identity();
+        scene->world_matrices[root] = mat3x4::create_identity();
 
         u32 node_zero_offset = nodes_start + 1;
         u32 current_node = node_zero_offset;
@@ -650,7 +650,7 @@ namespace
             scene->initial_transform[current_node].translation = scene->transforms[current_node].translation;
             scene->initial_transform[current_node].scale = scene->transforms[current_node].scale;
 
-            scene->local_matrices[current_node] = (matrix);
+            scene->local_matrices[current_node] = mat3x4(matrix);
 
             // store intial position for physics to hook into later
             scene->physics_data[current_node].rigid_body.position = translation;
@@ -672,7 +672,7 @@ namespace
                         inserted_nodes++;
                         clone_entity(scene, current_node, dest, current_node, e_clone_mode::instantiate, vec3f::zero(),
                                      (const c8*)node_suffix.c_str());
-                        scene->local_matrices[dest] = mat4::create_identity();
+                        scene->local_matrices[dest] = mat3x4::create_identity();
 
                         // child geometry which will inherit any skinning from its parent
                         scene->entities[dest] |= e_cmp::sub_geometry;
@@ -1220,7 +1220,7 @@ namespace put
             scene->bounding_volumes[entity_index].min_extents = -vec3f::one();
             scene->bounding_volumes[entity_index].max_extents = vec3f::one();
 
-            scene->world_matrices[entity_index] = mat4::create_identity();
+            scene->world_matrices[entity_index] = mat3x4::create_identity();
             f32 rad = std::max<f32>(scene->lights[entity_index].radius, 1.0f);
             scene->transforms[entity_index].scale = vec3f(rad, rad, rad);
             scene->entities[entity_index] |= e_cmp::transform;
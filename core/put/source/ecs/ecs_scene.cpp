@@ -2,6 +2,7 @@
 // Copyright 2014 - 2023 Alex Dixon.
 // License: https://github.com/polymonster/pmtech/blob/master/license.md
 
+#include <algorithm>
 #include <fstream>
 #include <functional>
 
@@ -16,11 +17,15 @@
 #include "pmfx.h"
 #include "str/Str.h"
 #include "str_utilities.h"
+#include "threads.h"
 #include "timer.h"
 
 #include "ecs/ecs_cull.h"
+#include "ecs/ecs_light_clusters.h"
 #include "ecs/ecs_resources.h"
 #include "ecs/ecs_scene.h"
+#include "ecs/ecs_scheduler.h"
+#include "ecs/ecs_simd.h"
 #include "ecs/ecs_utilities.h"
 
 using namespace put;
@@ -30,6 +35,7 @@ namespace put
     namespace ecs
     {
         static std::vector<ecs_scene_instance> s_scenes;
+        static const u32                       k_parallel_grain = 1024; // entities per chunk for parallel loops
 
         void register_ecs_extension(ecs_scene* scene, const ecs_extension& ext)
         {
@@ -119,40 +125,540 @@ namespace put
                 PEN_ASSERT(0);
         }
 
-        void resize_scene_buffers(ecs_scene* scene, s32 size)
+        // names of the base components in declaration order, for memory reports
+        static const c8* k_base_component_names[] = {
+            "entities", "state_flags", "id_name", "id_geometry", "id_material", "names", "geometry_names", "material_names",
+            "parents", "transforms", "local_matrices", "world_matrices", "offset_matrices", "physics_matrices",
+            "bounding_volumes", "lights", "physics_handles", "master_instances", "geometries", "pre_skin", "physics_data",
+            "position_geometries", "cbuffer", "draw_call_data", "free_list", "materials", "material_data",
+            "material_resources", "shadows", "samplers", "material_permutation", "initial_transform", "anim_controller_v2",
+            "physics_offset", "physics_debug_cbuffer", "area_light", "area_light_resources", "render_flags", "pos_extent",
+            "bone_cbuffer", "ref_slot", "additive_rotation"};
+
+        u32 num_cmp_pages(u32 soa_size)
         {
-            u32 new_size = scene->soa_size + size;
+            return (soa_size + k_cmp_page_mask) >> k_cmp_page_shift;
+        }
+
+        // address of an entities component without allocating, nullptr if its page is not allocated
+        u8* find_cmp_entity(generic_cmp_array& cmp, u32 index)
+        {
+            if (cmp.data)
+                return (u8*)cmp.data + index * cmp.size;
+
+            u8* page = (u8*)pen_atomic_load(cmp.pages[index >> k_cmp_page_shift]);
+            if (!page)
+                return nullptr;
+
+            return page + (index & k_cmp_page_mask) * cmp.size;
+        }
+
+        void* allocate_cmp_page(generic_cmp_array& cmp, size_t page)
+        {
+            size_t page_size = cmp.size * k_cmp_page_entities;
+            void*  mem = pen::memory_alloc(page_size);
+            pen::memory_zero(mem, page_size);
+
+#if PEN_SINGLE_THREADED
+            cmp.pages[page] = (size_t)mem;
+            return mem;
+#else
+            // another thread may have allocated the page since it was checked
+            size_t expected = 0;
+            if (cmp.pages[page].compare_exchange_strong(expected, (size_t)mem))
+                return mem;
+
+            pen::memory_free(mem);
+            return (void*)expected;
+#endif
+        }
+
+        void resize_cmp_array(generic_cmp_array& cmp, u32 prev_size, u32 new_size)
+        {
+            if (cmp.storage == e_cmp_storage::paged)
+            {
+                // grow the page table, pages themselves are allocated on access
+                u32       prev_pages = cmp.pages ? num_cmp_pages(prev_size) : 0;
+                u32       new_pages = num_cmp_pages(new_size);
+                a_size_t* pages = (a_size_t*)pen::memory_alloc(new_pages * sizeof(a_size_t));
+
+                for (u32 p = 0; p < new_pages; ++p)
+                {
+                    size_t addr = 0;
+                    if (p < prev_pages)
+                        addr = pen_atomic_load(cmp.pages[p]);
+
+                    new (&pages[p]) a_size_t(addr);
+                }
+
+                pen::memory_free(cmp.pages);
+                cmp.pages = pages;
+                return;
+            }
+
+            u32 alloc_size = cmp.size * new_size;
+
+            if (cmp.data)
+            {
+                // realloc
+                cmp.data = pen::memory_realloc(cmp.data, alloc_size);
+
+                // zero new mem
+                u32 prev_alloc = prev_size * cmp.size;
+                u8* new_offset = (u8*)cmp.data + prev_alloc;
+                u32 zero_size = alloc_size - prev_alloc;
+                pen::memory_zero(new_offset, zero_size);
+                return;
+            }
+
+            // alloc and zero
+            cmp.data = pen::memory_alloc(alloc_size);
+            pen::memory_zero(cmp.data, alloc_size);
+        }
+
+        void free_cmp_array(generic_cmp_array& cmp, u32 soa_size)
+        {
+            if (cmp.pages)
+            {
+                u32 num_pages = num_cmp_pages(soa_size);
+                for (u32 p = 0; p < num_pages; ++p)
+                    pen::memory_free((void*)pen_atomic_load(cmp.pages[p]));
+
+                pen::memory_free(cmp.pages);
+                cmp.pages = nullptr;
+            }
+
+            pen::memory_free(cmp.data);
+            cmp.data = nullptr;
+        }
+
+        void zero_cmp_entities(generic_cmp_array& cmp, u32 first, u32 count)
+        {
+            if (cmp.data)
+            {
+                pen::memory_zero((u8*)cmp.data + first * cmp.size, count * cmp.size);
+                return;
+            }
+
+            // unallocated pages are already zero
+            u32 end = first + count;
+            for (u32 i = first; i < end;)
+            {
+                u32 run = std::min<u32>(end - i, k_cmp_page_entities - (i & k_cmp_page_mask));
+                u8* d = find_cmp_entity(cmp, i);
+                if (d)
+                    pen::memory_zero(d, run * cmp.size);
+
+                i += run;
+            }
+        }
+
+        void copy_cmp_entities(generic_cmp_array& dst, u32 dst_first, generic_cmp_array& src, u32 src_first, u32 count)
+        {
+            PEN_ASSERT(dst.size == src.size);
+
+            if (dst.data && src.data)
+            {
+                memmove((u8*)dst.data + dst_first * dst.size, (u8*)src.data + src_first * src.size, count * dst.size);
+                return;
+            }
+
+            // entity at a time, backwards when moving up within the same array so overlapping ranges copy correctly
+            bool backwards = &dst == &src && dst_first > src_first;
+            for (u32 i = 0; i < count; ++i)
+            {
+                u32 j = backwards ? count - 1 - i : i;
+
+                u8* s = find_cmp_entity(src, src_first + j);
+                if (s)
+                {
+                    memcpy(dst[dst_first + j], s, dst.size);
+                    continue;
+                }
+
+                u8* d = find_cmp_entity(dst, dst_first + j);
+                if (d)
+                    pen::memory_zero(d, dst.size);
+            }
+        }
+
+        // unallocated pages hash as zeros so allocating a page to read it does not change the hash
+        u32 hash_cmp_entities(generic_cmp_array& cmp, u32 count)
+        {
+            pen::hash_murmur hm;
+            hm.begin();
+
+            if (cmp.data)
+            {
+                hm.add(cmp.data, cmp.size * count);
+                return hm.end();
+            }
+
+            u8* zero = (u8*)pen::memory_alloc(cmp.size * k_cmp_page_entities);
+            pen::memory_zero(zero, cmp.size * k_cmp_page_entities);
+
+            for (u32 i = 0; i < count;)
+            {
+                u32 run = std::min<u32>(count - i, k_cmp_page_entities - (i & k_cmp_page_mask));
+                u8* s = find_cmp_entity(cmp, i);
+                hm.add(s ? s : zero, run * cmp.size);
+                i += run;
+            }
+
+            pen::memory_free(zero);
+            return hm.end();
+        }
+
+        // pages which are not allocated are written as zeros so the file layout does not depend on storage
+        void write_cmp_entities(std::ofstream& ofs, generic_cmp_array& cmp, u32 first, u32 count)
+        {
+            if (cmp.data)
+            {
+                ofs.write((const c8*)cmp.data + first * cmp.size, cmp.size * count);
+                return;
+            }
+
+            u8* zero = (u8*)pen::memory_alloc(cmp.size * k_cmp_page_entities);
+            pen::memory_zero(zero, cmp.size * k_cmp_page_entities);
+
+            u32 end = first + count;
+            for (u32 i = first; i < end;)
+            {
+                u32 run = std::min<u32>(end - i, k_cmp_page_entities - (i & k_cmp_page_mask));
+                u8* s = find_cmp_entity(cmp, i);
+                ofs.write((const c8*)(s ? s : zero), run * cmp.size);
+                i += run;
+            }
+
+            pen::memory_free(zero);
+        }
+
+        // paged components only allocate pages which contain non zero data
+        void read_cmp_entities(std::ifstream& ifs, generic_cmp_array& cmp, u32 first, u32 count)
+        {
+            if (cmp.data)
+            {
+                ifs.read((c8*)cmp.data + first * cmp.size, cmp.size * count);
+                return;
+            }
+
+            u8* buf = (u8*)pen::memory_alloc(cmp.size * k_cmp_page_entities);
+
+            u32 end = first + count;
+            for (u32 i = first; i < end;)
+            {
+                u32 run = std::min<u32>(end - i, k_cmp_page_entities - (i & k_cmp_page_mask));
+                u32 run_size = run * cmp.size;
+                ifs.read((c8*)buf, run_size);
+
+                bool non_zero = false;
+                for (u32 b = 0; b < run_size; ++b)
+                {
+                    if (buf[b])
+                    {
+                        non_zero = true;
+                        break;
+                    }
+                }
+
+                if (non_zero)
+                    memcpy(cmp[i], buf, run_size);
+                else
+                    zero_cmp_entities(cmp, i, run);
+
+                i += run;
+            }
+
+            pen::memory_free(buf);
+        }
+
+        void get_component_name(ecs_scene* scene, u32 index, c8* name, u32 size)
+        {
+            PEN_ASSERT(PEN_ARRAY_SIZE(k_base_component_names) == scene->num_base_components);
+
+            name[0] = '\0';
+            if (index < scene->num_base_components)
+            {
+                strncpy(name, k_base_component_names[index], size - 1);
+                name[size - 1] = '\0';
+                return;
+            }
+
+            // extension components are named by extension and index
+            u32 ci = index - scene->num_base_components;
+            u32 ne = sb_count(scene->extensions);
+            for (u32 e = 0; e < ne; ++e)
+            {
+                if (ci < scene->extensions[e].num_components)
+                {
+                    snprintf(name, size, "%s[%u]", scene->extensions[e].name.c_str(), ci);
+                    return;
+                }
+
+                ci -= scene->extensions[e].num_components;
+            }
+        }
+
+        component_memory* get_component_memory(ecs_scene* scene)
+        {
+
+            component_memory* report = nullptr;
+            u32               num_pages = num_cmp_pages(scene->soa_size);
 
             for (u32 i = 0; i < scene->num_components; ++i)
             {
                 generic_cmp_array& cmp = scene->get_component_array(i);
-                u32                alloc_size = cmp.size * new_size;
 
-                if (cmp.data)
+                component_memory cm = {};
+                cm.size = cmp.size;
+                cm.storage = cmp.storage;
+                cm.dense_bytes = (size_t)cmp.size * scene->soa_size;
+                cm.bytes = cm.dense_bytes;
+
+                get_component_name(scene, i, cm.name, sizeof(cm.name));
+
+                if (!cmp.data)
                 {
-                    // realloc
-                    cmp.data = pen::memory_realloc(cmp.data, alloc_size);
+                    for (u32 p = 0; p < num_pages; ++p)
+                        if (pen_atomic_load(cmp.pages[p]))
+                            ++cm.pages;
 
-                    // zero new mem
-                    u32 prev_size = scene->soa_size * cmp.size;
-                    u8* new_offset = (u8*)cmp.data + prev_size;
-                    u32 zero_size = alloc_size - prev_size;
-                    pen::memory_zero(new_offset, zero_size);
+                    cm.bytes = (size_t)cm.pages * cmp.size * k_cmp_page_entities + num_pages * sizeof(a_size_t);
+                }
+
+                sb_push(report, cm);
+            }
+
+            return report;
+        }
+
+        void init_entity_queries(ecs_scene* scene)
+        {
+            query_set& qs = scene->queries;
+            if (qs.queries)
+                return;
+
+            // built in queries in e_query order
+            static const u64 k_query_masks[] = {e_cmp::physics,     e_cmp::light,   e_cmp::sdf_shadow,
+                                                e_cmp::pre_skinned, e_cmp::skinned, e_cmp::anim_controller};
+            static_assert(PEN_ARRAY_SIZE(k_query_masks) == e_query::COUNT, "query masks must match e_query");
+
+            for (u32 q = 0; q < e_query::COUNT; ++q)
+            {
+                entity_query eq;
+                eq.mask = k_query_masks[q];
+                sb_push(qs.queries, eq);
+                qs.bits |= eq.mask;
+            }
+        }
+
+        // added and removed are in ascending entity order, so both are merged into entities in a single pass
+        void merge_query_changes(entity_query& eq, u32*& scratch)
+        {
+            u32 ne = sb_count(eq.entities);
+            u32 na = sb_count(eq.added);
+            u32 nr = sb_count(eq.removed);
+            if (na == 0 && nr == 0)
+                return;
 
+            // new entities at the end of the scene append
+            if (nr == 0 && (ne == 0 || eq.added[0] > eq.entities[ne - 1]))
+            {
+                memcpy(sb_add(eq.entities, na), eq.added, na * sizeof(u32));
+                sb_reset(eq.added);
+                return;
+            }
+
+            sb_reset(scratch);
+            u32 a = 0;
+            u32 r = 0;
+            for (u32 i = 0; i < ne; ++i)
+            {
+                u32 n = eq.entities[i];
+                if (r < nr && eq.removed[r] == n)
+                {
+                    ++r;
                     continue;
                 }
 
-                // alloc and zero
-                cmp.data = pen::memory_alloc(alloc_size);
-                pen::memory_zero(cmp.data, alloc_size);
+                while (a < na && eq.added[a] < n)
+                    sb_push(scratch, eq.added[a++]);
+
+                sb_push(scratch, n);
+            }
+
+            while (a < na)
+                sb_push(scratch, eq.added[a++]);
+
+            std::swap(eq.entities, scratch);
+            sb_reset(eq.added);
+            sb_reset(eq.removed);
+        }
+
+        query register_entity_query(ecs_scene* scene, u64 mask)
+        {
+            PEN_ASSERT(mask);
+            init_entity_queries(scene);
+
+            query_set& qs = scene->queries;
+            u32        nq = sb_count(qs.queries);
+            for (u32 q = 0; q < nq; ++q)
+                if (qs.queries[q].mask == mask)
+                    return q;
+
+            entity_query eq;
+            eq.mask = mask;
+            sb_push(qs.queries, eq);
+            qs.bits |= mask;
+
+            // seen flags do not include the new bits, so every query is rebuilt
+            for (u32 q = 0; q < nq; ++q)
+                sb_reset(qs.queries[q].entities);
+            sb_reset(qs.seen_flags);
+
+            update_entity_queries(scene);
+            return nq;
+        }
+
+        const entity_query& get_entity_query(ecs_scene* scene, query q)
+        {
+            init_entity_queries(scene);
+            PEN_ASSERT(q < (u32)sb_count(scene->queries.queries));
+            return scene->queries.queries[q];
+        }
+
+        void update_entity_queries(ecs_scene* scene)
+        {
+            init_entity_queries(scene);
+
+            query_set& qs = scene->queries;
+            u32        num = (u32)scene->num_entities;
+            u32        nq = sb_count(qs.queries);
+
+            qs.changed = 0;
+
+            // each query filters the whole scene as every system used to
+            if (scene->flags & e_scene_flags::rebuild_entity_queries)
+            {
+                for (u32 q = 0; q < nq; ++q)
+                {
+                    entity_query& eq = qs.queries[q];
+                    sb_reset(eq.entities);
+                    for (u32 n = 0; n < num; ++n)
+                        if ((scene->entities[n] & eq.mask) == eq.mask)
+                            sb_push(eq.entities, n);
+                }
+
+                sb_reset(qs.seen_flags);
+                u64* seen = sb_add(qs.seen_flags, num);
+                for (u32 n = 0; n < num; ++n)
+                    seen[n] = scene->entities[n] & qs.bits;
+
+                return;
+            }
+
+            // scene was cleared or entities were removed from the end
+            if (num < (u32)sb_count(qs.seen_flags))
+            {
+                for (u32 q = 0; q < nq; ++q)
+                    sb_reset(qs.queries[q].entities);
+                sb_reset(qs.seen_flags);
+            }
+
+            // new entities have not been seen with any flags
+            u32 num_seen = sb_count(qs.seen_flags);
+            if (num > num_seen)
+                memset(sb_add(qs.seen_flags, num - num_seen), 0x0, (num - num_seen) * sizeof(u64));
+
+            for (u32 n = 0; n < num; ++n)
+            {
+                u64 flags = scene->entities[n] & qs.bits;
+                u64 seen = qs.seen_flags[n];
+                if (flags == seen)
+                    continue;
+
+                for (u32 q = 0; q < nq; ++q)
+                {
+                    entity_query& eq = qs.queries[q];
+                    bool          was_match = (seen & eq.mask) == eq.mask;
+                    bool          is_match = (flags & eq.mask) == eq.mask;
+                    if (was_match == is_match)
+                        continue;
+
+                    if (is_match)
+                        sb_push(eq.added, n);
+                    else
+                        sb_push(eq.removed, n);
+                }
+
+                qs.seen_flags[n] = flags;
+                ++qs.changed;
+            }
+
+            for (u32 q = 0; q < nq; ++q)
+                merge_query_changes(qs.queries[q], qs.scratch);
+        }
+
+        // registered queries are kept and find their entities again on the next update
+        void free_entity_queries(query_set& qs)
+        {
+            u32 nq = sb_count(qs.queries);
+            for (u32 q = 0; q < nq; ++q)
+            {
+                entity_query& eq = qs.queries[q];
+                sb_free(eq.entities);
+                sb_free(eq.added);
+                sb_free(eq.removed);
+                eq.entities = nullptr;
+                eq.added = nullptr;
+                eq.removed = nullptr;
+            }
+
+            sb_free(qs.seen_flags);
+            sb_free(qs.scratch);
+            qs.seen_flags = nullptr;
+            qs.scratch = nullptr;
+            qs.changed = 0;
+        }
+
+        void free_render_pipeline(render_pipeline& rp)
+        {
+            for (u32 f = 0; f < 2; ++f)
+            {
+                render_frame& rf = rp.frames[f];
+                pen::memory_free(rf.entities);
+                pen::memory_free(rf.state_flags);
+                pen::memory_free(rf.world_matrices);
+                pen::memory_free(rf.pos_extent);
+                pen::memory_free(rf.draw_call_data);
+                sb_free(rf.renderables);
+                sb_free(rf.bvh.nodes);
+                sb_free(rf.bvh.entities);
+                rf = render_frame();
             }
 
+            rp.pending = false;
+        }
+
+        void resize_scene_buffers(ecs_scene* scene, s32 size)
+        {
+            wait_for_update(scene);
+
+            u32 new_size = scene->soa_size + size;
+
+            for (u32 i = 0; i < scene->num_components; ++i)
+                resize_cmp_array(scene->get_component_array(i), scene->soa_size, new_size);
+
             scene->soa_size = new_size;
             initialise_free_list(scene);
         }
 
         void free_scene_buffers(ecs_scene* scene, bool cmp_mem_only = 0)
         {
+            // the uploads of a pending update are dropped along with the entities
+            wait_for_update(scene);
+            free_render_pipeline(scene->pipeline);
+
             // Remove entites for sub systems (physics, rendering, etc)
             if (!cmp_mem_only)
             {
@@ -165,11 +671,51 @@ namespace put
 
             // Free component array memory
             for (u32 i = 0; i < scene->num_components; ++i)
+                free_cmp_array(scene->get_component_array(i), scene->soa_size);
+
+            // hierarchy levels are rebuilt for the next scene
+            hierarchy_levels& hl = scene->hierarchy;
+            sb_free(hl.entities);
+            sb_free(hl.level_start);
+            sb_free(hl.bounds_dirty);
+            hl = hierarchy_levels();
+
+            scene_bvh& bvh = scene->bvh;
+            sb_free(bvh.nodes);
+            sb_free(bvh.parents);
+            sb_free(bvh.entities);
+            sb_free(bvh.leaves);
+            bvh = scene_bvh();
+
+            renderable_set& rs = scene->renderables;
+            sb_free(rs.entities);
+            sb_free(rs.slots);
+            rs = renderable_set();
+
+            free_entity_queries(scene->queries);
+
+            for (u32 i = 0; i < sb_count(scene->view_buffers); ++i)
             {
-                generic_cmp_array& cmp = scene->get_component_array(i);
-                pen::memory_free(cmp.data);
-                cmp.data = nullptr;
+                sb_free(scene->view_buffers[i].culled_entities);
+                sb_free(scene->view_buffers[i].visible_entities);
+                free_occlusion_buffer(scene->view_buffers[i].occlusion);
             }
+            sb_free(scene->view_buffers);
+            scene->view_buffers = nullptr;
+            scene->view_buffer_cursor = 0;
+
+            sb_free(scene->pending_culls);
+            scene->pending_culls = nullptr;
+
+            sb_free(scene->systems.systems);
+            sb_free(scene->systems.level_systems);
+            sb_free(scene->systems.hashes);
+            scene->systems = system_schedule();
+
+            free_light_clusters(scene->clusters);
+
+            sb_free(scene->uploaded_user_data);
+            scene->uploaded_user_data = nullptr;
 
             scene->soa_size = 0;
             scene->num_entities = 0;
@@ -178,18 +724,17 @@ namespace put
         void zero_entity_components(ecs_scene* scene, u32 node_index)
         {
             for (u32 i = 0; i < scene->num_components; ++i)
-            {
-                generic_cmp_array& cmp = scene->get_component_array(i);
-                u8*                offset = (u8*)cmp.data + node_index * cmp.size;
-                pen::memory_zero(offset, cmp.size);
-            }
+                zero_cmp_entities(scene->get_component_array(i), node_index, 1);
 
             // Annoyingly nodeindex == parent is used to determine if a node is not a child
             scene->parents[node_index] = node_index;
+            scene->hierarchy.rebuild = true;
         }
 
         void delete_entity(ecs_scene* scene, u32 node_index)
         {
+            PEN_ASSERT(!is_simulating(scene));
+
             // free allocated stuff
             if (is_valid(scene->physics_handles[node_index]))
                 physics::release_entity(scene->physics_handles[node_index]);
@@ -208,6 +753,8 @@ namespace put
 
         void delete_entity_first_pass(ecs_scene* scene, u32 node_index)
         {
+            PEN_ASSERT(!is_simulating(scene));
+
             // constraints must be freed or removed before we delete rigidbodies using them
             if (is_valid(scene->physics_handles[node_index]) && (scene->entities[node_index] & e_cmp::constraint))
                 physics::release_entity(scene->physics_handles[node_index]);
@@ -224,12 +771,15 @@ namespace put
                     pen::renderer_release_buffer(scene->pre_skin[node_index].position_buffer);
             }
 
-            if (scene->master_instances[node_index].instance_buffer)
-                pen::renderer_release_buffer(scene->master_instances[node_index].instance_buffer);
+            if (scene->entities[node_index] & e_cmp::master_instance)
+                if (scene->master_instances[node_index].instance_buffer)
+                    pen::renderer_release_buffer(scene->master_instances[node_index].instance_buffer);
         }
 
         void delete_entity_second_pass(ecs_scene* scene, u32 node_index)
         {
+            PEN_ASSERT(!is_simulating(scene));
+
             // all constraints must be removed by this point.
             if (scene->physics_handles[node_index] && (scene->entities[node_index] & e_cmp::physics))
                 physics::release_entity(scene->physics_handles[node_index]);
@@ -250,12 +800,14 @@ namespace put
             for (u32 i = 0; i < scene->num_components; ++i)
             {
                 generic_cmp_array& cmp = scene->get_component_array(i);
-                memcpy(cmp[dst], cmp[src], cmp.size);
+                copy_cmp_entities(cmp, dst, cmp, src, 1);
             }
         }
 
         void swap_entities(ecs_scene* scene, u32 a, s32 b)
         {
+            PEN_ASSERT(!is_simulating(scene));
+
             u32 temp = get_new_entity(scene);
             entity_cpy(scene, temp, a);
             entity_cpy(scene, a, b);
@@ -273,12 +825,15 @@ namespace put
                 else if (scene->parents[i] == b)
                     scene->parents[i] = a;
             }
+            scene->hierarchy.rebuild = true;
 
             zero_entity_components(scene, temp);
         }
 
         u32 clone_entity(ecs_scene* scene, u32 src, s32 dst, s32 parent, clone_mode mode, vec3f offset, const c8* suffix)
         {
+            PEN_ASSERT(!is_simulating(scene));
+
             if (dst == -1)
             {
                 dst = get_new_entity(scene);
@@ -295,7 +850,7 @@ namespace put
             for (u32 i = 0; i < scene->num_components; ++i)
             {
                 generic_cmp_array& cmp = p_sn->get_component_array(i);
-                memcpy(cmp[dst], cmp[src], cmp.size);
+                copy_cmp_entities(cmp, dst, cmp, src, 1);
             }
 
             // assign
@@ -320,6 +875,7 @@ namespace put
             {
                 p_sn->parents[dst] = parent;
             }
+            p_sn->hierarchy.rebuild = true;
 
             vec3f translation = p_sn->local_matrices[dst].get_translation();
             p_sn->local_matrices[dst].set_translation(translation + offset);
@@ -356,6 +912,8 @@ namespace put
             svr_main.name = "ecs_render_scene";
             svr_main.id_name = PEN_HASH(svr_main.name.c_str());
             svr_main.render_function = &ecs::render_scene_view;
+            svr_main.cull_function = &ecs::cull_scene_view;
+            svr_main.thread_safe = true;
 
             put::scene_view_renderer svr_light_volumes;
             svr_light_volumes.name = "ecs_render_light_volumes";
@@ -366,6 +924,8 @@ namespace put
             svr_shadow_maps.name = "ecs_render_shadow_maps";
             svr_shadow_maps.id_name = PEN_HASH(svr_shadow_maps.name.c_str());
             svr_shadow_maps.render_function = &ecs::render_shadow_views;
+            svr_shadow_maps.cull_function = &ecs::cull_shadow_views;
+            svr_shadow_maps.thread_safe = true;
 
             put::scene_view_renderer svr_area_light_textures;
             svr_area_light_textures.name = "ecs_render_area_light_textures";
@@ -376,6 +936,8 @@ namespace put
             svr_omni_shadow_maps.name = "ecs_render_omni_shadow_maps";
             svr_omni_shadow_maps.id_name = PEN_HASH(svr_omni_shadow_maps.name.c_str());
             svr_omni_shadow_maps.render_function = &ecs::render_omni_shadow_views;
+            svr_omni_shadow_maps.cull_function = &ecs::cull_omni_shadow_views;
+            svr_omni_shadow_maps.thread_safe = true;
 
             put::scene_view_renderer svr_volume_gi;
             svr_volume_gi.name = "ecs_compute_volume_gi";
@@ -390,6 +952,28 @@ namespace put
             pmfx::register_scene_view_renderer(svr_volume_gi);
         }
 
+        // the auto instance buffer holds the batches of one view at a time, it grows to the most instances a view draws
+        void reserve_auto_instances(ecs_scene* scene, u32 count)
+        {
+            if (count <= scene->auto_instance_capacity)
+                return;
+
+            if (is_valid(scene->auto_instance_buffer))
+                pen::renderer_release_buffer(scene->auto_instance_buffer);
+
+            u32 capacity = std::max<u32>(count, scene->auto_instance_capacity * 2);
+
+            pen::buffer_creation_params bcp;
+            bcp.usage_flags = PEN_USAGE_DYNAMIC;
+            bcp.bind_flags = PEN_BIND_VERTEX_BUFFER;
+            bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
+            bcp.buffer_size = sizeof(cmp_draw_call) * capacity;
+            bcp.data = nullptr;
+
+            scene->auto_instance_buffer = pen::renderer_create_buffer(bcp);
+            scene->auto_instance_capacity = capacity;
+        }
+
         ecs_scene* create_scene(const c8* name)
         {
             ecs_scene_instance new_instance;
@@ -398,6 +982,7 @@ namespace put
 
             s_scenes.push_back(new_instance);
 
+            simd_init();
             resize_scene_buffers(new_instance.scene, 8192);
 
             // create buffers
@@ -448,6 +1033,8 @@ namespace put
 
             new_instance.scene->gi_volume_buffer = pen::renderer_create_buffer(bcp);
 
+            reserve_auto_instances(new_instance.scene, e_scene_limits::auto_instances);
+
             return new_instance.scene;
         }
 
@@ -462,13 +1049,14 @@ namespace put
 
         void render_area_light_textures(const scene_view& view)
         {
-            ecs_scene* scene = view.scene;
+            ecs_scene*   scene = view.scene;
+            render_frame rf = get_render_frame(scene);
 
             u32 count = 0;
             u32 area_light = -1;
-            for (u32 i = 0; i < scene->num_entities; ++i)
+            for (u32 i = 0; i < rf.num_entities; ++i)
             {
-                if (!(scene->entities[i] & e_cmp::light))
+                if (!(rf.entities[i] & e_cmp::light))
                     continue;
 
                 if (!(scene->lights[i].type == e_light_type::area_ex))
@@ -492,7 +1080,7 @@ namespace put
 
             cmp_area_light& al = scene->area_light[area_light];
 
-            pen::renderer_set_constant_buffer(scene->cbuffer[area_light], 1, pen::CBUFFER_BIND_PS);
+            bind_draw_call_cbuffer(scene, rf, area_light);
 
             if (is_valid(al.shader))
             {
@@ -507,11 +1095,11 @@ namespace put
             }
         }
 
-        void single_light_from_entity(light_data& ld, const ecs_scene* scene, u32 n)
+        void single_light_from_entity(light_data& ld, const ecs_scene* scene, const render_frame& rf, u32 n)
         {
             cmp_draw_call dc;
-            dc.world_matrix = scene->world_matrices[n];
-            vec3f pos = scene->world_matrices[n].get_translation();
+            dc.world_matrix = rf.world_matrices[n];
+            vec3f pos = rf.world_matrices[n].get_translation();
             switch (scene->lights[n].type)
             {
                 case e_light_type::dir:
@@ -535,13 +1123,13 @@ namespace put
             }
         }
 
-        void shadow_camera_from_entity(camera& cam, const ecs_scene* scene, u32 n)
+        void shadow_camera_from_entity(camera& cam, const ecs_scene* scene, const render_frame& rf, u32 n)
         {
             if (scene->lights[n].type == e_light_type::dir)
             {
                 // clamp to shadow map max extents to prevent large shadow maps
-                vec3f emin = scene->renderable_extents.min;
-                vec3f emax = scene->renderable_extents.max;
+                vec3f emin = rf.renderable_extents.min;
+                vec3f emax = rf.renderable_extents.max;
 
                 if (mag2(scene->shadow_extent_constraints.min - scene->shadow_extent_constraints.max))
                 {
@@ -557,12 +1145,12 @@ namespace put
                 // spot
                 camera_create_perspective(&cam, 100.0f, 1.0f, 0.1f, 500.0f);
 
-                cam.view.set_row(0, vec4f((vec3f)normalize(scene->world_matrices[n].get_column(2).xyz), 0.0f));
-                cam.view.set_row(1, vec4f((vec3f)normalize(scene->world_matrices[n].get_column(0).xyz), 0.0f));
-                cam.view.set_row(2, vec4f((vec3f)normalize(scene->world_matrices[n].get_column(1).xyz), 0.0f));
+                cam.view.set_row(0, vec4f((vec3f)normalize(rf.world_matrices[n].get_column(2).xyz), 0.0f));
+                cam.view.set_row(1, vec4f((vec3f)normalize(rf.world_matrices[n].get_column(0).xyz), 0.0f));
+                cam.view.set_row(2, vec4f((vec3f)normalize(rf.world_matrices[n].get_column(1).xyz), 0.0f));
                 cam.view.set_row(3, vec4f(0.0f, 0.0f, 0.0f, 1.0f));
 
-                mat4 translate = mat::create_translation(-scene->world_matrices[n].get_translation());
+                mat4 translate = mat::create_translation(-rf.world_matrices[n].get_translation());
 
                 cam.view = cam.view * translate;
 
@@ -570,28 +1158,47 @@ namespace put
             }
         }
 
-        void render_shadow_views(const scene_view& view)
+        u32 create_constant_buffer(u32 size)
         {
-            ecs_scene* scene = view.scene;
+            pen::buffer_creation_params bcp;
+            bcp.usage_flags = PEN_USAGE_DYNAMIC;
+            bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
+            bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
+            bcp.buffer_size = size;
+            bcp.data = nullptr;
 
-            static u32 cb_view = PEN_INVALID_HANDLE;
-            if (!is_valid(cb_view))
-            {
-                pen::buffer_creation_params bcp;
-                bcp.usage_flags = PEN_USAGE_DYNAMIC;
-                bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
-                bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
-                bcp.buffer_size = sizeof(camera_cbuffer);
-                bcp.data = nullptr;
+            return pen::renderer_create_buffer(bcp);
+        }
 
-                cb_view = pen::renderer_create_buffer(bcp);
+        mat4 shadow_view_projection(const camera& cam)
+        {
+            // handle different clip spaces
+            if (pen::renderer_depth_0_to_1())
+            {
+                // if clip space is 0-1 scale and bias the depth buffer
+                mat4 scale = mat::create_scale(vec3f(1.0f, 1.0f, 0.5f));
+                mat4 bias = mat::create_translation(vec3f(0.0f, 0.0f, 0.5f));
+                return bias * scale * cam.proj * cam.view;
             }
 
-            static mat4 shadow_matrices[e_scene_limits::max_shadow_maps];
-            u32         shadow_index = 0;
-            for (u32 n = 0; n < scene->num_entities; ++n)
+            // opengl has -1 to 1 z so no need for the scale + bias
+            return cam.proj * cam.view;
+        }
+
+        // array slices may be recorded in parallel, each slice only writes the buffers it draws with and the command
+        // lists are submitted in slice order
+        void render_shadow_views(const scene_view& view)
+        {
+            ecs_scene* scene = view.scene;
+
+            static u32 cb_view = create_constant_buffer(sizeof(camera_cbuffer));
+            static u32 cb_light = create_constant_buffer(sizeof(light_data));
+
+            u32          shadow_index = 0;
+            render_frame rf = get_render_frame(scene);
+            for (u32 n = 0; n < rf.num_entities; ++n)
             {
-                if (!(scene->entities[n] & e_cmp::light))
+                if (!(rf.entities[n] & e_cmp::light))
                     continue;
 
                 if (!(scene->lights[n].flags & (e_light_flags::shadow_map | e_light_flags::global_illumination)))
@@ -602,51 +1209,22 @@ namespace put
 
                 // create a shadow camera
                 camera cam;
-                shadow_camera_from_entity(cam, scene, n);
+                shadow_camera_from_entity(cam, scene, rf, n);
 
                 // update view and camera
                 scene_view vv = view;
                 vv.camera = &cam;
 
-                mat4 shadow_vp;
-
-                // handle different clip spaces
-                if (pen::renderer_depth_0_to_1())
-                {
-                    // if clip space is 0-1 scale and bias the depth buffer
-                    mat4 scale = mat::create_scale(vec3f(1.0f, 1.0f, 0.5f));
-                    mat4 bias = mat::create_translation(vec3f(0.0f, 0.0f, 0.5f));
-                    shadow_vp = bias * scale * cam.proj * cam.view;
-                }
-                else
-                {
-                    // opengl has -1 to 1 z so no need for the scale + bias
-                    shadow_vp = cam.proj * cam.view;
-                }
-
+                mat4 shadow_vp = shadow_view_projection(cam);
                 pen::renderer_update_buffer(cb_view, &shadow_vp, sizeof(mat4));
-                shadow_matrices[shadow_index - 1] = shadow_vp;
                 vv.cb_view = cb_view;
 
                 // colour shadow maps
                 if (vv.render_flags & pmfx::e_scene_render_flags::forward_lit)
                 {
                     // bind single light cbuffer
-                    static u32 cb_light = -1;
-                    if (!is_valid(cb_light))
-                    {
-                        pen::buffer_creation_params bcp;
-                        bcp.usage_flags = PEN_USAGE_DYNAMIC;
-                        bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
-                        bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
-                        bcp.buffer_size = sizeof(light_data);
-                        bcp.data = nullptr;
-
-                        cb_light = pen::renderer_create_buffer(bcp);
-                    }
-
                     light_data ld;
-                    single_light_from_entity(ld, scene, n);
+                    single_light_from_entity(ld, scene, rf, n);
                     pen::renderer_update_buffer(cb_light, &ld, sizeof(light_data));
                     pen::renderer_set_constant_buffer(cb_light, 10, pen::CBUFFER_BIND_PS);
                 }
@@ -654,40 +1232,46 @@ namespace put
                 render_scene_view(vv);
             }
 
-            // update cbuffer
-            if (is_valid(scene->shadow_map_buffer))
+            // the last slice is drawn last, it writes the matrices of every shadow map
+            if (view.array_index + 1 != view.num_arrays || !is_valid(scene->shadow_map_buffer))
+                return;
+
+            mat4 shadow_matrices[e_scene_limits::max_shadow_maps];
+            memset(&shadow_matrices[0], 0x0, sizeof(shadow_matrices));
+
+            shadow_index = 0;
+            for (u32 n = 0; n < rf.num_entities && shadow_index < e_scene_limits::max_shadow_maps; ++n)
             {
-                pen::renderer_update_buffer(scene->shadow_map_buffer, &shadow_matrices[0],
-                                            sizeof(mat4) * e_scene_limits::max_shadow_maps);
+                if (!(rf.entities[n] & e_cmp::light))
+                    continue;
+
+                if (!(scene->lights[n].flags & (e_light_flags::shadow_map | e_light_flags::global_illumination)))
+                    continue;
+
+                camera cam;
+                shadow_camera_from_entity(cam, scene, rf, n);
+                shadow_matrices[shadow_index++] = shadow_view_projection(cam);
             }
+
+            pen::renderer_update_buffer(scene->shadow_map_buffer, &shadow_matrices[0],
+                                        sizeof(mat4) * e_scene_limits::max_shadow_maps);
         }
 
         void render_omni_shadow_views(const scene_view& view)
         {
             ecs_scene* scene = view.scene;
 
-            static camera cam_omni_shadow;
-            static u32    cb_light = -1;
-            if (!is_valid(cb_light))
-            {
-                cam_omni_shadow.pos = vec3f(0.0f, 0.0f, 0.0f);
-
-                pen::buffer_creation_params bcp;
-                bcp.usage_flags = PEN_USAGE_DYNAMIC;
-                bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
-                bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
-                bcp.buffer_size = sizeof(light_data);
-                bcp.data = nullptr;
-
-                cb_light = pen::renderer_create_buffer(bcp);
-            }
+            // faces share one cbuffer, each face updates it before drawing
+            static u32 cb_omni_view = create_constant_buffer(sizeof(camera_cbuffer));
+            static u32 cb_light = create_constant_buffer(sizeof(light_data));
 
-            u32 target_omni_light_index = view.array_index / 6;
-            u32 array_face = view.array_index % 6;
-            u32 omni_light_index = 0;
-            for (u32 n = 0; n < scene->num_entities; ++n)
+            u32          target_omni_light_index = view.array_index / 6;
+            u32          array_face = view.array_index % 6;
+            u32          omni_light_index = 0;
+            render_frame rf = get_render_frame(scene);
+            for (u32 n = 0; n < rf.num_entities; ++n)
             {
-                if (!(scene->entities[n] & e_cmp::light))
+                if (!(rf.entities[n] & e_cmp::light))
                     continue;
 
                 if (!(scene->lights[n].flags & e_light_flags::omni_shadow_map))
@@ -696,13 +1280,15 @@ namespace put
                 if (omni_light_index++ != target_omni_light_index)
                     continue;
 
+                camera cam_omni_shadow;
+                cam_omni_shadow.cbuffer = cb_omni_view;
                 cam_omni_shadow.pos = scene->transforms[n].translation;
                 put::camera_create_cubemap(&cam_omni_shadow, 0.1f, scene->lights[n].radius * 2.0f);
                 put::camera_set_cubemap_face(&cam_omni_shadow, array_face);
                 put::camera_update_shader_constants(&cam_omni_shadow);
 
                 light_data ld;
-                single_light_from_entity(ld, scene, n);
+                single_light_from_entity(ld, scene, rf, n);
                 pen::renderer_update_buffer(cb_light, &ld, sizeof(light_data));
                 pen::renderer_set_constant_buffer(cb_light, 10, pen::CBUFFER_BIND_PS);
 
@@ -739,9 +1325,10 @@ namespace put
             static hash_id id_disable_depth = PEN_HASH("disabled");
             u32            depth_disabled = pmfx::get_render_state(id_disable_depth, pmfx::e_render_state::depth_stencil);
 
-            for (u32 n = 0; n < scene->num_entities; ++n)
+            render_frame rf = get_render_frame(scene);
+            for (u32 n = 0; n < rf.num_entities; ++n)
             {
-                if (!(scene->entities[n] & e_cmp::light))
+                if (!(rf.entities[n] & e_cmp::light))
                     continue;
 
                 if (!scene->cbuffer[n])
@@ -754,7 +1341,7 @@ namespace put
                 pmfx::set_technique_perm(shader, id_technique[t], view.permutation);
 
                 cmp_draw_call dc;
-                dc.world_matrix = scene->world_matrices[n];
+                dc.world_matrix = rf.world_matrices[n];
 
                 vec3f pos = dc.world_matrix.get_translation();
 
@@ -795,8 +1382,9 @@ namespace put
                         continue;
                 }
 
-                // pack light data into world_matrix_inv_transpose
-                memcpy(&dc.world_matrix_inv_transpose, &ld, sizeof(mat4));
+                // pack light data into world_matrix_inv_transpose and v2
+                memcpy(&dc.world_matrix_inv_transpose, &ld, sizeof(mat3x4));
+                dc.v2 = ld.data;
 
                 // flip cull mode if we are inside the light volume
                 if (inside_volume)
@@ -857,45 +1445,494 @@ namespace put
             pmfx::get_render_target_dimensions(gi_rt, info.volume_size.x, info.volume_size.y);
             info.volume_size.z = info.volume_size.x;
 
-            f32 max_dim = max(scene->renderable_extents.max - scene->renderable_extents.min);
-            info.scene_size.xyz = vec3f(min(max_dim, 128.0f));
+            render_frame rf = get_render_frame(scene);
+            f32          max_dim = max(rf.renderable_extents.max - rf.renderable_extents.min);
+            info.scene_size.xyz = vec3f(min(max_dim, 128.0f));
+
+            // get inv shadow matrices
+            u32 i = 0;
+            for (u32 n = 0; n < rf.num_entities; ++n)
+            {
+                if (!(rf.entities[n] & e_cmp::light))
+                    continue;
+
+                if (!(scene->lights[n].flags & e_light_flags::global_illumination))
+                    continue;
+
+                camera cam;
+                shadow_camera_from_entity(cam, scene, rf, n);
+                mat4 vp = cam.proj * cam.view;
+
+                info.inv_mat = mat::inverse4x4(vp);
+                info.shadow_map_size.z = i++;
+
+                pmfx::set_technique_perm(view.pmfx_shader, view.id_technique, 0);
+                pen::renderer_set_texture(volume_gi_tex, 0, 0, pen::TEXTURE_BIND_CS);
+                pen::renderer_set_texture(colour_shadow_map, 0, 1, pen::TEXTURE_BIND_CS);
+                pen::renderer_set_texture(colour_shadow_map_depth, 0, 2, pen::TEXTURE_BIND_CS);
+                pen::renderer_update_buffer(cb_info, &info, sizeof(gi_info));
+                pen::renderer_set_constant_buffer(cb_info, 1, pen::CBUFFER_BIND_CS);
+                pen::renderer_dispatch_compute({(u32)info.shadow_map_size.x, (u32)info.shadow_map_size.y, 1}, {16, 16, 1});
+            }
+
+            // info for the ray marching
+            gi_volume_info gi_info;
+            gi_info.volume_size = info.volume_size;
+            gi_info.scene_size = info.scene_size;
+            pen::renderer_update_buffer(scene->gi_volume_buffer, &gi_info, sizeof(gi_info));
+
+            // unbind textures to silence validation warnings
+            pen::renderer_set_texture(0, 0, 0, pen::TEXTURE_BIND_CS);
+            pen::renderer_set_texture(0, 0, 1, pen::TEXTURE_BIND_CS);
+            pen::renderer_set_texture(0, 0, 2, pen::TEXTURE_BIND_CS);
+        }
+
+        // draw packets are built after culling and sorted by key before submission, the key is laid out so that
+        // opaque draws group by pipeline then geometry and material and finally front to back, alpha blended draws
+        // sort back to front first and group by state within the same depth.
+        struct draw_packet
+        {
+            u64 key;
+            u32 entity;
+        };
+
+        static const u32 k_key_depth_bits = 14;
+        static const u32 k_key_geometry_bits = 12;
+        static const u32 k_key_material_bits = 12;
+        static const u32 k_key_permutation_bits = 8;
+        static const u32 k_key_technique_bits = 8;
+        static const u32 k_key_shader_bits = 10;
+        static const u32 k_key_state_bits = k_key_geometry_bits + k_key_material_bits + k_key_permutation_bits +
+                                            k_key_technique_bits + k_key_shader_bits;
+
+        static_assert(k_key_state_bits + k_key_depth_bits == 64, "draw packet key must use all 64 bits");
+
+        pen_inline u64 key_bits(u32 value, u32 bits)
+        {
+            return (u64)value & ((1ull << bits) - 1);
+        }
+
+        u64 make_draw_key(u32 shader, u32 technique, u32 permutation, u32 material, u32 geometry, f32 depth, bool alpha)
+        {
+            // state is most significant first, collisions from truncating handles only affect the order not correctness
+            u64 state = key_bits(shader, k_key_shader_bits);
+            state = (state << k_key_technique_bits) | key_bits(technique, k_key_technique_bits);
+            state = (state << k_key_permutation_bits) | key_bits(permutation, k_key_permutation_bits);
+            state = (state << k_key_geometry_bits) | key_bits(geometry, k_key_geometry_bits);
+            state = (state << k_key_material_bits) | key_bits(material, k_key_material_bits);
+
+            // depth is normalised 0-1 within the view
+            u32 max_depth = (1 << k_key_depth_bits) - 1;
+            u32 qd = (u32)(min(max(depth, 0.0f), 1.0f) * (f32)max_depth);
+
+            if (alpha)
+                return ((u64)(max_depth - qd) << k_key_state_bits) | state;
+
+            return (state << k_key_depth_bits) | qd;
+        }
+
+        cull_key make_cull_key(const camera* cam)
+        {
+            cull_key key;
+            memset(&key, 0x0, sizeof(cull_key));
+            key.frust = cam->camera_frustum;
+            key.view = cam->view;
+            key.proj = cam->proj;
+            key.near_plane = cam->near_plane;
+
+            // transient flags like invalidated and apply_jitter do not change what is visible
+            key.flags = cam->flags & e_camera_flags::orthographic;
+            return key;
+        }
+
+        // buffers already holding this camera since the last update or null, only reads the pool
+        cull_buffers* find_view_buffers(ecs_scene* scene, const cull_key& key)
+        {
+            for (u32 i = 0; i < scene->view_buffer_cursor; ++i)
+                if (memcmp(&scene->view_buffers[i].key, &key, sizeof(cull_key)) == 0)
+                    return &scene->view_buffers[i];
+
+            return nullptr;
+        }
+
+        // buffers already holding this camera since the last update, or the next set in the pool
+        cull_buffers& get_view_buffers(ecs_scene* scene, const camera* cam)
+        {
+            cull_key      key = make_cull_key(cam);
+            cull_buffers* found = find_view_buffers(scene, key);
+            if (found)
+                return *found;
+
+            // the pool grows to the number of distinct views rendered between updates, indices handed out since the
+            // last update stay valid because the cursor is only reset by update_scene
+            u32 index = scene->view_buffer_cursor++;
+            while (sb_count(scene->view_buffers) <= index)
+                sb_push(scene->view_buffers, cull_buffers());
+
+            cull_buffers& buffers = scene->view_buffers[index];
+            buffers.key = key;
+            buffers.culled = false;
+            return buffers;
+        }
+
+        // frustum and occlusion cull for the camera in buffers.key, safe to run for different buffers in parallel
+        void cull_view(const ecs_scene* scene, cull_buffers& buffers)
+        {
+            camera cam;
+            cam.camera_frustum = buffers.key.frust;
+            cam.view = buffers.key.view;
+            cam.proj = buffers.key.proj;
+            cam.near_plane = buffers.key.near_plane;
+            cam.flags = buffers.key.flags;
+
+            sb_reset(buffers.culled_entities);
+            sb_reset(buffers.visible_entities);
+
+            render_frame rf = get_render_frame(scene);
+            if (rf.bvh.nodes && !(scene->flags & e_scene_flags::disable_bvh_culling))
+                frustum_cull_bvh(scene, &cam, &buffers.culled_entities);
+            else
+                frustum_cull_aabb(scene, &cam, rf.renderables, &buffers.culled_entities);
+
+            buffers.entities = buffers.culled_entities;
+            buffers.occluded = 0;
+
+            if (scene->flags & e_scene_flags::occlusion_culling)
+            {
+                rasterise_occluders(scene, &cam, buffers.occlusion);
+                occlusion_cull(scene, &cam, buffers.occlusion, buffers.culled_entities, &buffers.visible_entities);
+
+                buffers.entities = buffers.visible_entities;
+                buffers.occluded = sb_count(buffers.culled_entities) - sb_count(buffers.visible_entities);
+            }
+
+            buffers.culled = true;
+        }
+
+        void request_view_cull(ecs_scene* scene, const camera* cam)
+        {
+            cull_buffers& buffers = get_view_buffers(scene, cam);
+            if (buffers.culled)
+                return;
+
+            u32 index = (u32)(&buffers - scene->view_buffers);
+            for (u32 i = 0; i < sb_count(scene->pending_culls); ++i)
+                if (scene->pending_culls[i] == index)
+                    return;
+
+            sb_push(scene->pending_culls, index);
+        }
+
+        // views recorded into command lists leave the flag set, another list may draw the entity earlier in the frame
+        void update_draw_call_cbuffer(ecs_scene* scene, render_frame& rf, u32 n)
+        {
+            if (!(rf.state_flags[n] & e_state::cbuffer_stale))
+                return;
+
+            pen::renderer_update_buffer(scene->cbuffer[n], &rf.draw_call_data[n], sizeof(cmp_draw_call));
+            if (pen::renderer_recording_cmd_list())
+                return;
+
+            rf.state_flags[n] &= ~e_state::cbuffer_stale;
+            scene->update_stats.cbuffer_updates++;
+        }
+
+        void cull_views(ecs_scene* scene)
+        {
+            u32 num_pending = sb_count(scene->pending_culls);
+
+            // one view per job, the bvh traversal and occlusion rasterisation of each view are independent
+            pen::parallel_for(0, num_pending, 1, [&](u32 begin, u32 end) {
+                for (u32 i = begin; i < end; ++i)
+                    cull_view(scene, scene->view_buffers[scene->pending_culls[i]]);
+            });
+
+            sb_reset(scene->pending_culls);
+
+            // shared state views would change while drawing is brought up to date here, before any view is recorded
+            render_frame rf = get_render_frame(scene);
+            u32          max_culled = 0;
+            for (u32 i = 0; i < scene->view_buffer_cursor; ++i)
+            {
+                cull_buffers& buffers = scene->view_buffers[i];
+                if (!buffers.culled)
+                    continue;
+
+                u32 vc = sb_count(buffers.entities);
+                for (u32 j = 0; j < vc; ++j)
+                {
+                    u32 n = buffers.entities[j];
+                    if (is_renderable(rf, n))
+                        update_draw_call_cbuffer(scene, rf, n);
+                }
+
+                max_culled = std::max<u32>(max_culled, vc);
+            }
+
+            if (is_valid(scene->auto_instance_buffer))
+                reserve_auto_instances(scene, max_culled);
+        }
+
+        void cull_scene_view(const scene_view& view)
+        {
+            ecs_scene* scene = view.scene;
+            if (!scene || !view.camera || (scene->view_flags & e_scene_view_flags::hide))
+                return;
+
+            request_view_cull(scene, view.camera);
+        }
+
+        void cull_shadow_views(const scene_view& view)
+        {
+            ecs_scene* scene = view.scene;
+            if (!scene)
+                return;
+
+            // same light selection as render_shadow_views
+            u32          shadow_index = 0;
+            render_frame rf = get_render_frame(scene);
+            for (u32 n = 0; n < rf.num_entities; ++n)
+            {
+                if (!(rf.entities[n] & e_cmp::light))
+                    continue;
+
+                if (!(scene->lights[n].flags & (e_light_flags::shadow_map | e_light_flags::global_illumination)))
+                    continue;
+
+                if (shadow_index++ != view.array_index)
+                    continue;
+
+                camera cam;
+                shadow_camera_from_entity(cam, scene, rf, n);
+                request_view_cull(scene, &cam);
+            }
+        }
+
+        void cull_omni_shadow_views(const scene_view& view)
+        {
+            ecs_scene* scene = view.scene;
+            if (!scene)
+                return;
+
+            // same light selection as render_omni_shadow_views
+            u32          target_omni_light_index = view.array_index / 6;
+            u32          array_face = view.array_index % 6;
+            u32          omni_light_index = 0;
+            render_frame rf = get_render_frame(scene);
+            for (u32 n = 0; n < rf.num_entities; ++n)
+            {
+                if (!(rf.entities[n] & e_cmp::light))
+                    continue;
+
+                if (!(scene->lights[n].flags & e_light_flags::omni_shadow_map))
+                    continue;
+
+                if (omni_light_index++ != target_omni_light_index)
+                    continue;
+
+                camera cam;
+                cam.pos = scene->transforms[n].translation;
+                put::camera_create_cubemap(&cam, 0.1f, scene->lights[n].radius * 2.0f);
+                put::camera_set_cubemap_face(&cam, array_face);
+                put::camera_update_frustum(&cam);
+                request_view_cull(scene, &cam);
+            }
+        }
+
+        // lsd radix sort 8 bits at a time, passes where every key has the same byte are skipped
+        void radix_sort_draw_packets(draw_packet* packets, draw_packet* temp, u32 count)
+        {
+            if (count == 0)
+                return;
+
+            static const u32 k_passes = sizeof(u64);
+            u32              histogram[k_passes][256] = {};
+
+            for (u32 i = 0; i < count; ++i)
+            {
+                u64 key = packets[i].key;
+                for (u32 p = 0; p < k_passes; ++p)
+                    histogram[p][(key >> (p * 8)) & 0xff]++;
+            }
+
+            draw_packet* src = packets;
+            draw_packet* dst = temp;
+            for (u32 p = 0; p < k_passes; ++p)
+            {
+                u32* h = histogram[p];
+                u32  shift = p * 8;
+
+                if (h[(src[0].key >> shift) & 0xff] == count)
+                    continue;
+
+                u32 offset = 0;
+                for (u32 b = 0; b < 256; ++b)
+                {
+                    u32 c = h[b];
+                    h[b] = offset;
+                    offset += c;
+                }
+
+                for (u32 i = 0; i < count; ++i)
+                    dst[h[(src[i].key >> shift) & 0xff]++] = src[i];
+
+                std::swap(src, dst);
+            }
+
+            if (src != packets)
+                memcpy(packets, src, sizeof(draw_packet) * count);
+        }
+
+        // compatible entities which are adjacent after sorting are drawn with a single instanced draw, the per draw data
+        // of the batches of a view is written to the scenes auto instance buffer in one update
+        static const u32 k_max_auto_instances = 1024;
+        static const u32 k_min_auto_instances = 2;
+
+        bool auto_instance_candidate(const render_frame& rf, u32 n)
+        {
+            u32 reject = e_cmp::skinned | e_cmp::master_instance | e_cmp::sub_instance;
+            return !(rf.entities[n] & reject);
+        }
+
+        bool auto_instance_compatible(const ecs_scene* scene, const render_frame& rf, u32 a, u32 b, bool shadow)
+        {
+            if (!auto_instance_candidate(rf, b))
+                return false;
+
+            const cmp_material& ma = scene->materials[a];
+            const cmp_material& mb = scene->materials[b];
+            if (ma.shader != mb.shader || ma.technique_index != mb.technique_index)
+                return false;
+
+            if (scene->material_permutation[a] != scene->material_permutation[b])
+                return false;
+
+            const cmp_geometry& ga = shadow ? scene->position_geometries[a] : scene->geometries[a];
+            const cmp_geometry& gb = shadow ? scene->position_geometries[b] : scene->geometries[b];
+            if (ga.vertex_buffer != gb.vertex_buffer || ga.index_buffer != gb.index_buffer ||
+                ga.num_indices != gb.num_indices)
+                return false;
+
+            if (memcmp(&scene->samplers[a], &scene->samplers[b], sizeof(cmp_samplers)) != 0)
+                return false;
+
+            // material cbuffers are per entity, instances are drawn with the first entities cbuffer
+            if (is_valid(ma.material_cbuffer) != is_valid(mb.material_cbuffer))
+                return false;
+
+            if (is_valid(ma.material_cbuffer))
+                if (memcmp(&scene->material_data[a], &scene->material_data[b], sizeof(cmp_material_data)) != 0)
+                    return false;
+
+            return true;
+        }
+
+        // returns the instanced permutation of the technique or invalid handle if the technique has none
+        u32 get_auto_instance_technique(const scene_view& view, u32 shader, u32 technique, u32 permutation)
+        {
+            hash_id id_technique;
+            u32     base;
+            if (is_valid(view.pmfx_shader))
+            {
+                id_technique = view.id_technique;
+                base = pmfx::get_technique_index_perm(shader, id_technique, permutation);
+            }
+            else
+            {
+                id_technique = pmfx::get_technique_id(shader, technique);
+                base = technique;
+            }
+
+            u32 inst = pmfx::get_technique_index_perm(shader, id_technique, permutation | e_shader_permutation::instanced);
+
+            // permutations the technique does not have are masked out
+            if (inst == base)
+                return PEN_INVALID_HANDLE;
+
+            return inst;
+        }
+
+        // material technique specialised with the permutation bits set by a view, techniques without those options are
+        // returned unchanged
+        u32 get_view_technique(u32 shader, u32 technique, u32 permutation)
+        {
+            hash_id id_technique = pmfx::get_technique_id(shader, technique);
+            u32     view_technique = pmfx::get_technique_index_perm(shader, id_technique, permutation);
+
+            return is_valid(view_technique) ? view_technique : technique;
+        }
+
+        bool draw_buffer_enabled(const ecs_scene* scene)
+        {
+            if (scene->flags & e_scene_flags::disable_draw_buffer)
+                return false;
+
+            // the draw buffer is read in vertex shaders as a structured buffer
+            return pen::renderer_get_info().caps & PEN_CAPS_STRUCTURED_BUFFER;
+        }
+
+        // stale flags are cleared in the render frame, pipelined scenes upload every cbuffer during update so views
+        // never write to the scene
+        void bind_draw_call_cbuffer(ecs_scene* scene, render_frame& rf, u32 n)
+        {
+            update_draw_call_cbuffer(scene, rf, n);
+            pen::renderer_set_constant_buffer(scene->cbuffer[n], 1, pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS);
+        }
+
+        void bind_draw_call_cbuffer(ecs_scene* scene, u32 entity_index)
+        {
+            render_frame rf = get_render_frame(scene);
+            bind_draw_call_cbuffer(scene, rf, entity_index);
+        }
+
+        // true if the technique reads per draw constants from the draw buffer in its draw_buffer permutation
+        bool has_draw_buffer_permutation(u32 shader, hash_id id_technique, u32 permutation)
+        {
+            u32 base = pmfx::get_technique_index_perm(shader, id_technique, permutation);
+            u32 db = pmfx::get_technique_index_perm(shader, id_technique, permutation | e_shader_permutation::draw_buffer);
 
-            // get inv shadow matrices
-            u32 i = 0;
-            for (u32 n = 0; n < scene->num_entities; ++n)
-            {
-                if (!(scene->entities[n] & e_cmp::light))
-                    continue;
+            return db != base;
+        }
 
-                if (!(scene->lights[n].flags & e_light_flags::global_illumination))
-                    continue;
+        // views recorded in parallel build and sort their draw packets in memory owned by the recording thread
+        struct draw_scratch
+        {
+            draw_packet* packets = nullptr;
+            draw_packet* sort_temp = nullptr;
+            u32*         batch_sizes = nullptr;
+            cull_buffers miss; // culled while recording a command list, the view buffer pool is only read
+        };
+        thread_local draw_scratch t_draw_scratch;
 
-                camera cam;
-                shadow_camera_from_entity(cam, scene, n);
-                mat4 vp = cam.proj * cam.view;
+        struct view_textures
+        {
+            u32 ltc_mat;
+            u32 ltc_mag;
+            u32 blue_noise;
+        };
 
-                info.inv_mat = mat::inverse4x4(vp);
-                info.shadow_map_size.z = i++;
+        // loaded together so the first views recorded in parallel do not load textures concurrently
+        const view_textures& get_view_textures()
+        {
+            static view_textures vt = {put::load_texture("data/textures/ltc/ltc_mat.dds"),
+                                       put::load_texture("data/textures/ltc/ltc_amp.dds"),
+                                       put::load_texture("data/textures/noise/blue_noise_ldr_rgba_0.dds")};
+            return vt;
+        }
 
-                pmfx::set_technique_perm(view.pmfx_shader, view.id_technique, 0);
-                pen::renderer_set_texture(volume_gi_tex, 0, 0, pen::TEXTURE_BIND_CS);
-                pen::renderer_set_texture(colour_shadow_map, 0, 1, pen::TEXTURE_BIND_CS);
-                pen::renderer_set_texture(colour_shadow_map_depth, 0, 2, pen::TEXTURE_BIND_CS);
-                pen::renderer_update_buffer(cb_info, &info, sizeof(gi_info));
-                pen::renderer_set_constant_buffer(cb_info, 1, pen::CBUFFER_BIND_CS);
-                pen::renderer_dispatch_compute({(u32)info.shadow_map_size.x, (u32)info.shadow_map_size.y, 1}, {16, 16, 1});
-            }
+        void add_draw_stats(ecs_scene* scene, const scene_draw_stats& stats)
+        {
+            static pen::mutex* s_stats_mutex = pen::mutex_create();
+            pen::mutex_lock(s_stats_mutex);
 
-            // info for the ray marching
-            gi_volume_info gi_info;
-            gi_info.volume_size = info.volume_size;
-            gi_info.scene_size = info.scene_size;
-            pen::renderer_update_buffer(scene->gi_volume_buffer, &gi_info, sizeof(gi_info));
+            scene_draw_stats& ds = scene->draw_stats;
+            ds.draw_calls += stats.draw_calls;
+            ds.auto_instanced_entities += stats.auto_instanced_entities;
+            ds.occluded_entities += stats.occluded_entities;
+            ds.draw_buffer_entities += stats.draw_buffer_entities;
+            ds.inline_culls += stats.inline_culls;
 
-            // unbind textures to silence validation warnings
-            pen::renderer_set_texture(0, 0, 0, pen::TEXTURE_BIND_CS);
-            pen::renderer_set_texture(0, 0, 1, pen::TEXTURE_BIND_CS);
-            pen::renderer_set_texture(0, 0, 2, pen::TEXTURE_BIND_CS);
+            pen::mutex_unlock(s_stats_mutex);
         }
 
         void render_scene_view(const scene_view& view)
@@ -906,32 +1943,41 @@ namespace put
             if (scene->view_flags & e_scene_view_flags::hide)
                 return;
 
+            render_frame         rf = get_render_frame(scene);
+            const view_textures& vt = get_view_textures();
+            scene_draw_stats     stats;
+
             // view
             pen::renderer_set_constant_buffer(view.cb_view, 0, pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS);
 
             // fwd lights
+            u32 view_permutation = 0;
             if (view.render_flags & pmfx::e_scene_render_flags::forward_lit)
             {
                 pen::renderer_set_constant_buffer(scene->forward_light_buffer, 3, pen::CBUFFER_BIND_PS);
+
+                // point and spot lights from the clusters, directional lights stay in the forward light buffer
+                if (light_clusters_enabled(scene, view.camera))
+                {
+                    bind_light_clusters(scene, view.camera);
+                    view_permutation = e_shader_permutation::clustered_lights;
+                }
                 pen::renderer_set_constant_buffer(scene->shadow_map_buffer, 4, pen::CBUFFER_BIND_PS);
                 pen::renderer_set_constant_buffer(scene->area_light_buffer, 6, pen::CBUFFER_BIND_PS);
 
                 // ltc lookups
-                static u32 ltc_mat = put::load_texture("data/textures/ltc/ltc_mat.dds");
-                static u32 ltc_mag = put::load_texture("data/textures/ltc/ltc_amp.dds");
-
                 static hash_id id_clamp_linear = PEN_HASH("clamp_linear");
                 u32            clamp_linear = pmfx::get_render_state(id_clamp_linear, pmfx::e_render_state::sampler);
 
-                pen::renderer_set_texture(ltc_mat, clamp_linear, 13, pen::TEXTURE_BIND_PS);
-                pen::renderer_set_texture(ltc_mag, clamp_linear, 12, pen::TEXTURE_BIND_PS);
+                pen::renderer_set_texture(vt.ltc_mat, clamp_linear, 13, pen::TEXTURE_BIND_PS);
+                pen::renderer_set_texture(vt.ltc_mag, clamp_linear, 12, pen::TEXTURE_BIND_PS);
             }
 
             // sdf shadows
             pen::renderer_set_constant_buffer(scene->sdf_shadow_buffer, 5, pen::CBUFFER_BIND_PS);
-            for (u32 n = 0; n < scene->num_entities; ++n)
+            for (u32 n = 0; n < rf.num_entities; ++n)
             {
-                if (!(scene->entities[n] & e_cmp::sdf_shadow))
+                if (!(rf.entities[n] & e_cmp::sdf_shadow))
                     continue;
 
                 cmp_shadow& shadow = scene->shadows[n];
@@ -947,63 +1993,312 @@ namespace put
             // gi volume
             pen::renderer_set_constant_buffer(scene->gi_volume_buffer, 11, pen::CBUFFER_BIND_PS);
 
+            // per draw constants for every entity, draws pass their index as the start instance
+            bool draw_buffer = draw_buffer_enabled(scene) && is_valid(scene->draw_call_buffer);
+            if (draw_buffer)
+            {
+                u32 flags = pen::SBUFFER_BIND_VS | pen::SBUFFER_BIND_READ;
+                pen::renderer_set_structured_buffer(scene->draw_call_buffer, e_global_textures::draw_calls, flags);
+            }
+
             // blue noise
             static hash_id id_wrap_point = PEN_HASH("wrap_point");
             u32            wrap_point = pmfx::get_render_state(id_wrap_point, pmfx::e_render_state::sampler);
-            static u32     blue_noise = put::load_texture("data/textures/noise/blue_noise_ldr_rgba_0.dds");
-            pen::renderer_set_texture(blue_noise, wrap_point, 5, pen::TEXTURE_BIND_PS);
-
-            // filter and cull
-            u32* filtered_entities = nullptr;
-            u32* culled_entities = nullptr;
-            filter_entities_scalar(scene, &filtered_entities);
-            frustum_cull_aabb_scalar(scene, view.camera, filtered_entities, &culled_entities);
-            
+            pen::renderer_set_texture(vt.blue_noise, wrap_point, 5, pen::TEXTURE_BIND_PS);
+
+            // cull, usually done already by cull_views, a miss means the camera changed after it was culled
+            draw_scratch& scratch = t_draw_scratch;
+            cull_buffers* p_buffers = nullptr;
+            if (pen::renderer_recording_cmd_list())
+            {
+                cull_key key = make_cull_key(view.camera);
+                p_buffers = find_view_buffers(scene, key);
+                if (!p_buffers || !p_buffers->culled)
+                {
+                    scratch.miss.key = key;
+                    scratch.miss.culled = false;
+                    p_buffers = &scratch.miss;
+                }
+            }
+            else
+            {
+                p_buffers = &get_view_buffers(scene, view.camera);
+            }
+
+            cull_buffers& buffers = *p_buffers;
+            if (!buffers.culled)
+            {
+                cull_view(scene, buffers);
+                stats.inline_culls++;
+            }
+
+            sb_reset(scratch.packets);
+            sb_reset(scratch.sort_temp);
+
+            u32* culled_entities = buffers.entities;
+            u32  vc = sb_count(culled_entities);
+            stats.occluded_entities += buffers.occluded;
+
+            // build draw packets
+            if (vc > 0)
+            {
+                sb_add(scratch.packets, vc);
+                sb_add(scratch.sort_temp, vc);
+            }
+
+            draw_packet* packets = scratch.packets;
+            draw_packet* sort_temp = scratch.sort_temp;
+
+            bool  alpha = view.render_flags & pmfx::e_scene_render_flags::alpha_blended;
+            bool  shadow = view.render_flags & pmfx::e_scene_render_flags::shadow_map;
+            vec4f depth_row = view.camera->view.get_row(2);
+            f32   depth_scale = view.camera->far_plane > 0.0f ? 1.0f / view.camera->far_plane : 1.0f;
+
+            u32 num_packets = 0;
+            for (u32 i = 0; i < vc; ++i)
+            {
+                u32 n = culled_entities[i];
+
+                // flags may have changed since the renderables were updated
+                if (!is_renderable(rf, n))
+                    continue;
+
+                // skip 0 instance buffers
+                if (rf.entities[n] & e_cmp::master_instance)
+                    if (scene->master_instances[n].num_instances == 0)
+                        continue;
+
+                const cmp_geometry* p_geom = &scene->geometries[n];
+                if (!(rf.entities[n] & e_cmp::skinned))
+                    if (shadow)
+                        p_geom = &scene->position_geometries[n];
+
+                const cmp_material& mat = scene->materials[n];
+                u32                 shader = mat.shader;
+                u32                 technique = mat.technique_index;
+                if (is_valid(view.pmfx_shader))
+                {
+                    shader = view.pmfx_shader;
+                    technique = 0;
+                }
+
+                // view space depth, camera looks down -z
+                vec3f pos = rf.pos_extent[n].pos.xyz;
+                f32   depth = -(dot(pos, depth_row.xyz) + depth_row.w) * depth_scale;
+
+                draw_packet& dp = packets[num_packets++];
+                dp.entity = n;
+                dp.key = make_draw_key(shader, technique, scene->material_permutation[n], mat.material_cbuffer,
+                                       p_geom->vertex_buffer, depth, alpha);
+            }
+
+            radix_sort_draw_packets(packets, sort_temp, num_packets);
+
+            bool auto_instance = !(scene->flags & e_scene_flags::disable_auto_instancing);
+            bool shadow_pass = view.render_flags & pmfx::e_scene_render_flags::shadow_map;
+            auto_instance &= is_valid(scene->auto_instance_buffer);
+
+            // runs of compatible entities are found before drawing so every batch of the view is written with a single
+            // update. each update replaces what earlier draws read (d3d11 discards the buffer and metal moves further
+            // updates to fresh memory) so batches can not update their own regions of a shared buffer
+            u32* batch_sizes = nullptr;
+            u32  num_instances = 0;
+            if (auto_instance && num_packets > 0)
+            {
+                sb_reset(scratch.batch_sizes);
+                batch_sizes = sb_add(scratch.batch_sizes, num_packets);
+
+                for (u32 i = 0; i < num_packets;)
+                {
+                    u32 n = packets[i].entity;
+                    u32 batch_size = 1;
+                    if (auto_instance_candidate(rf, n))
+                    {
+                        while (i + batch_size < num_packets && batch_size < k_max_auto_instances &&
+                               auto_instance_compatible(scene, rf, n, packets[i + batch_size].entity, shadow_pass))
+                            ++batch_size;
+                    }
+
+                    // entities inside a batch draw singly if the technique has no instanced permutation
+                    for (u32 j = 0; j < batch_size; ++j)
+                        batch_sizes[i + j] = 1;
+
+                    batch_sizes[i] = batch_size;
+                    if (batch_size >= k_min_auto_instances)
+                        num_instances += batch_size;
+
+                    i += batch_size;
+                }
+            }
+
+            // the buffer can not grow while recording a command list, cull_views reserves enough for its culled views
+            if (num_instances > scene->auto_instance_capacity && pen::renderer_recording_cmd_list())
+            {
+                num_instances = 0;
+                batch_sizes = nullptr;
+            }
+
+            if (num_instances > 0)
+            {
+                reserve_auto_instances(scene, num_instances);
+
+                // write per draw data straight into upload memory
+                u32            data_size = sizeof(cmp_draw_call) * num_instances;
+                cmp_draw_call* instances = (cmp_draw_call*)pen::renderer_reserve_buffer_update(data_size);
+                u32            pos = 0;
+                for (u32 i = 0; i < num_packets; i += batch_sizes[i])
+                {
+                    if (batch_sizes[i] < k_min_auto_instances)
+                        continue;
+
+                    for (u32 j = 0; j < batch_sizes[i]; ++j)
+                        instances[pos++] = rf.draw_call_data[packets[i + j].entity];
+                }
+
+                pen::renderer_submit_buffer_update(scene->auto_instance_buffer, instances, data_size);
+            }
+
+            // first instance of the next batch, batches are drawn in the order they were written
+            u32 instance_cursor = 0;
+
             // track to prevent redundant state changes.
             u32 cur_shader = -1;
             u32 cur_technique = -1;
             u32 cur_permutation = -1;
             u32 cur_vb = -1;
             u32 cur_ib = -1;
-            u32 vc = sb_count(culled_entities);
-            
+
+            // draw buffer support is looked up once per run of packets with the same technique
+            u32  db_shader = -1;
+            u32  db_technique = -1;
+            u32  db_permutation = -1;
+            u32  db_draw_technique = -1;
+            bool db_supported = false;
+            bool cur_draw_index = false; // draw index stream is bound in slot 1
+
             // render
-            for (u32 i = 0; i < vc; ++i)
+            for (u32 i = 0; i < num_packets; ++i)
             {
-                u32 n = culled_entities[i];
-                
-                // skip 0 instance buffers
-                if (scene->entities[n] & e_cmp::master_instance)
-                    if(scene->master_instances[n].num_instances == 0)
-                        continue;
+                u32 n = packets[i].entity;
+                stats.draw_calls++;
 
                 cmp_geometry* p_geom = &scene->geometries[n];
-                if (!(scene->entities[n] & e_cmp::skinned))
+                if (!(rf.entities[n] & e_cmp::skinned))
                     if (view.render_flags & pmfx::e_scene_render_flags::shadow_map)
                         p_geom = &scene->position_geometries[n];
 
                 cmp_material* p_mat = &scene->materials[n];
-                u32           permutation = scene->material_permutation[n];
+                u32           permutation = scene->material_permutation[n] | view_permutation;
 
-                // set shader / technique only if we need to change
-                if (p_mat->shader != cur_shader || p_mat->technique_index != cur_technique || permutation != cur_permutation)
+                // per pass material but with permutation specialisation (instanced, skinned etc)
+                u32 shader = p_mat->shader;
+                u32 technique = p_mat->technique_index;
+                if (is_valid(view.pmfx_shader))
                 {
-                    if (!is_valid(view.pmfx_shader))
+                    shader = view.pmfx_shader;
+                    technique = view.id_technique;
+                }
+                else if (view_permutation)
+                {
+                    technique = get_view_technique(shader, technique, permutation);
+                }
+
+                // master instances bind their own instance stream so always use their cbuffer
+                bool use_draw_buffer = false;
+                if (draw_buffer && !(rf.entities[n] & e_cmp::master_instance))
+                {
+                    if (shader != db_shader || technique != db_technique || permutation != db_permutation)
                     {
-                        // per entity material
-                        pmfx::set_technique(p_mat->shader, p_mat->technique_index);
-                        cur_shader = p_mat->shader;
-                        cur_technique = p_mat->technique_index;
-                        cur_permutation = permutation;
+                        db_shader = shader;
+                        db_technique = technique;
+                        db_permutation = permutation;
+
+                        hash_id id_technique = technique;
+                        if (!is_valid(view.pmfx_shader))
+                            id_technique = pmfx::get_technique_id(shader, technique);
+
+                        db_supported = has_draw_buffer_permutation(shader, id_technique, permutation);
+                        db_draw_technique = technique;
+
+                        // per pass shaders are set by id and permutation so only material techniques are specialised
+                        if (db_supported && !is_valid(view.pmfx_shader))
+                            db_draw_technique = pmfx::get_technique_index_perm(
+                                shader, id_technique, permutation | e_shader_permutation::draw_buffer);
                     }
-                    else
+
+                    use_draw_buffer = db_supported;
+                }
+
+                // draw a run of compatible entities with an instanced draw
+                u32 batch_size = batch_sizes ? batch_sizes[i] : 1;
+                if (batch_size >= k_min_auto_instances)
+                {
+                    u32 first_instance = instance_cursor;
+                    instance_cursor += batch_size;
+
+                    u32 inst_technique = get_auto_instance_technique(view, shader, technique, permutation);
+                    if (is_valid(inst_technique))
                     {
-                        // per pass material but with permutation specialisation (instanced, skinned etc)
-                        pmfx::set_technique_perm(view.pmfx_shader, view.id_technique, permutation);
-                        cur_shader = view.pmfx_shader;
-                        cur_technique = view.id_technique;
-                        cur_permutation = permutation;
+                        pmfx::set_technique(shader, inst_technique);
+
+                        // mark the permutation so the next single draw sets its technique again
+                        cur_shader = shader;
+                        cur_technique = technique;
+                        cur_permutation = permutation | e_shader_permutation::instanced;
+
+                        u32 mcb = p_mat->material_cbuffer;
+                        if (is_valid(mcb))
+                            pen::renderer_set_constant_buffer(mcb, 7, pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS);
+
+                        bind_draw_call_cbuffer(scene, rf, n);
+
+                        cmp_samplers& samplers = scene->samplers[n];
+                        for (u32 s = 0; s < e_pmfx_constants::max_technique_sampler_bindings; ++s)
+                        {
+                            if (!samplers.sb[s].handle)
+                                continue;
+
+                            pen::renderer_set_texture(samplers.sb[s].handle, samplers.sb[s].sampler_state,
+                                                      samplers.sb[s].sampler_unit, pen::TEXTURE_BIND_PS);
+                        }
+
+                        u32 vbs[2] = {p_geom->vertex_buffer, scene->auto_instance_buffer};
+                        u32 strides[2] = {p_geom->vertex_size, sizeof(cmp_draw_call)};
+                        u32 offsets[2] = {0, (u32)sizeof(cmp_draw_call) * first_instance};
+
+                        pen::renderer_set_vertex_buffers(vbs, 2, 0, strides, offsets);
+                        pen::renderer_set_index_buffer(p_geom->index_buffer, p_geom->index_type, 0);
+
+                        // the instance stream is bound in slot 1 so the next single draw must rebind
+                        cur_vb = -1;
+                        cur_ib = p_geom->index_buffer;
+
+                        pen::renderer_draw_indexed_instanced(batch_size, 0, p_geom->num_indices, 0, 0,
+                                                             PEN_PT_TRIANGLELIST);
+
+                        stats.auto_instanced_entities += batch_size;
+                        i += batch_size - 1;
+                        continue;
                     }
+                }
+
+                if (use_draw_buffer)
+                {
+                    permutation |= e_shader_permutation::draw_buffer;
+                    technique = db_draw_technique;
+                }
+
+                // set shader / technique only if we need to change
+                if (shader != cur_shader || technique != cur_technique || permutation != cur_permutation)
+                {
+                    if (!is_valid(view.pmfx_shader))
+                        pmfx::set_technique(shader, technique); // per entity material
+                    else
+                        pmfx::set_technique_perm(shader, technique, permutation);
+
+                    cur_shader = shader;
+                    cur_technique = technique;
+                    cur_permutation = permutation;
 
                     // if we change pipeline, we need to rebind buffers
                     cur_vb = -1;
@@ -1011,7 +2306,7 @@ namespace put
                 }
 
                 // bind skinning
-                if (scene->entities[n] & e_cmp::skinned)
+                if (rf.entities[n] & e_cmp::skinned)
                 {
                     pen::renderer_set_constant_buffer(scene->bone_cbuffer[n], 2, pen::CBUFFER_BIND_VS);
                 }
@@ -1024,7 +2319,8 @@ namespace put
                 }
 
                 // draw call cb
-                pen::renderer_set_constant_buffer(scene->cbuffer[n], 1, pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS);
+                if (!use_draw_buffer)
+                    bind_draw_call_cbuffer(scene, rf, n);
 
                 // set textures
                 if (p_mat)
@@ -1041,7 +2337,7 @@ namespace put
                 }
 
                 // set vertex buffer
-                if (scene->entities[n] & e_cmp::master_instance)
+                if (rf.entities[n] & e_cmp::master_instance)
                 {
                     u32 vbs[2] = {p_geom->vertex_buffer, scene->master_instances[n].instance_buffer};
                     u32 strides[2] = {p_geom->vertex_size, scene->master_instances[n].instance_stride};
@@ -1049,6 +2345,21 @@ namespace put
 
                     pen::renderer_set_vertex_buffers(vbs, 2, 0, strides, offsets);
                     cur_vb = vbs[0];
+                    cur_draw_index = false;
+                }
+                else if (use_draw_buffer)
+                {
+                    // draw indices stream per instance in slot 1, offset by the start instance
+                    if (cur_vb != p_geom->vertex_buffer || !cur_draw_index)
+                    {
+                        u32 vbs[2] = {p_geom->vertex_buffer, scene->draw_index_buffer};
+                        u32 strides[2] = {p_geom->vertex_size, sizeof(vec4f)};
+                        u32 offsets[2] = {0};
+
+                        pen::renderer_set_vertex_buffers(vbs, 2, 0, strides, offsets);
+                        cur_vb = p_geom->vertex_buffer;
+                        cur_draw_index = true;
+                    }
                 }
                 else
                 {
@@ -1067,39 +2378,37 @@ namespace put
                 }
 
                 // instances
-                if (scene->entities[n] & e_cmp::master_instance)
+                if (rf.entities[n] & e_cmp::master_instance)
                 {
                     pen::renderer_draw_indexed_instanced(
                         scene->master_instances[n].num_instances, 0, p_geom->num_indices, 0, 0, PEN_PT_TRIANGLELIST);
                     
-                    if(!(scene->entities[n] & e_cmp::custom_instance_buffer))
+                    if(!(rf.entities[n] & e_cmp::custom_instance_buffer))
                         n += scene->master_instances[n].num_instances;
                         
                     continue;
                 }
 
                 // single
-                pen::renderer_draw_indexed(p_geom->num_indices, 0, 0, PEN_PT_TRIANGLELIST);
-            }
+                if (use_draw_buffer)
+                {
+                    pen::renderer_draw_indexed_instanced(1, n, p_geom->num_indices, 0, 0, PEN_PT_TRIANGLELIST);
+                    stats.draw_buffer_entities++;
+                    continue;
+                }
 
-            if (filtered_entities)
-            {
-                sb_free(filtered_entities);
+                pen::renderer_draw_indexed(p_geom->num_indices, 0, 0, PEN_PT_TRIANGLELIST);
             }
 
-            if (culled_entities)
-            {
-                sb_free(culled_entities);
-            }
+            add_draw_stats(scene, stats);
         }
 
         void update_animations(ecs_scene* scene, f32 dt)
         {
-            for (u32 n = 0; n < scene->num_entities; ++n)
+            const entity_query& anim_query = get_entity_query(scene, e_query::anim_controller);
+            for (u32 i = 0; i < sb_count(anim_query.entities); ++i)
             {
-                if (!(scene->entities[n] & e_cmp::anim_controller))
-                    continue;
-
+                u32                    n = anim_query.entities[i];
                 cmp_anim_controller_v2 controller = scene->anim_controller_v2[n];
                 u32 root = ecs::get_index_from_ref(scene, controller.root_joint_ref);
                 
@@ -1370,169 +2679,422 @@ namespace put
             }
         }
 
-        void update_scene(ecs_scene* scene, f32 dt)
+        mat3x4 local_matrix_from_transform(cmp_transform& t)
         {
-            // static anim time to pass into draw calls etc..
-            f32 anim_time = pen::get_time_ms() / 1000.0f;
+            mat4 rot_mat;
+            t.rotation.get_matrix(rot_mat);
 
-            u32 num_controllers = sb_count(scene->controllers);
-            u32 num_extensions = sb_count(scene->extensions);
+            mat4 translation_mat = mat::create_translation(t.translation);
+
+            mat4 scale_mat = mat::create_scale(t.scale);
 
-            // pre update controllers
-            for (u32 c = 0; c < num_controllers; ++c)
-                if (scene->controllers[c].funcs.update_func)
-                    scene->controllers[c].funcs.update_func(scene->controllers[c], scene, dt);
+            return mat3x4(translation_mat * rot_mat * scale_mat);
+        }
 
-            if (scene->flags & e_scene_flags::pause_update)
+        void build_hierarchy_levels(ecs_scene* scene)
+        {
+            static const u32 k_depth_unknown = PEN_INVALID_HANDLE;
+            static const u32 k_depth_visiting = PEN_INVALID_HANDLE - 1;
+
+            hierarchy_levels& hl = scene->hierarchy;
+            u32               num = (u32)scene->num_entities;
+            const u32*        parents = scene->parents.data;
+
+            // depth of each entity, walks up to the nearest ancestor with a known depth and assigns every entity on the
+            // path on the way back, so each entity is walked once and parents do not need lower indices than children
+            u32* depth = nullptr;
+            u32* path = nullptr;
+            sb_add(depth, num);
+            for (u32 n = 0; n < num; ++n)
+                depth[n] = k_depth_unknown;
+
+            u32 num_levels = 0;
+            for (u32 n = 0; n < num; ++n)
             {
-                physics::set_paused(1);
+                if (depth[n] != k_depth_unknown)
+                    continue;
+
+                sb_clear(path);
+
+                u32 d = 0; // depth of the last entity on the path
+                u32 p = n;
+                for (;;)
+                {
+                    depth[p] = k_depth_visiting;
+                    sb_push(path, p);
+
+                    u32 parent = parents[p];
+                    if (parent == p || parent >= num)
+                        break;
+
+                    if (depth[parent] == k_depth_visiting)
+                    {
+                        // cycle in the scene tree, p is treated as a root so the walk terminates
+                        PEN_ASSERT(0);
+                        break;
+                    }
+
+                    if (depth[parent] != k_depth_unknown)
+                    {
+                        d = depth[parent] + 1;
+                        break;
+                    }
+
+                    p = parent;
+                }
+
+                for (u32 i = sb_count(path); i > 0; --i)
+                    depth[path[i - 1]] = d++;
+
+                num_levels = max<u32>(num_levels, d);
             }
-            else
+
+            // counting sort by depth, entities keep index order within a level
+            sb_clear(hl.level_start);
+            sb_add(hl.level_start, num_levels + 1);
+            memset(hl.level_start, 0x0, sizeof(u32) * (num_levels + 1));
+
+            for (u32 n = 0; n < num; ++n)
+                hl.level_start[depth[n] + 1]++;
+
+            for (u32 l = 0; l < num_levels; ++l)
+                hl.level_start[l + 1] += hl.level_start[l];
+
+            sb_clear(hl.bounds_dirty);
+            sb_add(hl.bounds_dirty, num);
+
+            sb_clear(hl.entities);
+            sb_add(hl.entities, num);
+            for (u32 n = 0; n < num; ++n)
+                hl.entities[hl.level_start[depth[n]]++] = n;
+
+            // scatter advanced each start to the next level
+            for (u32 l = num_levels; l > 0; --l)
+                hl.level_start[l] = hl.level_start[l - 1];
+            hl.level_start[0] = 0;
+
+            sb_free(depth);
+            sb_free(path);
+        }
+
+        // returns true if the levels were rebuilt, in which case every entity is treated as dirty
+        bool update_hierarchy_levels(ecs_scene* scene)
+        {
+            hierarchy_levels& hl = scene->hierarchy;
+
+            // the scene tree ui also consumes invalidate_scene_tree and clears it, so rebuild once when it is raised.
+            // parent changes which do not raise it request a rebuild directly
+            bool invalidated = scene->flags & e_scene_flags::invalidate_scene_tree;
+            bool rebuild = hl.rebuild || (invalidated && !hl.invalidate_seen);
+            hl.invalidate_seen = invalidated;
+
+            // entities appended or removed from the end
+            rebuild |= !hl.level_start || sb_count(hl.entities) != (u32)scene->num_entities;
+
+            if (rebuild)
+                build_hierarchy_levels(scene);
+
+            hl.rebuild = false;
+            return rebuild;
+        }
+
+        void release_draw_buffer(ecs_scene* scene)
+        {
+            if (!is_valid(scene->draw_call_buffer))
+                return;
+
+            pen::renderer_release_buffer(scene->draw_call_buffer);
+            pen::renderer_release_buffer(scene->draw_index_buffer);
+
+            scene->draw_call_buffer = PEN_INVALID_HANDLE;
+            scene->draw_index_buffer = PEN_INVALID_HANDLE;
+            scene->draw_buffer_capacity = 0;
+        }
+
+        // buffers are sized to the scene soa and recreated when it resizes, the draw indices never change after creation
+        void update_draw_buffer(ecs_scene* scene, bool changed)
+        {
+            u32 capacity = (u32)scene->soa_size;
+            if (capacity != scene->draw_buffer_capacity)
             {
-                physics::set_paused(0);
-                update_animations(scene, dt);
+                release_draw_buffer(scene);
+
+                pen::buffer_creation_params bcp;
+                bcp.usage_flags = PEN_USAGE_DYNAMIC;
+                bcp.bind_flags = PEN_BIND_SHADER_RESOURCE;
+                bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
+                bcp.buffer_size = sizeof(cmp_draw_call) * capacity;
+                bcp.stride = sizeof(cmp_draw_call);
+                bcp.data = nullptr;
+
+                scene->draw_call_buffer = pen::renderer_create_buffer(bcp);
+
+                vec4f* indices = (vec4f*)pen::memory_alloc(sizeof(vec4f) * capacity);
+                for (u32 i = 0; i < capacity; ++i)
+                    indices[i] = vec4f((f32)i, 0.0f, 0.0f, 0.0f);
+
+                bcp.usage_flags = PEN_USAGE_DEFAULT;
+                bcp.bind_flags = PEN_BIND_VERTEX_BUFFER;
+                bcp.cpu_access_flags = 0;
+                bcp.buffer_size = sizeof(vec4f) * capacity;
+                bcp.stride = 0;
+                bcp.data = indices;
+
+                scene->draw_index_buffer = pen::renderer_create_buffer(bcp);
+                scene->draw_buffer_capacity = capacity;
+                pen::memory_free(indices);
+
+                changed = true;
             }
 
-            // extension component update
-            for (u32 e = 0; e < num_extensions; ++e)
-                if (scene->extensions[e].funcs.update_func)
-                    scene->extensions[e].funcs.update_func(scene->extensions[e], scene, dt);
+            if (!changed)
+                return;
 
-            static pen::timer* timer = pen::timer_create();
-            pen::timer_start(timer);
+            u32 size = sizeof(cmp_draw_call) * (u32)scene->num_entities;
+            pen::renderer_update_buffer(scene->draw_call_buffer, scene->draw_call_data.data, size);
+            scene->update_stats.draw_buffer_bytes += size;
+        }
 
-            // scene node transform
-            for (size_t n = 0; n < scene->num_entities; ++n)
-            {
-                // force physics entity to sync and ignore controlled transform
-                if (scene->state_flags[n] & e_state::sync_physics_transform)
-                {
-                    scene->state_flags[n] &= ~e_state::sync_physics_transform;
-                    scene->entities[n] &= ~e_cmp::transform;
-                }
+        render_frame get_render_frame(const ecs_scene* scene)
+        {
+            const render_pipeline& rp = scene->pipeline;
+            if (rp.pending)
+                return rp.frames[rp.front];
+
+            render_frame rf;
+            rf.entities = scene->entities.data;
+            rf.state_flags = scene->state_flags.data;
+            rf.world_matrices = scene->world_matrices.data;
+            rf.pos_extent = scene->pos_extent.data;
+            rf.draw_call_data = scene->draw_call_data.data;
+            rf.renderables = scene->renderables.entities;
+            rf.bvh = scene->bvh;
+            rf.renderable_extents = scene->renderable_extents;
+            rf.num_entities = (u32)scene->num_entities;
+            rf.capacity = scene->soa_size;
+            return rf;
+        }
 
-                // controlled transform
-                if (scene->entities[n] & e_cmp::transform)
-                {
-                    cmp_transform& t = scene->transforms[n];
+        template <typename T>
+        void reserve_frame_array(T*& arr, u32 capacity)
+        {
+            arr = (T*)pen::memory_realloc(arr, sizeof(T) * capacity);
+        }
+
+        template <typename T>
+        void copy_frame_sb(T*& dst, T* src)
+        {
+            u32 count = sb_count(src);
+            sb_reset(dst);
+            if (count == 0)
+                return;
 
-                    // generate matrix from transform
-                    mat4 rot_mat;
-                    t.rotation.get_matrix(rot_mat);
+            sb_add(dst, count);
+            memcpy(dst, src, sizeof(T) * count);
+        }
 
-                    mat4 translation_mat = mat::create_translation(t.translation);
+        // copies what views read into the frame not read by the last views, then makes it the front
+        void extract_render_frame(ecs_scene* scene)
+        {
+            f64 start = pen::get_time_ms();
 
-                    mat4 scale_mat = mat::create_scale(t.scale);
+            render_pipeline& rp = scene->pipeline;
+            render_frame&    rf = rp.frames[rp.front ^ 1];
+            u32              num = (u32)scene->num_entities;
 
-                    scene->local_matrices[n] = translation_mat * rot_mat * scale_mat;
+            if (num > rf.capacity)
+            {
+                rf.capacity = scene->soa_size;
+                reserve_frame_array(rf.entities, rf.capacity);
+                reserve_frame_array(rf.state_flags, rf.capacity);
+                reserve_frame_array(rf.world_matrices, rf.capacity);
+                reserve_frame_array(rf.pos_extent, rf.capacity);
+                reserve_frame_array(rf.draw_call_data, rf.capacity);
+            }
 
-                    if (scene->entities[n] & e_cmp::physics)
-                    {
-                        if (scene->physics_data[n].type == e_physics_type::rigid_body)
-                        {
-                            cmp_transform& pt = scene->physics_offset[n];
-                            physics::set_transform(scene->physics_handles[n], t.translation + pt.translation, t.rotation);
-                            physics::set_v3(scene->physics_handles[n], vec3f::zero(), physics::e_cmd::set_angular_velocity);
-                            physics::set_v3(scene->physics_handles[n], vec3f::zero(), physics::e_cmd::set_linear_velocity);
-                        }
-                    }
+            // large chunks, each is a handful of memcpys
+            static const u32 k_extract_grain = 4096;
+            pen::parallel_for(0, num, k_extract_grain, [&](u32 begin, u32 end) {
+                u32 count = end - begin;
+                memcpy(&rf.entities[begin], &scene->entities.data[begin], sizeof(u64) * count);
+                memcpy(&rf.state_flags[begin], &scene->state_flags.data[begin], sizeof(u64) * count);
+                memcpy(&rf.world_matrices[begin], &scene->world_matrices.data[begin], sizeof(mat3x4) * count);
+                memcpy(&rf.pos_extent[begin], &scene->pos_extent.data[begin], sizeof(cmp_pos_extent) * count);
+                memcpy(&rf.draw_call_data[begin], &scene->draw_call_data.data[begin], sizeof(cmp_draw_call) * count);
+            });
+
+            // culling only walks the nodes and entities of the bvh
+            copy_frame_sb(rf.renderables, scene->renderables.entities);
+            copy_frame_sb(rf.bvh.nodes, scene->bvh.nodes);
+            copy_frame_sb(rf.bvh.entities, scene->bvh.entities);
+            rf.bvh.build_cost = scene->bvh.build_cost;
+            rf.bvh.cost = scene->bvh.cost;
+            rf.bvh.rebuilds = scene->bvh.rebuilds;
+
+            rf.renderable_extents = scene->renderable_extents;
+            rf.num_entities = num;
+            rp.front ^= 1;
+
+            u32 entity_bytes = sizeof(u64) * 2 + sizeof(mat3x4) + sizeof(cmp_pos_extent) + sizeof(cmp_draw_call);
+            rp.stats.extract_bytes = entity_bytes * num + sizeof(u32) * sb_count(rf.renderables) +
+                                     sizeof(bvh_node) * sb_count(rf.bvh.nodes) + sizeof(u32) * sb_count(rf.bvh.entities);
+            rp.stats.extract_ms = (f32)(pen::get_time_ms() - start);
+        }
 
-                    // local matrix will be baked
-                    scene->entities[n] &= ~e_cmp::transform;
-                }
-                else if (scene->entities[n] & e_cmp::physics)
-                {
-                    if (!physics::has_rb_matrix(n))
-                        continue;
+        void wait_for_update(ecs_scene* scene)
+        {
+            render_pipeline& rp = scene->pipeline;
+            if (pen::tasks_complete(&rp.counter))
+                return;
 
-                    cmp_transform& t = scene->transforms[n];
-                    cmp_transform& pt = scene->physics_offset[n];
+            f64 start = pen::get_time_ms();
+            pen::tasks_wait(&rp.counter);
+            rp.stats.wait_ms += (f32)(pen::get_time_ms() - start);
+        }
 
-                    mat4 scale_mat = mat::create_scale(t.scale);
+        void wait_for_updates()
+        {
+            for (auto& si : s_scenes)
+                wait_for_update(si.scene);
+        }
 
-                    vec3f os = t.scale;
-                    t = physics::get_rb_transform(scene->physics_handles[n]);
-                    t.scale = os;
+        bool is_simulating(ecs_scene* scene)
+        {
+            render_pipeline& rp = scene->pipeline;
+            return rp.pending && !pen::tasks_complete(&rp.counter);
+        }
 
-                    mat4 rot_mat;
-                    t.rotation.get_matrix(rot_mat);
+        // world matrices, bounds, the culling bvh and draw call data. nothing here touches the renderer or physics so
+        // pipelined scenes run it on the task pool while views record
+        void simulate_scene(ecs_scene* scene)
+        {
+            // heirarchical scene transform, one level at a time with the entities of each level split across the task pool
+            // only entities whose local matrix changed this update or whose parent is dirty are updated. transform_dirty
+            // is recomputed for every entity here, so it only marks what moved since the last simulate
+            bool all_dirty = update_hierarchy_levels(scene);
+
+            const hierarchy_levels& hl = scene->hierarchy;
+            u32                     num_levels = sb_count(hl.level_start) - 1;
+            for (u32 l = 0; l < num_levels; ++l)
+            {
+                pen::parallel_for(hl.level_start[l], hl.level_start[l + 1], k_parallel_grain, [&](u32 begin, u32 end) {
+                    // controlled transforms are gathered and their local matrices baked as a batch
+                    u32 bake[k_parallel_grain];
+                    u32 num_bake = 0;
+                    for (u32 i = begin; i < end; ++i)
+                    {
+                        u32 n = hl.entities[i];
+                        if (scene->entities[n] & e_cmp::physics)
+                            continue;
 
-                    mat4 translation_mat = mat::create_translation(t.translation - pt.translation);
+                        if (scene->state_flags[n] & e_state::sync_physics_transform)
+                        {
+                            scene->state_flags[n] &= ~e_state::sync_physics_transform;
+                            scene->entities[n] &= ~e_cmp::transform;
+                        }
 
-                    scene->local_matrices[n] = translation_mat * rot_mat * scale_mat;
-                }
+                        if (scene->entities[n] & e_cmp::transform)
+                        {
+                            bake[num_bake++] = n;
+                            scene->entities[n] &= ~e_cmp::transform;
+                            scene->state_flags[n] |= e_state::transform_changed;
+                        }
+                    }
 
-                // heirarchical scene transform
-                u32 parent = scene->parents[n];
-                if (parent == n)
-                    scene->world_matrices[n] = scene->local_matrices[n];
-                else
-                    scene->world_matrices[n] = scene->world_matrices[parent] * scene->local_matrices[n];
-            }
+                    bake_local_matrices(scene, bake, num_bake);
+
+                    for (u32 i = begin; i < end; ++i)
+                    {
+                        u32  n = hl.entities[i];
+                        u32  parent = scene->parents[n];
+                        bool dirty = all_dirty || (scene->state_flags[n] & e_state::transform_changed);
+                        scene->state_flags[n] &= ~(e_state::transform_changed | e_state::transform_dirty);
 
-            // bounding volume transform
-            static vec3f corners[] = {vec3f(0.0f, 0.0f, 0.0f),
+                        // parents are a level above so were finalised before this level started
+                        if (parent != n && (scene->state_flags[parent] & e_state::transform_dirty))
+                            dirty = true;
 
-                                      vec3f(1.0f, 0.0f, 0.0f), vec3f(0.0f, 1.0f, 0.0f), vec3f(0.0f, 0.0f, 1.0f),
+                        if (!dirty)
+                            continue;
 
-                                      vec3f(1.0f, 1.0f, 0.0f), vec3f(0.0f, 1.0f, 1.0f), vec3f(1.0f, 0.0f, 1.0f),
+                        scene->state_flags[n] |= e_state::transform_dirty;
 
-                                      vec3f(1.0f, 1.0f, 1.0f)};
+                        if (parent == n)
+                            scene->world_matrices[n] = scene->local_matrices[n];
+                        else
+                            scene->world_matrices[n] = scene->world_matrices[parent] * scene->local_matrices[n];
+                    }
+                });
+            }
 
-            scene->renderable_extents.min = vec3f::flt_max();
-            scene->renderable_extents.max = -vec3f::flt_max();
+            extents empty_extents = {vec3f::flt_max(), -vec3f::flt_max()};
 
-            // transform extents by transform
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            // bounds of dirty entities and all of their ancestors are rebuilt, children come before parents in reverse
+            u32 num_ordered = sb_count(hl.entities);
+            u8* bounds_dirty = hl.bounds_dirty;
+            memset(bounds_dirty, 0x0, num_ordered);
+            for (u32 i = num_ordered; i > 0; --i)
             {
-                vec3f min = scene->bounding_volumes[n].min_extents;
-                vec3f max = scene->bounding_volumes[n].max_extents - min;
+                u32 n = hl.entities[i - 1];
+                if (scene->state_flags[n] & e_state::transform_dirty)
+                    bounds_dirty[n] = 1;
 
-                vec3f& tmin = scene->bounding_volumes[n].transformed_min_extents;
-                vec3f& tmax = scene->bounding_volumes[n].transformed_max_extents;
+                u32 p = scene->parents[n];
+                if (bounds_dirty[n] && p != n)
+                    bounds_dirty[p] = 1;
+            }
 
-                if (scene->entities[n] & e_cmp::bone)
+            // transform extents by transform, entities are independent so split across the task pool
+            auto transform_extents = [&](u32 begin, u32 end, extents& renderable_extents) {
+                u32 transform[k_parallel_grain];
+                u32 num_transform = 0;
+                for (u32 n = begin; n < end; ++n)
                 {
-                    tmin = tmax = scene->world_matrices[n].get_translation();
-                    continue;
+                    if (!bounds_dirty[n])
+                        continue;
+
+                    if (scene->entities[n] & e_cmp::bone)
+                    {
+                        vec3f& tmin = scene->bounding_volumes[n].transformed_min_extents;
+                        vec3f& tmax = scene->bounding_volumes[n].transformed_max_extents;
+                        tmin = tmax = scene->world_matrices[n].get_translation();
+                        continue;
+                    }
+
+                    transform[num_transform++] = n;
                 }
 
-                tmax = -vec3f::flt_max();
-                tmin = vec3f::flt_max();
+                transform_bounds(scene, transform, num_transform);
 
-                for (s32 c = 0; c < 8; ++c)
+                // rebuilt and unchanged bounds both contribute to the scene extents
+                for (u32 n = begin; n < end; ++n)
                 {
-                    vec3f p = scene->world_matrices[n].transform_vector(min + max * corners[c]);
+                    if (!(scene->entities[n] & e_cmp::geometry) || (scene->entities[n] & e_cmp::bone))
+                        continue;
 
-                    tmax = max_union(tmax, p);
-                    tmin = min_union(tmin, p);
+                    const cmp_bounding_volume& bv = scene->bounding_volumes[n];
+                    renderable_extents.min = min_union(bv.transformed_min_extents, renderable_extents.min);
+                    renderable_extents.max = max_union(bv.transformed_max_extents, renderable_extents.max);
                 }
+            };
 
-                f32& trad = scene->bounding_volumes[n].radius;
-                trad = mag(tmax - tmin) * 0.5f;
-
-                // pos extent for faster aabb and sphere culling
-                auto& pe = scene->pos_extent[n];
-                pe.pos.xyz = tmin + (tmax - tmin) * 0.5f;
-                pe.extent.xyz = tmax - pe.pos.xyz;
-                pe.extent.w = trad;
-
-                if (!(scene->entities[n] & e_cmp::geometry))
-                    continue;
+            auto union_extents = [](extents& a, const extents& b) {
+                a.min = min_union(a.min, b.min);
+                a.max = max_union(a.max, b.max);
+            };
 
-                // also set scene extents
-                scene->renderable_extents.min = min_union(tmin, scene->renderable_extents.min);
-                scene->renderable_extents.max = max_union(tmax, scene->renderable_extents.max);
-            }
+            scene->renderable_extents = pen::parallel_reduce((u32)0, (u32)scene->num_entities, k_parallel_grain,
+                                                             empty_extents, transform_extents, union_extents);
 
-            // reverse iterate over scene and expand parents extents by children
-            for (intptr_t n = scene->num_entities - 1; n > 0; --n)
+            // reverse iterate over the levels and expand rebuilt parents extents by children
+            for (u32 i = num_ordered; i > 0; --i)
             {
+                u32 n = hl.entities[i - 1];
                 if (!(scene->entities[n] & e_cmp::allocated))
                     continue;
 
                 u32 p = scene->parents[n];
-                if (p == n)
+                if (p == n || !bounds_dirty[p])
                     continue;
 
                 vec3f& parent_tmin = scene->bounding_volumes[p].transformed_min_extents;
@@ -1555,6 +3117,53 @@ namespace put
                 }
             }
 
+            // culling bvh is refit from the new pos extents
+            update_renderables(scene);
+            update_bvh(scene);
+
+            // update draw call data, compute in parallel
+            f32 time_ms = pen::get_time_ms();
+            pen::parallel_for(0, (u32)scene->num_entities, k_parallel_grain, [&](u32 begin, u32 end) {
+                for (u32 n = begin; n < end; ++n)
+                {
+                    if (scene->state_flags[n] & e_state::transform_dirty)
+                        scene->draw_call_data[n].world_matrix = scene->world_matrices[n];
+
+                    // store node index in v1.x
+                    scene->draw_call_data[n].v1.x = (f32)n;
+                    scene->draw_call_data[n].v1.y = time_ms;
+
+                    if (!(scene->state_flags[n] & e_state::transform_dirty))
+                        continue;
+
+                    if (is_invalid_or_null(scene->cbuffer[n]))
+                        continue;
+
+                    if (scene->entities[n] & e_cmp::sub_instance)
+                        continue;
+
+                    // skinned meshes have the world matrix baked into the bones
+                    if (scene->entities[n] & e_cmp::skinned || scene->entities[n] & e_cmp::pre_skinned)
+                        scene->draw_call_data[n].world_matrix = mat3x4::create_identity();
+
+                    scene->draw_call_data[n].world_matrix_inv_transpose = affine_inverse_transpose(scene->world_matrices[n]);
+                }
+            });
+        }
+
+        void simulate_task(void* user_data)
+        {
+            ecs_scene* scene = (ecs_scene*)user_data;
+
+            f64 start = pen::get_time_ms();
+            simulate_scene(scene);
+            scene->pipeline.stats.simulate_ms = (f32)(pen::get_time_ms() - start);
+        }
+
+        // lights, skinning and per draw constants are uploaded on the user thread since the renderer command buffer has
+        // a single producer, then physics steps and controllers post update
+        void upload_scene(ecs_scene* scene, f32 dt)
+        {
             // Forward light buffer
             static forward_light_buffer light_buffer;
             s32                         pos = 0;
@@ -1562,12 +3171,14 @@ namespace put
 
             memset(&light_buffer, 0x0, sizeof(forward_light_buffer));
 
+            const entity_query& light_query = get_entity_query(scene, e_query::light);
+            u32                 num_light_entities = sb_count(light_query.entities);
+
             // directional lights
             s32 num_directions_lights = 0;
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            for (u32 i = 0; i < num_light_entities; ++i)
             {
-                if (!(scene->entities[n] & e_cmp::light))
-                    continue;
+                u32 n = light_query.entities[i];
 
                 cmp_light& l = scene->lights[n];
                 if (l.type != e_light_type::dir)
@@ -1576,6 +3187,7 @@ namespace put
                 // update bv and transform
                 scene->bounding_volumes[n].min_extents = -vec3f(FLT_MAX);
                 scene->bounding_volumes[n].max_extents = vec3f(FLT_MAX);
+                scene->state_flags[n] |= e_state::transform_changed;
 
                 if (num_lights >= e_scene_limits::max_forward_lights)
                     break;
@@ -1594,10 +3206,9 @@ namespace put
 
             // point lights
             s32 num_point_lights = 0;
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            for (u32 i = 0; i < num_light_entities; ++i)
             {
-                if (!(scene->entities[n] & e_cmp::light))
-                    continue;
+                u32 n = light_query.entities[i];
 
                 cmp_light& l = scene->lights[n];
                 if (l.type != e_light_type::point)
@@ -1627,13 +3238,12 @@ namespace put
 
             // spot lights
             s32 num_spot_lights = 0;
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            for (u32 i = 0; i < num_light_entities; ++i)
             {
                 if (num_lights >= e_scene_limits::max_forward_lights)
                     break;
 
-                if (!(scene->entities[n] & e_cmp::light))
-                    continue;
+                u32 n = light_query.entities[i];
 
                 cmp_light& l = scene->lights[n];
 
@@ -1671,6 +3281,9 @@ namespace put
 
             pen::renderer_update_buffer(scene->forward_light_buffer, &light_buffer, sizeof(light_buffer));
 
+            // point and spot lights for clustered lighting, without the forward light limit
+            gather_cluster_lights(scene);
+
             // Area light buffer
             static area_light_buffer al_buffer;
 
@@ -1681,19 +3294,18 @@ namespace put
             u32 num_constant_colour_area_lights = 0;
             u32 num_textured_area_lights = 0;
             // constant colour area light
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            for (u32 i = 0; i < num_light_entities; ++i)
             {
                 if (num_lights >= e_scene_limits::max_forward_lights)
                     break;
 
-                if (!(scene->entities[n] & e_cmp::light))
-                    continue;
+                u32 n = light_query.entities[i];
 
                 cmp_light& l = scene->lights[n];
                 if (l.type != e_light_type::area)
                     continue;
 
-                mat4& wm = scene->world_matrices[n];
+                const mat3x4& wm = scene->world_matrices[n];
                 for (u32 c = 0; c < 4; ++c)
                     al_buffer.lights[num_area_lights].corners[c] = wm.transform_vector(corners_al[c]);
 
@@ -1703,23 +3315,22 @@ namespace put
                 ++num_area_lights;
             }
             // textured / shader / animated area light
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            for (u32 i = 0; i < num_light_entities; ++i)
             {
                 if (num_lights >= e_scene_limits::max_forward_lights)
                     break;
 
-                if (!(scene->entities[n] & e_cmp::light))
-                    continue;
+                u32 n = light_query.entities[i];
 
                 cmp_light& l = scene->lights[n];
                 if (l.type != e_light_type::area_ex)
                     continue;
 
-                mat4& wm = scene->world_matrices[n];
+                const mat3x4& wm = scene->world_matrices[n];
                 for (u32 c = 0; c < 4; ++c)
                     al_buffer.lights[num_area_lights].corners[c] = wm.transform_vector(corners_al[c]);
 
-                scene->draw_call_data[n].v1.y = (f32)anim_time; // time
+                scene->state_flags[n] |= e_state::dynamic_draw_data;
                 al_buffer.lights[num_area_lights].colour = vec4f(l.colour, num_textured_area_lights);
                 scene->draw_call_data[n].v1.z = (f32)num_textured_area_lights;
                 ++num_textured_area_lights;
@@ -1749,15 +3360,15 @@ namespace put
             }
 
             // Distance field shadows
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            const entity_query& sdf_query = get_entity_query(scene, e_query::sdf_shadow);
+            for (u32 i = 0; i < sb_count(sdf_query.entities); ++i)
             {
-                if (!(scene->entities[n] & e_cmp::sdf_shadow))
-                    continue;
+                u32 n = sdf_query.entities[i];
 
                 static distance_field_shadow_buffer sdf_buffer;
 
                 sdf_buffer.shadows.world_matrix = scene->world_matrices[n];
-                sdf_buffer.shadows.world_matrix_inverse = mat::inverse4x4(scene->world_matrices[n]);
+                sdf_buffer.shadows.world_matrix_inverse = affine_inverse(scene->world_matrices[n]);
 
                 pen::renderer_update_buffer(scene->sdf_shadow_buffer, &sdf_buffer, sizeof(sdf_buffer));
             }
@@ -1768,10 +3379,9 @@ namespace put
             u32 num_shadow_maps = 0;
             u32 num_omni_shadow_maps = 0;
             u32 num_gi_maps = 0;
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            for (u32 i = 0; i < num_light_entities; ++i)
             {
-                if (!(scene->entities[n] & e_cmp::light))
-                    continue;
+                u32 n = light_query.entities[i];
 
                 cmp_light& l = scene->lights[n];
 
@@ -1838,11 +3448,11 @@ namespace put
             }
 
             // update pre skinned vertex buffers
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            const entity_query& pre_skinned_query = get_entity_query(scene, e_query::pre_skinned);
+            for (u32 i = 0; i < sb_count(pre_skinned_query.entities); ++i)
             {
-                if (!(scene->entities[n] & e_cmp::pre_skinned))
-                    continue;
-                
+                u32 n = pre_skinned_query.entities[i];
+
                 u32 cbuffer = -1;
                 cmp_geometry& geom = scene->geometries[n];
                 cmp_geometry& pos_geom = scene->position_geometries[n];
@@ -1856,7 +3466,6 @@ namespace put
                 else
                 {
                     // create bone cbuffer
-                    static mat4 bb[85];
                     if (geom.p_skin->bone_cbuffer == PEN_INVALID_HANDLE)
                     {
                         pen::buffer_creation_params bcp;
@@ -1873,11 +3482,16 @@ namespace put
                     u32 rjr = scene->anim_controller_v2[n].root_joint_ref;
                     s32 joints_offset = ecs::get_index_from_ref(scene, rjr);
                     joints_offset += geom.p_skin->bone_offset;
-                    
-                    for (u32 i = 0; i < geom.p_skin->num_joints; ++i)
-                        bb[i] = scene->world_matrices[joints_offset + i] * geom.p_skin->joint_bind_matrices[i];
 
-                    pen::renderer_update_buffer(geom.p_skin->bone_cbuffer, bb, sizeof(bb));
+                    // write the palette straight into upload memory
+                    mat4* bb = (mat4*)pen::renderer_reserve_buffer_update(sizeof(mat4) * 85);
+                    for (u32 j = 0; j < geom.p_skin->num_joints; ++j)
+                        bb[j] = scene->world_matrices[joints_offset + j] * mat3x4(geom.p_skin->joint_bind_matrices[j]);
+
+                    // upload memory is not cleared, zero unused bones so the whole buffer is defined
+                    memset(&bb[geom.p_skin->num_joints], 0x0, sizeof(mat4) * (85 - geom.p_skin->num_joints));
+
+                    pen::renderer_submit_buffer_update(geom.p_skin->bone_cbuffer, bb, sizeof(mat4) * 85);
                     
                     cbuffer = geom.p_skin->bone_cbuffer;
                 }
@@ -1914,52 +3528,81 @@ namespace put
             }
             
             // update skinning buffers
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            const entity_query& skinned_query = get_entity_query(scene, e_query::skinned);
+            for (u32 i = 0; i < sb_count(skinned_query.entities); ++i)
             {
+                u32 n = skinned_query.entities[i];
                 if (scene->entities[n] & e_cmp::pre_skinned)
                     continue;
-                    
-                if (scene->entities[n] & e_cmp::skinned)
-                {
-                    // sub geom share bones with parent
-                    if(scene->entities[n] & e_cmp::sub_geometry)
-                    {
-                        u32 p = scene->parents[n];
-                        scene->bone_cbuffer[n] = scene->bone_cbuffer[p];
-                        continue;
-                    }
-                    
-                    static mat4 bb[85];
-                    cmp_geometry* p_geom = &scene->geometries[n];
-                    if (!scene->bone_cbuffer[n])
-                    {
-                        pen::buffer_creation_params bcp;
-                        bcp.usage_flags = PEN_USAGE_DYNAMIC;
-                        bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
-                        bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
-                        bcp.buffer_size = sizeof(mat4) * 85;
-                        bcp.data = nullptr;
 
-                        scene->bone_cbuffer[n] = pen::renderer_create_buffer(bcp);
-                    }
-                    
-                    u32 rjr = scene->anim_controller_v2[n].root_joint_ref;
-                    s32 joints_offset = ecs::get_index_from_ref(scene, rjr);
-                    joints_offset += p_geom->p_skin->bone_offset;
-                    
-                    for (u32 i = 0; i < p_geom->p_skin->num_joints; ++i)
-                    {
-                        mat4& joint_matrix = scene->world_matrices[joints_offset + i];
-                        mat4& bind_matrix = p_geom->p_skin->joint_bind_matrices[i];
-                        bb[i] = joint_matrix * bind_matrix;
-                    }
+                // sub geom share bones with parent
+                if(scene->entities[n] & e_cmp::sub_geometry)
+                {
+                    u32 p = scene->parents[n];
+                    scene->bone_cbuffer[n] = scene->bone_cbuffer[p];
+                    continue;
+                }
+                
+                cmp_geometry* p_geom = &scene->geometries[n];
+                if (!scene->bone_cbuffer[n])
+                {
+                    pen::buffer_creation_params bcp;
+                    bcp.usage_flags = PEN_USAGE_DYNAMIC;
+                    bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
+                    bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
+                    bcp.buffer_size = sizeof(mat4) * 85;
+                    bcp.data = nullptr;
+
+                    scene->bone_cbuffer[n] = pen::renderer_create_buffer(bcp);
+                }
+                
+                u32 rjr = scene->anim_controller_v2[n].root_joint_ref;
+                s32 joints_offset = ecs::get_index_from_ref(scene, rjr);
+                joints_offset += p_geom->p_skin->bone_offset;
 
-                    pen::renderer_update_buffer(scene->bone_cbuffer[n], bb, sizeof(bb));
+                // write the palette straight into upload memory
+                mat4* bb = (mat4*)pen::renderer_reserve_buffer_update(sizeof(mat4) * 85);
+                for (u32 j = 0; j < p_geom->p_skin->num_joints; ++j)
+                {
+                    const mat3x4& joint_matrix = scene->world_matrices[joints_offset + j];
+                    const mat3x4  bind_matrix = mat3x4(p_geom->p_skin->joint_bind_matrices[j]);
+                    bb[j] = joint_matrix * bind_matrix;
                 }
+
+                // upload memory is not cleared, zero unused bones so the whole buffer is defined
+                memset(&bb[p_geom->p_skin->num_joints], 0x0, sizeof(mat4) * (85 - p_geom->p_skin->num_joints));
+
+                pen::renderer_submit_buffer_update(scene->bone_cbuffer[n], bb, sizeof(mat4) * 85);
+            }
+
+            // upload changed draw call data on this thread, the renderer command buffer has a single producer.
+            // user data in v2 can be written directly so it is compared against what was last uploaded
+            u32  num_entities = (u32)scene->num_entities;
+            bool upload_all = sb_count(scene->uploaded_user_data) != num_entities;
+            if (upload_all)
+            {
+                sb_clear(scene->uploaded_user_data);
+                sb_add(scene->uploaded_user_data, num_entities);
             }
 
-            // update draw call data
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            auto draw_data_changed = [&](u32 n) {
+                if (upload_all || (scene->state_flags[n] & (e_state::transform_dirty | e_state::dynamic_draw_data)))
+                    return true;
+
+                return memcmp(&scene->uploaded_user_data[n], &scene->draw_call_data[n].v2, sizeof(vec4f)) != 0;
+            };
+
+            transform_stats& stats = scene->update_stats;
+            stats = transform_stats();
+            stats.entities = num_entities;
+
+            // with the draw buffer entity cbuffers are marked stale and only uploaded if a draw binds them. views of a
+            // pipelined scene can not clear the flag in the scene so its cbuffers are all uploaded here instead
+            bool draw_buffer = draw_buffer_enabled(scene);
+            bool draw_buffer_changed = false;
+            bool lazy_cbuffers = draw_buffer && !(scene->flags & e_scene_flags::pipelined_update);
+
+            for (u32 n = 0; n < num_entities; ++n)
             {
                 if (scene->entities[n] & e_cmp::material)
                 {
@@ -1969,11 +3612,32 @@ namespace put
                                                     scene->materials[n].material_cbuffer_size);
                 }
 
-                scene->draw_call_data[n].world_matrix = scene->world_matrices[n];
+                if (scene->state_flags[n] & e_state::transform_dirty)
+                    stats.dirty_transforms++;
+
+                // instance buffers upload when any of their sub instances changed, before the sub instances are visited
+                if ((scene->entities[n] & e_cmp::master_instance) && !(scene->entities[n] & e_cmp::custom_instance_buffer))
+                {
+                    cmp_master_instance& master = scene->master_instances[n];
+
+                    bool changed = false;
+                    for (u32 i = 1; i <= master.num_instances && !changed; ++i)
+                        changed = draw_data_changed(n + i);
+
+                    if (changed)
+                    {
+                        u32 instance_data_size = master.num_instances * master.instance_stride;
+                        pen::renderer_update_buffer(master.instance_buffer, &scene->draw_call_data[n + 1], instance_data_size);
+                    }
+                }
+
+                // cbuffers left stale by lazy uploads are flushed once they are no longer lazy
+                if (!draw_data_changed(n))
+                    if (lazy_cbuffers || !(scene->state_flags[n] & e_state::cbuffer_stale))
+                        continue;
 
-                // store node index in v1.x
-                scene->draw_call_data[n].v1.x = (f32)n;
-                scene->draw_call_data[n].v1.y = pen::get_time_ms();
+                scene->uploaded_user_data[n] = scene->draw_call_data[n].v2;
+                draw_buffer_changed = true;
 
                 if (is_invalid_or_null(scene->cbuffer[n]))
                     continue;
@@ -1981,47 +3645,132 @@ namespace put
                 if (scene->entities[n] & e_cmp::sub_instance)
                     continue;
 
-                // skinned meshes have the world matrix baked into the bones
-                if (scene->entities[n] & e_cmp::skinned || scene->entities[n] & e_cmp::pre_skinned)
-                    scene->draw_call_data[n].world_matrix = mat4::create_identity();
+                if (lazy_cbuffers)
+                {
+                    scene->state_flags[n] |= e_state::cbuffer_stale;
+                    continue;
+                }
 
-                mat4 invt = scene->world_matrices[n];
+                pen::renderer_update_buffer(scene->cbuffer[n], &scene->draw_call_data[n], sizeof(cmp_draw_call));
+                scene->state_flags[n] &= ~e_state::cbuffer_stale;
+                stats.cbuffer_updates++;
+            }
 
-                invt = invt.transposed();
-                invt = mat::inverse4x4(invt);
+            // changes made while the draw buffer was disabled are not tracked, so it is recreated when re-enabled
+            if (draw_buffer)
+                update_draw_buffer(scene, draw_buffer_changed);
+            else
+                release_draw_buffer(scene);
 
-                scene->draw_call_data[n].world_matrix_inv_transpose = invt;
+            // update physics running 1 frame behind to allow the sets to take effect
+            physics::step(dt);
+            physics::physics_consume_command_buffer();
 
-                // todo mark dirty?
-                pen::renderer_update_buffer(scene->cbuffer[n], &scene->draw_call_data[n], sizeof(cmp_draw_call));
+            // controllers post update
+            run_post_update_systems(scene, dt);
+        }
+
+        void update_scene(ecs_scene* scene, f32 dt)
+        {
+            // uploads for the frame a pipelined update left simulating, made before the scene is changed again
+            render_pipeline& rp = scene->pipeline;
+            if (rp.pending)
+            {
+                wait_for_update(scene);
+                rp.pending = false;
+
+                // entities may have been added or removed since the last update
+                update_entity_queries(scene);
+                upload_scene(scene, rp.pending_dt);
             }
 
-            // update instance buffers
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            // draw stats accumulate from the views rendered since the last update
+            scene->draw_stats = scene_draw_stats();
+            scene->view_buffer_cursor = 0;
+
+            // pre update controllers, animation and extension component update, systems which do not conflict run
+            // concurrently. the loops below visit the entities of their query instead of testing every entity
+            run_update_systems(scene, dt);
+
+            // entities added by controllers are visited by the loops below
+            update_entity_queries(scene);
+
+            // takes effect from the next physics step
+            physics::set_paused(scene->flags & e_scene_flags::pause_update ? 1 : 0);
+
+            static pen::timer* timer = pen::timer_create();
+            pen::timer_start(timer);
+
+            // physics entities sync with the physics thread through its command buffer so are updated serially
+            const entity_query& physics_query = get_entity_query(scene, e_query::physics);
+            for (u32 i = 0; i < sb_count(physics_query.entities); ++i)
             {
-                if (!(scene->entities[n] & e_cmp::master_instance))
-                    continue;
-                    
-                if (scene->entities[n] & e_cmp::custom_instance_buffer)
-                    continue;
+                u32 n = physics_query.entities[i];
+
+                // force physics entity to sync and ignore controlled transform
+                if (scene->state_flags[n] & e_state::sync_physics_transform)
+                {
+                    scene->state_flags[n] &= ~e_state::sync_physics_transform;
+                    scene->entities[n] &= ~e_cmp::transform;
+                }
+
+                // controlled transform
+                if (scene->entities[n] & e_cmp::transform)
+                {
+                    cmp_transform& t = scene->transforms[n];
+                    scene->local_matrices[n] = local_matrix_from_transform(t);
+
+                    if (scene->physics_data[n].type == e_physics_type::rigid_body)
+                    {
+                        cmp_transform& pt = scene->physics_offset[n];
+                        physics::set_transform(scene->physics_handles[n], t.translation + pt.translation, t.rotation);
+                        physics::set_v3(scene->physics_handles[n], vec3f::zero(), physics::e_cmd::set_angular_velocity);
+                        physics::set_v3(scene->physics_handles[n], vec3f::zero(), physics::e_cmd::set_linear_velocity);
+                    }
+
+                    // local matrix will be baked
+                    scene->entities[n] &= ~e_cmp::transform;
+                    scene->state_flags[n] |= e_state::transform_changed;
+                }
+                else
+                {
+                    if (!physics::has_rb_matrix(n))
+                        continue;
+
+                    cmp_transform& t = scene->transforms[n];
+                    cmp_transform& pt = scene->physics_offset[n];
+
+                    mat4 scale_mat = mat::create_scale(t.scale);
+
+                    vec3f os = t.scale;
+                    t = physics::get_rb_transform(scene->physics_handles[n]);
+                    t.scale = os;
 
-                cmp_master_instance& master = scene->master_instances[n];
+                    mat4 rot_mat;
+                    t.rotation.get_matrix(rot_mat);
 
-                u32 instance_data_size = master.num_instances * master.instance_stride;
-                pen::renderer_update_buffer(master.instance_buffer, &scene->draw_call_data[n + 1], instance_data_size);
+                    mat4 translation_mat = mat::create_translation(t.translation - pt.translation);
 
-                // stride over sub instances
-                n += scene->master_instances[n].num_instances;
+                    scene->local_matrices[n] = mat3x4(translation_mat * rot_mat * scale_mat);
+                    scene->state_flags[n] |= e_state::transform_changed;
+                }
             }
 
-            // update physics running 1 frame behind to allow the sets to take effect
-            physics::step(dt);
-            physics::physics_consume_command_buffer();
+            if (scene->flags & e_scene_flags::pipelined_update)
+            {
+                // views record from a copy of the last simulated frame while this one simulates
+                extract_render_frame(scene);
 
-            // controllers post update
-            for (u32 c = 0; c < num_controllers; ++c)
-                if (scene->controllers[c].funcs.post_update_func)
-                    scene->controllers[c].funcs.post_update_func(scene->controllers[c], scene, dt);
+                rp.pending = true;
+                rp.pending_dt = dt;
+                rp.stats.wait_ms = 0.0f;
+                pen::tasks_submit(simulate_task, scene, &rp.counter);
+            }
+            else
+            {
+                simulate_scene(scene);
+                upload_scene(scene, dt);
+            }
 
             f64 elapsed = pen::timer_elapsed_ms(timer);
             PEN_UNUSED(elapsed);
@@ -2143,7 +3892,7 @@ namespace put
                     generic_cmp_array& src = scene->get_component_array(c);
                     generic_cmp_array& dst = sub_scene.get_component_array(c);
 
-                    memcpy(dst[ni], src[ii], src.size);
+                    copy_cmp_entities(dst, ni, src, ii, 1);
                 }
 
                 sub_scene.parents[ni] -= root;
@@ -2173,7 +3922,7 @@ namespace put
             for (u32 i = 0; i < scene->num_components; ++i)
             {
                 generic_cmp_array& cmp = scene->get_component_array(i);
-                ofs.write((const c8*)cmp.data, cmp.size * scene->num_entities);
+                write_cmp_entities(ofs, cmp, 0, scene->num_entities);
             }
 
             // specialisations ------------------------------------------------------------------------------
@@ -2205,8 +3954,9 @@ namespace put
             {
                 s32 size = 0;
 
-                if (scene->anim_controller_v2[n].anim_instances)
-                    size = sb_count(scene->anim_controller_v2[n].anim_instances);
+                if (scene->entities[n] & e_cmp::anim_controller)
+                    if (scene->anim_controller_v2[n].anim_instances)
+                        size = sb_count(scene->anim_controller_v2[n].anim_instances);
 
                 ofs.write((const c8*)&size, sizeof(s32));
 
@@ -2347,6 +4097,47 @@ namespace put
             ofs.close();
         }
 
+        // version 11 stores entity matrices as mat3x4 and packs the matrices in draw call data, components of older
+        // scenes which were read with their old size are converted here
+        void upgrade_affine_component(ecs_scene* scene, generic_cmp_array& cmp, const c8* old, u32 old_size, u32 first,
+                                      u32 count)
+        {
+            const generic_cmp_array* matrices[] = {
+                (generic_cmp_array*)&scene->local_matrices, (generic_cmp_array*)&scene->world_matrices,
+                (generic_cmp_array*)&scene->offset_matrices, (generic_cmp_array*)&scene->physics_matrices};
+
+            for (u32 m = 0; m < PEN_ARRAY_SIZE(matrices); ++m)
+            {
+                if (&cmp != matrices[m] || old_size != sizeof(mat4))
+                    continue;
+
+                static const c8 zero[sizeof(mat3x4)] = {0};
+                for (u32 i = 0; i < count; ++i)
+                {
+                    // paged components only allocate pages for non zero data
+                    const c8* src = old + i * old_size;
+                    if (!cmp.data && memcmp(src, zero, sizeof(mat3x4)) == 0)
+                        continue;
+
+                    memcpy(cmp[first + i], src, sizeof(mat3x4));
+                }
+
+                return;
+            }
+
+            if (&cmp == (generic_cmp_array*)&scene->draw_call_data && old_size == sizeof(mat4) * 2 + sizeof(vec4f) * 2)
+            {
+                for (u32 i = 0; i < count; ++i)
+                {
+                    const c8*      src = old + i * old_size;
+                    cmp_draw_call& dc = scene->draw_call_data[first + i];
+                    memcpy(&dc.world_matrix, src, sizeof(mat3x4));
+                    memcpy(&dc.v1, src + sizeof(mat4), sizeof(vec4f) * 2);
+                    memcpy(&dc.world_matrix_inv_transpose, src + sizeof(mat4) + sizeof(vec4f) * 2, sizeof(mat3x4));
+                }
+            }
+        }
+
         void load_scene(const c8* filename, ecs_scene* scene, bool merge)
         {
             scene->flags |= e_scene_flags::invalidate_scene_tree;
@@ -2506,8 +4297,7 @@ namespace put
                     if (cmp.size == component_sizes[i])
                     {
                         // read whole array
-                        c8* data_offset = (c8*)cmp.data + zero_offset * cmp.size;
-                        ifs.read(data_offset, cmp.size * num_nodes);
+                        read_cmp_entities(ifs, cmp, zero_offset, num_nodes);
                         read = true;
                     }
                 }
@@ -2520,6 +4310,9 @@ namespace put
                     ifs.read(old, array_size);
 
                     // here any fuxup can be applied old into cmp.data
+                    if (ri != -1 && sh.version < 11)
+                        upgrade_affine_component(scene, scene->get_component_array(ri), old, component_sizes[i],
+                                                 zero_offset, num_nodes);
 
                     pen::memory_free(old);
                 }
@@ -2722,7 +4515,8 @@ namespace put
 
             // invalidate physics debug cbuffer.. will recreate on demand
             for (u32 n = zero_offset; n < zero_offset + num_nodes; ++n)
-                scene->physics_debug_cbuffer[n] = PEN_INVALID_HANDLE;
+                if (scene->entities[n] & e_cmp::physics)
+                    scene->physics_debug_cbuffer[n] = PEN_INVALID_HANDLE;
 
             if (!merge)
             {
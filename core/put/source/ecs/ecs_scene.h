@@ -11,10 +11,13 @@
 
 #include "data_struct.h"
 #include "pen.h"
+#include "threads.h"
 
 #include "maths/maths.h"
 #include "maths/quat.h"
 
+#include "ecs_affine.h"
+
 #include "str/Str.h"
 
 #include <vector>
@@ -61,7 +64,15 @@ namespace put
             {
                 none = 0,
                 invalidate_scene_tree = 1 << 1,
-                pause_update = 1 << 2
+                pause_update = 1 << 2,
+                disable_auto_instancing = 1 << 3,
+                disable_bvh_culling = 1 << 4,
+                occlusion_culling = 1 << 5,
+                clustered_lights = 1 << 6,
+                disable_draw_buffer = 1 << 7,
+                rebuild_entity_queries = 1 << 8, // rebuild queries from every entity each update, for comparison
+                validate_system_access = 1 << 9, // run systems serially and report writes to undeclared components
+                pipelined_update = 1 << 10       // simulate the next frame on the task pool while views record this one
             };
         }
         typedef u32 scene_flags;
@@ -78,6 +89,11 @@ namespace put
                 samplers_initialised = (1 << 5),
                 apply_anim_transform = (1 << 6),
                 sync_physics_transform = (1 << 7),
+                transform_dirty = (1 << 8),    // world matrix moved in the last simulate, bounds and draw data follow
+                dynamic_draw_data = (1 << 9),  // upload the draw call cbuffer every frame, for shaders which use time
+                occluder = (1 << 10),          // rasterised into the cpu occlusion buffer with occlusion_culling
+                cbuffer_stale = (1 << 11),     // draw call data changed since the draw call cbuffer was last uploaded
+                transform_changed = (1 << 12), // local matrix written since the last simulate, consumed by it
                 alpha_blended = (1 << 0)
             };
         }
@@ -115,7 +131,11 @@ namespace put
             {
                 shadow_map = 15,
                 sdf_shadow = 14,
-                omni_shadow_map = 13
+                omni_shadow_map = 13,
+                cluster_lights = 16,
+                cluster_grid = 17,
+                cluster_indices = 18,
+                draw_calls = 19
             };
         }
 
@@ -137,7 +157,8 @@ namespace put
                 max_area_lights = 10,
                 max_shadow_maps = 100,
                 max_sdf_shadows = 1,
-                max_omni_shadow_maps = 100
+                max_omni_shadow_maps = 100,
+                auto_instances = 16384 // initial instances of the auto instance buffer, it grows to the largest view
             };
         }
 
@@ -181,12 +202,13 @@ namespace put
         };
         typedef u8 light_flags;
 
+        // matrices are packed as 3 rows, per_draw_call in shaders unpacks them with a bottom row of 0, 0, 0, 1
         struct cmp_draw_call
         {
-            mat4  world_matrix;
-            vec4f v1; // generic data 1
-            vec4f v2; // generic data 2
-            mat4  world_matrix_inv_transpose;
+            mat3x4 world_matrix;
+            vec4f  v1; // generic data 1
+            vec4f  v2; // generic data 2
+            mat3x4 world_matrix_inv_transpose;
         };
 
         struct cmp_skin
@@ -357,7 +379,7 @@ namespace put
             vec4f pos_radius; // radius = point radius and spot length
             vec4f dir_cutoff; // spot dir and cos cutoff
             vec4f colour;     // w = boolean cast shadow
-            vec4f data;       // x = spot falloff, yzw reserved
+            vec4f data;       // x = spot falloff, y = shadow index and z = type for clustered lights
         };
 
         struct forward_light_buffer
@@ -366,6 +388,57 @@ namespace put
             light_data lights[e_scene_limits::max_forward_lights];
         };
 
+        // froxel grid for clustered lighting, tiles split the screen evenly and slices split view depth exponentially
+        // between the camera near and far planes
+        namespace e_cluster_grid
+        {
+            enum cluster_grid_t
+            {
+                tiles_x = 16,
+                tiles_y = 9,
+                slices = 24,
+                slice_clusters = tiles_x * tiles_y,
+                clusters = slice_clusters * slices
+            };
+        }
+
+        struct light_cluster_info
+        {
+            vec4f dims;  // x = tiles x, y = tiles y, z = slices, w = number of lights
+            vec4f slice; // slice = log(view depth) * x + y
+        };
+
+        // point and spot lights binned into the clusters of a camera, each cluster references a contiguous range of
+        // indices, so pixels only shade the lights which can reach their cluster
+        struct light_clusters
+        {
+            light_data*        lights = nullptr;       // point and spot lights, data.y = shadow index, data.z = type
+            vec4f*             spheres = nullptr;      // view space bounding sphere of point lights, apex of spot lights
+            vec4f*             cones = nullptr;        // view space spot direction and cos of the half angle
+            u32*               light_slices = nullptr; // first slice | last slice << 16
+            f32*               bounds = nullptr;       // soa cluster aabb min xyz, max xyz, bounding sphere xyzr
+            u32*               grid = nullptr;         // offset and count of each cluster into indices
+            u32*               indices = nullptr;
+
+            // per slice scratch, slices are binned in parallel then concatenated
+            u32* slice_lights[e_cluster_grid::slices] = {}; // lights which reach each slice
+            u32* pairs[e_cluster_grid::slices] = {};        // cluster << 24 | light
+            u32* slice_indices[e_cluster_grid::slices] = {};
+
+            light_cluster_info info;
+            mat4               view; // camera the clusters were last built for
+            mat4               proj;
+            bool               built = false;    // grid and indices are valid for view and proj since lights were gathered
+            bool               uploaded = false; // gpu buffers hold the built clusters
+            f64                build_ms = 0.0;
+            u32                light_buffer = PEN_INVALID_HANDLE;
+            u32                grid_buffer = PEN_INVALID_HANDLE;
+            u32                index_buffer = PEN_INVALID_HANDLE;
+            u32                info_buffer = PEN_INVALID_HANDLE;
+            u32                light_capacity = 0;
+            u32                index_capacity = 0;
+        };
+
         struct distance_field_shadow
         {
             mat4 world_matrix;
@@ -402,11 +475,32 @@ namespace put
             free_node_list* prev;
         };
 
+        // components are stored densely for every entity, or in pages which are allocated the first time an entity in
+        // them is accessed. storage is chosen when a component is registered, paged suits components only a small
+        // fraction of entities have. accessing a paged component allocates its page even to read, so loops over all
+        // entities should check the entity has the component first
+        namespace e_cmp_storage
+        {
+            enum cmp_storage_t
+            {
+                dense,
+                paged
+            };
+        }
+        typedef u32 cmp_storage;
+
+        static const u32 k_cmp_page_shift = 8;
+        static const u32 k_cmp_page_entities = 1 << k_cmp_page_shift;
+        static const u32 k_cmp_page_mask = k_cmp_page_entities - 1;
+
+        // cmp_array and generic_cmp_array must have the same layout
         template <typename T>
         struct cmp_array
         {
-            u32 size = sizeof(T);
-            T*  data = nullptr;
+            u32         size = sizeof(T);
+            cmp_storage storage = e_cmp_storage::dense;
+            T*          data = nullptr;  // dense storage
+            a_size_t*   pages = nullptr; // paged storage, address of each page or 0 if it is not allocated
 
             T&       operator[](size_t index);
             const T& operator[](size_t index) const;
@@ -414,12 +508,47 @@ namespace put
 
         struct generic_cmp_array
         {
-            u32   size;
-            void* data;
+            u32         size;
+            cmp_storage storage = e_cmp_storage::dense;
+            void*       data = nullptr;
+            a_size_t*   pages = nullptr;
 
             void* operator[](size_t index);
         };
 
+        // thread safe, concurrent accesses to an unallocated page all receive the same page
+        void* allocate_cmp_page(generic_cmp_array& cmp, size_t page);
+
+        // storage aware operations on entity ranges, paged components only allocate pages which receive non zero data
+        void resize_cmp_array(generic_cmp_array& cmp, u32 prev_size, u32 new_size);
+        void free_cmp_array(generic_cmp_array& cmp, u32 soa_size);
+        void zero_cmp_entities(generic_cmp_array& cmp, u32 first, u32 count);
+        void copy_cmp_entities(generic_cmp_array& dst, u32 dst_first, generic_cmp_array& src, u32 src_first, u32 count);
+        u32  hash_cmp_entities(generic_cmp_array& cmp, u32 count);
+
+        struct component_memory
+        {
+            c8          name[64];
+            u32         size; // bytes per entity
+            cmp_storage storage;
+            u32         pages;       // allocated pages of paged components
+            size_t      bytes;       // allocated component and page table memory
+            size_t      dense_bytes; // memory the component would use with dense storage
+        };
+
+        static const u32 k_max_system_components = 128;
+
+        // component arrays a controller or extension reads and writes in its update functions. systems which declare
+        // access may run concurrently on the task pool, so they must only touch the components they declare and their
+        // own context and must not submit renderer or physics commands. undeclared systems run alone on the updating
+        // thread in registration order
+        struct system_access
+        {
+            u64  reads[k_max_system_components / 64] = {};
+            u64  writes[k_max_system_components / 64] = {};
+            bool declared = false;
+        };
+
         struct ecs_extension;
         struct ecs_extension_functions
         {
@@ -439,6 +568,7 @@ namespace put
             generic_cmp_array*      components;
             u32                     num_components;
             ecs_extension_functions funcs;
+            system_access           access;
         };
 
         struct ecs_controller;
@@ -455,16 +585,224 @@ namespace put
             put::camera*             camera = nullptr;
             void*                    context = nullptr;
             ecs_controller_functions funcs;
+            system_access            access; // of both update functions
         };
         
+        // entities grouped by depth in the scene tree, a level only depends on the levels above it so each one
+        // can be transformed in parallel. rebuilt when invalidate_scene_tree is raised, rebuild is set or the number
+        // of entities changes. entity allocation and re-parenting helpers set rebuild, so direct writes to parents
+        // of newly allocated entities are picked up too.
+        struct hierarchy_levels
+        {
+            u32* entities = nullptr;     // entity indices ordered by depth, roots first
+            u32* level_start = nullptr;  // offset of each level into entities, plus one entry for the end
+            u8*  bounds_dirty = nullptr; // per frame scratch, set for dirty entities and their ancestors
+            bool invalidate_seen = false;
+            bool rebuild = false;
+        };
+
+        // node of the culling bvh, the entities of a subtree are contiguous in scene_bvh::entities so a node fully
+        // inside a frustum can accept them all without visiting its children
+        struct bvh_node
+        {
+            vec3f min;
+            vec3f max;
+            u32   child; // left child, right is child + 1, invalid for leaves
+            u32   first; // first entity of the subtree in scene_bvh::entities
+            u32   count; // number of entities in the subtree
+        };
+
+        // bvh over the pos_extent of renderable entities, refit each update for entities with changed bounds and
+        // rebuilt when renderables are added or removed or when refitting has grown the tree too far
+        struct scene_bvh
+        {
+            bvh_node* nodes = nullptr;
+            u32*      parents = nullptr;  // parent of each node, the root is its own parent
+            u32*      entities = nullptr; // renderable entities ordered by leaf
+            u32*      leaves = nullptr;   // leaf node of each entity, invalid for entities not in the bvh
+            f32       build_cost = 0.0f;  // summed node surface area after the last build
+            f32       cost = 0.0f;        // summed node surface area after refitting
+            u32       rebuilds = 0;
+        };
+
+        // entities which pass the renderable filter, kept up to date by update_scene as component and hidden flags
+        // change so views do not filter the whole scene
+        struct renderable_set
+        {
+            u32* entities = nullptr; // unordered
+            u32* slots = nullptr;    // index of each entity in entities, invalid if it is not renderable
+        };
+
+        struct schedule_stats
+        {
+            u32 systems = 0;
+            u32 levels = 0;            // groups of systems run one after another, systems within a level run concurrently
+            u32 max_concurrent = 0;    // systems in the largest level
+            u32 access_violations = 0; // found while validate_system_access is set
+        };
+
+        // scratch of the system scheduler, owned by the scene so scenes simulating concurrently do not share it
+        struct system_node;
+        struct system_schedule
+        {
+            system_node* systems = nullptr;
+            u32*         level_systems = nullptr;
+            u32*         hashes = nullptr;
+        };
+
+        // queries update_scene uses to visit the entities of each system
+        namespace e_query
+        {
+            enum query_t
+            {
+                physics,
+                light,
+                sdf_shadow,
+                pre_skinned,
+                skinned,
+                anim_controller,
+                COUNT
+            };
+        }
+        typedef u32 query;
+
+        // entities whose component flags contain every bit of mask, in ascending entity order since light and shadow
+        // map indices are assigned in entity order
+        struct entity_query
+        {
+            u64  mask = 0;
+            u32* entities = nullptr;
+            u32* added = nullptr; // changes found by the current update, merged into entities
+            u32* removed = nullptr;
+        };
+
+        // queries are kept up to date at the start of each update by comparing entity flags against the flags seen
+        // by the previous update, this covers entity creation, deletion and flags written directly by any system
+        struct query_set
+        {
+            entity_query* queries = nullptr;
+            u64*          seen_flags = nullptr; // flags of each entity masked by bits at the last update
+            u64           bits = 0;             // union of all query masks
+            u32*          scratch = nullptr;
+            u32           changed = 0;          // entities whose queried flags changed in the last update
+        };
+
+        struct draw_packet;
+        struct pmm_renderable;
+
+        // low resolution cpu depth buffer of a view's occluders, holds 1/w which interpolates linearly in screen space
+        // and is 0 where nothing was drawn
+        struct occlusion_buffer
+        {
+            f32*                   depth = nullptr;
+            u32                    width = 0;
+            u32                    height = 0;
+            u32*                   occluders = nullptr;
+            const pmm_renderable** geometry = nullptr;
+            u32*                   tri_offsets = nullptr;
+            f32*                   tris = nullptr; // screen space x, y, 1/w per vertex
+        };
+
+        // the parts of a camera culling depends on, views whose cameras have equal keys share cull results
+        struct cull_key
+        {
+            frustum      frust;
+            mat4         view;
+            mat4         proj;
+            f32          near_plane;
+            camera_flags flags;
+        };
+
+        // culling and sorting output kept between frames so views reuse their allocations, each distinct camera takes
+        // the next set of buffers after an update
+        struct cull_buffers
+        {
+            cull_key         key;
+            bool             culled = false;             // entities is valid for key since the last update
+            u32*             entities = nullptr;         // culled_entities or visible_entities, whichever the view draws
+            u32              occluded = 0;               // entities removed by the occlusion test
+            u32*             culled_entities = nullptr;
+            u32*             visible_entities = nullptr; // culled_entities which pass the occlusion test
+            occlusion_buffer occlusion;
+        };
+
+        struct scene_draw_stats
+        {
+            u32 draw_calls = 0;              // draws submitted by all views, an instanced batch counts once
+            u32 auto_instanced_entities = 0; // entities drawn as part of an automatic instanced batch
+            u32 occluded_entities = 0;       // inside a view frustum but hidden behind occluders
+            u32 draw_buffer_entities = 0;    // single draws which read their constants from the draw buffer
+            u32 inline_culls = 0;            // views culled on the render thread because cull_views had no result
+        };
+
+        struct transform_stats
+        {
+            u32 entities = 0;
+            u32 dirty_transforms = 0;  // entities with world matrix, bounds and draw call data recomputed
+            u32 cbuffer_updates = 0;   // per draw cbuffers uploaded
+            u32 draw_buffer_bytes = 0; // draw call data uploaded to the draw buffer
+        };
+
+        // the data views read which the simulation writes. arrays alias the scene unless it is pipelined, then they are
+        // copies taken by the extract phase which stay untouched while the next frame is simulated
+        struct render_frame
+        {
+            u64*            entities = nullptr;
+            u64*            state_flags = nullptr;
+            mat3x4*         world_matrices = nullptr;
+            cmp_pos_extent* pos_extent = nullptr;
+            cmp_draw_call*  draw_call_data = nullptr;
+            u32*            renderables = nullptr; // stretchy buffer, as scene->renderables.entities
+            scene_bvh       bvh;
+            extents         renderable_extents;
+            u32             num_entities = 0;
+            u32             capacity = 0;
+        };
+
+        struct pipeline_stats
+        {
+            f32 extract_ms = 0.0f;  // copying the render frame on the user thread
+            f32 simulate_ms = 0.0f; // transforms, bounds, bvh and draw call data on the task pool
+            f32 wait_ms = 0.0f;     // user thread blocked on the simulation
+            u32 extract_bytes = 0;
+        };
+
+        // update of a pipelined scene: wait for the simulation started by the previous update and make its uploads, run
+        // systems, extract a render frame and start simulating on the task pool. views see the scene one frame late.
+        // frames are double buffered so the frame extracted by the previous update is intact while the next is written
+        struct render_pipeline
+        {
+            render_frame      frames[2];
+            u32               front = 0;
+            bool              pending = false; // simulation started whose uploads have not been made
+            f32               pending_dt = 0.0f;
+            pen::task_counter counter;
+            pipeline_stats    stats;
+        };
+
         struct ecs_scene
         {
-            static const u32 k_version = 10;
+            static const u32 k_version = 11;
 
             ecs_scene()
             {
                 num_base_components = (u32)(((size_t)&num_base_components) - ((size_t)&entities)) / sizeof(generic_cmp_array);
                 num_components = num_base_components;
+
+                // components most entities do not have
+                offset_matrices.storage = e_cmp_storage::paged;
+                physics_matrices.storage = e_cmp_storage::paged;
+                master_instances.storage = e_cmp_storage::paged;
+                pre_skin.storage = e_cmp_storage::paged;
+                physics_data.storage = e_cmp_storage::paged;
+                material_resources.storage = e_cmp_storage::paged;
+                shadows.storage = e_cmp_storage::paged;
+                anim_controller_v2.storage = e_cmp_storage::paged;
+                physics_offset.storage = e_cmp_storage::paged;
+                physics_debug_cbuffer.storage = e_cmp_storage::paged;
+                area_light.storage = e_cmp_storage::paged;
+                area_light_resources.storage = e_cmp_storage::paged;
+                additive_rotation.storage = e_cmp_storage::paged;
             };
 
             // Components version 4
@@ -478,10 +816,10 @@ namespace put
             cmp_array<Str>                      material_names;
             cmp_array<u32>                      parents;
             cmp_array<cmp_transform>            transforms;
-            cmp_array<mat4>                     local_matrices;
-            cmp_array<mat4>                     world_matrices;
-            cmp_array<mat4>                     offset_matrices;
-            cmp_array<mat4>                     physics_matrices;
+            cmp_array<mat3x4>                   local_matrices;       // version 11
+            cmp_array<mat3x4>                   world_matrices;       // version 11
+            cmp_array<mat3x4>                   offset_matrices;      // version 11
+            cmp_array<mat3x4>                   physics_matrices;     // version 11
             cmp_array<cmp_bounding_volume>      bounding_volumes;
             cmp_array<cmp_light>                lights;
             cmp_array<u32>                      physics_handles;
@@ -491,7 +829,7 @@ namespace put
             cmp_array<cmp_physics>              physics_data;
             cmp_array<cmp_geometry>             position_geometries;
             cmp_array<u32>                      cbuffer;
-            cmp_array<cmp_draw_call>            draw_call_data;
+            cmp_array<cmp_draw_call>            draw_call_data;       // version 11
             cmp_array<free_node_list>           free_list;
             cmp_array<cmp_material>             materials;
             cmp_array<cmp_material_data>        material_data;
@@ -536,6 +874,25 @@ namespace put
             extents          renderable_extents;
             extents          shadow_extent_constraints = {{0.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 0.0f}};
             u32*             selection_list = nullptr;
+            scene_draw_stats draw_stats;
+            hierarchy_levels hierarchy;
+            scene_bvh        bvh;
+            renderable_set   renderables;
+            query_set        queries;
+            schedule_stats   schedule;
+            system_schedule  systems;
+            cull_buffers*    view_buffers = nullptr;
+            u32              view_buffer_cursor = 0;
+            u32*             pending_culls = nullptr; // view buffers requested by request_view_cull and not yet culled
+            light_clusters   clusters;
+            u32              draw_call_buffer = PEN_INVALID_HANDLE;  // draw_call_data of every entity, read by draw index
+            u32              draw_index_buffer = PEN_INVALID_HANDLE; // per instance stream of draw indices 0 to capacity
+            u32              draw_buffer_capacity = 0;
+            u32              auto_instance_buffer = PEN_INVALID_HANDLE; // per draw data for the instanced batches of a view
+            u32              auto_instance_capacity = 0;                // instances auto_instance_buffer can hold
+            transform_stats  update_stats;
+            render_pipeline  pipeline;
+            vec4f*           uploaded_user_data = nullptr; // v2 of each draw call when it was last uploaded
             u32              version = k_version;
             Str              filename = "";
 
@@ -557,8 +914,38 @@ namespace put
 
         void update(f32 dt);
         void update_scene(ecs_scene* scene, f32 dt);
+
+        // pipelined scenes are still simulating on the task pool after update_scene returns. until the next update_scene
+        // or wait_for_update the simulation reads entities, parents, local matrices and bounding volumes and writes state
+        // flags, world matrices, bounds, the bvh and draw call data. code running between updates must not write any of
+        // these or add, delete or reparent entities without waiting first, and reads of what the simulation writes see a
+        // partly updated frame. views read the extracted render_frame instead. update and the scene functions which free
+        // or reallocate the scene wait themselves and the entity helpers assert when called while simulating
+        void wait_for_update(ecs_scene* scene);
+        void wait_for_updates();
+        bool is_simulating(ecs_scene* scene);
+
+        // the frame views read, see render_frame
+        render_frame get_render_frame(const ecs_scene* scene);
+        void update_animations(ecs_scene* scene, f32 dt);
         void reset(ecs_scene* scene);
         
+        // views are culled ahead of recording, pmfx calls the cull function of each scene view to request the cameras
+        // it will render with and then cull_views culls them in parallel. cameras which were not requested are culled
+        // inline by render_scene_view. cull_views also uploads stale cbuffers of the culled entities and sizes the auto
+        // instance buffer for them, views recorded into command lists on job threads leave both untouched
+        void request_view_cull(ecs_scene* scene, const camera* cam);
+        void cull_views(ecs_scene* scene);
+        void cull_scene_view(const scene_view& view);
+        void cull_shadow_views(const scene_view& view);
+        void cull_omni_shadow_views(const scene_view& view);
+
+        // per draw constants of all entities are uploaded once per frame into a single structured buffer and indexed
+        // by the draw, entity cbuffers are only uploaded when a draw has to bind them
+        bool draw_buffer_enabled(const ecs_scene* scene);
+        void bind_draw_call_cbuffer(ecs_scene* scene, u32 entity_index);
+        void bind_draw_call_cbuffer(ecs_scene* scene, render_frame& rf, u32 entity_index); // clears cbuffer_stale in rf
+
         void render_scene_view(const scene_view& view);
         void render_light_volumes(const scene_view& view);
         void render_shadow_views(const scene_view& view);
@@ -570,6 +957,16 @@ namespace put
         void default_scene(ecs_scene* scene);
 
         void resize_scene_buffers(ecs_scene* scene, s32 size = 1024);
+
+        // memory used by each component, returns a stretchy buffer for the caller to free
+        component_memory* get_component_memory(ecs_scene* scene);
+        void              get_component_name(ecs_scene* scene, u32 index, c8* name, u32 size);
+
+        // returns the query for mask, queries with the same mask are shared. the entities of a query are valid after
+        // registering and are updated by update_scene
+        query               register_entity_query(ecs_scene* scene, u64 mask);
+        void                update_entity_queries(ecs_scene* scene);
+        const entity_query& get_entity_query(ecs_scene* scene, query q);
         void zero_entity_components(ecs_scene* scene, u32 node_index);
 
         void delete_entity(ecs_scene* scene, u32 node_index);
@@ -591,18 +988,35 @@ namespace put
         template <typename T>
         pen_inline T& cmp_array<T>::operator[](size_t index)
         {
-            return data[index];
+            if (data)
+                return data[index];
+
+            size_t page = pen_atomic_load(pages[index >> k_cmp_page_shift]);
+            if (!page)
+                page = (size_t)allocate_cmp_page((generic_cmp_array&)*this, index >> k_cmp_page_shift);
+
+            return ((T*)page)[index & k_cmp_page_mask];
         }
 
         template <typename T>
         pen_inline const T& cmp_array<T>::operator[](size_t index) const
         {
-            return data[index];
+            return (*const_cast<cmp_array<T>*>(this))[index];
         }
 
         pen_inline void* generic_cmp_array::operator[](size_t index)
         {
             u8* d = (u8*)data;
+            if (!d)
+            {
+                size_t page = pen_atomic_load(pages[index >> k_cmp_page_shift]);
+                if (!page)
+                    page = (size_t)allocate_cmp_page(*this, index >> k_cmp_page_shift);
+
+                d = (u8*)page;
+                index &= k_cmp_page_mask;
+            }
+
             u8* di = &d[index * size];
             return (void*)(di);
         }
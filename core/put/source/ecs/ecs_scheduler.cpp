@@ -0,0 +1,307 @@
+// ecs_scheduler.cpp
+// Copyright 2014 - 2023 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+#include "ecs_scheduler.h"
+
+#include <algorithm>
+
+#include "console.h"
+#include "data_struct.h"
+#include "ecs_scene.h"
+#include "threads.h"
+
+using namespace ::pen;
+
+namespace put
+{
+    namespace ecs
+    {
+        namespace e_system_type
+        {
+            enum system_type_t
+            {
+                controller_update,
+                animation,
+                extension_update,
+                controller_post_update
+            };
+        }
+        typedef u32 system_type;
+
+        struct system_node
+        {
+            system_type   type;
+            u32           index; // of the controller or extension
+            system_access access;
+            u32           level;
+        };
+
+        namespace
+        {
+            static const u32 k_access_words = k_max_system_components / 64;
+
+            bool systems_conflict(const system_access& a, const system_access& b)
+            {
+                if (!a.declared || !b.declared)
+                    return true;
+
+                for (u32 w = 0; w < k_access_words; ++w)
+                {
+                    if (a.writes[w] & (b.reads[w] | b.writes[w]))
+                        return true;
+
+                    if (b.writes[w] & a.reads[w])
+                        return true;
+                }
+
+                return false;
+            }
+
+            const c8* system_name(ecs_scene* scene, const system_node& sn)
+            {
+                switch (sn.type)
+                {
+                    case e_system_type::controller_update:
+                    case e_system_type::controller_post_update:
+                        return scene->controllers[sn.index].name.c_str();
+                    case e_system_type::extension_update:
+                        return scene->extensions[sn.index].name.c_str();
+                    default:
+                        return "animation";
+                }
+            }
+
+            void run_animation(ecs_scene* scene, f32 dt)
+            {
+                if (!(scene->flags & e_scene_flags::pause_update))
+                    update_animations(scene, dt);
+            }
+
+            void run_system(ecs_scene* scene, const system_node& sn, f32 dt)
+            {
+                switch (sn.type)
+                {
+                    case e_system_type::controller_update:
+                    {
+                        ecs_controller& c = scene->controllers[sn.index];
+                        c.funcs.update_func(c, scene, dt);
+                    }
+                    break;
+                    case e_system_type::animation:
+                        run_animation(scene, dt);
+                        break;
+                    case e_system_type::extension_update:
+                    {
+                        ecs_extension& e = scene->extensions[sn.index];
+                        e.funcs.update_func(e, scene, dt);
+                    }
+                    break;
+                    case e_system_type::controller_post_update:
+                    {
+                        ecs_controller& c = scene->controllers[sn.index];
+                        c.funcs.post_update_func(c, scene, dt);
+                    }
+                    break;
+                }
+            }
+
+            void add_system(ecs_scene* scene, system_type type, u32 index, const system_access& access)
+            {
+                system_node sn;
+                sn.type = type;
+                sn.index = index;
+                sn.access = access;
+                sn.level = 0;
+
+                // after the last earlier system it conflicts with
+                system_node*& systems = scene->systems.systems;
+                u32           num = sb_count(systems);
+                for (u32 i = 0; i < num; ++i)
+                    if (systems_conflict(systems[i].access, access))
+                        sn.level = std::max<u32>(sn.level, systems[i].level + 1);
+
+                sb_push(systems, sn);
+            }
+
+            // runs one system at a time, hashing every component it does not declare write access to before and after
+            void run_systems_validated(ecs_scene* scene, f32 dt, u32 num_levels)
+            {
+                system_node* systems = scene->systems.systems;
+                u32*&        hashes = scene->systems.hashes;
+                u32          num_systems = sb_count(systems);
+                u32          num_entities = (u32)scene->num_entities;
+
+                for (u32 l = 0; l < num_levels; ++l)
+                {
+                    for (u32 s = 0; s < num_systems; ++s)
+                    {
+                        const system_node& sn = systems[s];
+                        if (sn.level != l)
+                            continue;
+
+                        // undeclared systems may touch anything
+                        if (!sn.access.declared)
+                        {
+                            run_system(scene, sn, dt);
+                            continue;
+                        }
+
+                        u32 num_components = scene->num_components;
+                        sb_reset(hashes);
+                        sb_add(hashes, num_components);
+                        for (u32 i = 0; i < num_components; ++i)
+                            hashes[i] = hash_cmp_entities(scene->get_component_array(i), num_entities);
+
+                        run_system(scene, sn, dt);
+
+                        // components added by the system are not checked
+                        num_components = std::min<u32>(num_components, scene->num_components);
+                        num_entities = std::min<u32>(num_entities, (u32)scene->num_entities);
+
+                        for (u32 i = 0; i < num_components; ++i)
+                        {
+                            if (sn.access.writes[i / 64] & (1ull << (i % 64)))
+                                continue;
+
+                            if (hashes[i] == hash_cmp_entities(scene->get_component_array(i), num_entities))
+                                continue;
+
+                            c8 name[64];
+                            get_component_name(scene, i, name, sizeof(name));
+                            PEN_LOG("ecs: system %s wrote to %s without declaring write access\n", system_name(scene, sn),
+                                    name);
+
+                            scene->schedule.access_violations++;
+                        }
+
+                        num_entities = (u32)scene->num_entities;
+                    }
+                }
+            }
+
+            void run_systems(ecs_scene* scene, f32 dt)
+            {
+                system_node* systems = scene->systems.systems;
+                u32*&        level_systems = scene->systems.level_systems;
+                u32          num_systems = sb_count(systems);
+                if (num_systems == 0)
+                    return;
+
+                u32 num_levels = 0;
+                for (u32 s = 0; s < num_systems; ++s)
+                    num_levels = std::max<u32>(num_levels, systems[s].level + 1);
+
+                schedule_stats& stats = scene->schedule;
+                stats.systems += num_systems;
+                stats.levels += num_levels;
+
+                if (scene->flags & e_scene_flags::validate_system_access)
+                {
+                    run_systems_validated(scene, dt, num_levels);
+                    return;
+                }
+
+                for (u32 l = 0; l < num_levels; ++l)
+                {
+                    sb_reset(level_systems);
+                    for (u32 s = 0; s < num_systems; ++s)
+                        if (systems[s].level == l)
+                            sb_push(level_systems, s);
+
+                    // a single system runs on this thread, undeclared systems are always alone in their level
+                    u32 num_level_systems = sb_count(level_systems);
+                    stats.max_concurrent = std::max<u32>(stats.max_concurrent, num_level_systems);
+
+                    pen::parallel_for(0, num_level_systems, 1, [&](u32 begin, u32 end) {
+                        for (u32 i = begin; i < end; ++i)
+                            run_system(scene, systems[level_systems[i]], dt);
+                    });
+                }
+            }
+        } // namespace
+
+        u32 get_component_index(ecs_scene* scene, const void* cmp)
+        {
+            // base components are laid out contiguously from entities
+            const generic_cmp_array* base = (const generic_cmp_array*)&scene->entities;
+            const generic_cmp_array* gcmp = (const generic_cmp_array*)cmp;
+            if (gcmp >= base && gcmp < base + scene->num_base_components)
+                return (u32)(gcmp - base);
+
+            u32 offset = scene->num_base_components;
+            u32 num_ext = sb_count(scene->extensions);
+            for (u32 e = 0; e < num_ext; ++e)
+            {
+                const ecs_extension& ext = scene->extensions[e];
+                if (gcmp >= ext.components && gcmp < ext.components + ext.num_components)
+                    return offset + (u32)(gcmp - ext.components);
+
+                offset += ext.num_components;
+            }
+
+            PEN_ASSERT(0);
+            return PEN_INVALID_HANDLE;
+        }
+
+        void declare_access(ecs_scene* scene, system_access& access, const void* cmp, cmp_access flags)
+        {
+            u32 i = get_component_index(scene, cmp);
+            PEN_ASSERT(i < k_max_system_components);
+            if (i >= k_max_system_components)
+                return;
+
+            u64 bit = 1ull << (i % 64);
+            if (flags & e_cmp_access::read)
+                access.reads[i / 64] |= bit;
+
+            if (flags & e_cmp_access::write)
+                access.writes[i / 64] |= bit;
+
+            access.declared = true;
+        }
+
+        void run_update_systems(ecs_scene* scene, f32 dt)
+        {
+            scene->schedule = schedule_stats();
+            sb_reset(scene->systems.systems);
+
+            u32 num_controllers = sb_count(scene->controllers);
+            for (u32 c = 0; c < num_controllers; ++c)
+                if (scene->controllers[c].funcs.update_func)
+                    add_system(scene, e_system_type::controller_update, c, scene->controllers[c].access);
+
+            // animation writes transforms and flags of joints and their parents
+            system_access animation_access;
+            declare_access(scene, animation_access, &scene->entities, e_cmp_access::read | e_cmp_access::write);
+            declare_access(scene, animation_access, &scene->transforms, e_cmp_access::read | e_cmp_access::write);
+            declare_access(scene, animation_access, &scene->anim_controller_v2, e_cmp_access::read | e_cmp_access::write);
+            declare_access(scene, animation_access, &scene->parents, e_cmp_access::read);
+            declare_access(scene, animation_access, &scene->initial_transform, e_cmp_access::read);
+            declare_access(scene, animation_access, &scene->additive_rotation, e_cmp_access::read);
+            add_system(scene, e_system_type::animation, 0, animation_access);
+
+            u32 num_extensions = sb_count(scene->extensions);
+            for (u32 e = 0; e < num_extensions; ++e)
+                if (scene->extensions[e].funcs.update_func)
+                    add_system(scene, e_system_type::extension_update, e, scene->extensions[e].access);
+
+            // queries are brought up to date before any system reads them, never from inside a concurrent level
+            update_entity_queries(scene);
+
+            run_systems(scene, dt);
+        }
+
+        void run_post_update_systems(ecs_scene* scene, f32 dt)
+        {
+            sb_reset(scene->systems.systems);
+
+            u32 num_controllers = sb_count(scene->controllers);
+            for (u32 c = 0; c < num_controllers; ++c)
+                if (scene->controllers[c].funcs.post_update_func)
+                    add_system(scene, e_system_type::controller_post_update, c, scene->controllers[c].access);
+
+            run_systems(scene, dt);
+        }
+    } // namespace ecs
+} // namespace put
@@ -0,0 +1,44 @@
+// ecs_scheduler.h
+// Copyright 2014 - 2023 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Controller updates, animation and extension updates, and controller post updates run as systems. Each update the
+// systems of a phase are placed in levels, a system goes in the level after the last earlier system it conflicts with,
+// two systems conflict if either writes a component the other reads or writes. Levels run in order and the systems of
+// a level run concurrently on the task pool, so conflicting systems keep their registration order.
+
+#pragma once
+
+#include "types.h"
+
+namespace put
+{
+    namespace ecs
+    {
+        struct ecs_scene;
+        struct system_access;
+
+        namespace e_cmp_access
+        {
+            enum cmp_access_t
+            {
+                read = 1 << 0,
+                write = 1 << 1
+            };
+        }
+        typedef u32 cmp_access;
+
+        // cmp is the address of one of the scenes component arrays, base or extension, ie. &scene->transforms.
+        // extensions declare on their registered copy from get_ecs_extension, since that is where the scheduler looks
+        void declare_access(ecs_scene* scene, system_access& access, const void* cmp, cmp_access flags);
+
+        // index of the component array at cmp in get_component_array order
+        u32 get_component_index(ecs_scene* scene, const void* cmp);
+
+        // controller update funcs, animation and extension update funcs
+        void run_update_systems(ecs_scene* scene, f32 dt);
+
+        // controller post update funcs
+        void run_post_update_systems(ecs_scene* scene, f32 dt);
+    } // namespace ecs
+} // namespace put
@@ -0,0 +1,769 @@
+// ecs_simd.cpp
+// Copyright 2014 - 2023 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+#include "ecs_simd.h"
+#include "ecs_scene.h"
+
+#if PUT_SIMD_SSE2
+#include <immintrin.h>
+#include <xmmintrin.h>
+#if _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#if __ARM_NEON || __ARM_NEON__
+#include <arm_neon.h>
+#endif
+
+using namespace ::pen;
+
+namespace put
+{
+    namespace ecs
+    {
+        //
+        // cpu detection
+        //
+
+        simd_flags simd_detect()
+        {
+            simd_flags flags = e_simd::scalar;
+
+#if PUT_SIMD_SSE2
+            u32 regs[4] = {0};
+#if _MSC_VER
+            __cpuid((int*)regs, 0);
+            u32 max_leaf = regs[0];
+            __cpuid((int*)regs, 1);
+#else
+            u32 max_leaf = __get_cpuid_max(0, nullptr);
+            __get_cpuid(1, &regs[0], &regs[1], &regs[2], &regs[3]);
+#endif
+            if (regs[3] & (1 << 26))
+                flags |= e_simd::sse2;
+
+            // avx registers must also be saved by the os
+            bool osxsave = regs[2] & (1 << 27);
+            bool ymm_state = false;
+            if (osxsave)
+            {
+#if _MSC_VER
+                u64 xcr0 = _xgetbv(0);
+#else
+                u32 xcr0_lo, xcr0_hi;
+                __asm__ volatile("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+                u64 xcr0 = ((u64)xcr0_hi << 32) | xcr0_lo;
+#endif
+                ymm_state = (xcr0 & 0x6) == 0x6;
+            }
+
+            if (ymm_state && (regs[2] & (1 << 28)))
+                flags |= e_simd::avx;
+
+            if (ymm_state && (regs[2] & (1 << 12)))
+                flags |= e_simd::fma;
+
+            if (ymm_state && max_leaf >= 7)
+            {
+#if _MSC_VER
+                __cpuidex((int*)regs, 7, 0);
+#else
+                __cpuid_count(7, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+                if (regs[1] & (1 << 5))
+                    flags |= e_simd::avx2;
+            }
+#endif
+
+#if __ARM_NEON || __ARM_NEON__
+            flags |= e_simd::neon;
+#endif
+            return flags;
+        }
+
+        simd_flags simd_supported()
+        {
+            // kernels are only available for instruction sets the compiler was allowed to emit
+            simd_flags compiled = e_simd::scalar;
+#if PUT_SIMD_SSE2
+            compiled |= e_simd::sse2;
+#endif
+#if PUT_SIMD_AVX2
+            compiled |= e_simd::avx | e_simd::avx2 | e_simd::fma;
+#endif
+#if __ARM_NEON || __ARM_NEON__
+            compiled |= e_simd::neon;
+#endif
+            static simd_flags s_detected = simd_detect();
+            return s_detected & compiled;
+        }
+
+        //
+        // scalar float implementation
+        //
+
+        namespace
+        {
+            void bake_local_matrix(const cmp_transform& t, mat3x4& out)
+            {
+                const quat& q = t.rotation;
+
+                // scale by 2 / |q|^2 so the result is a pure rotation for non unit quaternions
+                f32 s = 2.0f / (q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+                f32 xs = q.x * s, ys = q.y * s, zs = q.z * s;
+                f32 wx = q.w * xs, wy = q.w * ys, wz = q.w * zs;
+                f32 xx = q.x * xs, xy = q.x * ys, xz = q.x * zs;
+                f32 yy = q.y * ys, yz = q.y * zs, zz = q.z * zs;
+
+                f32* m = out.m;
+                m[0] = (1.0f - (yy + zz)) * t.scale.x;
+                m[1] = (xy - wz) * t.scale.y;
+                m[2] = (xz + wy) * t.scale.z;
+                m[3] = t.translation.x;
+
+                m[4] = (xy + wz) * t.scale.x;
+                m[5] = (1.0f - (xx + zz)) * t.scale.y;
+                m[6] = (yz - wx) * t.scale.z;
+                m[7] = t.translation.y;
+
+                m[8] = (xz - wy) * t.scale.x;
+                m[9] = (yz + wx) * t.scale.y;
+                m[10] = (1.0f - (xx + yy)) * t.scale.z;
+                m[11] = t.translation.z;
+            }
+
+            // centre and half extents in world space, written out to the bounding volume and pos extent
+            void store_bounds(ecs_scene* scene, u32 e, f32 cx, f32 cy, f32 cz, f32 ex, f32 ey, f32 ez, f32 radius)
+            {
+                cmp_bounding_volume& bv = scene->bounding_volumes[e];
+                bv.transformed_min_extents = vec3f(cx - ex, cy - ey, cz - ez);
+                bv.transformed_max_extents = vec3f(cx + ex, cy + ey, cz + ez);
+                bv.radius = radius;
+
+                cmp_pos_extent& pe = scene->pos_extent[e];
+                pe.pos.xyz = vec3f(cx, cy, cz);
+                pe.extent = vec4f(ex, ey, ez, radius);
+            }
+
+            // half extents are computed as max * 0.5 - min * 0.5 so infinite volumes do not overflow
+            void local_centre_extent(const cmp_bounding_volume& bv, vec3f& c, vec3f& e)
+            {
+                c = bv.min_extents * 0.5f + bv.max_extents * 0.5f;
+                e = bv.max_extents * 0.5f - bv.min_extents * 0.5f;
+            }
+        } // namespace
+
+        void bake_local_matrices_scalar(ecs_scene* scene, const u32* entities, u32 count)
+        {
+            for (u32 i = 0; i < count; ++i)
+            {
+                u32 e = entities[i];
+                bake_local_matrix(scene->transforms[e], scene->local_matrices[e]);
+            }
+        }
+
+        void transform_bounds_scalar(ecs_scene* scene, const u32* entities, u32 count)
+        {
+            for (u32 i = 0; i < count; ++i)
+            {
+                u32         e = entities[i];
+                const f32*  m = scene->world_matrices[e].m;
+                vec3f       c, x;
+                local_centre_extent(scene->bounding_volumes[e], c, x);
+
+                f32 cx = m[0] * c.x + m[1] * c.y + m[2] * c.z + m[3];
+                f32 cy = m[4] * c.x + m[5] * c.y + m[6] * c.z + m[7];
+                f32 cz = m[8] * c.x + m[9] * c.y + m[10] * c.z + m[11];
+
+                f32 ex = fabs(m[0]) * x.x + fabs(m[1]) * x.y + fabs(m[2]) * x.z;
+                f32 ey = fabs(m[4]) * x.x + fabs(m[5]) * x.y + fabs(m[6]) * x.z;
+                f32 ez = fabs(m[8]) * x.x + fabs(m[9]) * x.y + fabs(m[10]) * x.z;
+
+                store_bounds(scene, e, cx, cy, cz, ex, ey, ez, sqrt(ex * ex + ey * ey + ez * ez));
+            }
+        }
+
+        //
+        // sse2 128 implementation
+        //
+#if PUT_SIMD_SSE2
+        namespace
+        {
+            // rows of the world matrix for 4 entities transposed so each register holds one element for all entities
+            void load_affine_soa4(const ecs_scene* scene, const u32* e, __m128 out[12])
+            {
+                for (u32 r = 0; r < 3; ++r)
+                {
+                    __m128 r0 = _mm_loadu_ps(scene->world_matrices[e[0]].m + r * 4);
+                    __m128 r1 = _mm_loadu_ps(scene->world_matrices[e[1]].m + r * 4);
+                    __m128 r2 = _mm_loadu_ps(scene->world_matrices[e[2]].m + r * 4);
+                    __m128 r3 = _mm_loadu_ps(scene->world_matrices[e[3]].m + r * 4);
+                    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                    out[r * 4 + 0] = r0;
+                    out[r * 4 + 1] = r1;
+                    out[r * 4 + 2] = r2;
+                    out[r * 4 + 3] = r3;
+                }
+            }
+
+            // 12 soa elements for 4 entities transposed back to matrix rows
+            void store_affine_soa4(ecs_scene* scene, const u32* e, __m128 m[12])
+            {
+                for (u32 r = 0; r < 3; ++r)
+                {
+                    __m128 c0 = m[r * 4 + 0];
+                    __m128 c1 = m[r * 4 + 1];
+                    __m128 c2 = m[r * 4 + 2];
+                    __m128 c3 = m[r * 4 + 3];
+                    _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+                    _mm_storeu_ps(scene->local_matrices[e[0]].m + r * 4, c0);
+                    _mm_storeu_ps(scene->local_matrices[e[1]].m + r * 4, c1);
+                    _mm_storeu_ps(scene->local_matrices[e[2]].m + r * 4, c2);
+                    _mm_storeu_ps(scene->local_matrices[e[3]].m + r * 4, c3);
+                }
+            }
+        } // namespace
+
+        void bake_local_matrices_simd128(ecs_scene* scene, const u32* entities, u32 count)
+        {
+            const __m128 one = _mm_set1_ps(1.0f);
+            const __m128 two = _mm_set1_ps(2.0f);
+
+            u32 n = count & ~3;
+            for (u32 i = 0; i < n; i += 4)
+            {
+                const u32*           e = &entities[i];
+                const cmp_transform& t0 = scene->transforms[e[0]];
+                const cmp_transform& t1 = scene->transforms[e[1]];
+                const cmp_transform& t2 = scene->transforms[e[2]];
+                const cmp_transform& t3 = scene->transforms[e[3]];
+
+                __m128 qx = _mm_setr_ps(t0.rotation.x, t1.rotation.x, t2.rotation.x, t3.rotation.x);
+                __m128 qy = _mm_setr_ps(t0.rotation.y, t1.rotation.y, t2.rotation.y, t3.rotation.y);
+                __m128 qz = _mm_setr_ps(t0.rotation.z, t1.rotation.z, t2.rotation.z, t3.rotation.z);
+                __m128 qw = _mm_setr_ps(t0.rotation.w, t1.rotation.w, t2.rotation.w, t3.rotation.w);
+                __m128 sx = _mm_setr_ps(t0.scale.x, t1.scale.x, t2.scale.x, t3.scale.x);
+                __m128 sy = _mm_setr_ps(t0.scale.y, t1.scale.y, t2.scale.y, t3.scale.y);
+                __m128 sz = _mm_setr_ps(t0.scale.z, t1.scale.z, t2.scale.z, t3.scale.z);
+
+                __m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(qx, qx), _mm_mul_ps(qy, qy)),
+                                         _mm_add_ps(_mm_mul_ps(qz, qz), _mm_mul_ps(qw, qw)));
+                __m128 s = _mm_div_ps(two, len2);
+
+                __m128 xs = _mm_mul_ps(qx, s);
+                __m128 ys = _mm_mul_ps(qy, s);
+                __m128 zs = _mm_mul_ps(qz, s);
+                __m128 wx = _mm_mul_ps(qw, xs);
+                __m128 wy = _mm_mul_ps(qw, ys);
+                __m128 wz = _mm_mul_ps(qw, zs);
+                __m128 xx = _mm_mul_ps(qx, xs);
+                __m128 xy = _mm_mul_ps(qx, ys);
+                __m128 xz = _mm_mul_ps(qx, zs);
+                __m128 yy = _mm_mul_ps(qy, ys);
+                __m128 yz = _mm_mul_ps(qy, zs);
+                __m128 zz = _mm_mul_ps(qz, zs);
+
+                __m128 m[12];
+                m[0] = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(yy, zz)), sx);
+                m[1] = _mm_mul_ps(_mm_sub_ps(xy, wz), sy);
+                m[2] = _mm_mul_ps(_mm_add_ps(xz, wy), sz);
+                m[3] = _mm_setr_ps(t0.translation.x, t1.translation.x, t2.translation.x, t3.translation.x);
+
+                m[4] = _mm_mul_ps(_mm_add_ps(xy, wz), sx);
+                m[5] = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, zz)), sy);
+                m[6] = _mm_mul_ps(_mm_sub_ps(yz, wx), sz);
+                m[7] = _mm_setr_ps(t0.translation.y, t1.translation.y, t2.translation.y, t3.translation.y);
+
+                m[8] = _mm_mul_ps(_mm_sub_ps(xz, wy), sx);
+                m[9] = _mm_mul_ps(_mm_add_ps(yz, wx), sy);
+                m[10] = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, yy)), sz);
+                m[11] = _mm_setr_ps(t0.translation.z, t1.translation.z, t2.translation.z, t3.translation.z);
+
+                store_affine_soa4(scene, e, m);
+            }
+
+            bake_local_matrices_scalar(scene, entities + n, count - n);
+        }
+
+        void transform_bounds_simd128(ecs_scene* scene, const u32* entities, u32 count)
+        {
+            const __m128 half = _mm_set1_ps(0.5f);
+            const __m128 sign = _mm_set1_ps(-0.0f);
+
+            f32 out[7][4];
+
+            u32 n = count & ~3;
+            for (u32 i = 0; i < n; i += 4)
+            {
+                const u32*                 e = &entities[i];
+                const cmp_bounding_volume& b0 = scene->bounding_volumes[e[0]];
+                const cmp_bounding_volume& b1 = scene->bounding_volumes[e[1]];
+                const cmp_bounding_volume& b2 = scene->bounding_volumes[e[2]];
+                const cmp_bounding_volume& b3 = scene->bounding_volumes[e[3]];
+
+#define GATHER4(member) _mm_mul_ps(_mm_setr_ps(b0.member, b1.member, b2.member, b3.member), half)
+
+                __m128 mnx = GATHER4(min_extents.x);
+                __m128 mny = GATHER4(min_extents.y);
+                __m128 mnz = GATHER4(min_extents.z);
+                __m128 mxx = GATHER4(max_extents.x);
+                __m128 mxy = GATHER4(max_extents.y);
+                __m128 mxz = GATHER4(max_extents.z);
+#undef GATHER4
+
+                __m128 cx = _mm_add_ps(mnx, mxx);
+                __m128 cy = _mm_add_ps(mny, mxy);
+                __m128 cz = _mm_add_ps(mnz, mxz);
+                __m128 ex = _mm_sub_ps(mxx, mnx);
+                __m128 ey = _mm_sub_ps(mxy, mny);
+                __m128 ez = _mm_sub_ps(mxz, mnz);
+
+                __m128 m[12];
+                load_affine_soa4(scene, e, m);
+
+                __m128 w[6];
+                for (u32 r = 0; r < 3; ++r)
+                {
+                    __m128 m0 = m[r * 4 + 0];
+                    __m128 m1 = m[r * 4 + 1];
+                    __m128 m2 = m[r * 4 + 2];
+
+                    // centre
+                    __m128 c = _mm_add_ps(_mm_mul_ps(m0, cx), m[r * 4 + 3]);
+                    c = _mm_add_ps(_mm_mul_ps(m1, cy), c);
+                    w[r] = _mm_add_ps(_mm_mul_ps(m2, cz), c);
+
+                    // extent with absolute rotation scale
+                    __m128 x = _mm_mul_ps(_mm_andnot_ps(sign, m0), ex);
+                    x = _mm_add_ps(_mm_mul_ps(_mm_andnot_ps(sign, m1), ey), x);
+                    w[r + 3] = _mm_add_ps(_mm_mul_ps(_mm_andnot_ps(sign, m2), ez), x);
+                }
+
+                __m128 r2 = _mm_add_ps(_mm_mul_ps(w[3], w[3]), _mm_add_ps(_mm_mul_ps(w[4], w[4]), _mm_mul_ps(w[5], w[5])));
+
+                for (u32 k = 0; k < 6; ++k)
+                    _mm_storeu_ps(out[k], w[k]);
+                _mm_storeu_ps(out[6], _mm_sqrt_ps(r2));
+
+                for (u32 j = 0; j < 4; ++j)
+                    store_bounds(scene, e[j], out[0][j], out[1][j], out[2][j], out[3][j], out[4][j], out[5][j], out[6][j]);
+            }
+
+            transform_bounds_scalar(scene, entities + n, count - n);
+        }
+#endif
+
+        //
+        // avx 256 implementation
+        //
+#if PUT_SIMD_AVX2
+        namespace
+        {
+            PUT_TARGET_AVX2 __m256 combine_m128(__m128 lo, __m128 hi)
+            {
+                return _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+            }
+        } // namespace
+
+        PUT_TARGET_AVX2 void bake_local_matrices_simd256(ecs_scene* scene, const u32* entities, u32 count)
+        {
+            const __m256 one = _mm256_set1_ps(1.0f);
+            const __m256 two = _mm256_set1_ps(2.0f);
+
+            u32 n = count & ~7;
+            for (u32 i = 0; i < n; i += 8)
+            {
+                const u32* e = &entities[i];
+
+                const cmp_transform* t[8];
+                for (u32 j = 0; j < 8; ++j)
+                    t[j] = &scene->transforms[e[j]];
+
+#define GATHER8(member)                                                                                                      \
+    _mm256_setr_ps(t[0]->member, t[1]->member, t[2]->member, t[3]->member, t[4]->member, t[5]->member, t[6]->member,         \
+                   t[7]->member)
+
+                __m256 qx = GATHER8(rotation.x);
+                __m256 qy = GATHER8(rotation.y);
+                __m256 qz = GATHER8(rotation.z);
+                __m256 qw = GATHER8(rotation.w);
+                __m256 sx = GATHER8(scale.x);
+                __m256 sy = GATHER8(scale.y);
+                __m256 sz = GATHER8(scale.z);
+
+                __m256 len2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(qx, qx), _mm256_mul_ps(qy, qy)),
+                                            _mm256_add_ps(_mm256_mul_ps(qz, qz), _mm256_mul_ps(qw, qw)));
+                __m256 s = _mm256_div_ps(two, len2);
+
+                __m256 xs = _mm256_mul_ps(qx, s);
+                __m256 ys = _mm256_mul_ps(qy, s);
+                __m256 zs = _mm256_mul_ps(qz, s);
+                __m256 wx = _mm256_mul_ps(qw, xs);
+                __m256 wy = _mm256_mul_ps(qw, ys);
+                __m256 wz = _mm256_mul_ps(qw, zs);
+                __m256 xx = _mm256_mul_ps(qx, xs);
+                __m256 xy = _mm256_mul_ps(qx, ys);
+                __m256 xz = _mm256_mul_ps(qx, zs);
+                __m256 yy = _mm256_mul_ps(qy, ys);
+                __m256 yz = _mm256_mul_ps(qy, zs);
+                __m256 zz = _mm256_mul_ps(qz, zs);
+
+                __m256 m[12];
+                m[0] = _mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(yy, zz)), sx);
+                m[1] = _mm256_mul_ps(_mm256_sub_ps(xy, wz), sy);
+                m[2] = _mm256_mul_ps(_mm256_add_ps(xz, wy), sz);
+                m[3] = GATHER8(translation.x);
+
+                m[4] = _mm256_mul_ps(_mm256_add_ps(xy, wz), sx);
+                m[5] = _mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(xx, zz)), sy);
+                m[6] = _mm256_mul_ps(_mm256_sub_ps(yz, wx), sz);
+                m[7] = GATHER8(translation.y);
+
+                m[8] = _mm256_mul_ps(_mm256_sub_ps(xz, wy), sx);
+                m[9] = _mm256_mul_ps(_mm256_add_ps(yz, wx), sy);
+                m[10] = _mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(xx, yy)), sz);
+                m[11] = GATHER8(translation.z);
+#undef GATHER8
+
+                // write out as two groups of 4
+                __m128 lo[12], hi[12];
+                for (u32 k = 0; k < 12; ++k)
+                {
+                    lo[k] = _mm256_castps256_ps128(m[k]);
+                    hi[k] = _mm256_extractf128_ps(m[k], 1);
+                }
+
+                store_affine_soa4(scene, e, lo);
+                store_affine_soa4(scene, e + 4, hi);
+            }
+
+            bake_local_matrices_simd128(scene, entities + n, count - n);
+        }
+
+        PUT_TARGET_AVX2 void transform_bounds_simd256(ecs_scene* scene, const u32* entities, u32 count)
+        {
+            const __m256 half = _mm256_set1_ps(0.5f);
+            const __m256 sign = _mm256_set1_ps(-0.0f);
+
+            f32 out[7][8];
+
+            u32 n = count & ~7;
+            for (u32 i = 0; i < n; i += 8)
+            {
+                const u32* e = &entities[i];
+
+                const cmp_bounding_volume* b[8];
+                for (u32 j = 0; j < 8; ++j)
+                    b[j] = &scene->bounding_volumes[e[j]];
+
+#define GATHER8(member)                                                                                                      \
+    _mm256_mul_ps(_mm256_setr_ps(b[0]->member, b[1]->member, b[2]->member, b[3]->member, b[4]->member, b[5]->member,         \
+                                 b[6]->member, b[7]->member),                                                                \
+                  half)
+
+                __m256 mnx = GATHER8(min_extents.x);
+                __m256 mny = GATHER8(min_extents.y);
+                __m256 mnz = GATHER8(min_extents.z);
+                __m256 mxx = GATHER8(max_extents.x);
+                __m256 mxy = GATHER8(max_extents.y);
+                __m256 mxz = GATHER8(max_extents.z);
+#undef GATHER8
+
+                __m256 cx = _mm256_add_ps(mnx, mxx);
+                __m256 cy = _mm256_add_ps(mny, mxy);
+                __m256 cz = _mm256_add_ps(mnz, mxz);
+                __m256 ex = _mm256_sub_ps(mxx, mnx);
+                __m256 ey = _mm256_sub_ps(mxy, mny);
+                __m256 ez = _mm256_sub_ps(mxz, mnz);
+
+                __m128 lo[12], hi[12];
+                load_affine_soa4(scene, e, lo);
+                load_affine_soa4(scene, e + 4, hi);
+
+                __m256 w[6];
+                for (u32 r = 0; r < 3; ++r)
+                {
+                    __m256 m0 = combine_m128(lo[r * 4 + 0], hi[r * 4 + 0]);
+                    __m256 m1 = combine_m128(lo[r * 4 + 1], hi[r * 4 + 1]);
+                    __m256 m2 = combine_m128(lo[r * 4 + 2], hi[r * 4 + 2]);
+                    __m256 m3 = combine_m128(lo[r * 4 + 3], hi[r * 4 + 3]);
+
+                    // centre
+                    __m256 c = _mm256_add_ps(_mm256_mul_ps(m0, cx), m3);
+                    c = _mm256_add_ps(_mm256_mul_ps(m1, cy), c);
+                    w[r] = _mm256_add_ps(_mm256_mul_ps(m2, cz), c);
+
+                    // extent with absolute rotation scale
+                    __m256 x = _mm256_mul_ps(_mm256_andnot_ps(sign, m0), ex);
+                    x = _mm256_add_ps(_mm256_mul_ps(_mm256_andnot_ps(sign, m1), ey), x);
+                    w[r + 3] = _mm256_add_ps(_mm256_mul_ps(_mm256_andnot_ps(sign, m2), ez), x);
+                }
+
+                __m256 r2 = _mm256_add_ps(_mm256_mul_ps(w[3], w[3]),
+                                          _mm256_add_ps(_mm256_mul_ps(w[4], w[4]), _mm256_mul_ps(w[5], w[5])));
+
+                for (u32 k = 0; k < 6; ++k)
+                    _mm256_storeu_ps(out[k], w[k]);
+                _mm256_storeu_ps(out[6], _mm256_sqrt_ps(r2));
+
+                for (u32 j = 0; j < 8; ++j)
+                    store_bounds(scene, e[j], out[0][j], out[1][j], out[2][j], out[3][j], out[4][j], out[5][j], out[6][j]);
+            }
+
+            transform_bounds_simd128(scene, entities + n, count - n);
+        }
+#endif
+
+        //
+        // arm neon simd 128 implementation
+        //
+#if __ARM_NEON || __ARM_NEON__
+        void bake_local_matrices_neon(ecs_scene* scene, const u32* entities, u32 count)
+        {
+            const float32x4_t one = vdupq_n_f32(1.0f);
+
+            f32 in[10][4];
+
+            u32 n = count & ~3;
+            for (u32 i = 0; i < n; i += 4)
+            {
+                const u32* e = &entities[i];
+                for (u32 j = 0; j < 4; ++j)
+                {
+                    const cmp_transform& t = scene->transforms[e[j]];
+                    in[0][j] = t.rotation.x;
+                    in[1][j] = t.rotation.y;
+                    in[2][j] = t.rotation.z;
+                    in[3][j] = t.rotation.w;
+                    in[4][j] = t.scale.x;
+                    in[5][j] = t.scale.y;
+                    in[6][j] = t.scale.z;
+                    in[7][j] = t.translation.x;
+                    in[8][j] = t.translation.y;
+                    in[9][j] = t.translation.z;
+                }
+
+                float32x4_t qx = vld1q_f32(in[0]);
+                float32x4_t qy = vld1q_f32(in[1]);
+                float32x4_t qz = vld1q_f32(in[2]);
+                float32x4_t qw = vld1q_f32(in[3]);
+                float32x4_t sx = vld1q_f32(in[4]);
+                float32x4_t sy = vld1q_f32(in[5]);
+                float32x4_t sz = vld1q_f32(in[6]);
+
+                float32x4_t len2 = vaddq_f32(vaddq_f32(vmulq_f32(qx, qx), vmulq_f32(qy, qy)),
+                                             vaddq_f32(vmulq_f32(qz, qz), vmulq_f32(qw, qw)));
+
+                // reciprocal estimate refined twice with newton raphson
+                float32x4_t rcp = vrecpeq_f32(len2);
+                rcp = vmulq_f32(vrecpsq_f32(len2, rcp), rcp);
+                rcp = vmulq_f32(vrecpsq_f32(len2, rcp), rcp);
+                float32x4_t s = vaddq_f32(rcp, rcp);
+
+                float32x4_t xs = vmulq_f32(qx, s);
+                float32x4_t ys = vmulq_f32(qy, s);
+                float32x4_t zs = vmulq_f32(qz, s);
+                float32x4_t wx = vmulq_f32(qw, xs);
+                float32x4_t wy = vmulq_f32(qw, ys);
+                float32x4_t wz = vmulq_f32(qw, zs);
+                float32x4_t xx = vmulq_f32(qx, xs);
+                float32x4_t xy = vmulq_f32(qx, ys);
+                float32x4_t xz = vmulq_f32(qx, zs);
+                float32x4_t yy = vmulq_f32(qy, ys);
+                float32x4_t yz = vmulq_f32(qy, zs);
+                float32x4_t zz = vmulq_f32(qz, zs);
+
+                // vst4 interleaves one row of each entity, 4 floats apart
+                f32 rows[3][16];
+
+                float32x4x4_t r0;
+                r0.val[0] = vmulq_f32(vsubq_f32(one, vaddq_f32(yy, zz)), sx);
+                r0.val[1] = vmulq_f32(vsubq_f32(xy, wz), sy);
+                r0.val[2] = vmulq_f32(vaddq_f32(xz, wy), sz);
+                r0.val[3] = vld1q_f32(in[7]);
+                vst4q_f32(rows[0], r0);
+
+                float32x4x4_t r1;
+                r1.val[0] = vmulq_f32(vaddq_f32(xy, wz), sx);
+                r1.val[1] = vmulq_f32(vsubq_f32(one, vaddq_f32(xx, zz)), sy);
+                r1.val[2] = vmulq_f32(vsubq_f32(yz, wx), sz);
+                r1.val[3] = vld1q_f32(in[8]);
+                vst4q_f32(rows[1], r1);
+
+                float32x4x4_t r2;
+                r2.val[0] = vmulq_f32(vsubq_f32(xz, wy), sx);
+                r2.val[1] = vmulq_f32(vaddq_f32(yz, wx), sy);
+                r2.val[2] = vmulq_f32(vsubq_f32(one, vaddq_f32(xx, yy)), sz);
+                r2.val[3] = vld1q_f32(in[9]);
+                vst4q_f32(rows[2], r2);
+
+                for (u32 j = 0; j < 4; ++j)
+                {
+                    f32* m = scene->local_matrices[e[j]].m;
+                    vst1q_f32(m + 0, vld1q_f32(&rows[0][j * 4]));
+                    vst1q_f32(m + 4, vld1q_f32(&rows[1][j * 4]));
+                    vst1q_f32(m + 8, vld1q_f32(&rows[2][j * 4]));
+                }
+            }
+
+            bake_local_matrices_scalar(scene, entities + n, count - n);
+        }
+
+        void transform_bounds_neon(ecs_scene* scene, const u32* entities, u32 count)
+        {
+            const float32x4_t half = vdupq_n_f32(0.5f);
+
+            f32 in[6][4];
+            f32 out[7][4];
+
+            u32 n = count & ~3;
+            for (u32 i = 0; i < n; i += 4)
+            {
+                const u32* e = &entities[i];
+                for (u32 j = 0; j < 4; ++j)
+                {
+                    const cmp_bounding_volume& bv = scene->bounding_volumes[e[j]];
+                    in[0][j] = bv.min_extents.x;
+                    in[1][j] = bv.min_extents.y;
+                    in[2][j] = bv.min_extents.z;
+                    in[3][j] = bv.max_extents.x;
+                    in[4][j] = bv.max_extents.y;
+                    in[5][j] = bv.max_extents.z;
+                }
+
+                float32x4_t mn[3], mx[3], c[3], x[3];
+                for (u32 k = 0; k < 3; ++k)
+                {
+                    mn[k] = vmulq_f32(vld1q_f32(in[k]), half);
+                    mx[k] = vmulq_f32(vld1q_f32(in[k + 3]), half);
+                    c[k] = vaddq_f32(mn[k], mx[k]);
+                    x[k] = vsubq_f32(mx[k], mn[k]);
+                }
+
+                // vld4 de-interleaves a matrix row into x, y, z, w for 4 entities
+                float32x4_t w[6];
+                for (u32 r = 0; r < 3; ++r)
+                {
+                    f32 rows[16];
+                    for (u32 j = 0; j < 4; ++j)
+                        vst1q_f32(&rows[j * 4], vld1q_f32(scene->world_matrices[e[j]].m + r * 4));
+
+                    float32x4x4_t m = vld4q_f32(rows);
+
+                    float32x4_t cc = vaddq_f32(vmulq_f32(m.val[0], c[0]), m.val[3]);
+                    cc = vaddq_f32(vmulq_f32(m.val[1], c[1]), cc);
+                    w[r] = vaddq_f32(vmulq_f32(m.val[2], c[2]), cc);
+
+                    float32x4_t xx = vmulq_f32(vabsq_f32(m.val[0]), x[0]);
+                    xx = vaddq_f32(vmulq_f32(vabsq_f32(m.val[1]), x[1]), xx);
+                    w[r + 3] = vaddq_f32(vmulq_f32(vabsq_f32(m.val[2]), x[2]), xx);
+                }
+
+                for (u32 k = 0; k < 6; ++k)
+                    vst1q_f32(out[k], w[k]);
+
+                for (u32 j = 0; j < 4; ++j)
+                {
+                    f32 radius = sqrt(out[3][j] * out[3][j] + out[4][j] * out[4][j] + out[5][j] * out[5][j]);
+                    store_bounds(scene, e[j], out[0][j], out[1][j], out[2][j], out[3][j], out[4][j], out[5][j], radius);
+                }
+            }
+
+            transform_bounds_scalar(scene, entities + n, count - n);
+        }
+#endif
+
+        //
+        // dispatch
+        //
+
+        namespace
+        {
+            typedef void (*batch_kernel)(ecs_scene* scene, const u32* entities, u32 count);
+
+            struct simd_kernels
+            {
+                simd_flags   level = e_simd::scalar;
+                batch_kernel bake_local_matrices = bake_local_matrices_scalar;
+                batch_kernel transform_bounds = transform_bounds_scalar;
+            };
+            simd_kernels s_kernels;
+
+            void select_kernels(simd_flags level)
+            {
+                simd_kernels k;
+                k.level = level & simd_supported();
+
+#if PUT_SIMD_SSE2
+                if (k.level & e_simd::sse2)
+                {
+                    k.bake_local_matrices = bake_local_matrices_simd128;
+                    k.transform_bounds = transform_bounds_simd128;
+                }
+#endif
+#if PUT_SIMD_AVX2
+                if (k.level & e_simd::avx2)
+                {
+                    k.bake_local_matrices = bake_local_matrices_simd256;
+                    k.transform_bounds = transform_bounds_simd256;
+                }
+#endif
+#if __ARM_NEON || __ARM_NEON__
+                if (k.level & e_simd::neon)
+                {
+                    k.bake_local_matrices = bake_local_matrices_neon;
+                    k.transform_bounds = transform_bounds_neon;
+                }
+#endif
+                s_kernels = k;
+            }
+
+            // kernels are selected on first use, function static init is thread safe
+            const simd_kernels& get_kernels()
+            {
+                static bool s_init = (select_kernels(simd_supported()), true);
+                PEN_UNUSED(s_init);
+                return s_kernels;
+            }
+        } // namespace
+
+        simd_flags simd_get_level()
+        {
+            return get_kernels().level;
+        }
+
+        void simd_set_level(simd_flags level)
+        {
+            get_kernels();
+            select_kernels(level);
+        }
+
+        const c8* simd_level_name(simd_flags level)
+        {
+            if (level & e_simd::avx2)
+                return "avx2";
+
+            if (level & e_simd::sse2)
+                return "sse2";
+
+            if (level & e_simd::neon)
+                return "neon";
+
+            return "scalar";
+        }
+
+        void bake_local_matrices(ecs_scene* scene, const u32* entities, u32 count)
+        {
+            get_kernels().bake_local_matrices(scene, entities, count);
+        }
+
+        void transform_bounds(ecs_scene* scene, const u32* entities, u32 count)
+        {
+            get_kernels().transform_bounds(scene, entities, count);
+        }
+    } // namespace ecs
+} // namespace put
@@ -0,0 +1,62 @@
+// ecs_simd.h
+// Copyright 2014 - 2023 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Batch kernels for the per entity maths in update_scene, each kernel has a scalar version and sse, avx2 and neon
+// versions which process 4 or 8 entities at a time. the widest version compiled in and supported by the cpu is selected
+// at run time.
+
+#pragma once
+
+#include "types.h"
+
+// sse2 is part of the x64 baseline, msvc does not define __SSE2__ for it
+#if __SSE2__ || __AVX__ || _M_X64 || _M_IX86_FP >= 2
+#define PUT_SIMD_SSE2 1
+#endif
+
+// avx2 kernels are compiled with their own function target so the rest of the binary runs on cpus without avx2, they
+// are only called when cpuid reports support. msvc emits avx2 intrinsics without /arch
+#if __AVX2__ || _M_X64
+#define PUT_SIMD_AVX2 1
+#define PUT_TARGET_AVX2
+#elif (__x86_64__ || __i386__) && __GNUC__
+#define PUT_SIMD_AVX2 1
+#define PUT_TARGET_AVX2 __attribute__((target("avx,avx2,fma")))
+#endif
+
+namespace put
+{
+    namespace ecs
+    {
+        struct ecs_scene;
+
+        namespace e_simd
+        {
+            enum simd_t
+            {
+                scalar = 0,
+                sse2 = 1 << 0,
+                avx = 1 << 1,
+                avx2 = 1 << 2,
+                fma = 1 << 3,
+                neon = 1 << 4
+            };
+        }
+        typedef u32 simd_flags;
+
+        simd_flags simd_supported(); // instruction sets compiled in and supported by the running cpu
+        simd_flags simd_get_level();
+        void       simd_set_level(simd_flags level); // restrict kernels to a subset of simd_supported, for benchmarks
+        const c8*  simd_level_name(simd_flags level);
+
+        // local matrix = translation * rotation * scale, built directly from cmp_transform for the entities in the list
+        void bake_local_matrices(ecs_scene* scene, const u32* entities, u32 count);
+        void bake_local_matrices_scalar(ecs_scene* scene, const u32* entities, u32 count);
+
+        // transformed extents, radius and pos_extent from bounding volumes and world matrices, an aabb is transformed by
+        // its centre and the absolute rotation scale of its half extents instead of transforming 8 corners
+        void transform_bounds(ecs_scene* scene, const u32* entities, u32 count);
+        void transform_bounds_scalar(ecs_scene* scene, const u32* entities, u32 count);
+    } // namespace ecs
+} // namespace put
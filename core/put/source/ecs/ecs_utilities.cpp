@@ -90,6 +90,8 @@ namespace put
         
         void insert_new_entities(ecs_scene* scene, s32 pos, s32 num)
         {
+            PEN_ASSERT(!is_simulating(scene));
+
             u32 shift_count = scene->num_entities - pos;
             
             // inserts new entites at pos moving entities downward to make space
@@ -103,7 +105,7 @@ namespace put
             for (u32 i = 0; i < scene->num_components; ++i)
             {
                 generic_cmp_array& cmp = scene->get_component_array(i);
-                memmove(cmp[pos+num], cmp[pos], cmp.size*shift_count);
+                copy_cmp_entities(cmp, pos+num, cmp, pos, shift_count);
             }
             
             // fix refs
@@ -118,7 +120,7 @@ namespace put
             for (u32 i = 0; i < scene->num_components; ++i)
             {
                 generic_cmp_array& cmp = scene->get_component_array(i);
-                memset(cmp[pos], 0x00, cmp.size*num);
+                zero_cmp_entities(cmp, pos, num);
             }
             
             // allocate new entities
@@ -132,10 +134,13 @@ namespace put
             //fully update free list
             initialise_free_list(scene);
             scene->flags |= e_scene_flags::invalidate_scene_tree;
+            scene->hierarchy.rebuild = true;
         }
 
         void get_new_entities_append(ecs_scene* scene, s32 num, s32& start, s32& end)
         {
+            PEN_ASSERT(!is_simulating(scene));
+
             // o(1) - appends a bunch of nodes on the end
             u32 max_num = scene->num_entities + num;
             if (max_num >= scene->soa_size || !scene->free_list_head)
@@ -165,10 +170,13 @@ namespace put
             }
 
             scene->num_entities = end;
+            scene->hierarchy.rebuild = true;
         }
 
         void get_new_entities_contiguous(ecs_scene* scene, s32 num, s32& start, s32& end)
         {
+            PEN_ASSERT(!is_simulating(scene));
+
             // o(n) - has to find contiguous nodes within the free list, and worst case will allocate more mem and append the
             // new nodes
             u32 max_num = scene->num_entities + num;
@@ -221,6 +229,7 @@ namespace put
                 }
 
                 scene->num_entities = std::max<u32>(end, scene->num_entities);
+                scene->hierarchy.rebuild = true;
             }
         }
 
@@ -234,6 +243,8 @@ namespace put
 
         u32 get_new_entity(ecs_scene* scene)
         {
+            PEN_ASSERT(!is_simulating(scene));
+
             // o(1) using free list
 
             if (!scene->free_list_head)
@@ -247,6 +258,9 @@ namespace put
 
             scene->flags |= e_scene_flags::invalidate_scene_tree;
 
+            // freed slots are reused and callers parent new entities by writing parents directly
+            scene->hierarchy.rebuild = true;
+
             scene->num_entities = std::max<u32>(i + 1, scene->num_entities);
 
             scene->names[i] = "";
@@ -387,14 +401,15 @@ namespace put
         // just set parent and fixup matrix
         void set_entity_parent(ecs_scene* scene, u32 parent, u32 child)
         {
+            PEN_ASSERT(!is_simulating(scene));
+
             if (child == parent)
                 return;
 
             scene->parents[child] = parent;
+            scene->hierarchy.rebuild = true;
 
-            mat4 parent_mat = scene->world_matrices[parent];
-
-            scene->local_matrices[child] = mat::inverse4x4(parent_mat) * scene->local_matrices[child];
+            scene->local_matrices[child] = affine_inverse(scene->world_matrices[parent]) * scene->local_matrices[child];
         }
 
         // set parent and also swap nodes to maintain valid heirarchy
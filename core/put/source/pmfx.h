@@ -53,7 +53,9 @@ namespace put
         enum shader_permutation_t
         {
             skinned = 1 << 31,
-            instanced = 1 << 30
+            instanced = 1 << 30,
+            clustered_lights = 1 << 29,
+            draw_buffer = 1 << 28
         };
     }
     typedef u32 shader_permutation;
@@ -77,12 +79,18 @@ namespace put
     };
 
     typedef void (*svr_render_function)(const scene_view&);
+    typedef void (*svr_cull_function)(const scene_view&);
     struct scene_view_renderer
     {
         Str     name;
         hash_id id_name = 0;
 
         svr_render_function render_function = nullptr;
+        svr_cull_function   cull_function = nullptr; // optional, requests the cameras render_function will cull
+
+        // render_function can record on a job thread at the same time as other views and array slices, views made
+        // only of thread safe renderers are recorded into command lists in parallel
+        bool thread_safe = false;
     };
 
     struct technique_constant_data
@@ -298,6 +306,7 @@ namespace put
         void release_script_resources();
         void render();
         void render_view(hash_id id_name);
+        void enable_parallel_recording(bool enable);
         void register_scene(ecs::ecs_scene* scene, const char* name);
         void register_camera(camera* cam, const char* name);
         void register_scene_view_renderer(const scene_view_renderer& svr);
@@ -20,6 +20,7 @@
 #include "pen_string.h"
 #include "renderer_shared.h"
 #include "str_utilities.h"
+#include "threads.h"
 #include "timer.h"
 
 #include <fstream>
@@ -251,6 +252,8 @@ namespace
         put::camera*    camera;
 
         std::vector<void (*)(const put::scene_view&)> render_functions;
+        std::vector<void (*)(const put::scene_view&)> cull_functions;
+        bool                                          thread_safe = false; // every render function is thread safe
 
         // targets
         u32 render_targets[pen::MAX_MRT] = {PEN_INVALID_HANDLE, PEN_INVALID_HANDLE, PEN_INVALID_HANDLE, PEN_INVALID_HANDLE,
@@ -374,6 +377,11 @@ namespace
     geometry_utility                     s_geometry;
     std::vector<Str>                     s_script_files;
     bool                                 s_reload = false;
+    camera                               s_ortho_camera; // for views without a camera (directional shadow maps)
+    u32                                  s_cb_sampler_info = PEN_INVALID_HANDLE;
+    u32                                  s_cb_pp_info = PEN_INVALID_HANDLE;
+    bool                                 s_parallel_recording = true;
+    pen::cmd_list*                       s_cmd_lists = nullptr; // stretchy buffer reused by every parallel batch
 
     // ids
 } // namespace
@@ -393,7 +401,9 @@ namespace put
             {
                 if(id == s.id_name)
                 {
+                    // replacements are recorded on the main thread
                     s.render_function = render_func;
+                    s.thread_safe = false;
                     return;
                 }
             }
@@ -1856,6 +1866,7 @@ namespace put
 
                 // scene views
                 pen::json scene_views = view["scene_views"];
+                new_view.thread_safe = scene_views.size() > 0;
                 for (u32 ii = 0; ii < scene_views.size(); ++ii)
                 {
                     hash_id id = scene_views[ii].as_hash_id();
@@ -1866,6 +1877,10 @@ namespace put
                         {
                             found = true;
                             new_view.render_functions.push_back(sv.render_function);
+                            new_view.thread_safe &= sv.thread_safe;
+
+                            if (sv.cull_function)
+                                new_view.cull_functions.push_back(sv.cull_function);
                         }
                     }
 
@@ -2651,6 +2666,12 @@ namespace put
 
             // clear vectors of remaining stuff
             s_scene_view_renderers.clear();
+
+            for (u32 i = 0; i < sb_count(s_cmd_lists); ++i)
+                pen::renderer_release_cmd_list(s_cmd_lists[i]);
+
+            sb_free(s_cmd_lists);
+            s_cmd_lists = nullptr;
         }
 
         void render_taa_resolve(const scene_view& view)
@@ -2853,46 +2874,30 @@ namespace put
                 pen::renderer_set_texture(0, 0, i, pen::TEXTURE_BIND_PS | pen::TEXTURE_BIND_VS);
         }
 
-        void render_view(view_params& v)
+        // state shared by the array slices of a view
+        struct view_pass
         {
-            // compute doesnt need render pipeline setup
-            if (v.view_flags & e_view_flags::compute)
-            {
-                scene_view sv;
-                sv.scene = v.scene;
-                sv.render_flags = v.render_flags;
-                sv.id_technique = v.id_technique;
-                sv.camera = v.camera;
-                sv.pmfx_shader = v.pmfx_shader;
-                sv.permutation = v.technique_permutation;
-
-                // faster clear for d3d uav
-                pen::renderer_clear_texture(v.clear_state, v.render_targets[0]);
-
-                for (s32 rf = 0; rf < v.render_functions.size(); ++rf)
-                    v.render_functions[rf](sv);
-
-                if (v.view_flags & (e_view_flags::resolve | e_view_flags::generate_mips))
-                    resolve_view_targets(v);
-
-                return;
-            }
+            pen::viewport vp;  // viewport with ratio
+            pen::viewport vvp; // literal size
+            scene_view    sv;
+        };
 
+        // sets the view wide state, returns false if the view has nothing to render
+        bool begin_view(view_params& v, view_pass& pass)
+        {
             // caps based exclusion
             const pen::renderer_info& ri = pen::renderer_get_info();
             if (v.view_flags & e_view_flags::cubemap_array)
                 if (!(ri.caps & PEN_CAPS_TEXTURE_CUBE_ARRAY))
-                    return;
+                    return false;
 
             // render pipeline
 
             // early out.. nothing to render
             if (v.num_colour_targets == 0 && v.depth_target == PEN_INVALID_HANDLE)
-                return;
+                return false;
 
             static u32 cb_2d = PEN_INVALID_HANDLE;
-            static u32 cb_sampler_info = PEN_INVALID_HANDLE;
-            static u32 cb_pp_info = PEN_INVALID_HANDLE;
             if (!is_valid(cb_2d))
             {
                 pen::buffer_creation_params bcp;
@@ -2907,11 +2912,11 @@ namespace put
 
                 // cb for sampler info
                 bcp.buffer_size = sizeof(vec4f) * 16; // 16 samplers worth, x = 1.0 / width, y = 1.0 / height
-                cb_sampler_info = pen::renderer_create_buffer(bcp);
+                s_cb_sampler_info = pen::renderer_create_buffer(bcp);
 
                 // cb for post process info
                 bcp.buffer_size = sizeof(post_process::pp_info);
-                cb_pp_info = pen::renderer_create_buffer(bcp);
+                s_cb_pp_info = pen::renderer_create_buffer(bcp);
             }
 
             // unbind samplers to stop validation layers complaining, render targets may still be bound on output.
@@ -2919,7 +2924,8 @@ namespace put
                 pen::renderer_set_texture(0, 0, i, pen::TEXTURE_BIND_PS | pen::TEXTURE_BIND_VS);
 
             // render state
-            pen::viewport vp = {0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f};
+            pen::viewport& vp = pass.vp;
+            vp = {0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f};
             get_rt_viewport(v.rt_width, v.rt_height, v.rt_ratio, v.viewport, vp);
             pen::renderer_set_depth_stencil_state(v.depth_stencil_state);
             pen::renderer_set_stencil_ref(v.stencil_ref);
@@ -2927,7 +2933,8 @@ namespace put
             pen::renderer_set_blend_state(v.blend_state);
 
             // we need the literal size not ratio
-            pen::viewport vvp = _renderer_resolve_viewport_ratio(vp);
+            pen::viewport& vvp = pass.vvp;
+            vvp = _renderer_resolve_viewport_ratio(vp);
 
             // create 2d view proj matrix
             f32 W = 2.0f / vvp.width;
@@ -2936,7 +2943,7 @@ namespace put
             pen::renderer_update_buffer(cb_2d, mvp, sizeof(mvp), 0);
 
             // build scene view info
-            scene_view sv;
+            scene_view& sv = pass.sv;
             sv.scene = v.scene;
             sv.render_flags = v.render_flags;
             sv.id_technique = v.id_technique;
@@ -2948,106 +2955,157 @@ namespace put
             sv.cb_2d_view = cb_2d;
             sv.pmfx_shader = v.pmfx_shader;
             sv.permutation = v.technique_permutation;
+            sv.num_arrays = v.num_arrays;
 
-            // render passes.. multi pass for cubemaps or arrays
-            for (u32 a = 0; a < v.num_arrays; ++a)
-            {
-                sv.array_index = a;
-                sv.num_arrays = v.num_arrays;
+            return true;
+        }
 
-                // generate 3d view proj matrix
-                if (v.camera)
+        // moves the view camera, or the orthographic camera of views without one, to array slice a
+        void set_slice_camera(const view_params& v, const view_pass& pass, u32 a, camera* cam)
+        {
+            if (v.camera)
+            {
+                // set jitter
+                if (v.view_flags & e_view_flags::jitter)
                 {
-                    // set jitter
-                    if (v.view_flags & e_view_flags::jitter)
-                    {
-                        v.camera->jitter = halton(pen::_renderer_frame_index());
-                        v.camera->jitter /= vec2f(vvp.width, vvp.height);
-                        v.camera->flags |= e_camera_flags::apply_jitter;
-                    }
+                    cam->jitter = halton(pen::_renderer_frame_index());
+                    cam->jitter /= vec2f(pass.vvp.width, pass.vvp.height);
+                    cam->flags |= e_camera_flags::apply_jitter;
+                }
 
-                    // cubemap face render
-                    if (v.view_flags & e_view_flags::cubemap)
-                        put::camera_set_cubemap_face(v.camera, a);
+                // cubemap face render
+                if (v.view_flags & e_view_flags::cubemap)
+                    put::camera_set_cubemap_face(cam, a);
+            }
+            else
+            {
+                // orthogonal projections (directional shadow maps)
+                const pen::viewport& vvp = pass.vvp;
+                put::camera_create_orthographic(cam, vvp.x, vvp.width, vvp.y, vvp.height, 0.0f, 1.0f);
+            }
+        }
 
-                    put::camera_update_shader_constants(v.camera);
-                    sv.cb_view = v.camera->cbuffer;
-                }
-                else
-                {
-                    // orthogonal projections (directional shadow maps)
-                    static put::camera c;
-                    put::camera_create_orthographic(&c, vvp.x, vvp.width, vvp.y, vvp.height, 0.0f, 1.0f);
-                    put::camera_update_shader_constants(&c);
-                    sv.cb_view = c.cbuffer;
-                }
+        // renders array slice a of a view with cam set up by set_slice_camera, only reads the view so slices of
+        // thread safe views can be recorded in parallel
+        void render_view_slice(const view_params& v, const view_pass& pass, u32 a, camera* cam)
+        {
+            const pen::viewport& vp = pass.vp;
 
-                // bind targets before samplers..
-                // so that ping-pong buffers get unbound from rt before being bound on samplers
-                pen::renderer_set_targets(v.render_targets, v.num_colour_targets, v.depth_target, a);
-                pen::renderer_set_viewport(vp);
-                pen::renderer_set_scissor_rect({vp.x, vp.y, vp.width, vp.height});
-                pen::renderer_clear(v.clear_state, a);
+            scene_view sv = pass.sv;
+            sv.array_index = a;
 
-                // bind view samplers.. render targets, global textures
-                for (auto& sb : v.sampler_bindings)
-                {
-                    pen::renderer_set_texture(sb.handle, sb.sampler_state, sb.sampler_unit, sb.bind_flags);
-                }
+            // generate 3d view proj matrix
+            put::camera_update_shader_constants(cam);
+            sv.cb_view = cam->cbuffer;
+            if (v.camera)
+                sv.camera = cam;
 
-                // bind technique samplers
-                for (u32 i = 0; i < e_pmfx_constants::max_technique_sampler_bindings; ++i)
-                {
-                    auto& sb = v.technique_samplers.sb[i];
-                    if (sb.handle == 0)
-                        continue;
+            // bind targets before samplers..
+            // so that ping-pong buffers get unbound from rt before being bound on samplers
+            pen::renderer_set_targets(v.render_targets, v.num_colour_targets, v.depth_target, a);
+            pen::renderer_set_viewport(vp);
+            pen::renderer_set_scissor_rect({vp.x, vp.y, vp.width, vp.height});
+            pen::renderer_clear(v.clear_state, a);
 
-                    pen::renderer_set_texture(sb.handle, sb.sampler_state, sb.sampler_unit, sb.bind_flags);
-                }
+            // bind view samplers.. render targets, global textures
+            for (auto& sb : v.sampler_bindings)
+            {
+                pen::renderer_set_texture(sb.handle, sb.sampler_state, sb.sampler_unit, sb.bind_flags);
+            }
 
-                // bind any per view cbuffers
-                u32 num_samplers = (u32)v.sampler_bindings.size();
-                if (num_samplers > 0)
-                {
-                    pen::renderer_update_buffer(cb_sampler_info, v.sampler_info, num_samplers * sizeof(vec4f));
-                    pen::renderer_set_constant_buffer(cb_sampler_info, e_cbuffer_location::sampler_info,
-                                                      pen::CBUFFER_BIND_PS);
-                }
+            // bind technique samplers
+            for (u32 i = 0; i < e_pmfx_constants::max_technique_sampler_bindings; ++i)
+            {
+                auto& sb = v.technique_samplers.sb[i];
+                if (sb.handle == 0)
+                    continue;
 
-                // filters
-                if (is_valid(v.cbuffer_filter))
-                    pen::renderer_set_constant_buffer(v.cbuffer_filter, e_cbuffer_location::filter_kernel,
-                                                      pen::CBUFFER_BIND_PS);
+                pen::renderer_set_texture(sb.handle, sb.sampler_state, sb.sampler_unit, sb.bind_flags);
+            }
 
-                // technique cbuffer
-                if (is_valid(v.cbuffer_technique))
-                {
-                    pen::renderer_update_buffer(v.cbuffer_technique, v.technique_constants.data,
-                                                sizeof(technique_constant_data));
-                    pen::renderer_set_constant_buffer(v.cbuffer_technique, e_cbuffer_location::material_constants,
-                                                      pen::CBUFFER_BIND_PS);
-                }
+            // bind any per view cbuffers
+            u32 num_samplers = (u32)v.sampler_bindings.size();
+            if (num_samplers > 0)
+            {
+                pen::renderer_update_buffer(s_cb_sampler_info, v.sampler_info, num_samplers * sizeof(vec4f));
+                pen::renderer_set_constant_buffer(s_cb_sampler_info, e_cbuffer_location::sampler_info,
+                                                  pen::CBUFFER_BIND_PS);
+            }
 
-                // generic buffer for post process shaders
-                if (v.post_process_flags & e_pp_flags::bind_info)
-                {
-                    post_process::pp_info pp_info;
-                    pp_info.frame_jitter.xy = halton(pen::_renderer_frame_index());
-                    pen::renderer_update_buffer(cb_pp_info, &pp_info, sizeof(pp_info));
-                    pen::renderer_set_constant_buffer(cb_pp_info, e_cbuffer_location::post_process_info,
-                                                      pen::CBUFFER_BIND_PS);
-                }
+            // filters
+            if (is_valid(v.cbuffer_filter))
+                pen::renderer_set_constant_buffer(v.cbuffer_filter, e_cbuffer_location::filter_kernel, pen::CBUFFER_BIND_PS);
 
-                // call render functions and make draw calls
-                for (s32 rf = 0; rf < v.render_functions.size(); ++rf)
-                    v.render_functions[rf](sv);
+            // technique cbuffer
+            if (is_valid(v.cbuffer_technique))
+            {
+                pen::renderer_update_buffer(v.cbuffer_technique, v.technique_constants.data, sizeof(technique_constant_data));
+                pen::renderer_set_constant_buffer(v.cbuffer_technique, e_cbuffer_location::material_constants,
+                                                  pen::CBUFFER_BIND_PS);
             }
 
+            // generic buffer for post process shaders
+            if (v.post_process_flags & e_pp_flags::bind_info)
+            {
+                post_process::pp_info pp_info;
+                pp_info.frame_jitter.xy = halton(pen::_renderer_frame_index());
+                pen::renderer_update_buffer(s_cb_pp_info, &pp_info, sizeof(pp_info));
+                pen::renderer_set_constant_buffer(s_cb_pp_info, e_cbuffer_location::post_process_info,
+                                                  pen::CBUFFER_BIND_PS);
+            }
+
+            // call render functions and make draw calls
+            for (s32 rf = 0; rf < v.render_functions.size(); ++rf)
+                v.render_functions[rf](sv);
+        }
+
+        void end_view(view_params& v, const view_pass& pass)
+        {
             if (v.view_flags & (e_view_flags::resolve | e_view_flags::generate_mips))
                 resolve_view_targets(v);
 
             // for debug
-            stash_output(v, vp);
+            stash_output(v, pass.vp);
+        }
+
+        void render_view(view_params& v)
+        {
+            // compute doesnt need render pipeline setup
+            if (v.view_flags & e_view_flags::compute)
+            {
+                scene_view sv;
+                sv.scene = v.scene;
+                sv.render_flags = v.render_flags;
+                sv.id_technique = v.id_technique;
+                sv.camera = v.camera;
+                sv.pmfx_shader = v.pmfx_shader;
+                sv.permutation = v.technique_permutation;
+
+                // faster clear for d3d uav
+                pen::renderer_clear_texture(v.clear_state, v.render_targets[0]);
+
+                for (s32 rf = 0; rf < v.render_functions.size(); ++rf)
+                    v.render_functions[rf](sv);
+
+                if (v.view_flags & (e_view_flags::resolve | e_view_flags::generate_mips))
+                    resolve_view_targets(v);
+
+                return;
+            }
+
+            view_pass pass;
+            if (!begin_view(v, pass))
+                return;
+
+            // render passes.. multi pass for cubemaps or arrays
+            camera* cam = v.camera ? v.camera : &s_ortho_camera;
+            for (u32 a = 0; a < v.num_arrays; ++a)
+            {
+                set_slice_camera(v, pass, a, cam);
+                render_view_slice(v, pass, a, cam);
+            }
+
+            end_view(v, pass);
         }
 
         void render_view(hash_id view)
@@ -3076,15 +3134,231 @@ namespace put
             }
         }
 
+        // collects the cameras of every scene view this frame, including array slices and cubemap faces, and culls
+        // them all on the job system before any commands are recorded
+        void cull_views()
+        {
+            const pen::renderer_info& ri = pen::renderer_get_info();
+
+            for (auto& v : s_views)
+            {
+                if (v.view_flags & (e_view_flags::template_view | e_view_flags::abstract | e_view_flags::compute))
+                    continue;
+
+                if (!v.scene || v.cull_functions.empty())
+                    continue;
+
+                // same exclusions as render_view
+                if (v.view_flags & e_view_flags::cubemap_array)
+                    if (!(ri.caps & PEN_CAPS_TEXTURE_CUBE_ARRAY))
+                        continue;
+
+                if (v.num_colour_targets == 0 && v.depth_target == PEN_INVALID_HANDLE)
+                    continue;
+
+                scene_view sv;
+                sv.scene = v.scene;
+                sv.render_flags = v.render_flags;
+                sv.camera = v.camera;
+                sv.num_arrays = v.num_arrays;
+
+                for (u32 a = 0; a < v.num_arrays; ++a)
+                {
+                    sv.array_index = a;
+
+                    // cull with a copy set up the way render_view will set up the camera, so the view camera is not
+                    // changed between culling and rendering and the cull keys match
+                    camera cam;
+                    if (v.camera)
+                    {
+                        cam = *v.camera;
+
+                        if (v.view_flags & e_view_flags::cubemap)
+                            put::camera_set_cubemap_face(&cam, a);
+
+                        if (cam.flags & e_camera_flags::window_aspect)
+                        {
+                            f32 cur_aspect = pen::window_get_aspect();
+                            if (cur_aspect != cam.aspect)
+                            {
+                                cam.aspect = cur_aspect;
+                                put::camera_update_projection_matrix(&cam);
+                            }
+                        }
+
+                        put::camera_update_frustum(&cam);
+                        sv.camera = &cam;
+                    }
+
+                    for (auto& cf : v.cull_functions)
+                        cf(sv);
+                }
+            }
+
+            for (auto& rs : s_scenes)
+                ecs::cull_views(rs.scene);
+        }
+
+        void enable_parallel_recording(bool enable)
+        {
+            s_parallel_recording = enable;
+        }
+
+        // an array slice recorded on a job thread with its own copy of the camera
+        struct view_slice
+        {
+            view_params*     v;
+            const view_pass* pass;
+            u32              array_index;
+            camera           cam;
+            pen::cmd_list    list;
+        };
+
+        pen::cmd_list get_cmd_list(u32 index)
+        {
+            while (sb_count(s_cmd_lists) <= index)
+                sb_push(s_cmd_lists, pen::renderer_create_cmd_list());
+
+            return s_cmd_lists[index];
+        }
+
+        // records the slices of thread safe views on the job system. each view is stitched back as its setup, its slices
+        // in array order and then its resolve, so the render thread receives the same commands as render_view would give
+        void render_views_parallel(std::vector<view_params*>& views)
+        {
+            u32 num_views = (u32)views.size();
+            if (num_views == 0)
+                return;
+
+            // nothing to gain from a list
+            if (num_views == 1 && views[0]->num_arrays == 1)
+            {
+                render_view(*views[0]);
+                views.clear();
+                return;
+            }
+
+            static std::vector<view_pass>     passes;
+            static std::vector<view_slice>    slices;
+            static std::vector<pen::cmd_list> order;
+            static std::vector<pen::cmd_list> end_lists;
+            passes.resize(num_views);
+            end_lists.resize(num_views);
+            slices.clear();
+            order.clear();
+
+            // view setup and the cameras of each slice, in view order so views sharing a camera see it as they would
+            // when rendered in turn
+            u32 num_lists = 0;
+            for (u32 i = 0; i < num_views; ++i)
+            {
+                view_params& v = *views[i];
+                view_pass&   pass = passes[i];
+                camera*      base = v.camera ? v.camera : &s_ortho_camera;
+
+                pen::cmd_list begin_list = get_cmd_list(num_lists++);
+                order.push_back(begin_list);
+
+                pen::renderer_begin_cmd_list(begin_list);
+                bool active = begin_view(v, pass);
+
+                // slice cameras share the cbuffer of the camera they are copied from
+                if (active && !is_valid(base->cbuffer))
+                    put::camera_update_shader_constants(base);
+
+                pen::renderer_end_cmd_list();
+
+                end_lists[i] = nullptr;
+                if (!active)
+                    continue;
+
+                for (u32 a = 0; a < v.num_arrays; ++a)
+                {
+                    view_slice vs;
+                    vs.v = &v;
+                    vs.pass = &pass;
+                    vs.array_index = a;
+                    vs.cam = *base;
+                    vs.list = get_cmd_list(num_lists++);
+                    set_slice_camera(v, pass, a, &vs.cam);
+
+                    slices.push_back(vs);
+                    order.push_back(vs.list);
+                }
+
+                // jitter is cleared when the slice updates its constants
+                *base = slices.back().cam;
+                base->flags &= ~e_camera_flags::apply_jitter;
+
+                end_lists[i] = get_cmd_list(num_lists++);
+                order.push_back(end_lists[i]);
+            }
+
+            u32 num_slices = (u32)slices.size();
+            pen::parallel_for(0, num_slices, 1, [&](u32 begin, u32 end) {
+                for (u32 i = begin; i < end; ++i)
+                {
+                    view_slice& vs = slices[i];
+                    pen::renderer_begin_cmd_list(vs.list);
+                    render_view_slice(*vs.v, *vs.pass, vs.array_index, &vs.cam);
+                    pen::renderer_end_cmd_list();
+                }
+            });
+
+            // leave cameras as the last slice which rendered with them
+            for (auto& vs : slices)
+            {
+                if (vs.v->camera)
+                    *vs.v->camera = vs.cam;
+                else
+                    s_ortho_camera = vs.cam;
+            }
+
+            for (u32 i = 0; i < num_views; ++i)
+            {
+                if (!end_lists[i])
+                    continue;
+
+                pen::renderer_begin_cmd_list(end_lists[i]);
+                end_view(*views[i], passes[i]);
+                pen::renderer_end_cmd_list();
+            }
+
+            pen::renderer_submit_cmd_lists(order.data(), (u32)order.size());
+            views.clear();
+        }
+
         void render()
         {
             reload();
+            cull_views();
+
+            // runs of thread safe views are recorded together, other views are rendered in turn between them
+            static std::vector<view_params*> parallel_views;
+            parallel_views.clear();
 
             for (auto& v : s_views)
             {
                 if (v.view_flags & e_view_flags::template_view)
                     continue;
 
+                u32 serial_flags = e_view_flags::abstract | e_view_flags::compute;
+                if (s_parallel_recording && v.thread_safe && !(v.view_flags & serial_flags))
+                {
+                    parallel_views.push_back(&v);
+
+                    // post processing reads the views output
+                    if (v.post_process_flags & e_pp_flags::enabled)
+                    {
+                        render_views_parallel(parallel_views);
+                        render_post_process(v);
+                    }
+
+                    continue;
+                }
+
+                render_views_parallel(parallel_views);
+
                 if (v.view_flags & e_view_flags::abstract)
                 {
                     render_abstract_view(v);
@@ -3097,6 +3371,8 @@ namespace put
                         render_post_process(v);
                 }
             }
+
+            render_views_parallel(parallel_views);
         }
 
         void render_target_info_ui(const render_target& rt)
@@ -2,6 +2,7 @@
 // Copyright 2014 - 2023 Alex Dixon.
 // License: https://github.com/polymonster/pmtech/blob/master/license.md
 
+#include <atomic>
 #include <vector>
 
 #include "dev_ui.h"
@@ -20,6 +21,7 @@
 #include "pen_json.h"
 #include "pen_string.h"
 #include "renderer.h"
+#include "threads.h"
 
 using namespace put;
 using namespace pmfx;
@@ -582,12 +584,29 @@ namespace put
 
         void lazy_load_shader_technique(shader_program& t, u32 shader)
         {
-            auto& s = s_pmfx_list[shader];
+            if (t.loaded)
+            {
+                std::atomic_thread_fence(std::memory_order_acquire);
+                return;
+            }
+
+            // views recorded into command lists on job threads can be the first to use a technique, loaded is set
+            // only once the rest of the technique is written
+            static pen::mutex* s_load_mutex = pen::mutex_create();
+            pen::mutex_lock(s_load_mutex);
+
             if (!t.loaded)
             {
-                t = load_shader_technique(s.filename.c_str(), t.info, s.info);
+                auto&          s = s_pmfx_list[shader];
+                shader_program loaded = load_shader_technique(s.filename.c_str(), t.info, s.info);
+                loaded.loaded = false;
+                t = loaded;
+
+                std::atomic_thread_fence(std::memory_order_release);
                 t.loaded = true;
             }
+
+            pen::mutex_unlock(s_load_mutex);
         }
 
         void initialise_constant_defaults(u32 shader, u32 technique_index, f32* data)
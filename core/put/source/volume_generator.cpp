@@ -20,6 +20,7 @@
 #include "hash.h"
 #include "memory.h"
 #include "pen.h"
+#include "threads.h"
 
 #include "sdf_gen/makelevelset3.h"
 
@@ -292,46 +293,49 @@ namespace put
 
             rasteriser_job->combine_position = 0;
 
-            for (u32 z = 0; z < volume_dim; ++z)
-            {
-                if (g_cancel_volume_job)
-                    break;
-
-                u8* slice_mem[6] = {0};
-                for (u32 a = 0; a < 6; ++a)
+            // slices are independent so the combine is split across the task pool, this thread joins in
+            pen::parallel_for(0, volume_dim, 1, [&](u32 begin, u32 end) {
+                for (u32 z = begin; z < end; ++z)
                 {
-                    slice_mem[a] = (u8*)volume_slices[a][z];
-                }
+                    if (g_cancel_volume_job)
+                        break;
 
-                for (u32 y = 0; y < volume_dim; ++y)
-                {
-                    for (u32 x = 0; x < volume_dim; ++x)
+                    u8* slice_mem[6] = {0};
+                    for (u32 a = 0; a < 6; ++a)
                     {
-                        rasteriser_job->combine_position++;
-
-                        u32 offset = z * slice_pitch + y * row_pitch + x * rasteriser_job->block_size;
+                        slice_mem[a] = (u8*)volume_slices[a][z];
+                    }
 
-                        u8 rgba[4] = {0};
+                    for (u32 y = 0; y < volume_dim; ++y)
+                    {
+                        rasteriser_job->combine_position += volume_dim;
 
-                        for (u32 a = 0; a < 6; ++a)
+                        for (u32 x = 0; x < volume_dim; ++x)
                         {
-                            u8* tex = get_texel(a, x, y, z);
+                            u32 offset = z * slice_pitch + y * row_pitch + x * rasteriser_job->block_size;
 
-                            if (!tex)
-                                continue;
+                            u8 rgba[4] = {0};
 
-                            if (tex[3] > 8)
-                                for (u32 p = 0; p < 4; ++p)
-                                    rgba[p] = tex[p];
-                        }
+                            for (u32 a = 0; a < 6; ++a)
+                            {
+                                u8* tex = get_texel(a, x, y, z);
+
+                                if (!tex)
+                                    continue;
+
+                                if (tex[3] > 8)
+                                    for (u32 p = 0; p < 4; ++p)
+                                        rgba[p] = tex[p];
+                            }
 
-                        volume_data[offset + 0] = rgba[2];
-                        volume_data[offset + 1] = rgba[1];
-                        volume_data[offset + 2] = rgba[0];
-                        volume_data[offset + 3] = rgba[3];
+                            volume_data[offset + 0] = rgba[2];
+                            volume_data[offset + 1] = rgba[1];
+                            volume_data[offset + 2] = rgba[0];
+                            volume_data[offset + 3] = rgba[3];
+                        }
                     }
                 }
-            }
+            });
 
             if (g_cancel_volume_job)
             {
@@ -270,7 +270,7 @@ void example_update(ecs::ecs_scene* scene, camera& cam, f32 dt)
 {
     // debug draw shape
     physics::collision_mesh_data& convex_cmd = scene->physics_data[convex].rigid_body.mesh_data;
-    mat4&                         convex_mat = scene->world_matrices[convex];
+    const mat3x4&                 convex_mat = scene->world_matrices[convex];
 
     for (u32 i = 0; i < convex_cmd.num_floats; i += 9)
     {
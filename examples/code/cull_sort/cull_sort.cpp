@@ -1,4 +1,7 @@
 #include "../example_common.h"
+#include "ecs/ecs_cull.h"
+#include "ecs/ecs_light_clusters.h"
+#include "ecs/ecs_simd.h"
 
 using namespace put;
 using namespace ecs;
@@ -13,7 +16,10 @@ namespace pen
         p.window_title = "cull_sort";
         p.window_sample_count = 4;
         p.user_thread_function = user_setup;
-        p.max_renderer_commands = 1 << 22;
+
+        // the command stream is sized by the average packed command (32 bytes), 32MB holds several frames of this
+        // scene. with fixed size commands it needed 1 << 22 entries of the largest command
+        p.max_renderer_commands = 1 << 20;
         p.flags = pen::e_pen_create_flags::renderer;
         return p;
     }
@@ -78,6 +84,701 @@ void example_setup(ecs::ecs_scene* scene, camera& cam)
     }
 }
 
+namespace
+{
+    struct kernel_timings
+    {
+        simd_flags level;
+        f64        bake_ms;
+        f64        bounds_ms;
+        f32        bake_error;   // max abs difference to the matrix multiply path
+        f32        bounds_error; // max abs difference to the scalar kernel
+        f64        cull_aabb_ms;
+        f64        cull_sphere_ms;
+        u32        aabb_mismatches;
+        u32        sphere_mismatches;
+    };
+
+    struct cluster_timings
+    {
+        simd_flags level;
+        u32        lights;
+        u32        indices;
+        f64        build_ms;
+    };
+
+    static const u32 k_benchmark_iterations = 16;
+    kernel_timings*  s_kernel_timings = nullptr;
+    f64              s_matrix_multiply_ms = 0.0;
+    f64              s_linear_cull_ms = 0.0;
+    f64              s_bvh_cull_ms = 0.0;
+    u32              s_bvh_mismatches = 0;
+    bool             s_bvh_benchmarked = false;
+    cluster_timings* s_cluster_timings = nullptr;
+    f64              s_query_update_ms = 0.0;
+    f64              s_query_rebuild_ms = 0.0;
+    bool             s_queries_benchmarked = false;
+    u32              s_occluder_wall = PEN_INVALID_HANDLE;
+
+    // entities which differ from the scalar reference, or the count difference if the lists have different lengths
+    u32 count_mismatches(const u32* a, const u32* b)
+    {
+        u32 ca = sb_count(a);
+        u32 cb = sb_count(b);
+        if (ca != cb)
+            return ca > cb ? ca - cb : cb - ca;
+
+        u32 mismatches = 0;
+        for (u32 i = 0; i < ca; ++i)
+            if (a[i] != b[i])
+                ++mismatches;
+
+        return mismatches;
+    }
+
+    // keeps the largest abs difference in err, infinite values which match are not an error
+    void accumulate_error(f32& err, f32 a, f32 b)
+    {
+        if (a != b && fabs(a - b) > err)
+            err = fabs(a - b);
+    }
+
+    f32 max_local_matrix_error(const ecs::ecs_scene* scene, const u32* entities, u32 count, const mat3x4* reference)
+    {
+        f32 err = 0.0f;
+        for (u32 i = 0; i < count; ++i)
+            for (u32 j = 0; j < 12; ++j)
+                accumulate_error(err, scene->local_matrices[entities[i]].m[j], reference[i].m[j]);
+
+        return err;
+    }
+
+    f32 max_bounds_error(const ecs::ecs_scene* scene, const u32* entities, u32 count, const cmp_pos_extent* reference)
+    {
+        f32 err = 0.0f;
+        for (u32 i = 0; i < count; ++i)
+        {
+            const cmp_pos_extent& pe = scene->pos_extent[entities[i]];
+            const cmp_pos_extent& ref = reference[i];
+            accumulate_error(err, pe.pos.x, ref.pos.x);
+            accumulate_error(err, pe.pos.y, ref.pos.y);
+            accumulate_error(err, pe.pos.z, ref.pos.z);
+            accumulate_error(err, pe.extent.x, ref.extent.x);
+            accumulate_error(err, pe.extent.y, ref.extent.y);
+            accumulate_error(err, pe.extent.z, ref.extent.z);
+            accumulate_error(err, pe.extent.w, ref.extent.w);
+        }
+
+        return err;
+    }
+
+    // times the batch kernels at each simd level against matrix multiplies, over every entity in the scene. baked
+    // matrices are checked against the matrix multiply path, which also catches a wrong quaternion convention, bounds and
+    // culling results are checked against the scalar version
+    void benchmark_simd_kernels(ecs::ecs_scene* scene, const camera* cam)
+    {
+        u32* entities = nullptr;
+        for (u32 n = 0; n < scene->num_entities; ++n)
+            if (!(scene->entities[n] & e_cmp::physics))
+                sb_push(entities, n);
+
+        u32         count = sb_count(entities);
+        pen::timer* t = pen::timer_create();
+
+        pen::timer_start(t);
+        for (u32 i = 0; i < k_benchmark_iterations; ++i)
+        {
+            for (u32 j = 0; j < count; ++j)
+            {
+                cmp_transform& tc = scene->transforms[entities[j]];
+
+                mat4 rot_mat;
+                tc.rotation.get_matrix(rot_mat);
+                scene->local_matrices[entities[j]] =
+                    mat3x4(mat::create_translation(tc.translation) * rot_mat * mat::create_scale(tc.scale));
+            }
+        }
+        s_matrix_multiply_ms = pen::timer_elapsed_ms(t) / k_benchmark_iterations;
+
+        mat3x4*         reference_local = nullptr;
+        cmp_pos_extent* reference_bounds = nullptr;
+        for (u32 j = 0; j < count; ++j)
+            sb_push(reference_local, scene->local_matrices[entities[j]]);
+
+        transform_bounds_scalar(scene, entities, count);
+        for (u32 j = 0; j < count; ++j)
+            sb_push(reference_bounds, scene->pos_extent[entities[j]]);
+
+        u32* filtered = nullptr;
+        u32* reference_aabb = nullptr;
+        u32* reference_sphere = nullptr;
+        filter_entities_scalar(scene, &filtered);
+        frustum_cull_aabb_scalar(scene, cam, filtered, &reference_aabb);
+        frustum_cull_sphere_scalar(scene, cam, filtered, &reference_sphere);
+
+        simd_flags levels[] = {e_simd::scalar, e_simd::sse2, e_simd::sse2 | e_simd::avx | e_simd::avx2, e_simd::neon};
+        simd_flags prev_level = simd_get_level();
+        simd_flags supported = simd_supported();
+
+        sb_free(s_kernel_timings);
+        s_kernel_timings = nullptr;
+
+        for (u32 l = 0; l < PEN_ARRAY_SIZE(levels); ++l)
+        {
+            if ((levels[l] & supported) != levels[l])
+                continue;
+
+            simd_set_level(levels[l]);
+
+            kernel_timings kt;
+            kt.level = levels[l];
+
+            pen::timer_start(t);
+            for (u32 i = 0; i < k_benchmark_iterations; ++i)
+                bake_local_matrices(scene, entities, count);
+            kt.bake_ms = pen::timer_elapsed_ms(t) / k_benchmark_iterations;
+            kt.bake_error = max_local_matrix_error(scene, entities, count, reference_local);
+
+            pen::timer_start(t);
+            for (u32 i = 0; i < k_benchmark_iterations; ++i)
+                transform_bounds(scene, entities, count);
+            kt.bounds_ms = pen::timer_elapsed_ms(t) / k_benchmark_iterations;
+            kt.bounds_error = max_bounds_error(scene, entities, count, reference_bounds);
+
+            u32* culled = nullptr;
+            pen::timer_start(t);
+            for (u32 i = 0; i < k_benchmark_iterations; ++i)
+            {
+                sb_clear(culled);
+                frustum_cull_aabb(scene, cam, filtered, &culled);
+            }
+            kt.cull_aabb_ms = pen::timer_elapsed_ms(t) / k_benchmark_iterations;
+            kt.aabb_mismatches = count_mismatches(culled, reference_aabb);
+
+            pen::timer_start(t);
+            for (u32 i = 0; i < k_benchmark_iterations; ++i)
+            {
+                sb_clear(culled);
+                frustum_cull_sphere(scene, cam, filtered, &culled);
+            }
+            kt.cull_sphere_ms = pen::timer_elapsed_ms(t) / k_benchmark_iterations;
+            kt.sphere_mismatches = count_mismatches(culled, reference_sphere);
+            sb_free(culled);
+
+            sb_push(s_kernel_timings, kt);
+        }
+
+        simd_set_level(prev_level);
+        pen::timer_destroy(t);
+        sb_free(entities);
+        sb_free(filtered);
+        sb_free(reference_aabb);
+        sb_free(reference_sphere);
+        sb_free(reference_local);
+        sb_free(reference_bounds);
+    }
+
+    // each feature is shown in its own auto sized window
+    void begin_window(const c8* name)
+    {
+        ImGui::Begin(name, nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+    }
+
+    // checkbox which sets or clears a scene flag, inverted for flags which disable a feature. returns if the feature
+    // is enabled
+    bool scene_flag_checkbox(ecs::ecs_scene* scene, const c8* label, scene_flags flag, bool inverted = false)
+    {
+        bool enabled = (scene->flags & flag) ? !inverted : inverted;
+        if (ImGui::Checkbox(label, &enabled))
+        {
+            if (enabled != inverted)
+                scene->flags |= flag;
+            else
+                scene->flags &= ~flag;
+        }
+
+        return enabled;
+    }
+
+    // wall through the middle of the spheres, drawn into the cpu occlusion buffer. it is only in the scene while
+    // occlusion culling is enabled so it does not hide spheres otherwise
+    void set_occluder_wall(ecs::ecs_scene* scene, bool enabled)
+    {
+        if (enabled == is_valid(s_occluder_wall))
+            return;
+
+        wait_for_update(scene);
+
+        if (!enabled)
+        {
+            delete_entity(scene, s_occluder_wall);
+            initialise_free_list(scene);
+            scene->flags |= e_scene_flags::invalidate_scene_tree;
+            s_occluder_wall = PEN_INVALID_HANDLE;
+            return;
+        }
+
+        // sized to the sphere field of example_setup
+        f32 num_spheres = 32.0f;
+        f32 d = 10.0f;
+
+        material_resource* default_material = get_material_resource(PEN_HASH("default_material"));
+        geometry_resource* cube_resource = get_geometry_resource(PEN_HASH("cube"));
+
+        u32 wall = get_new_entity(scene);
+        scene->names[wall] = "occluder_wall";
+        scene->transforms[wall].rotation = quat();
+        scene->transforms[wall].scale = vec3f(d * num_spheres * 0.5f, d * num_spheres * 0.5f, 1.0f);
+        scene->transforms[wall].translation = vec3f(-d * 0.5f);
+        scene->parents[wall] = wall;
+        scene->entities[wall] |= e_cmp::transform;
+        scene->state_flags[wall] |= e_state::occluder;
+
+        instantiate_geometry(cube_resource, scene, wall);
+        instantiate_material(default_material, scene, wall);
+        instantiate_model_cbuffer(scene, wall);
+
+        s_occluder_wall = wall;
+    }
+
+    // random position within the sphere field
+    vec3f random_field_pos()
+    {
+        f32 extent = 165.0f;
+        return vec3f((f32)(rand() % 1000) / 500.0f - 1.0f, (f32)(rand() % 1000) / 500.0f - 1.0f,
+                     (f32)(rand() % 1000) / 500.0f - 1.0f) *
+               extent;
+    }
+
+    // adds point and spot light entities scattered through the sphere field, without shadows. the new entities are
+    // pushed to created if it is not null
+    void add_cluster_lights(ecs::ecs_scene* scene, u32 count, u32** created = nullptr)
+    {
+        wait_for_update(scene);
+
+        for (u32 i = 0; i < count; ++i)
+        {
+            u32 light = get_new_entity(scene);
+            if (created)
+                sb_push(*created, light);
+
+            instantiate_light(scene, light);
+            scene->names[light] = i % 2 ? "cluster_spot_light" : "cluster_point_light";
+            scene->lights[light].colour = vec3f((f32)(rand() % 255), (f32)(rand() % 255), (f32)(rand() % 255)) / 255.0f;
+            scene->lights[light].radius = 5.0f + (f32)(rand() % 10);
+            scene->lights[light].type = i % 2 ? e_light_type::spot : e_light_type::point;
+            scene->lights[light].cos_cutoff = 0.3f;
+            scene->lights[light].spot_falloff = 0.2f;
+            scene->transforms[light].translation = random_field_pos();
+            scene->transforms[light].rotation = quat((f32)(rand() % 360), 0.0f, (f32)(rand() % 360));
+            scene->transforms[light].scale = vec3f::one();
+            scene->entities[light] |= e_cmp::light;
+            scene->entities[light] |= e_cmp::transform;
+        }
+    }
+
+    // bins increasing numbers of synthetic point and spot lights into the clusters of the main camera at each simd
+    // level, timings include the parallel transform and binning of slices
+    void benchmark_light_clusters(const camera* cam)
+    {
+        u32        counts[] = {1000, 10000, 50000};
+        simd_flags levels[] = {e_simd::scalar, e_simd::sse2};
+        simd_flags prev_level = simd_get_level();
+        simd_flags supported = simd_supported();
+
+        sb_free(s_cluster_timings);
+        s_cluster_timings = nullptr;
+
+        light_clusters lc;
+        for (u32 c = 0; c < PEN_ARRAY_SIZE(counts); ++c)
+        {
+            srand(c);
+            sb_reset(lc.lights);
+            for (u32 i = 0; i < counts[c]; ++i)
+            {
+                light_data ld = {};
+                ld.pos_radius = vec4f(random_field_pos(), 5.0f + (f32)(rand() % 10));
+                ld.colour = vec4f::one();
+
+                if (i % 2)
+                {
+                    vec3f dir = normalize(random_field_pos());
+                    ld.dir_cutoff = vec4f(dir, 0.3f);
+                    ld.data = vec4f(0.2f, 0.0f, 1.0f, 0.0f); // data.z = 1 spot
+                }
+
+                sb_push(lc.lights, ld);
+            }
+
+            for (u32 l = 0; l < PEN_ARRAY_SIZE(levels); ++l)
+            {
+                if ((levels[l] & supported) != levels[l])
+                    continue;
+
+                simd_set_level(levels[l]);
+
+                cluster_timings ct;
+                ct.level = levels[l];
+                ct.lights = counts[c];
+                ct.build_ms = 0.0;
+                for (u32 i = 0; i < k_benchmark_iterations; ++i)
+                {
+                    build_light_clusters(lc, cam);
+                    ct.build_ms += lc.build_ms;
+                }
+                ct.build_ms /= k_benchmark_iterations;
+                ct.indices = sb_count(lc.indices);
+
+                PEN_LOG("light clusters %s: %u lights, %u indices, %2.3f ms\n", simd_level_name(ct.level), ct.lights,
+                        ct.indices, ct.build_ms);
+
+                sb_push(s_cluster_timings, ct);
+            }
+        }
+
+        simd_set_level(prev_level);
+        free_light_clusters(lc);
+    }
+
+    // adds static sphere meshes scattered through the sphere field, the new entities are pushed to created
+    void add_static_meshes(ecs::ecs_scene* scene, u32 count, u32** created)
+    {
+        material_resource* default_material = get_material_resource(PEN_HASH("default_material"));
+        geometry_resource* sphere_resource = get_geometry_resource(PEN_HASH("sphere"));
+
+        for (u32 i = 0; i < count; ++i)
+        {
+            u32 s = get_new_entity(scene);
+            sb_push(*created, s);
+
+            scene->transforms[s].rotation = quat();
+            scene->transforms[s].scale = vec3f::one();
+            scene->transforms[s].translation = random_field_pos();
+            scene->parents[s] = s;
+            scene->entities[s] |= e_cmp::transform;
+
+            instantiate_geometry(sphere_resource, scene, s);
+            instantiate_material(default_material, scene, s);
+            instantiate_model_cbuffer(scene, s);
+        }
+    }
+
+    // update cost of a scene with 100k static meshes and 50 lights, with queries kept up to date from flag changes
+    // and with every query filtering the whole scene each update as systems used to. the entities added to reach those
+    // counts are deleted again afterwards
+    void benchmark_entity_queries(ecs::ecs_scene* scene)
+    {
+        wait_for_update(scene);
+
+        u32* created = nullptr;
+        u32  num_meshes = sb_count(scene->renderables.entities);
+        if (num_meshes < 100000)
+            add_static_meshes(scene, 100000 - num_meshes, &created);
+
+        u32 num_lights = sb_count(get_entity_query(scene, e_query::light).entities);
+        if (num_lights < 50)
+            add_cluster_lights(scene, 50 - num_lights, &created);
+
+        // settle new entities so both runs only measure static updates
+        update_scene(scene, 0.0f);
+
+        scene_flags prev_flags = scene->flags;
+        pen::timer* t = pen::timer_create();
+
+        scene->flags &= ~e_scene_flags::rebuild_entity_queries;
+        pen::timer_start(t);
+        for (u32 i = 0; i < k_benchmark_iterations; ++i)
+            update_scene(scene, 0.0f);
+        s_query_update_ms = pen::timer_elapsed_ms(t) / k_benchmark_iterations;
+
+        scene->flags |= e_scene_flags::rebuild_entity_queries;
+        pen::timer_start(t);
+        for (u32 i = 0; i < k_benchmark_iterations; ++i)
+            update_scene(scene, 0.0f);
+        s_query_rebuild_ms = pen::timer_elapsed_ms(t) / k_benchmark_iterations;
+
+        scene->flags = prev_flags;
+        s_queries_benchmarked = true;
+
+        PEN_LOG("entity queries: %u entities, update %2.3f ms, rebuilding queries %2.3f ms\n", (u32)scene->num_entities,
+                s_query_update_ms, s_query_rebuild_ms);
+
+        wait_for_update(scene);
+        for (u32 i = 0; i < sb_count(created); ++i)
+            delete_entity(scene, created[i]);
+
+        initialise_free_list(scene);
+        trim_entities(scene);
+        scene->flags |= e_scene_flags::invalidate_scene_tree;
+
+        sb_free(created);
+        pen::timer_destroy(t);
+    }
+
+    // filter + linear cull against the bvh for the main camera, the bvh outputs in tree order so results are compared
+    // as sets
+    void benchmark_bvh_culling(ecs::ecs_scene* scene, const camera* cam)
+    {
+        pen::timer* t = pen::timer_create();
+
+        u32* linear = nullptr;
+        pen::timer_start(t);
+        for (u32 i = 0; i < k_benchmark_iterations; ++i)
+        {
+            u32* filtered = nullptr;
+            sb_clear(linear);
+            filter_entities_scalar(scene, &filtered);
+            frustum_cull_aabb(scene, cam, filtered, &linear);
+            sb_free(filtered);
+        }
+        s_linear_cull_ms = pen::timer_elapsed_ms(t) / k_benchmark_iterations;
+
+        u32* bvh = nullptr;
+        pen::timer_start(t);
+        for (u32 i = 0; i < k_benchmark_iterations; ++i)
+        {
+            sb_clear(bvh);
+            frustum_cull_bvh(scene, cam, &bvh);
+        }
+        s_bvh_cull_ms = pen::timer_elapsed_ms(t) / k_benchmark_iterations;
+
+        u8* visible = (u8*)pen::memory_calloc(scene->num_entities, 1);
+        for (u32 i = 0; i < sb_count(linear); ++i)
+            visible[linear[i]] |= 1;
+        for (u32 i = 0; i < sb_count(bvh); ++i)
+            visible[bvh[i]] |= 2;
+
+        s_bvh_mismatches = 0;
+        for (u32 n = 0; n < scene->num_entities; ++n)
+            if (visible[n] == 1 || visible[n] == 2)
+                ++s_bvh_mismatches;
+
+        s_bvh_benchmarked = true;
+
+        pen::memory_free(visible);
+        pen::timer_destroy(t);
+        sb_free(linear);
+        sb_free(bvh);
+    }
+} // namespace
+
 void example_update(ecs::ecs_scene* scene, camera& cam, f32 dt)
 {
+    // hierarchical culling through the bvh against filtering and culling every entity
+    begin_window("BVH Culling");
+
+    scene_flag_checkbox(scene, "Enabled", e_scene_flags::disable_bvh_culling, true);
+
+    const scene_bvh& bvh = scene->bvh;
+    ImGui::Text("Nodes: %u, Entities: %u, Rebuilds: %u", sb_count(bvh.nodes), sb_count(bvh.entities), bvh.rebuilds);
+    ImGui::Text("Refit Cost: %2.2f", bvh.build_cost > 0.0f ? bvh.cost / bvh.build_cost : 0.0f);
+
+    if (ImGui::Button("Benchmark##bvh"))
+        benchmark_bvh_culling(scene, &cam);
+
+    if (s_bvh_benchmarked)
+    {
+        ImGui::Separator();
+        ImGui::Text("Linear: %2.3f ms", s_linear_cull_ms);
+        ImGui::Text("BVH: %2.3f ms (%u mismatches)", s_bvh_cull_ms, s_bvh_mismatches);
+    }
+
+    ImGui::End();
+
+    // bytes written to the packed command stream against what the same commands would take as fixed size entries
+    begin_window("Command Stream");
+
+    pen::renderer_cmd_stats stream_stats;
+    pen::renderer_get_cmd_stats(stream_stats);
+
+    f32 pack_ratio = stream_stats.fixed_bytes ? (f32)stream_stats.packed_bytes / (f32)stream_stats.fixed_bytes : 0.0f;
+    ImGui::Text("Commands: %u", stream_stats.num_cmds);
+    ImGui::Text("Packed: %u KB", stream_stats.packed_bytes / 1024);
+    ImGui::Text("Fixed: %u KB (%2.1f%%)", stream_stats.fixed_bytes / 1024, pack_ratio * 100.0f);
+    ImGui::Text("Consume: %2.3f ms", stream_stats.consume_ms);
+
+    ImGui::End();
+
+    // entities behind the occluder wall are removed after frustum culling
+    begin_window("Occlusion Culling");
+
+    bool occlusion_culling = scene_flag_checkbox(scene, "Enabled", e_scene_flags::occlusion_culling);
+
+    set_occluder_wall(scene, occlusion_culling);
+
+    ImGui::Text("Occluded Entities: %u", scene->draw_stats.occluded_entities);
+    ImGui::Text("Inline Culls: %u", scene->draw_stats.inline_culls);
+
+    ImGui::End();
+
+    // single threaded cost of the per entity transform and culling kernels, compares instruction sets on the same data
+    begin_window("SIMD Kernels");
+
+    ImGui::Text("Active: %s", simd_level_name(simd_get_level()));
+    if (ImGui::Button("Benchmark"))
+        benchmark_simd_kernels(scene, &cam);
+
+    if (s_kernel_timings)
+    {
+        ImGui::Separator();
+        ImGui::Text("Matrix Multiply: %2.3f ms", s_matrix_multiply_ms);
+
+        for (u32 i = 0; i < sb_count(s_kernel_timings); ++i)
+        {
+            const kernel_timings& kt = s_kernel_timings[i];
+            ImGui::Text("%-8s bake: %2.3f ms (max error %g), bounds: %2.3f ms (max error %g)", simd_level_name(kt.level),
+                        kt.bake_ms, kt.bake_error, kt.bounds_ms, kt.bounds_error);
+            ImGui::Text("%-8s aabb: %2.3f ms (%u mismatches), sphere: %2.3f ms (%u mismatches)", "", kt.cull_aabb_ms,
+                        kt.aabb_mismatches, kt.cull_sphere_ms, kt.sphere_mismatches);
+        }
+    }
+
+    ImGui::End();
+
+    // point and spot lights binned per cluster instead of every light being shaded by every pixel
+    begin_window("Light Clusters");
+
+    scene_flag_checkbox(scene, "Enabled", e_scene_flags::clustered_lights);
+
+    if (!(pen::renderer_get_info().caps & PEN_CAPS_STRUCTURED_BUFFER))
+        ImGui::Text("Structured buffers are not supported by this renderer");
+
+    const light_clusters& lc = scene->clusters;
+    ImGui::Text("Lights: %u, Indices: %u", sb_count(lc.lights), sb_count(lc.indices));
+    ImGui::Text("Build: %2.3f ms", lc.build_ms);
+
+    if (ImGui::Button("Add Lights"))
+        add_cluster_lights(scene, 1024);
+
+    ImGui::SameLine();
+    if (ImGui::Button("Benchmark##clusters"))
+        benchmark_light_clusters(&cam);
+
+    if (s_cluster_timings)
+    {
+        ImGui::Separator();
+        for (u32 i = 0; i < sb_count(s_cluster_timings); ++i)
+        {
+            const cluster_timings& ct = s_cluster_timings[i];
+            ImGui::Text("%-8s %u lights: %2.3f ms (%u indices)", simd_level_name(ct.level), ct.lights, ct.build_ms,
+                        ct.indices);
+        }
+    }
+
+    ImGui::End();
+
+    // compare draw calls and frame time with automatic instancing on and off
+    begin_window("Auto Instancing");
+
+    scene_flag_checkbox(scene, "Enabled", e_scene_flags::disable_auto_instancing, true);
+
+    // single draws read per draw constants from one buffer instead of binding a cbuffer each
+    scene_flag_checkbox(scene, "Draw Buffer", e_scene_flags::disable_draw_buffer, true);
+
+    // views and array slices of thread safe views are recorded into command lists on the job system
+    static bool parallel_recording = true;
+    if (ImGui::Checkbox("Parallel Recording", &parallel_recording))
+        pmfx::enable_parallel_recording(parallel_recording);
+
+    f32 render_gpu = 0.0f;
+    f32 render_cpu = 0.0f;
+    pen::renderer_get_present_time(render_cpu, render_gpu);
+
+    pen::renderer_cmd_stats cmd_stats;
+    pen::renderer_get_cmd_stats(cmd_stats);
+
+    ImGui::Separator();
+    ImGui::Text("Draw Calls: %u", scene->draw_stats.draw_calls);
+    ImGui::Text("Instanced Entities: %u", scene->draw_stats.auto_instanced_entities);
+    ImGui::Text("Draw Buffer Entities: %u", scene->draw_stats.draw_buffer_entities);
+    ImGui::Text("Commands: %u", cmd_stats.num_cmds);
+
+    const transform_stats& ts = scene->update_stats;
+    f32                    dirty_ratio = ts.entities ? (f32)ts.dirty_transforms / (f32)ts.entities : 0.0f;
+    ImGui::Text("Dirty Transforms: %u / %u (%2.1f%%)", ts.dirty_transforms, ts.entities, dirty_ratio * 100.0f);
+    ImGui::Text("Cbuffer Updates: %u", ts.cbuffer_updates);
+    ImGui::Text("Draw Buffer Upload: %u KB", ts.draw_buffer_bytes / 1024);
+    ImGui::Text("Frame: %2.2f ms", dt * 1000.0f);
+    ImGui::Text("Render Thread: %2.2f ms", render_cpu);
+    ImGui::Text("GPU: %2.2f ms", render_gpu);
+
+    ImGui::End();
+
+    // systems iterate cached entity lists per component mask instead of testing the flags of every entity
+    begin_window("Entity Queries");
+
+    scene_flag_checkbox(scene, "Rebuild Each Update", e_scene_flags::rebuild_entity_queries);
+
+    static const c8* k_query_names[] = {"physics", "light", "sdf_shadow", "pre_skinned", "skinned", "anim_controller"};
+    for (u32 q = 0; q < e_query::COUNT; ++q)
+        ImGui::Text("%-16s %u", k_query_names[q], sb_count(get_entity_query(scene, q).entities));
+
+    ImGui::Text("Changed Entities: %u", scene->queries.changed);
+
+    if (ImGui::Button("Benchmark##queries"))
+        benchmark_entity_queries(scene);
+
+    if (s_queries_benchmarked)
+    {
+        ImGui::Separator();
+        ImGui::Text("Update: %2.3f ms", s_query_update_ms);
+        ImGui::Text("Update Rebuilding Queries: %2.3f ms", s_query_rebuild_ms);
+    }
+
+    ImGui::End();
+
+    // controllers and extensions which declare their component access run concurrently
+    begin_window("Systems");
+
+    scene_flag_checkbox(scene, "Validate Access", e_scene_flags::validate_system_access);
+
+    const schedule_stats& ss = scene->schedule;
+    ImGui::Text("Systems: %u, Levels: %u", ss.systems, ss.levels);
+    ImGui::Text("Max Concurrent: %u", ss.max_concurrent);
+    ImGui::Text("Access Violations: %u", ss.access_violations);
+
+    ImGui::End();
+
+    // views record from an extracted copy of the scene while the next frame simulates on the task pool
+    begin_window("Pipelined Update");
+
+    bool pipelined = scene_flag_checkbox(scene, "Enabled##pipelined", e_scene_flags::pipelined_update);
+
+    if (pipelined)
+    {
+        const pipeline_stats& ps = scene->pipeline.stats;
+        ImGui::Text("Extract: %2.3f ms (%u KB)", ps.extract_ms, ps.extract_bytes / 1024);
+        ImGui::Text("Simulate: %2.3f ms", ps.simulate_ms);
+        ImGui::Text("Wait: %2.3f ms", ps.wait_ms);
+    }
+
+    ImGui::End();
+
+    // rarely used components only allocate pages for the entities which have them
+    begin_window("Component Memory");
+
+    component_memory* cm = get_component_memory(scene);
+    size_t            total_bytes = 0;
+    size_t            total_dense = 0;
+    for (u32 i = 0; i < sb_count(cm); ++i)
+    {
+        total_bytes += cm[i].bytes;
+        total_dense += cm[i].dense_bytes;
+    }
+
+    ImGui::Text("Total: %u KB (dense: %u KB)", (u32)(total_bytes / 1024), (u32)(total_dense / 1024));
+    ImGui::Separator();
+
+    for (u32 i = 0; i < sb_count(cm); ++i)
+    {
+        if (cm[i].storage == e_cmp_storage::paged)
+            ImGui::Text("%-24s %6u KB (dense: %u KB, pages: %u)", cm[i].name, (u32)(cm[i].bytes / 1024),
+                        (u32)(cm[i].dense_bytes / 1024), cm[i].pages);
+        else
+            ImGui::Text("%-24s %6u KB", cm[i].name, (u32)(cm[i].bytes / 1024));
+    }
+
+    sb_free(cm);
+
+    ImGui::End();
 }
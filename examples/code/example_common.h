@@ -113,6 +113,9 @@ namespace
 
         put::dev_ui::new_frame();
 
+        // pipelined scenes may still be simulating the last update
+        ecs::wait_for_updates();
+
         example_update(main_scene, main_camera, dt);
 
         ecs::update(dt);
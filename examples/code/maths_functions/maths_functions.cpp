@@ -1096,7 +1096,7 @@ void test_ray_vs_obb(ecs_scene* scene, bool initialise)
 
     if (show_unit_aabb_space)
     {
-        mat4  invm = mat::inverse4x4(scene->world_matrices[obb.node]);
+        mat4  invm = affine_inverse(scene->world_matrices[obb.node]);
         vec3f tr1 = invm.transform_vector(vec4f(ray.origin, 1.0f)).xyz;
 
         invm.set_translation(vec3f::zero());
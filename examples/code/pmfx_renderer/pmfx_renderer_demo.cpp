@@ -57,11 +57,15 @@ void example_update(ecs::ecs_scene* scene, camera& cam, f32 dt)
     f32 render_cpu = 0.0f;
     pen::renderer_get_present_time(render_cpu, render_gpu);
 
+    pen::renderer_cmd_stats cmd_stats;
+    pen::renderer_get_cmd_stats(cmd_stats);
+
     ImGui::Separator();
     ImGui::Text("Stats:");
     ImGui::Text("User Thread: %2.2f ms", user_thread_time);
     ImGui::Text("Render Thread: %2.2f ms", render_cpu);
     ImGui::Text("GPU: %2.2f ms", render_gpu);
+    ImGui::Text("Commands: %u (%u redundant binds dropped)", cmd_stats.num_cmds, cmd_stats.dropped_cmds);
     ImGui::Separator();
 
     ImGui::End();
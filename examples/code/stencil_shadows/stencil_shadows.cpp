@@ -70,7 +70,7 @@ void render_stencil_shadows(const scene_view& view)
 
     for (u32 i = cube_start; i <= cube_end; ++i)
     {
-        pen::renderer_set_constant_buffer(scene->cbuffer[i], 1, pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS);
+        bind_draw_call_cbuffer(scene, i);
         pen::renderer_draw_indexed(r.num_indices, 0, 0, PEN_PT_TRIANGLELIST);
     }
 }
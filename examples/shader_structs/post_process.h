@@ -28,10 +28,10 @@ namespace post_process
     };
     struct per_draw_call
     {
-        float4x4 world_matrix;
+        float4 world_matrix_3x4[3];
         float4 user_data;
         float4 user_data2;
-        float4x4 world_matrix_inv_transpose;
+        float4 world_matrix_inv_transpose_3x4[3];
     };
     struct per_pass_lights
     {
@@ -0,0 +1,110 @@
+#include "console.h"
+#include "data_struct.h"
+#include "pen.h"
+#include "renderer.h"
+#include "os.h"
+#include "threads.h"
+#include "timer.h"
+
+using namespace pen;
+
+static Str* s_args = nullptr;
+
+namespace pen
+{
+    pen_creation_params pen_entry(int argc, char** argv)
+    {
+        // unpack args
+        for (u32 i = 0; i < argc; ++i)
+            sb_push(s_args, argv[i]);
+
+        pen::pen_creation_params p;
+        p.window_width = 1280;
+        p.window_height = 720;
+        p.window_title = "cmd_replay";
+        p.window_sample_count = 4;
+        p.user_thread_function = user_entry;
+        p.flags = pen::e_pen_create_flags::renderer;
+        return p;
+    }
+} // namespace pen
+
+void show_help()
+{
+    PEN_LOG("cmd_replay help");
+    PEN_LOG("    -help <show this dialog>");
+    PEN_LOG("    -i <capture file>");
+    PEN_LOG("      captures are written by running an app with -capture <capture file> <num frames>");
+}
+
+void* pen::user_entry(void* params)
+{
+    // unpack the params passed to the thread and signal to the engine it ok to proceed
+    pen::job_thread_params* job_params = (pen::job_thread_params*)params;
+    pen::job*               p_thread_info = job_params->job_info;
+    pen::semaphore_post(p_thread_info->p_sem_continue, 1);
+
+    Str input_file = "";
+
+    u32 argc = sb_count(s_args);
+    for (u32 i = 0; i < argc; ++i)
+    {
+        if (s_args[i] == "-help")
+        {
+            break;
+        }
+        else if (s_args[i] == "-i" && i + 1 < argc)
+        {
+            input_file = s_args[i + 1];
+        }
+    }
+
+    u32 num_frames = 0;
+    if (!input_file.empty())
+        num_frames = pen::renderer_replay_load(input_file.c_str());
+
+    if (num_frames == 0)
+    {
+        show_help();
+        goto term;
+    }
+
+    PEN_LOG("replaying: %s, %i frames", input_file.c_str(), num_frames);
+
+    // replay at full speed, the render thread executes each frame as soon as it is submitted
+    {
+        pen::timer* replay_timer = pen::timer_create();
+        pen::timer_start(replay_timer);
+        pen::renderer_enable_cmd_timings(true);
+
+        while (pen::renderer_replay_frame())
+            pen::renderer_consume_cmd_buffer();
+
+        // wait for the final frame to be consumed before reading timings
+        pen::renderer_consume_cmd_buffer();
+        pen::renderer_enable_cmd_timings(false);
+        f32 total_ms = pen::timer_elapsed_ms(replay_timer);
+
+        static const u32    k_max_timings = 128;
+        renderer_cmd_timing timings[k_max_timings];
+        u32                 num_timings = pen::renderer_get_cmd_timings(timings, k_max_timings);
+
+        PEN_LOG("%-28s %10s %12s %12s", "command", "count", "total ms", "avg us");
+        for (u32 i = 0; i < num_timings; ++i)
+        {
+            const renderer_cmd_timing& t = timings[i];
+            PEN_LOG("%-28s %10u %12.3f %12.3f", t.name, t.count, t.total_ms, (t.total_ms * 1000.0) / t.count);
+        }
+
+        PEN_LOG("replayed %i frames in %.3f ms, %.3f ms per frame", num_frames, total_ms, total_ms / num_frames);
+    }
+
+    pen::renderer_replay_unload();
+
+term:
+    // signal to the engine the thread has finished
+    pen::os_terminate(0);
+    pen::semaphore_post(p_thread_info->p_sem_terminated, 1);
+
+    return PEN_THREAD_OK;
+}
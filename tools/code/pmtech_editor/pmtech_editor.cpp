@@ -200,6 +200,9 @@ namespace
 
         pen::renderer_new_frame();
         put::dev_ui::new_frame();
+
+        // pipelined scenes may still be simulating the last update
+        ecs::wait_for_updates();
         
         update_live_lib();
         
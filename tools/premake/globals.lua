@@ -90,9 +90,9 @@ function setup_from_action()
             build_cmd = "-std=c++11 -s WASM=1 -s INITIAL_MEMORY=1024MB -s DETERMINISTIC=0 -s PTHREAD_POOL_SIZE=8"
             link_cmd = "-s --shared-memory -s WASM=1 -s FULL_ES3=1 -s MIN_WEBGL_VERSION=2 -s MAX_WEBGL_VERSION=2 -s PTHREAD_POOL_SIZE=8 -s INITIAL_MEMORY=1024MB --shell-file ../../../core/template/web/shell.html"            
         elseif platform_dir == "linux" then
-            build_cmd = "-std=c++11 -mfma -mavx -mavx2 -msse2"
+            build_cmd = "-std=c++11 -msse2"
         else -- macos
-            build_cmd = "-std=c++11 -stdlib=libc++ -mfma -mavx -mavx2 -msse2"
+            build_cmd = "-std=c++11 -stdlib=libc++ -msse2"
             link_cmd = "-stdlib=libc++"
         end
     elseif _ACTION == "xcode4" then 
@@ -107,14 +107,14 @@ function setup_from_action()
             build_cmd = "-std=c++11 -stdlib=libc++"
             link_cmd = "-stdlib=libc++"
         else
-            build_cmd = "-std=c++11 -stdlib=libc++ -mfma -mavx -mavx2 -msse2"
+            build_cmd = "-std=c++11 -stdlib=libc++ -msse2"
             link_cmd = "-stdlib=libc++"
         end
     elseif _ACTION == "android-studio" then 
         build_cmd = { "-std=c++11" }
     elseif _ACTION == "vs2017" or _ACTION == "vs2019" or _ACTION == "vs2022" then
         platform_dir = "win32" 
-        build_cmd = "/Ob1 /arch:AVX2 /arch:AVX " -- use force inline and avx
+        build_cmd = "/Ob1" -- use force inline
         disablewarnings { "4267", "4305", "4244" }
     end
     
@@ -25,6 +25,9 @@ dofile "pmtech.lua"
 -- mesh optimiser
 create_app_example("mesh_opt", script_path())
 
+-- renderer command capture replay
+create_app_example("cmd_replay", script_path())
+
 -- dll to hot reload
 create_dll("live_lib", "live_lib", script_path())
 setup_live_lib("live_lib")